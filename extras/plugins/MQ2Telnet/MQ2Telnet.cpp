@@ -17,7 +17,6 @@
 // 01/13/2017 - Added the TelNet TLO for Ready, Port, and LoginInfo.
 
 #include "../MQ2Plugin.h"
-#include "WinTelnet.h"
 #include "TelnetServer.h"
 
 PreSetup("MQ2Telnet");
@@ -190,6 +189,7 @@ PLUGIN_API void InitializePlugin()
 	AddMQ2Data("TelNet", DataTelNet);
 
 	server = new CTelnetServer();
+	server->SetSendBufferSize(GetPrivateProfileInt("Telnet Server", "SendBufferSize", 64 * 1024, INIFileName));
 	server->Listen(TelnetPort);
 }
 
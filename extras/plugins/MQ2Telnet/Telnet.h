@@ -14,6 +14,8 @@
 
 #pragma once
 
+#include <cstdlib>
+#include <cstring>
 #include <string>
 
  // the options we want to keep track of for each side
@@ -79,7 +81,7 @@ public:
 		Local.SuppressGoAhead = true;
 	};
 
-	~CTelnet() = default;
+	virtual ~CTelnet() = default;
 
 	virtual bool Connect(char*, int) = 0;
 	virtual bool Disconnect() = 0;
@@ -306,10 +308,11 @@ public:
 					TCPos = 0;
 					continue;
 				}
-				//if (TCPos>=TELNET_MAXCOMMANDSIZE)
-				//{
-				//    // ... problem.
-				//}
+				if (TCPos >= TELNET_MAXCOMMANDSIZE)
+				{
+					// Longer than any command we understand, throw it away.
+					TCPos = 0;
+				}
 				continue;
 			}
 			// not inside telnet command, check for IAC
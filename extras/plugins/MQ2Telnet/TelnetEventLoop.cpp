@@ -0,0 +1,570 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#if defined(_WIN32)
+
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+
+#include <winsock2.h>
+#include <Ws2tcpip.h>
+
+#pragma comment(lib, "ws2_32")
+
+using socket_t = SOCKET;
+using pollfd_t = WSAPOLLFD;
+
+static constexpr socket_t BadSocket = INVALID_SOCKET;
+
+static int PollSockets(pollfd_t* fds, size_t count, int timeoutMs) { return WSAPoll(fds, static_cast<ULONG>(count), timeoutMs); }
+static void CloseSocket(socket_t s) { closesocket(s); }
+static bool WouldBlock() { return WSAGetLastError() == WSAEWOULDBLOCK; }
+
+static void SetNonBlocking(socket_t s)
+{
+	unsigned long nonblocking = 1;
+	ioctlsocket(s, FIONBIO, &nonblocking);
+}
+
+// Sends both pieces with one call.
+static int SendPieces(socket_t s, const char* first, size_t firstLength, const char* second, size_t secondLength)
+{
+	WSABUF buffers[2] = {
+		{ static_cast<ULONG>(firstLength), const_cast<char*>(first) },
+		{ static_cast<ULONG>(secondLength), const_cast<char*>(second) },
+	};
+
+	DWORD sent = 0;
+	if (WSASend(s, buffers, secondLength ? 2 : 1, &sent, 0, nullptr, nullptr) == SOCKET_ERROR)
+		return -1;
+
+	return static_cast<int>(sent);
+}
+
+#else // BSD sockets
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using socket_t = int;
+using pollfd_t = pollfd;
+
+static constexpr socket_t BadSocket = -1;
+
+static int PollSockets(pollfd_t* fds, size_t count, int timeoutMs) { return poll(fds, static_cast<nfds_t>(count), timeoutMs); }
+static void CloseSocket(socket_t s) { close(s); }
+static bool WouldBlock() { return errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR; }
+
+static void SetNonBlocking(socket_t s)
+{
+	fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+}
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// Sends both pieces with one call.
+static int SendPieces(socket_t s, const char* first, size_t firstLength, const char* second, size_t secondLength)
+{
+	iovec buffers[2] = {
+		{ const_cast<char*>(first), firstLength },
+		{ const_cast<char*>(second), secondLength },
+	};
+
+	msghdr message = {};
+	message.msg_iov = buffers;
+	message.msg_iovlen = secondLength ? 2 : 1;
+
+	return static_cast<int>(sendmsg(s, &message, MSG_NOSIGNAL));
+}
+
+#endif
+
+#include "TelnetEventLoop.h"
+#include "Telnet.h"
+
+#include <algorithm>
+#include <cstring>
+
+static constexpr size_t MaxClients = 64;
+static constexpr size_t MaxLineLength = 250;
+static constexpr int MaxPortAttempts = 100;
+
+static socket_t ToSocket(intptr_t s) { return static_cast<socket_t>(s); }
+
+//============================================================================
+
+TelnetRingBuffer::TelnetRingBuffer(size_t capacity)
+	: m_data(std::max<size_t>(capacity, 1))
+{
+}
+
+bool TelnetRingBuffer::Write(const char* data, size_t length)
+{
+	if (length > Available())
+		return false;
+
+	size_t tail = (m_head + m_size) % m_data.size();
+	size_t firstPart = std::min(length, m_data.size() - tail);
+
+	memcpy(&m_data[tail], data, firstPart);
+	memcpy(&m_data[0], data + firstPart, length - firstPart);
+
+	m_size += length;
+	return true;
+}
+
+void TelnetRingBuffer::Peek(const char*& first, size_t& firstLength, const char*& second, size_t& secondLength) const
+{
+	firstLength = std::min(m_size, m_data.size() - m_head);
+	secondLength = m_size - firstLength;
+
+	first = m_data.data() + m_head;
+	second = m_data.data();
+}
+
+void TelnetRingBuffer::Consume(size_t length)
+{
+	length = std::min(length, m_size);
+
+	m_head = (m_head + length) % m_data.size();
+	m_size -= length;
+
+	if (m_size == 0)
+		m_head = 0;
+}
+
+void TelnetRingBuffer::Clear()
+{
+	m_head = 0;
+	m_size = 0;
+}
+
+//============================================================================
+
+// A connected client. Telnet negotiation is handled by CTelnet, its replies are queued along
+// with everything else sent to the client.
+class TelnetClient : public CTelnet
+{
+public:
+	TelnetClient(uint32_t id, socket_t socket, size_t sendBufferSize)
+		: id(id)
+		, socket(socket)
+		, output(sendBufferSize)
+	{
+	}
+
+	~TelnetClient()
+	{
+		if (socket != BadSocket)
+			CloseSocket(socket);
+	}
+
+	bool Connect(char*, int) override { return false; }
+	bool Disconnect() override { closeWhenSent = true; return true; }
+
+	bool Open(int) override { return false; }
+	bool Close() override { closing = true; return true; }
+
+	bool Write(char c) override { return Write(&c, 1) == 1; }
+
+	int Write(const void* data, int length) override
+	{
+		if (closing)
+			return 0;
+
+		if (!output.Write(static_cast<const char*>(data), length))
+		{
+			overflowed = true;
+			closing = true;
+			return 0;
+		}
+
+		return length;
+	}
+
+	bool Read(char*) override { return false; }
+	int Read(void*, int) override { return 0; }
+
+	bool isOpen() override { return socket != BadSocket; }
+	bool isConnected() override { return !closing; }
+	long isData() override { return 0; }
+
+	uint32_t id;
+	socket_t socket;
+	TelnetRingBuffer output;
+	std::string input;
+	bool broadcasts = false;
+	bool closing = false;          // close now, without sending anything else
+	bool closeWhenSent = false;    // close once the output has been sent
+	bool overflowed = false;
+};
+
+//============================================================================
+
+TelnetEventLoop::TelnetEventLoop()
+	: m_listener(static_cast<intptr_t>(BadSocket))
+{
+#if defined(_WIN32)
+	WSADATA wsa;
+	WSAStartup(MAKEWORD(2, 2), &wsa);
+#endif
+}
+
+TelnetEventLoop::~TelnetEventLoop()
+{
+	CloseAll();
+	StopListening();
+
+#if defined(_WIN32)
+	WSACleanup();
+#endif
+}
+
+int TelnetEventLoop::Listen(int port, bool localOnly)
+{
+	StopListening();
+
+	socket_t listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (listener == BadSocket)
+		return 0;
+
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(localOnly ? INADDR_LOOPBACK : INADDR_ANY);
+
+	int attempts = 0;
+	do
+	{
+		address.sin_port = htons(static_cast<uint16_t>(port));
+		if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0)
+			break;
+
+		++port;
+	} while (++attempts < MaxPortAttempts);
+
+	if (attempts == MaxPortAttempts || listen(listener, SOMAXCONN) != 0)
+	{
+		CloseSocket(listener);
+		return 0;
+	}
+
+	SetNonBlocking(listener);
+
+	std::scoped_lock lock(m_mutex);
+	m_listener = static_cast<intptr_t>(listener);
+	return port;
+}
+
+void TelnetEventLoop::StopListening()
+{
+	std::scoped_lock lock(m_mutex);
+
+	if (ToSocket(m_listener) != BadSocket)
+	{
+		CloseSocket(ToSocket(m_listener));
+		m_listener = static_cast<intptr_t>(BadSocket);
+	}
+}
+
+bool TelnetEventLoop::IsListening() const
+{
+	std::scoped_lock lock(m_mutex);
+	return ToSocket(m_listener) != BadSocket;
+}
+
+void TelnetEventLoop::Poll(int timeoutMs)
+{
+	std::vector<pollfd_t> fds;
+	std::vector<uint32_t> ids;
+
+	{
+		std::scoped_lock lock(m_mutex);
+
+		fds.reserve(m_clients.size() + 1);
+		ids.reserve(m_clients.size() + 1);
+
+		if (ToSocket(m_listener) != BadSocket)
+		{
+			fds.push_back({ ToSocket(m_listener), POLLIN, 0 });
+			ids.push_back(0);
+		}
+
+		for (const auto& [id, client] : m_clients)
+		{
+			short events = POLLIN;
+			if (!client->output.Empty())
+				events |= POLLOUT;
+
+			fds.push_back({ client->socket, events, 0 });
+			ids.push_back(id);
+		}
+	}
+
+	int ready = 0;
+	if (!fds.empty())
+		ready = PollSockets(fds.data(), fds.size(), timeoutMs);
+
+	std::vector<Event> events;
+
+	{
+		std::scoped_lock lock(m_mutex);
+
+		for (size_t i = 0; ready > 0 && i < fds.size(); ++i)
+		{
+			if (fds[i].revents == 0)
+				continue;
+
+			if (ids[i] == 0)
+			{
+				AcceptClients(events);
+				continue;
+			}
+
+			auto iter = m_clients.find(ids[i]);
+			if (iter == m_clients.end())
+				continue;
+
+			if (fds[i].revents & (POLLIN | POLLERR | POLLHUP))
+				ReadFrom(*iter->second, events);
+		}
+
+		// Anything broadcast while we were waiting is sent now rather than on the next pass.
+		for (auto& [id, client] : m_clients)
+		{
+			if (!client->closing && !client->output.Empty())
+				WriteTo(*client);
+		}
+
+		RemoveClosedClients(events);
+	}
+
+	for (const Event& event : events)
+	{
+		switch (event.type)
+		{
+		case Event::Type::Connect:
+			if (OnConnect)
+				OnConnect(event.clientId);
+			break;
+
+		case Event::Type::Line:
+			if (OnLine)
+				OnLine(event.clientId, event.line);
+			break;
+
+		case Event::Type::Disconnect:
+			if (OnDisconnect)
+				OnDisconnect(event.clientId);
+			break;
+		}
+	}
+}
+
+void TelnetEventLoop::AcceptClients(std::vector<Event>& events)
+{
+	while (true)
+	{
+		socket_t incoming = accept(ToSocket(m_listener), nullptr, nullptr);
+		if (incoming == BadSocket)
+			return;
+
+		if (m_clients.size() >= MaxClients)
+		{
+			CloseSocket(incoming);
+			continue;
+		}
+
+		SetNonBlocking(incoming);
+
+		uint32_t id = m_nextClientId++;
+		m_clients.emplace(id, std::make_unique<TelnetClient>(id, incoming, m_sendBufferSize));
+
+		events.push_back({ Event::Type::Connect, id, {} });
+	}
+}
+
+void TelnetEventLoop::ReadFrom(TelnetClient& client, std::vector<Event>& events)
+{
+	unsigned char buffer[4096];
+
+	int received = static_cast<int>(recv(client.socket, reinterpret_cast<char*>(buffer), sizeof(buffer), 0));
+	if (received == 0 || (received < 0 && !WouldBlock()))
+	{
+		client.closing = true;
+		return;
+	}
+
+	if (received < 0)
+		return;
+
+	// Removes telnet commands from the data, and queues any replies to them.
+	client.StripTelnet(buffer, received);
+
+	for (int i = 0; i < received; ++i)
+	{
+		char c = static_cast<char>(buffer[i]);
+
+		if (c == '\r' || c == '\n' || client.input.length() >= MaxLineLength)
+		{
+			if (!client.input.empty())
+			{
+				events.push_back({ Event::Type::Line, client.id, std::move(client.input) });
+				client.input.clear();
+			}
+
+			if (c == '\r' || c == '\n')
+				continue;
+		}
+
+		client.input.push_back(c);
+	}
+}
+
+void TelnetEventLoop::WriteTo(TelnetClient& client)
+{
+	const char* first;
+	const char* second;
+	size_t firstLength, secondLength;
+	client.output.Peek(first, firstLength, second, secondLength);
+
+	int sent = SendPieces(client.socket, first, firstLength, second, secondLength);
+	if (sent < 0)
+	{
+		if (!WouldBlock())
+			client.closing = true;
+
+		return;
+	}
+
+	client.output.Consume(sent);
+	m_stats.bytesSent += sent;
+}
+
+void TelnetEventLoop::Queue(TelnetClient& client, std::string_view text)
+{
+	if (client.closing || client.closeWhenSent)
+		return;
+
+	if (!client.output.Write(text.data(), text.length()))
+		DropSlowClient(client);
+}
+
+void TelnetEventLoop::DropSlowClient(TelnetClient& client)
+{
+	// This client isn't reading fast enough, don't let it hold on to everything sent since.
+	client.overflowed = true;
+	client.closing = true;
+	++m_stats.slowDisconnects;
+}
+
+void TelnetEventLoop::RemoveClosedClients(std::vector<Event>& events)
+{
+	for (auto iter = m_clients.begin(); iter != m_clients.end();)
+	{
+		TelnetClient& client = *iter->second;
+
+		if (client.closing || (client.closeWhenSent && client.output.Empty()))
+		{
+			events.push_back({ Event::Type::Disconnect, client.id, {} });
+			iter = m_clients.erase(iter);
+		}
+		else
+		{
+			++iter;
+		}
+	}
+}
+
+void TelnetEventLoop::Send(uint32_t clientId, std::string_view text)
+{
+	std::scoped_lock lock(m_mutex);
+
+	auto iter = m_clients.find(clientId);
+	if (iter != m_clients.end())
+		Queue(*iter->second, text);
+}
+
+void TelnetEventLoop::Broadcast(std::string_view line)
+{
+	std::scoped_lock lock(m_mutex);
+
+	++m_stats.linesBroadcast;
+
+	for (auto& [id, client] : m_clients)
+	{
+		if (!client->broadcasts || client->closing)
+			continue;
+
+		// The line and its end go in together, or the client is dropped.
+		if (client->output.Available() < line.length() + 2)
+		{
+			DropSlowClient(*client);
+			continue;
+		}
+
+		Queue(*client, line);
+		Queue(*client, "\r\n");
+	}
+}
+
+void TelnetEventLoop::SetBroadcastEnabled(uint32_t clientId, bool enabled)
+{
+	std::scoped_lock lock(m_mutex);
+
+	auto iter = m_clients.find(clientId);
+	if (iter != m_clients.end())
+		iter->second->broadcasts = enabled;
+}
+
+void TelnetEventLoop::Disconnect(uint32_t clientId)
+{
+	std::scoped_lock lock(m_mutex);
+
+	auto iter = m_clients.find(clientId);
+	if (iter != m_clients.end())
+		iter->second->closeWhenSent = true;
+}
+
+void TelnetEventLoop::CloseAll()
+{
+	std::scoped_lock lock(m_mutex);
+	m_clients.clear();
+}
+
+void TelnetEventLoop::SetSendBufferSize(size_t size)
+{
+	std::scoped_lock lock(m_mutex);
+	m_sendBufferSize = std::max<size_t>(size, 1024);
+}
+
+size_t TelnetEventLoop::GetClientCount() const
+{
+	std::scoped_lock lock(m_mutex);
+	return m_clients.size();
+}
+
+TelnetEventLoop::Stats TelnetEventLoop::GetStats() const
+{
+	std::scoped_lock lock(m_mutex);
+	return m_stats;
+}
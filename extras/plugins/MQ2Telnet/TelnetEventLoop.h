@@ -0,0 +1,131 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#pragma once
+
+// The socket side of the telnet server. This doesn't depend on MacroQuest so it can be built
+// and exercised on its own, on Windows or on any system with BSD sockets.
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Bounded queue of bytes waiting to be sent to a client.
+class TelnetRingBuffer
+{
+public:
+	explicit TelnetRingBuffer(size_t capacity);
+
+	// Queues all of the data, or none of it if there isn't room.
+	bool Write(const char* data, size_t length);
+
+	// The queued data as at most two contiguous pieces, oldest first. Either may be empty.
+	void Peek(const char*& first, size_t& firstLength, const char*& second, size_t& secondLength) const;
+	void Consume(size_t length);
+	void Clear();
+
+	size_t Size() const { return m_size; }
+	size_t Capacity() const { return m_data.size(); }
+	size_t Available() const { return m_data.size() - m_size; }
+	bool Empty() const { return m_size == 0; }
+
+private:
+	std::vector<char> m_data;
+	size_t m_head = 0;
+	size_t m_size = 0;
+};
+
+class TelnetClient;
+
+// Runs every connection from a single thread. Each call to Poll waits until a socket is ready,
+// then accepts, reads and writes whatever it can without blocking. Output is queued per client
+// in a bounded buffer. A client that can't keep up with what is being broadcast is disconnected
+// instead of holding up everyone else.
+class TelnetEventLoop
+{
+public:
+	struct Stats
+	{
+		uint64_t bytesSent = 0;
+		uint64_t linesBroadcast = 0;
+		uint32_t slowDisconnects = 0;    // clients dropped because their send buffer filled up
+	};
+
+	// Called from Poll, on the thread that runs the loop, without the loop's lock held.
+	std::function<void(uint32_t clientId)> OnConnect;
+	std::function<void(uint32_t clientId, std::string_view line)> OnLine;
+	std::function<void(uint32_t clientId)> OnDisconnect;
+
+	TelnetEventLoop();
+	~TelnetEventLoop();
+
+	TelnetEventLoop(const TelnetEventLoop&) = delete;
+	TelnetEventLoop& operator=(const TelnetEventLoop&) = delete;
+
+	// Listens on the first free port starting at port. A local only server only accepts
+	// connections from this machine. Returns the port used, or 0 on failure.
+	int Listen(int port, bool localOnly);
+	void StopListening();
+	bool IsListening() const;
+
+	// Waits up to timeoutMs for socket activity and handles it.
+	void Poll(int timeoutMs);
+
+	// Queues text for one client. The client is disconnected if it doesn't fit.
+	void Send(uint32_t clientId, std::string_view text);
+
+	// Queues a line for every client that has broadcasts enabled. Safe to call from any thread.
+	void Broadcast(std::string_view line);
+	void SetBroadcastEnabled(uint32_t clientId, bool enabled);
+
+	// Closes the connection once everything queued for it has been sent.
+	void Disconnect(uint32_t clientId);
+	void CloseAll();
+
+	// Size of the send buffer for clients that connect after this is set.
+	void SetSendBufferSize(size_t size);
+
+	size_t GetClientCount() const;
+	Stats GetStats() const;
+
+private:
+	struct Event
+	{
+		enum class Type { Connect, Line, Disconnect };
+
+		Type type;
+		uint32_t clientId;
+		std::string line;
+	};
+
+	void AcceptClients(std::vector<Event>& events);
+	void ReadFrom(TelnetClient& client, std::vector<Event>& events);
+	void WriteTo(TelnetClient& client);
+	void Queue(TelnetClient& client, std::string_view text);
+	void DropSlowClient(TelnetClient& client);
+	void RemoveClosedClients(std::vector<Event>& events);
+
+	mutable std::mutex m_mutex;
+	intptr_t m_listener;
+	std::unordered_map<uint32_t, std::unique_ptr<TelnetClient>> m_clients;
+	uint32_t m_nextClientId = 1;
+	size_t m_sendBufferSize = 64 * 1024;
+	Stats m_stats;
+};
@@ -14,7 +14,14 @@
 
 #pragma once
 
-#include "WinTelnet.h"
+#include "TelnetEventLoop.h"
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
 
 #define TS_SENDLOGIN    0
 #define TS_GETLOGIN     1
@@ -28,24 +35,13 @@ extern char TelnetLoginPrompt[MAX_STRING];
 extern char TelnetPasswordPrompt[MAX_STRING];
 extern char TelnetWelcome[MAX_STRING];
 
-struct TXTBUFFER
-{
-	char     szText[MAX_STRING];
-
-	TXTBUFFER* pNext;
-};
-
+// Login state for a connection. Only touched from the server's thread.
 struct TELNET
 {
-	CWinTelnet* connection;
-	int State;
-	char Username[32];
-	char Password[32];
-	int PasswordTries;
-	char Buffer[MAX_STRING];
-	TXTBUFFER* Received;
-	TELNET* pLast;
-	TELNET* pNext;
+	int State = TS_SENDLOGIN;
+	char Username[32] = { 0 };
+	char Password[32] = { 0 };
+	int PasswordTries = 0;
 };
 
 class CTelnetServer
@@ -56,9 +52,26 @@ public:
 
 	void ShutdownListener();
 	bool Listen(int Port);
-	void Broadcast(char* String);
+	void Broadcast(const char* String);
 	void Shutdown();
-	bool IsValidUser(char* user, char* pwdest);
+	bool IsValidUser(const char* user, char* pwdest);
+
+	// Bytes that may be waiting to be sent to a connection before it is dropped as too slow.
+	void SetSendBufferSize(size_t size);
 
 	void ProcessIncoming();
+
+private:
+	void OnConnect(uint32_t clientId);
+	void OnLine(uint32_t clientId, std::string_view line);
+	void SendPrompt(uint32_t clientId, TELNET& conn);
+
+	TelnetEventLoop m_loop;
+	std::thread m_thread;
+	std::atomic<bool> m_stop = false;
+
+	std::unordered_map<uint32_t, TELNET> m_connections;
+
+	std::mutex m_commandMutex;
+	std::deque<std::string> m_commands;
 };
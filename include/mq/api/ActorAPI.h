@@ -62,6 +62,9 @@ struct Address
 
 	/** Used to specify if the mailbox is fully qualified (default to false) */
 	bool AbsoluteMailbox = false;
+
+	/** The topic to publish to. If this is specified, every mailbox subscribed to the topic gets the message instead of the mailbox. */
+	std::optional<std::string> Topic;
 };
 
 /**
@@ -141,6 +144,20 @@ struct DropboxAPI
 	 */
 	void PostReply(const std::shared_ptr<Message>& message, const std::string& data, uint8_t status = 0) const;
 
+	/**
+	 * Subscribes the mailbox to a topic, so that it receives messages sent to the topic
+	 *
+	 * @param topic the name of the topic
+	 */
+	void Subscribe(const std::string& topic) const;
+
+	/**
+	 * Unsubscribes the mailbox from a topic
+	 *
+	 * @param topic the name of the topic
+	 */
+	void Unsubscribe(const std::string& topic) const;
+
 	/**
 	 * Removes the mailbox with the same name from the post office
 	 */
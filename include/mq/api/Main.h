@@ -53,6 +53,12 @@ public:
 		postoffice::Dropbox*& dropbox,
 		const MQPluginHandle& pluginHandle) = 0;
 
+	virtual void SubscribeActor(
+		postoffice::Dropbox* dropbox,
+		const std::string& topic,
+		bool subscribe,
+		const MQPluginHandle& pluginHandle) = 0;
+
 	//
 	// Command API
 	//
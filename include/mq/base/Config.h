@@ -15,11 +15,15 @@
 #pragma once
 
 #include <mq/base/Color.h>
+#include <mq/base/IniFile.h>
 #include <mq/base/String.h>
 
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <optional>
 #include <string>
 #include <vector>
-#include <filesystem>
 
 #include <windows.h>
 
@@ -31,75 +35,213 @@
 
 namespace mq {
 
+//----------------------------------------------------------------------------
+// These functions provide the GetPrivateProfile* and WritePrivateProfile* api on top of
+// the IniCache (see IniFile.h), so that reading a value doesn't require re-reading and
+// parsing the ini file every time.
+
+namespace detail {
+
+// Copies a string into a caller provided buffer, with the truncation behavior of GetPrivateProfileString.
+inline int CopyProfileString(std::string_view value, char* Return, size_t Size)
+{
+	if (!Return || Size == 0)
+		return 0;
+
+	size_t length = std::min(value.length(), Size - 1);
+	memcpy(Return, value.data(), length);
+	Return[length] = 0;
+
+	return static_cast<int>(length);
+}
+
+// Copies a list of strings into a caller provided buffer as a sequence of null terminated strings
+// followed by a final null, with the truncation behavior of GetPrivateProfileString.
+inline int CopyProfileList(const std::vector<std::string_view>& values, char* Return, size_t Size)
+{
+	if (!Return || Size < 2)
+	{
+		if (Return && Size == 1)
+			Return[0] = 0;
+		return 0;
+	}
+
+	size_t pos = 0;
+	for (std::string_view value : values)
+	{
+		if (pos + value.length() + 1 > Size - 1)
+		{
+			size_t length = Size - 2 - pos;
+			memcpy(Return + pos, value.data(), length);
+			Return[Size - 2] = 0;
+			Return[Size - 1] = 0;
+			return static_cast<int>(Size - 2);
+		}
+
+		memcpy(Return + pos, value.data(), value.length());
+		pos += value.length();
+		Return[pos++] = 0;
+	}
+
+	Return[pos] = 0;
+	return static_cast<int>(pos);
+}
+
+// Parses an integer the way GetPrivateProfileInt does: leading digits only, with optional sign or hex prefix.
+inline int ParseProfileInt(std::string_view value)
+{
+	value = trim(value);
+
+	bool negative = false;
+	if (!value.empty() && (value[0] == '-' || value[0] == '+'))
+	{
+		negative = value[0] == '-';
+		value.remove_prefix(1);
+	}
+
+	uint32_t base = 10;
+	if (value.length() > 2 && value[0] == '0' && (value[1] == 'x' || value[1] == 'X'))
+	{
+		base = 16;
+		value.remove_prefix(2);
+	}
+
+	uint32_t result = 0;
+	for (char ch : value)
+	{
+		uint32_t digit;
+		if (ch >= '0' && ch <= '9')
+			digit = ch - '0';
+		else if (base == 16 && ch >= 'a' && ch <= 'f')
+			digit = ch - 'a' + 10;
+		else if (base == 16 && ch >= 'A' && ch <= 'F')
+			digit = ch - 'A' + 10;
+		else
+			break;
+
+		result = result * base + digit;
+	}
+
+	return static_cast<int>(negative ? 0 - result : result);
+}
+
+inline std::optional<std::string> ReadProfileValue(std::string_view Section, std::string_view Key, const std::string& iniFileName)
+{
+	return GetIniCache().Read(iniFileName, [&](const IniDocument& doc) -> std::optional<std::string>
+		{
+			if (auto value = doc.GetValue(Section, Key))
+				return std::string(*value);
+			return std::nullopt;
+		});
+}
+
+// Splits a block of null terminated "key=value" strings, as passed to WritePrivateProfileSection.
+inline std::vector<std::string> SplitProfileSection(std::string_view KeysAndValues)
+{
+	std::vector<std::string> lines;
+
+	while (!KeysAndValues.empty() && KeysAndValues[0] != 0)
+	{
+		size_t length = std::min(KeysAndValues.find('\0'), KeysAndValues.length());
+		lines.emplace_back(KeysAndValues.substr(0, length));
+		KeysAndValues.remove_prefix(std::min(length + 1, KeysAndValues.length()));
+	}
+
+	return lines;
+}
+
+inline std::string_view GetProfileSectionBlock(const char* KeysAndValues)
+{
+	const char* end = KeysAndValues;
+	while (*end)
+		end += strlen(end) + 1;
+
+	return std::string_view(KeysAndValues, end - KeysAndValues);
+}
+
+} // namespace detail
+
 inline float GetPrivateProfileFloat(const std::string& Section, const std::string& Key, const float DefaultValue, const std::string& iniFileName)
 {
-	const std::string strDefaultValue = std::to_string(DefaultValue);
-	const size_t Size = 100;
-	char Return[Size] = { 0 };
-	::GetPrivateProfileStringA(Section.c_str(), Key.c_str(), strDefaultValue.c_str(), Return, Size, iniFileName.c_str());
-	return GetFloatFromString(Return, DefaultValue);
+	if (auto value = detail::ReadProfileValue(Section, Key, iniFileName))
+		return GetFloatFromString(*value, DefaultValue);
+	return DefaultValue;
 }
 
 inline bool GetPrivateProfileBool(const std::string& Section, const std::string& Key, const bool DefaultValue, const std::string& iniFileName)
 {
-	const size_t Size = 10;
-	char Return[Size] = { 0 };
-	::GetPrivateProfileStringA(Section.c_str(), Key.c_str(), DefaultValue ? "true" : "false", Return, Size, iniFileName.c_str());
-	return GetBoolFromString(Return, DefaultValue);
+	if (auto value = detail::ReadProfileValue(Section, Key, iniFileName))
+		return GetBoolFromString(*value, DefaultValue);
+	return DefaultValue;
 }
 
 inline bool GetPrivateProfileBool(const char* Section, const char* Key, const bool DefaultValue, const std::string& iniFileName)
 {
-	const size_t Size = 10;
-	char Return[Size] = { 0 };
-	::GetPrivateProfileStringA(Section, Key, DefaultValue ? "true" : "false", Return, Size, iniFileName.c_str());
-	return GetBoolFromString(Return, DefaultValue);
+	if (auto value = detail::ReadProfileValue(Section, Key, iniFileName))
+		return GetBoolFromString(*value, DefaultValue);
+	return DefaultValue;
 }
 
 inline int GetPrivateProfileInt(const std::string& Section, const std::string& Key, const int DefaultValue, const std::string& iniFileName)
 {
-	return ::GetPrivateProfileIntA(Section.c_str(), Key.c_str(), DefaultValue, iniFileName.c_str());
+	if (auto value = detail::ReadProfileValue(Section, Key, iniFileName))
+		return detail::ParseProfileInt(*value);
+	return DefaultValue;
 }
 
 inline int GetPrivateProfileInt(const char* Section, const char* Key, const int DefaultValue, const char* iniFileName)
 {
-	return ::GetPrivateProfileIntA(Section, Key, DefaultValue, iniFileName);
+	if (auto value = detail::ReadProfileValue(Section, Key, iniFileName))
+		return detail::ParseProfileInt(*value);
+	return DefaultValue;
 }
 
-inline int GetPrivateProfileString(const std::string& Section, const std::string& Key, const std::string& DefaultValue, char* Return, const size_t Size, const std::string& iniFileName)
+inline int GetPrivateProfileString(const char* Section, const char* Key, const char* DefaultValue, char* Return, const size_t Size, const char* iniFileName)
 {
-	return ::GetPrivateProfileStringA(Section.empty() ? nullptr : Section.c_str(), Key.empty() ? nullptr : Key.c_str(), DefaultValue.c_str(), Return, static_cast<DWORD>(Size), iniFileName.c_str());
+	return GetIniCache().Read(iniFileName, [&](const IniDocument& doc)
+		{
+			if (!Section)
+				return detail::CopyProfileList(doc.GetSectionNames(), Return, Size);
+
+			if (!Key)
+				return detail::CopyProfileList(doc.GetKeys(Section), Return, Size);
+
+			if (auto value = doc.GetValue(Section, Key))
+				return detail::CopyProfileString(*value, Return, Size);
+
+			return detail::CopyProfileString(DefaultValue ? DefaultValue : "", Return, Size);
+		});
 }
 
-inline int GetPrivateProfileString(const char* Section, const char* Key, const char* DefaultValue, char* Return, const size_t Size, const char* iniFileName)
+inline int GetPrivateProfileString(const std::string& Section, const std::string& Key, const std::string& DefaultValue, char* Return, const size_t Size, const std::string& iniFileName)
 {
-	return ::GetPrivateProfileStringA(Section, Key, DefaultValue, Return, static_cast<DWORD>(Size), iniFileName);
+	return GetPrivateProfileString(Section.empty() ? nullptr : Section.c_str(), Key.empty() ? nullptr : Key.c_str(), DefaultValue.c_str(), Return, Size, iniFileName.c_str());
 }
 
 inline std::string GetPrivateProfileString(const std::string& Section, const std::string& Key, const std::string& DefaultValue, const std::string& iniFileName)
 {
 	char szBuffer[MAX_STRING] = { 0 };
 
-	const DWORD length = ::GetPrivateProfileStringA(Section.empty() ? nullptr : Section.c_str(), Key.empty() ? nullptr : Key.c_str(), DefaultValue.c_str(), szBuffer, MAX_STRING, iniFileName.c_str());
-	return std::string{ szBuffer, length };
+	const int length = GetPrivateProfileString(Section, Key, DefaultValue, szBuffer, MAX_STRING, iniFileName);
+	return std::string{ szBuffer, static_cast<size_t>(length) };
 }
 
 inline std::string GetPrivateProfileString(const char* Section, const char* Key, const char* DefaultValue, const char* iniFileName)
 {
 	char szBuffer[MAX_STRING] = { 0 };
 
-	const DWORD length = ::GetPrivateProfileStringA(Section, Key, DefaultValue, szBuffer, MAX_STRING, iniFileName);
-	return std::string{ szBuffer, length };
+	const int length = GetPrivateProfileString(Section, Key, DefaultValue, szBuffer, MAX_STRING, iniFileName);
+	return std::string{ szBuffer, static_cast<size_t>(length) };
 }
 
 inline mq::MQColor GetPrivateProfileColor(const std::string& Section, const std::string& Key, mq::MQColor color, const std::string& iniFileName)
 {
-	return (uint32_t)::GetPrivateProfileIntA(Section.c_str(), Key.c_str(), (int32_t)color.ToARGB(), iniFileName.c_str());
+	return (uint32_t)GetPrivateProfileInt(Section, Key, (int32_t)color.ToARGB(), iniFileName);
 }
 
 inline mq::MQColor GetPrivateProfileColor(const char* Section, const char* Key, mq::MQColor color, const char* iniFileName)
 {
-	return (uint32_t)::GetPrivateProfileIntA(Section, Key, (int32_t)color.ToARGB(), iniFileName);
+	return (uint32_t)GetPrivateProfileInt(Section, Key, (int32_t)color.ToARGB(), iniFileName);
 }
 
 
@@ -117,159 +259,167 @@ inline auto GetPrivateProfileValue(const std::string& Section, const std::string
 	return GetPrivateProfileValue(Section.c_str(), Key.c_str(), defaultValue, IniFileName);
 }
 
+// BUFFER_SIZE is no longer used to limit the results, it is kept for compatibility.
 template <size_t BUFFER_SIZE = MAX_STRING>
 inline std::vector<std::string> GetPrivateProfileKeys(const std::string& section, const std::string& iniFileName)
 {
-	char keybuffer[BUFFER_SIZE] = { 0 };
-
-	const int bufferLen = ::GetPrivateProfileStringA(section.c_str(), nullptr, "", keybuffer, BUFFER_SIZE, iniFileName.c_str());
-	char* ptr = keybuffer;
-
-	std::vector<std::string> results;
-
-	while (ptr < keybuffer + bufferLen)
-	{
-		std::string keyName = ptr;
-		ptr += keyName.length() + 1;
-
-		results.push_back(std::move(keyName));
-	}
-
-	return results;
+	return GetIniCache().Read(iniFileName, [&](const IniDocument& doc)
+		{
+			auto keys = doc.GetKeys(section);
+			return std::vector<std::string>(keys.begin(), keys.end());
+		});
 }
 
 template <size_t BUFFER_SIZE = MAX_STRING>
 inline std::vector<std::pair<std::string, std::string>> GetPrivateProfileKeyValues(const std::string& section, const std::string& iniFileName)
 {
-	char keybuffer[BUFFER_SIZE] = { 0 };
-
-	const int bufferLen = ::GetPrivateProfileSectionA(section.c_str(), keybuffer, BUFFER_SIZE, iniFileName.c_str());
-	char* ptr = keybuffer;
-
-	std::vector<std::pair<std::string, std::string>> results;
-
-	while (ptr < keybuffer + bufferLen)
-	{
-		const std::string keyLine = ptr;
-		std::string keyName = keyLine;
-		std::string keyValue = "";
-
-		const size_t pos = keyLine.find("=");
-		if (pos != std::string::npos)
+	return GetIniCache().Read(iniFileName, [&](const IniDocument& doc)
 		{
-			keyName = keyLine.substr(0, pos);
-			keyValue = keyLine.substr(pos + 1, keyLine.length() - pos - 1);
-		}
-		ptr += keyLine.length() + 1;
+			std::vector<std::pair<std::string, std::string>> results;
 
-		results.emplace_back(std::make_pair(keyName, keyValue));
-	}
+			for (const auto& [key, value] : doc.GetKeyValues(section))
+				results.emplace_back(key, value);
 
-	return results;
+			return results;
+		});
 }
 
 inline bool PrivateProfileKeyExists(const std::string& section, const std::string& key, const std::string& iniFileName)
 {
-	const auto key_list = GetPrivateProfileKeys(section, iniFileName);
-	return std::any_of(key_list.begin(), key_list.end(), [key](const auto& this_key) { return ci_equals(this_key, key); });
+	return GetIniCache().Read(iniFileName, [&](const IniDocument& doc) { return doc.HasKey(section, key); });
 }
 
 template <size_t BUFFER_SIZE = MAX_STRING>
 inline std::vector<std::string> GetPrivateProfileSections(const std::string& iniFileName)
 {
-	char sectionbuffer[BUFFER_SIZE] = { 0 };
-
-	const int bufferLen = ::GetPrivateProfileSectionNamesA(sectionbuffer, BUFFER_SIZE, iniFileName.c_str());
-	char* ptr = sectionbuffer;
-
-	std::vector<std::string> results;
-
-	while (ptr < sectionbuffer + bufferLen)
-	{
-		std::string keyName = ptr;
-		ptr += keyName.length() + 1;
-
-		results.push_back(std::move(keyName));
-	}
-
-	return results;
+	return GetIniCache().Read(iniFileName, [&](const IniDocument& doc)
+		{
+			auto sections = doc.GetSectionNames();
+			return std::vector<std::string>(sections.begin(), sections.end());
+		});
 }
 
 inline bool PrivateProfileSectionExists(const std::string& section, const std::string& iniFileName)
 {
-	const auto section_list = GetPrivateProfileSections(iniFileName);
-	return std::any_of(section_list.begin(), section_list.end(), [section](const auto& this_section) { return ci_equals(this_section, section); });
+	return GetIniCache().Read(iniFileName, [&](const IniDocument& doc) { return doc.HasSection(section); });
 }
 
+// Checks the cached state of the file, so this doesn't go to the disk more than once per validation interval.
+inline bool PrivateProfileFileExists(const std::string& iniFileName)
+{
+	return GetIniCache().Exists(iniFileName);
+}
+
+// Writes are recorded as edits so that they can be replayed if the file changes on disk before it is
+// flushed, so each edit owns copies of its arguments.
+
 inline bool WritePrivateProfileSection(const std::string& Section, const std::string& KeysAndValues, const std::string& iniFileName)
 {
-	return ::WritePrivateProfileSectionA(Section.c_str(), KeysAndValues.c_str(), iniFileName.c_str());
+	return GetIniCache().Write(iniFileName, [section = Section, lines = detail::SplitProfileSection(KeysAndValues)](IniDocument& doc)
+		{
+			doc.SetSection(section, std::vector<std::string_view>(lines.begin(), lines.end()));
+			return true;
+		});
 }
 
 inline bool WritePrivateProfileSection(const char* Section, const char* KeysAndValues, const char* iniFileName)
 {
-	return ::WritePrivateProfileSectionA(Section, KeysAndValues, iniFileName);
+	if (!KeysAndValues)
+	{
+		return GetIniCache().Write(iniFileName, [section = std::string(Section)](IniDocument& doc)
+			{
+				return doc.DeleteSection(section);
+			});
+	}
+
+	return WritePrivateProfileSection(Section, std::string(detail::GetProfileSectionBlock(KeysAndValues)), iniFileName);
 }
 
-inline bool WritePrivateProfileString(const std::string& Section, const std::string& Key, const std::string& Value, const std::string& iniFileName)
+inline bool WritePrivateProfileString(const char* Section, const char* Key, const char* Value, const char* iniFileName)
 {
-	return ::WritePrivateProfileStringA(Section.c_str(), Key.c_str(), Value.c_str(), iniFileName.c_str());
+	if (!Section)
+	{
+		// Matches the WritePrivateProfileString convention of flushing the file when no section is given.
+		GetIniCache().Invalidate(iniFileName);
+		return true;
+	}
+
+	if (!Key)
+	{
+		return GetIniCache().Write(iniFileName, [section = std::string(Section)](IniDocument& doc)
+			{
+				return doc.DeleteSection(section);
+			});
+	}
+
+	if (!Value)
+	{
+		return GetIniCache().Write(iniFileName, [section = std::string(Section), key = std::string(Key)](IniDocument& doc)
+			{
+				return doc.DeleteKey(section, key);
+			});
+	}
+
+	return GetIniCache().Write(iniFileName, [section = std::string(Section), key = std::string(Key), value = std::string(Value)](IniDocument& doc)
+		{
+			return doc.SetValue(section, key, value);
+		});
 }
 
-inline bool WritePrivateProfileString(const char* Section, const char* Key, const char* Value, const char* iniFileName)
+inline bool WritePrivateProfileString(const std::string& Section, const std::string& Key, const std::string& Value, const std::string& iniFileName)
 {
-	return ::WritePrivateProfileStringA(Section, Key, Value, iniFileName);
+	return WritePrivateProfileString(Section.c_str(), Key.c_str(), Value.c_str(), iniFileName.c_str());
 }
 
 inline bool WritePrivateProfileBool(const std::string& Section, const std::string& Key, bool Value, const std::string& iniFileName)
 {
-	return ::WritePrivateProfileStringA(Section.c_str(), Key.c_str(), Value ? "1" : "0", iniFileName.c_str());
+	return WritePrivateProfileString(Section.c_str(), Key.c_str(), Value ? "1" : "0", iniFileName.c_str());
 }
 
 inline bool WritePrivateProfileBool(const char* Section, const char* Key, bool Value, const char* iniFileName)
 {
-	return ::WritePrivateProfileStringA(Section, Key, Value ? "1" : "0", iniFileName);
+	return WritePrivateProfileString(Section, Key, Value ? "1" : "0", iniFileName);
 }
 
 inline bool WritePrivateProfileInt(const std::string& Section, const std::string& Key, int Value, const std::string& iniFileName)
 {
 	std::string ValueString = std::to_string(Value);
-	return ::WritePrivateProfileStringA(Section.c_str(), Key.c_str(), ValueString.c_str(), iniFileName.c_str());
+	return WritePrivateProfileString(Section.c_str(), Key.c_str(), ValueString.c_str(), iniFileName.c_str());
 }
 
 inline bool WritePrivateProfileInt(const char* Section, const char* Key, int Value, const char* iniFileName)
 {
 	std::string ValueString = std::to_string(Value);
-	return ::WritePrivateProfileStringA(Section, Key, ValueString.c_str(), iniFileName);
+	return WritePrivateProfileString(Section, Key, ValueString.c_str(), iniFileName);
 }
 
 inline bool WritePrivateProfileFloat(const std::string& Section, const std::string& Key, float Value, const std::string& iniFileName)
 {
 	std::string ValueString = std::to_string(Value);
-	return ::WritePrivateProfileStringA(Section.c_str(), Key.c_str(), ValueString.c_str(), iniFileName.c_str());
+	return WritePrivateProfileString(Section.c_str(), Key.c_str(), ValueString.c_str(), iniFileName.c_str());
 }
 
 inline bool WritePrivateProfileFloat(const char* Section, const char* Key, float Value, const char* iniFileName)
 {
 	std::string ValueString = std::to_string(Value);
-	return ::WritePrivateProfileStringA(Section, Key, ValueString.c_str(), iniFileName);
+	return WritePrivateProfileString(Section, Key, ValueString.c_str(), iniFileName);
 }
 
 inline bool WritePrivateProfileColor(const std::string& Section, const std::string& Key, mq::MQColor Value, const std::string& iniFileName)
 {
 	std::string ValueString = std::to_string(Value.ToARGB());
-	return ::WritePrivateProfileStringA(Section.c_str(), Key.c_str(), ValueString.c_str(), iniFileName.c_str());
+	return WritePrivateProfileString(Section.c_str(), Key.c_str(), ValueString.c_str(), iniFileName.c_str());
 }
 
 inline bool WritePrivateProfileColor(const char* Section, const char* Key, mq::MQColor Value, const char* iniFileName)
 {
 	std::string ValueString = std::to_string(Value.ToARGB());
-	return ::WritePrivateProfileStringA(Section, Key, ValueString.c_str(), iniFileName);
+	return WritePrivateProfileString(Section, Key, ValueString.c_str(), iniFileName);
 }
 
 inline bool DeletePrivateProfileKey(const std::string& Section, const std::string& Key, const std::string& iniFileName)
 {
-	return ::WritePrivateProfileStringA(Section.c_str(), Key.c_str(), nullptr, iniFileName.c_str());
+	return WritePrivateProfileString(Section.c_str(), Key.c_str(), nullptr, iniFileName.c_str());
 }
 
 // WritePrivateProfileValue provides overloads to allow dispatching by type (selected by the type of default value)
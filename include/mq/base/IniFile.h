@@ -0,0 +1,760 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#pragma once
+
+#include <mq/base/String.h>
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mq {
+
+//----------------------------------------------------------------------------
+// IniDocument is an in-memory representation of an ini file. Sections and keys
+// are looked up without regard to case, and every line of the original file
+// (comments, blank lines, spacing) is kept so that writing the document back
+// out only changes the lines that were actually modified.
+//
+// Lookup rules follow GetPrivateProfileString: the first matching section and
+// the first matching key win, whitespace around keys and values is ignored, and
+// a value wrapped in matching quotes is returned without them.
+
+class IniDocument
+{
+public:
+	IniDocument() = default;
+	explicit IniDocument(std::string_view contents) { Parse(contents); }
+
+	void Parse(std::string_view contents)
+	{
+		m_sections.clear();
+		m_sections.emplace_back();
+		m_hasBOM = false;
+		m_trailingNewline = false;
+		m_newline = "\r\n";
+
+		if (starts_with(contents, "\xEF\xBB\xBF"))
+		{
+			m_hasBOM = true;
+			contents.remove_prefix(3);
+		}
+
+		if (size_t pos = contents.find('\n'); pos != std::string_view::npos && (pos == 0 || contents[pos - 1] != '\r'))
+			m_newline = "\n";
+
+		while (!contents.empty())
+		{
+			size_t eol = contents.find('\n');
+			std::string_view line = contents.substr(0, eol);
+
+			if (eol == std::string_view::npos)
+			{
+				contents = {};
+			}
+			else
+			{
+				contents.remove_prefix(eol + 1);
+				m_trailingNewline = contents.empty();
+			}
+
+			if (!line.empty() && line.back() == '\r')
+				line.remove_suffix(1);
+
+			ParseLine(line);
+		}
+
+		RebuildIndex();
+	}
+
+	std::string Serialize() const
+	{
+		std::string result;
+		if (m_hasBOM)
+			result.append("\xEF\xBB\xBF");
+
+		bool first = true;
+		for (const Section& section : m_sections)
+		{
+			if (section.hasHeader)
+			{
+				if (!first) result.append(m_newline);
+				result.append(section.header);
+				first = false;
+			}
+
+			for (const Line& line : section.lines)
+			{
+				if (!first) result.append(m_newline);
+				result.append(line.raw);
+				first = false;
+			}
+		}
+
+		if (!first && m_trailingNewline)
+			result.append(m_newline);
+
+		return result;
+	}
+
+	bool HasSection(std::string_view section) const
+	{
+		return FindSection(section) != nullptr;
+	}
+
+	bool HasKey(std::string_view section, std::string_view key) const
+	{
+		return FindLine(section, key) != nullptr;
+	}
+
+	// Returns the value of the key with surrounding quotes removed, or nullopt if the key is not present.
+	std::optional<std::string_view> GetValue(std::string_view section, std::string_view key) const
+	{
+		const Line* line = FindLine(section, key);
+		if (!line)
+			return std::nullopt;
+
+		std::string_view value = line->value;
+		if (value.length() >= 2 && (value.front() == '"' || value.front() == '\'') && value.back() == value.front())
+			value = value.substr(1, value.length() - 2);
+
+		return value;
+	}
+
+	// All section names in file order, including duplicates.
+	std::vector<std::string_view> GetSectionNames() const
+	{
+		std::vector<std::string_view> names;
+		names.reserve(m_sections.size());
+
+		for (const Section& section : m_sections)
+		{
+			if (section.hasHeader)
+				names.push_back(section.name);
+		}
+
+		return names;
+	}
+
+	// All key names in the section in file order, including duplicates.
+	std::vector<std::string_view> GetKeys(std::string_view sectionName) const
+	{
+		std::vector<std::string_view> keys;
+
+		if (const Section* section = FindSection(sectionName))
+		{
+			for (const Line& line : section->lines)
+			{
+				if (line.type == LineType::KeyValue)
+					keys.push_back(line.key);
+			}
+		}
+
+		return keys;
+	}
+
+	// All key/value pairs in the section in file order. Values are returned as written.
+	std::vector<std::pair<std::string_view, std::string_view>> GetKeyValues(std::string_view sectionName) const
+	{
+		std::vector<std::pair<std::string_view, std::string_view>> keyValues;
+
+		if (const Section* section = FindSection(sectionName))
+		{
+			for (const Line& line : section->lines)
+			{
+				if (line.type == LineType::KeyValue)
+					keyValues.emplace_back(line.key, line.value);
+			}
+		}
+
+		return keyValues;
+	}
+
+	// Returns true if the document was modified.
+	bool SetValue(std::string_view sectionName, std::string_view key, std::string_view value)
+	{
+		key = trim(key);
+		value = trim(value);
+
+		Section* section = FindSection(sectionName);
+		if (!section)
+		{
+			section = &AddSection(sectionName);
+		}
+		else if (Line* line = FindLine(*section, key))
+		{
+			if (line->value == value)
+				return false;
+
+			line->value = std::string(value);
+			line->raw = line->key + "=" + line->value;
+			return true;
+		}
+
+		// New keys go after the last key in the section, so that any blank lines or
+		// comments separating it from the next section stay where they are.
+		size_t insertPos = 0;
+		for (size_t i = 0; i < section->lines.size(); ++i)
+		{
+			if (section->lines[i].type == LineType::KeyValue)
+				insertPos = i + 1;
+		}
+
+		Line line;
+		line.type = LineType::KeyValue;
+		line.key = std::string(key);
+		line.value = std::string(value);
+		line.raw = line.key + "=" + line.value;
+		section->lines.insert(section->lines.begin() + insertPos, std::move(line));
+
+		RebuildIndex(*section);
+		return true;
+	}
+
+	bool DeleteKey(std::string_view sectionName, std::string_view key)
+	{
+		Section* section = FindSection(sectionName);
+		if (!section)
+			return false;
+
+		auto iter = section->keyIndex.find(trim(key));
+		if (iter == section->keyIndex.end())
+			return false;
+
+		section->lines.erase(section->lines.begin() + iter->second);
+		RebuildIndex(*section);
+		return true;
+	}
+
+	bool DeleteSection(std::string_view sectionName)
+	{
+		auto iter = m_sectionIndex.find(trim(sectionName));
+		if (iter == m_sectionIndex.end())
+			return false;
+
+		m_sections.erase(m_sections.begin() + iter->second);
+		RebuildIndex();
+		return true;
+	}
+
+	// Replaces the contents of a section with the given "key=value" lines, like WritePrivateProfileSection.
+	void SetSection(std::string_view sectionName, const std::vector<std::string_view>& keyValueLines)
+	{
+		Section* section = FindSection(sectionName);
+		if (!section)
+			section = &AddSection(sectionName);
+
+		// Keep trailing blank lines that separate this section from the next one.
+		size_t trailing = section->lines.size();
+		while (trailing > 0 && section->lines[trailing - 1].type == LineType::Other && trim(std::string_view(section->lines[trailing - 1].raw)).empty())
+			--trailing;
+
+		std::vector<Line> lines;
+		lines.reserve(keyValueLines.size() + section->lines.size() - trailing);
+
+		for (std::string_view keyValueLine : keyValueLines)
+		{
+			lines.push_back(MakeLine(keyValueLine));
+		}
+
+		std::move(section->lines.begin() + trailing, section->lines.end(), std::back_inserter(lines));
+		section->lines = std::move(lines);
+
+		RebuildIndex(*section);
+	}
+
+private:
+	enum class LineType
+	{
+		KeyValue,
+		Other,                                   // comments, blank lines and anything else we don't understand
+	};
+
+	struct Line
+	{
+		LineType type = LineType::Other;
+		std::string key;
+		std::string value;
+		std::string raw;
+	};
+
+	struct Section
+	{
+		std::string name;
+		std::string header;
+		bool hasHeader = false;
+		std::vector<Line> lines;
+		ci_unordered::map<std::string_view, size_t> keyIndex;
+	};
+
+	static Line MakeLine(std::string_view text)
+	{
+		Line line;
+		line.raw = std::string(text);
+
+		std::string_view trimmed = trim(text);
+		if (trimmed.empty() || trimmed[0] == ';')
+			return line;
+
+		line.type = LineType::KeyValue;
+
+		size_t pos = trimmed.find('=');
+		if (pos == std::string_view::npos)
+		{
+			line.key = std::string(trimmed);
+		}
+		else
+		{
+			line.key = std::string(trim(trimmed.substr(0, pos)));
+			line.value = std::string(trim(trimmed.substr(pos + 1)));
+		}
+
+		return line;
+	}
+
+	void ParseLine(std::string_view text)
+	{
+		std::string_view trimmed = trim(text);
+		if (!trimmed.empty() && trimmed[0] == '[')
+		{
+			size_t end = trimmed.find(']');
+
+			Section& section = m_sections.emplace_back();
+			section.name = std::string(trim(trimmed.substr(1, end == std::string_view::npos ? std::string_view::npos : end - 1)));
+			section.header = std::string(text);
+			section.hasHeader = true;
+			return;
+		}
+
+		m_sections.back().lines.push_back(MakeLine(text));
+	}
+
+	Section& AddSection(std::string_view sectionName)
+	{
+		Section& section = m_sections.emplace_back();
+		section.name = std::string(trim(sectionName));
+		section.header = "[" + section.name + "]";
+		section.hasHeader = true;
+
+		if (m_sections.size() > 1 || !m_sections[0].lines.empty())
+			m_trailingNewline = true;
+
+		RebuildIndex();
+		return m_sections.back();
+	}
+
+	static void RebuildIndex(Section& section)
+	{
+		section.keyIndex.clear();
+		for (size_t i = 0; i < section.lines.size(); ++i)
+		{
+			if (section.lines[i].type == LineType::KeyValue)
+				section.keyIndex.emplace(section.lines[i].key, i);
+		}
+	}
+
+	void RebuildIndex()
+	{
+		m_sectionIndex.clear();
+		for (size_t i = 0; i < m_sections.size(); ++i)
+		{
+			RebuildIndex(m_sections[i]);
+
+			if (m_sections[i].hasHeader)
+				m_sectionIndex.emplace(m_sections[i].name, i);
+		}
+	}
+
+	const Section* FindSection(std::string_view sectionName) const
+	{
+		auto iter = m_sectionIndex.find(trim(sectionName));
+		return iter == m_sectionIndex.end() ? nullptr : &m_sections[iter->second];
+	}
+
+	Section* FindSection(std::string_view sectionName)
+	{
+		auto iter = m_sectionIndex.find(trim(sectionName));
+		return iter == m_sectionIndex.end() ? nullptr : &m_sections[iter->second];
+	}
+
+	static const Line* FindLine(const Section& section, std::string_view key)
+	{
+		auto iter = section.keyIndex.find(trim(key));
+		return iter == section.keyIndex.end() ? nullptr : &section.lines[iter->second];
+	}
+
+	static Line* FindLine(Section& section, std::string_view key)
+	{
+		auto iter = section.keyIndex.find(trim(key));
+		return iter == section.keyIndex.end() ? nullptr : &section.lines[iter->second];
+	}
+
+	const Line* FindLine(std::string_view sectionName, std::string_view key) const
+	{
+		const Section* section = FindSection(sectionName);
+		return section ? FindLine(*section, key) : nullptr;
+	}
+
+	// m_sections[0] holds any lines that appear before the first section header.
+	std::vector<Section> m_sections = std::vector<Section>(1);
+	ci_unordered::map<std::string_view, size_t> m_sectionIndex;
+	std::string m_newline = "\r\n";
+	bool m_hasBOM = false;
+	bool m_trailingNewline = false;
+};
+
+//----------------------------------------------------------------------------
+// IniCache keeps parsed ini files in memory so that repeated reads don't have to
+// go back to the disk. A cached file is checked for external modification (by
+// timestamp and size) at most once per validation interval.
+//
+// Writes are applied to the cached document immediately. With a write-behind delay
+// of zero they are also written to disk immediately (the file is always checked for
+// changes first), otherwise the file is marked dirty and written out by Flush() once
+// the delay has passed, so that a burst of writes to the same file only rewrites it
+// once. If the file was changed by someone
+// else in the meantime, it is reloaded and the pending edits are replayed on top of
+// it before writing.
+//
+// At most a fixed number of files are kept. When another file is needed, the one that
+// was used least recently is written out if it is dirty and dropped.
+//
+// Each module that includes Config.h has its own cache unless it is given another
+// module's cache with SetIniCache. Modules loaded into the game all use MQ2Main's cache
+// (see pluginapi), so none of them can read a value another one already replaced.
+// Modules that enable the write-behind delay are responsible for calling Flush()
+// periodically.
+
+class IniCache
+{
+public:
+	using clock = std::chrono::steady_clock;
+
+	IniCache() = default;
+	IniCache(const IniCache&) = delete;
+	IniCache& operator=(const IniCache&) = delete;
+
+	~IniCache()
+	{
+		Flush(true);
+	}
+
+	void SetValidateInterval(std::chrono::milliseconds interval)
+	{
+		std::scoped_lock lock(m_mutex);
+		m_validateInterval = interval;
+	}
+
+	void SetWriteBehindDelay(std::chrono::milliseconds delay)
+	{
+		std::scoped_lock lock(m_mutex);
+		m_writeBehindDelay = delay;
+	}
+
+	void SetMaxFiles(size_t maxFiles)
+	{
+		std::scoped_lock lock(m_mutex);
+		m_maxFiles = std::max<size_t>(maxFiles, 1);
+		Evict(nullptr);
+	}
+
+	size_t GetFileCount()
+	{
+		std::scoped_lock lock(m_mutex);
+		return m_entries.size();
+	}
+
+	// Calls func with the document for the given file. The document is empty if the file doesn't exist.
+	template <typename Func>
+	auto Read(const std::string& fileName, Func&& func)
+	{
+		std::scoped_lock lock(m_mutex);
+		FlushDue(clock::now(), false);
+
+		return func(static_cast<const IniDocument&>(GetEntry(fileName).doc));
+	}
+
+	// Calls func with the document for the given file. func returns true if it modified the document.
+	template <typename Func>
+	bool Write(const std::string& fileName, Func&& func)
+	{
+		std::scoped_lock lock(m_mutex);
+		auto now = clock::now();
+		FlushDue(now, false);
+
+		Entry& entry = GetEntry(fileName);
+
+		if (m_writeBehindDelay.count() <= 0)
+		{
+			// The whole file is rewritten from the cached document, so it has to be current
+			// before the edit is applied. Don't trust the validation interval here, or a write
+			// made by someone else within it would be lost.
+			if (entry.dirty)
+			{
+				WriteEntry(fileName, entry);
+				--m_dirtyCount;
+			}
+			else if (IsModified(fileName, entry))
+			{
+				Load(fileName, entry);
+			}
+
+			entry.validated = now;
+
+			if (!func(entry.doc))
+				return true;
+
+			return WriteEntry(fileName, entry);
+		}
+
+		if (!func(entry.doc))
+			return true;
+
+		if (!entry.dirty)
+		{
+			entry.dirty = true;
+			entry.flushTime = now + m_writeBehindDelay;
+			++m_dirtyCount;
+		}
+
+		entry.pendingEdits.emplace_back(std::forward<Func>(func));
+		return true;
+	}
+
+	// Returns true if the file exists, or will once its pending changes are written out.
+	bool Exists(const std::string& fileName)
+	{
+		std::scoped_lock lock(m_mutex);
+
+		const Entry& entry = GetEntry(fileName);
+		return entry.exists || entry.dirty;
+	}
+
+	// Writes out dirty files whose write-behind delay has passed, or all dirty files if force is set.
+	void Flush(bool force = false)
+	{
+		std::scoped_lock lock(m_mutex);
+		FlushDue(clock::now(), force);
+	}
+
+	// Drop a file from the cache, writing out any pending changes first.
+	void Invalidate(const std::string& fileName)
+	{
+		std::scoped_lock lock(m_mutex);
+
+		auto iter = m_entries.find(fileName);
+		if (iter == m_entries.end())
+			return;
+
+		if (iter->second.dirty)
+		{
+			WriteEntry(iter->first, iter->second);
+			--m_dirtyCount;
+		}
+
+		m_entries.erase(iter);
+	}
+
+private:
+	struct Entry
+	{
+		IniDocument doc;
+		bool exists = false;
+		std::filesystem::file_time_type writeTime;
+		uintmax_t fileSize = 0;
+		clock::time_point validated;
+		uint64_t lastUsed = 0;
+
+		bool dirty = false;
+		clock::time_point flushTime;
+		std::vector<std::function<bool(IniDocument&)>> pendingEdits;
+	};
+
+	static bool Stat(const std::string& fileName, std::filesystem::file_time_type& writeTime, uintmax_t& fileSize)
+	{
+		std::error_code ec;
+		std::filesystem::path path = std::filesystem::path(fileName);
+
+		writeTime = std::filesystem::last_write_time(path, ec);
+		if (ec)
+			return false;
+
+		fileSize = std::filesystem::file_size(path, ec);
+		return !ec;
+	}
+
+	static bool IsModified(const std::string& fileName, const Entry& entry)
+	{
+		std::filesystem::file_time_type writeTime;
+		uintmax_t fileSize = 0;
+		bool exists = Stat(fileName, writeTime, fileSize);
+
+		return exists != entry.exists
+			|| (exists && (writeTime != entry.writeTime || fileSize != entry.fileSize));
+	}
+
+	static void Load(const std::string& fileName, Entry& entry)
+	{
+		entry.exists = Stat(fileName, entry.writeTime, entry.fileSize);
+		entry.doc = IniDocument{};
+
+		if (entry.exists)
+		{
+			std::ifstream file(std::filesystem::path(fileName), std::ios::in | std::ios::binary);
+			std::string contents{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+
+			entry.doc.Parse(contents);
+		}
+	}
+
+	Entry& GetEntry(const std::string& fileName)
+	{
+		auto now = clock::now();
+		auto [iter, inserted] = m_entries.try_emplace(fileName);
+		Entry& entry = iter->second;
+		entry.lastUsed = ++m_useCounter;
+
+		if (inserted)
+		{
+			Evict(&entry);
+			Load(fileName, entry);
+			entry.validated = now;
+		}
+		else if (!entry.dirty && now - entry.validated >= m_validateInterval)
+		{
+			if (IsModified(fileName, entry))
+				Load(fileName, entry);
+
+			entry.validated = now;
+		}
+
+		return entry;
+	}
+
+	bool WriteEntry(const std::string& fileName, Entry& entry)
+	{
+		if (entry.dirty && IsModified(fileName, entry))
+		{
+			// Someone else wrote to the file since we loaded it. Pick up their changes and
+			// re-apply ours on top.
+			Load(fileName, entry);
+
+			for (auto& edit : entry.pendingEdits)
+				edit(entry.doc);
+		}
+
+		entry.dirty = false;
+		entry.pendingEdits.clear();
+
+		bool success;
+		{
+			std::ofstream file(std::filesystem::path(fileName), std::ios::out | std::ios::binary | std::ios::trunc);
+			std::string contents = entry.doc.Serialize();
+			file.write(contents.data(), contents.size());
+			success = file.good();
+		}
+
+		entry.exists = Stat(fileName, entry.writeTime, entry.fileSize);
+		entry.validated = clock::now();
+		return success;
+	}
+
+	// Drops least recently used files until there are at most m_maxFiles, never dropping keep.
+	// Unordered map iterators other than the erased one stay valid, so keep is still good after.
+	void Evict(const Entry* keep)
+	{
+		while (m_entries.size() > m_maxFiles)
+		{
+			auto oldest = m_entries.end();
+			for (auto iter = m_entries.begin(); iter != m_entries.end(); ++iter)
+			{
+				if (&iter->second != keep && (oldest == m_entries.end() || iter->second.lastUsed < oldest->second.lastUsed))
+					oldest = iter;
+			}
+
+			if (oldest == m_entries.end())
+				return;
+
+			if (oldest->second.dirty)
+			{
+				WriteEntry(oldest->first, oldest->second);
+				--m_dirtyCount;
+			}
+
+			m_entries.erase(oldest);
+		}
+	}
+
+	void FlushDue(clock::time_point now, bool force)
+	{
+		if (m_dirtyCount == 0)
+			return;
+
+		for (auto& [fileName, entry] : m_entries)
+		{
+			if (entry.dirty && (force || now >= entry.flushTime))
+			{
+				WriteEntry(fileName, entry);
+				--m_dirtyCount;
+			}
+		}
+	}
+
+	std::mutex m_mutex;
+	ci_unordered::map<std::string, Entry> m_entries;
+	size_t m_dirtyCount = 0;
+	size_t m_maxFiles = 64;
+	uint64_t m_useCounter = 0;
+	std::chrono::milliseconds m_validateInterval{ 100 };
+	std::chrono::milliseconds m_writeBehindDelay{ 0 };
+};
+
+namespace detail {
+
+inline IniCache*& IniCacheOverride()
+{
+	static IniCache* s_cache = nullptr;
+	return s_cache;
+}
+
+} // namespace detail
+
+// Makes the Config.h functions in this module use another module's cache. The other module
+// must outlive this one, and flush before this module unloads: pending writes hold code from
+// the module that made them. Passing nullptr goes back to this module's own cache.
+inline void SetIniCache(IniCache* cache)
+{
+	detail::IniCacheOverride() = cache;
+}
+
+// The ini cache used by the Config.h functions in this module.
+inline IniCache& GetIniCache()
+{
+	if (IniCache* cache = detail::IniCacheOverride())
+		return *cache;
+
+	static IniCache s_iniCache;
+	return s_iniCache;
+}
+
+} // namespace mq
@@ -16,6 +16,7 @@
 #include "loader/PostOffice.h"
 #include "loader/Crashpad.h"
 #include "loader/LoaderAutoLogin.h"
+#include "routing/LauncherRouter.h"
 #include "routing/PostOffice.h"
 
 #include <date/date.h>
@@ -32,16 +33,8 @@ using namespace postoffice;
 class LauncherPostOffice : public PostOffice
 {
 private:
-	struct ClientIdentification
-	{
-		uint32_t pid;
-		std::string account;
-		std::string server;
-		std::string character;
-	};
+	LauncherRouter m_router;
 
-	std::unordered_map<uint32_t, ClientIdentification> m_identities;
-	ci_unordered::map<std::string, uint32_t> m_names;
 	bool m_running = false;
 	std::thread m_thread;
 	std::thread::id m_threadId;
@@ -73,13 +66,19 @@ private:
 
 			case mq::MQMessageId::MSG_ROUTE:
 			{
-				auto envelope = ProtoMessage::Parse<proto::routing::Envelope>(message);
-				const auto& address = envelope.address();
+				EnvelopeHeader envelope;
+				if (!envelope.Peek(message))
+				{
+					SPDLOG_WARN("Dropping malformed route message from connectionId={}", message->GetConnectionId());
+					break;
+				}
+
+				const auto& address = envelope.address;
 				if ((address.has_pid() && address.pid() == GetCurrentProcessId()) || (address.has_name() && ci_equals(address.name(), "launcher")))
 				{
 					auto routing_failed = [&envelope](int status, PipeMessagePtr&& message)
 						{
-							RoutingFailed(envelope, status, std::move(message), nullptr);
+							LauncherRouter::RoutingFailed(envelope, status, std::move(message), nullptr);
 						};
 
 					if (address.has_mailbox())
@@ -114,18 +113,17 @@ private:
 					auto id = ProtoMessage::Parse<proto::routing::Identification>(message);
 					if (id.has_name())
 					{
-						m_postOffice->m_names.insert_or_assign(id.name(), id.pid());
+						m_postOffice->m_router.AddName(id.name(), id.pid());
 						SPDLOG_INFO("Got name-based identification from {}: {}", id.pid(), id.name());
 					}
 					else
 					{
-						auto result = m_postOffice->m_identities.insert_or_assign(id.pid(), ClientIdentification{
+						added = m_postOffice->m_router.AddIdentity(LauncherRouter::ClientIdentification{
 							id.pid(),
 							id.has_account() ? id.account() : "",
 							id.has_server() ? id.server() : "",
 							id.has_character() ? id.character() : ""
 						});
-						added = result.second;
 
 						// only include the PID here, otherwise it's pseudonym-identifiable information from the logs
 						SPDLOG_INFO("Got identification from {}", id.pid());
@@ -143,7 +141,7 @@ private:
 				else
 				{
 					// we are getting a request to send all IDs, do so sequentially and asynchronously
-					for (const auto& [_, client] : m_postOffice->m_identities)
+					for (const auto& [_, client] : m_postOffice->m_router.GetIdentities())
 					{
 						proto::routing::Identification id;
 						id.set_pid(client.pid);
@@ -163,7 +161,7 @@ private:
 							id);
 					}
 
-					for (const auto& [name, pid] : m_postOffice->m_names)
+					for (const auto& [name, pid] : m_postOffice->m_router.GetNames())
 					{
 						proto::routing::Identification id;
 						id.set_pid(pid);
@@ -177,6 +175,32 @@ private:
 				}
 				break;
 
+			case mq::MQMessageId::MSG_SUBSCRIPTION:
+			{
+				auto subscription = ProtoMessage::Parse<proto::routing::Subscription>(message);
+
+				// subscribe the process on the other end of the pipe, not whichever pid it claims to be
+				auto connection = m_postOffice->m_pipeServer.GetConnection(message->GetConnectionId());
+				const uint32_t pid = connection ? connection->GetProcessId() : 0;
+				if (pid == 0)
+				{
+					SPDLOG_WARN("Dropping subscription to {} from unknown connectionId={}", subscription.topic(), message->GetConnectionId());
+					break;
+				}
+
+				if (subscription.pid() != 0 && subscription.pid() != pid)
+				{
+					SPDLOG_WARN("Subscription to {} from pid {} claims pid {}, using the connection's pid", subscription.topic(),
+						pid, subscription.pid());
+				}
+
+				if (subscription.subscribe())
+					m_postOffice->m_router.AddSubscriber(subscription.topic(), pid);
+				else
+					m_postOffice->m_router.RemoveSubscriber(subscription.topic(), pid);
+				break;
+			}
+
 			case mq::MQMessageId::MSG_MAIN_PROCESS_UNLOADED:
 				break;
 
@@ -306,45 +330,39 @@ private:
 					}
 				};
 
-			for (auto name_it = m_postOffice->m_names.begin(); name_it != m_postOffice->m_names.end();)
+			for (const std::string& name : m_postOffice->m_router.RemoveNames(processId))
 			{
-				if (name_it->second == processId)
-				{
-					proto::routing::Identification id;
-					id.set_pid(name_it->second);
-					id.set_name(name_it->first);
-
-					SPDLOG_INFO("Disconnection detected, dropping name from {}: {}", id.pid(), id.name());
-					broadcast(std::move(id));
+				proto::routing::Identification id;
+				id.set_pid(processId);
+				id.set_name(name);
 
-					name_it = m_postOffice->m_names.erase(name_it);
-				}
-				else
-					++name_it;
+				SPDLOG_INFO("Disconnection detected, dropping name from {}: {}", id.pid(), id.name());
+				broadcast(std::move(id));
 			}
 
-			auto ident_it = m_postOffice->m_identities.find(processId);
-			if (ident_it != m_postOffice->m_identities.end())
+			if (auto client = m_postOffice->m_router.GetIdentity(processId))
 			{
 				proto::routing::Identification id;
-				id.set_pid(ident_it->first);
+				id.set_pid(client->pid);
 
-				if (!ident_it->second.account.empty())
-					id.set_account(ident_it->second.account);
+				if (!client->account.empty())
+					id.set_account(client->account);
 
-				if (!ident_it->second.server.empty())
-					id.set_server(ident_it->second.server);
+				if (!client->server.empty())
+					id.set_server(client->server);
 
-				if (!ident_it->second.character.empty())
-					id.set_character(ident_it->second.character);
+				if (!client->character.empty())
+					id.set_character(client->character);
 
 				// only include the PID here, otherwise it's pseudonym-identifiable information from the logs
 				SPDLOG_INFO("Disconnection detected, dropping ID from {}", id.pid());
 
 				broadcast(std::move(id));
 
-				m_postOffice->m_identities.erase(ident_it);
+				m_postOffice->m_router.RemoveIdentity(processId);
 			}
+
+			m_postOffice->m_router.RemoveSubscriber(processId);
 		}
 
 		private:
@@ -352,159 +370,32 @@ private:
 	};
 
 public:
-	LauncherPostOffice() : m_pipeServer{ mq::MQ2_PIPE_SERVER_PATH }
-	{
-		m_names.emplace("launcher", GetCurrentProcessId());
-	}
-
-	static void RoutingFailed(
-		const proto::routing::Envelope& envelope,
-		int status,
-		PipeMessagePtr&& message,
-		const PipeMessageResponseCb& callback)
+	LauncherPostOffice()
+		: m_router(*this, GetCurrentProcessId(),
+			[this](uint32_t pid) { return m_pipeServer.GetConnectionForProcessId(pid); },
+			[this](PipeMessagePtr&& message) { m_pipeServer.DispatchMessage(std::move(message)); })
+		, m_pipeServer{ mq::MQ2_PIPE_SERVER_PATH }
 	{
-		// we can't assume that the mailbox exists here, so manually create the reply
-		proto::routing::Envelope outbound;
-		*outbound.mutable_address() = envelope.return_address();
-		outbound.set_payload(envelope.address().SerializeAsString());
-
-		std::string data = outbound.SerializeAsString();
-		if (callback == nullptr)
-			message->SendReply(MQMessageId::MSG_ROUTE, &data[0], data.size(), status);
-		else
-			callback(status, std::make_unique<PipeMessage>(MQMessageId::MSG_ROUTE, &data[0], data.size()));
+		m_router.AddName("launcher", GetCurrentProcessId());
 	}
 
-	static bool IsRecipient(const proto::routing::Address& address, const ClientIdentification& id)
-	{
-		return (!address.has_account() || ci_equals(address.account(), id.account)) &&
-			(!address.has_server() || ci_equals(address.server(), id.server)) &&
-			(!address.has_character() || ci_equals(address.character(), id.character));
-	}
-
-	auto FindIdentity(
-		const proto::routing::Address& address,
-		const std::unordered_map<uint32_t, ClientIdentification>::iterator& from)
+	void RouteMessage(PipeMessagePtr&& message, const PipeMessageResponseCb& callback) override
 	{
-		return std::find_if(from, m_identities.end(),
-			[&address](const std::pair<uint32_t, ClientIdentification>& pair)
-			{ return IsRecipient(address, pair.second); });
+		m_router.RouteMessage(std::move(message), callback);
 	}
 
-	void RouteMessage(PipeMessagePtr&& message, const PipeMessageResponseCb& callback) override
+	void RouteMessage(PipeMessagePtr&& message)
 	{
-		if (callback == nullptr) // simple message, just route it
-			RouteMessage(std::move(message));
-		else // routing will fail here if there are too many recipients
-		{
-			auto envelope = ProtoMessage::Parse<proto::routing::Envelope>(message);
-			const auto& address = envelope.address();
-
-			auto routing_failed = [&envelope, callback](int status, PipeMessagePtr&& message)
-				{
-					RoutingFailed(envelope, status, std::move(message), callback);
-				};
-
-			auto single_send = [callback](const PipeConnectionPtr& connection, PipeMessagePtr&& message)
-				{
-					connection->SendMessageWithResponse(std::move(message), callback);
-				};
-
-			if (address.has_pid())
-			{
-				SendMessageToPID(address.pid(), std::move(message), single_send, routing_failed);
-			}
-			else if (address.has_name())
-			{
-				auto pid_it = m_names.find(address.name());
-				if (pid_it == m_names.end())
-				{
-					routing_failed(MsgError_RoutingFailed, std::move(message));
-				}
-				else
-				{
-					SendMessageToPID(pid_it->second, std::move(message), single_send, routing_failed);
-				}
-			}
-			else
-			{
-				auto identity = FindIdentity(envelope.address(), m_identities.begin());
-
-				if (identity == m_identities.end())
-					RoutingFailed(envelope, MsgError_RoutingFailed, std::move(message), callback);
-				else if (FindIdentity(envelope.address(), std::next(identity)) != m_identities.end())
-					RoutingFailed(envelope, MsgError_AmbiguousRecipient, std::move(message), callback);
-				else
-				{
-					message->SetRequestMode(MQRequestMode::CallAndResponse);
-					SendMessageToPID(identity->first, std::move(message), single_send, routing_failed);
-				}
-			}
-		}
+		m_router.RouteMessage(std::move(message));
 	}
 
-	void RouteMessage(
-		PipeMessagePtr&& message)
+	// The launcher's own mailboxes subscribe just like a client would
+	void OnSubscriptionChanged(const std::string& topic, bool subscribed) override
 	{
-		auto envelope = ProtoMessage::Parse<proto::routing::Envelope>(message);
-		const auto& address = envelope.address();
-		auto routing_failed = [&envelope](int status, PipeMessagePtr&& message)
-			{
-				RoutingFailed(envelope, status, std::move(message), nullptr);
-			};
-
-		auto single_send = [](const PipeConnectionPtr& connection, PipeMessagePtr&& message)
-			{
-				connection->SendMessage(std::move(message));
-			};
-
-		if (address.has_pid())
-		{
-			// a PID is necessarily a singular identifier, avoid the loop
-			SendMessageToPID(address.pid(), std::move(message), single_send, routing_failed);
-		}
-		else if (address.has_name())
-		{
-			// a name is also a singular identifier, avoid the loop here too
-			// route the message to a registered (named) client
-			auto pid_it = m_names.find(address.name());
-			if (pid_it == m_names.end())
-			{
-				routing_failed(MsgError_RoutingFailed, std::move(message));
-			}
-			else
-			{
-				SendMessageToPID(pid_it->second, std::move(message), single_send, routing_failed);
-			}
-		}
-		else if (message->GetRequestMode() == MQRequestMode::CallAndResponse)
-		{
-			// ensure that we have a singular target for an RPC message
-			auto identity = FindIdentity(envelope.address(), m_identities.begin());
-
-			if (identity == m_identities.end())
-				RoutingFailed(envelope, MsgError_RoutingFailed, std::move(message), nullptr);
-			else if (FindIdentity(envelope.address(), std::next(identity)) != m_identities.end())
-				RoutingFailed(envelope, MsgError_AmbiguousRecipient, std::move(message), nullptr);
-			else
-				SendMessageToPID(identity->first, std::move(message), single_send, routing_failed);
-		}
+		if (subscribed)
+			m_router.AddSubscriber(topic, GetCurrentProcessId());
 		else
-		{
-			// we don't have a PID or a name and this is not an RPC, so we will send this message to 
-			// all clients that match the address -- it's important to copy these messages
-			for (const auto& identity : m_identities)
-			{
-				if (IsRecipient(address, identity.second))
-				{
-					SendMessageToPID(
-						identity.first,
-						std::make_unique<PipeMessage>(*message->GetHeader(), message->get(), message->size()),
-						single_send,
-						routing_failed);
-				}
-			}
-		}
+			m_router.RemoveSubscriber(topic, GetCurrentProcessId());
 	}
 
 	bool SendSetForegroundWindow(HWND hWnd, uint32_t processID)
@@ -619,30 +510,6 @@ public:
 private:
 	mq::ProtoPipeServer m_pipeServer;
 	Dropbox m_serverDropbox;
-
-	bool SendMessageToPID(
-		uint32_t pid,
-		PipeMessagePtr&& message,
-		const std::function<void(const PipeConnectionPtr&, PipeMessagePtr&&)> send,
-		const std::function<void(int, PipeMessagePtr&&)>& failed)
-	{
-		if (pid == GetCurrentProcessId())
-		{
-			// send to self, dispatch directly to the handler
-			m_pipeServer.DispatchMessage(std::move(message));
-			return true;
-		}
-		else if (auto connection = m_pipeServer.GetConnectionForProcessId(pid))
-		{
-			// found a connection to send it over
-			send(connection, std::move(message));
-			return true;
-		}
-
-		SPDLOG_WARN("Unable to get connection for PID {}, message route failed.", pid);
-		failed(MsgError_NoConnection, std::move(message));
-		return false;
-	}
 };
 
 PostOffice& postoffice::GetPostOffice()
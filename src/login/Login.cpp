@@ -38,8 +38,6 @@
 #include "argon2.h"
 #pragma comment(lib, "argon2")
 
-std::string s_dbPath;
-
 using namespace mq;
 namespace fs = std::filesystem;
 
@@ -403,120 +401,6 @@ static std::string ReadText(sqlite3_stmt* stmt, int position)
 	return reinterpret_cast<const char*>(sqlite3_column_text(stmt, position));
 }
 
-static std::map<int, std::shared_ptr<WithDb>> s_connections;
-class WithDb
-{
-public:
-	template <typename T>
-	using DoQuery = std::function<T(sqlite3_stmt*, sqlite3*)>;
-
-	explicit WithDb(const int flags)
-	{
-		if (sqlite3_open_v2(s_dbPath.c_str(), &m_db, flags, nullptr) != SQLITE_OK)
-		{
-			SPDLOG_ERROR("AutoLogin Error failed to open database %s: %s", s_dbPath, sqlite3_errmsg(m_db));
-			sqlite3_close(m_db);
-			m_db = nullptr;
-		}
-		else
-		{
-			// pragmas don't need return values, just execute them
-			sqlite3_exec(m_db, "PRAGMA journal_mode = WAL", nullptr, nullptr, nullptr);
-			sqlite3_exec(m_db, "PRAGMA synchronous = normal", nullptr, nullptr, nullptr);
-			sqlite3_exec(m_db, "PRAGMA temp_store = memory", nullptr, nullptr, nullptr);
-			sqlite3_exec(m_db, "PRAGMA mmap_size = 100000000", nullptr, nullptr, nullptr);
-			sqlite3_exec(m_db, "PRAGMA foreign_keys = ON", nullptr, nullptr, nullptr);
-		}
-	}
-
-	~WithDb()
-	{
-		if (m_db != nullptr) sqlite3_close(m_db);
-	}
-
-	[[nodiscard]] sqlite3* GetDB() const { return m_db; }
-
-	template <typename T>
-	static T Query(const int flags, const std::string& query, const DoQuery<T>& action)
-	{
-		const auto connection = Get(flags);
-		return WithStatement<T>(connection->m_db, query).Execute(action);
-	}
-
-	WithDb(const WithDb&) = delete;
-	WithDb(WithDb&&) = delete;
-	WithDb& operator=(const WithDb&) = delete;
-	WithDb& operator=(WithDb&&) = delete;
-
-	static const std::shared_ptr<WithDb>& Get(int flags)
-	{
-		auto connection = s_connections.find(flags);
-		if (connection == s_connections.end())
-			connection = s_connections.emplace_hint(connection, flags, std::make_shared<WithDb>(flags));
-
-		return connection->second;
-	}
-
-	static void Close(int flags)
-	{
-		s_connections.erase(flags);
-	}
-
-private:
-	template <typename T>
-	class WithStatement
-	{
-	public:
-		WithStatement(sqlite3* db, const std::string& query) : m_db(db), m_stmt(nullptr)
-		{
-			if (sqlite3_prepare_v2(m_db, query.c_str(), -1, &m_stmt, nullptr) != SQLITE_OK)
-				SPDLOG_ERROR("{}", sqlite3_errmsg(m_db));
-		}
-
-		~WithStatement()
-		{
-			sqlite3_finalize(m_stmt);
-		}
-
-		T Execute(const DoQuery<T>& action) const
-		{
-			return action(m_stmt, m_db);
-		}
-
-		WithStatement(const WithStatement&) = delete;
-		WithStatement(WithStatement&&) = delete;
-		WithStatement& operator=(const WithStatement&) = delete;
-		WithStatement& operator=(WithStatement&&) = delete;
-
-	private:
-		sqlite3* m_db;
-		sqlite3_stmt* m_stmt;
-	};
-
-	sqlite3* m_db = nullptr;
-};
-
-login::db::StatementHelper::StatementHelper(
-	const std::shared_ptr<WithDb>& db,
-	const std::string& query,
-	const std::function<void(sqlite3_stmt*, sqlite3*)>& bind)
-	: m_db(db->GetDB())
-	, m_stmt(nullptr)
-{
-	sqlite3_prepare_v2(m_db, query.c_str(), -1, &m_stmt, nullptr);
-	bind(m_stmt, m_db);
-}
-
-login::db::StatementHelper::~StatementHelper()
-{
-	sqlite3_finalize(m_stmt);
-}
-
-bool login::db::StatementHelper::Step() const
-{
-	return sqlite3_step(m_stmt) != SQLITE_ROW;
-}
-
 static std::string XorEncryptDecrypt(const std::string_view str, const std::string_view key)
 {
 	std::string out(str);
@@ -542,7 +426,9 @@ struct HashParams
 
 int login::db::ReadDataVersion()
 {
-	return WithDb::Query<int>(SQLITE_OPEN_READONLY,
+	// data_version only changes for commits made by other connections, so this always asks the read
+	// connection, even while this thread has a write transaction open
+	return WithDb::Query<int>(WithDb::GetOwn(SQLITE_OPEN_READONLY),
 		"PRAGMA data_version",
 		[](sqlite3_stmt* stmt, sqlite3*)
 		{
@@ -2023,6 +1909,9 @@ std::vector<ProfileGroup> login::db::GetProfileGroups()
 {
 	std::vector<ProfileGroup> profile_groups;
 
+	// read all of the groups from the same snapshot
+	Transaction transaction(true);
+
 	auto groups = WithDb::Query<std::map<unsigned int, ProfileGroup>>(SQLITE_OPEN_READONLY,
 		R"(SELECT id, name, eq_path FROM profile_groups ORDER BY sort_order ASC)",
 		[](sqlite3_stmt* stmt, sqlite3* db)
@@ -2135,6 +2024,9 @@ login::db::Results<std::string> login::db::ListProfileGroupMatches(std::string_v
 
 void login::db::WriteProfileGroups(const std::vector<ProfileGroup>& groups, const std::string_view eq_path)
 {
+	// commit the whole import at once instead of one implicit transaction per row
+	Transaction transaction;
+
 	// all of these creates are upserts, we don't have to worry about testing for existence
 	for (auto& group : groups)
 	{
@@ -2524,20 +2416,20 @@ static bool MigrateVersion7Schema()
 // sqlite init concurrency should be solved by sqlite, if two processes try to create the db at the same time, one will lock
 bool login::db::InitDatabase(const std::string& path)
 {
-	s_dbPath = path;
+	SetDatabasePath(path);
 	sqlite3* db = nullptr;
 
 	// first check if the db exists, and if it doesn't then attempt to create it by loading from the ini
 	// we specifically don't want to do this if we have a db already, we assume that it's more recent
 	// than any ini
 	// no matter what happens here, we have to close the db to clear resources as per the sqlite API
-	const bool first_load = sqlite3_open_v2(s_dbPath.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK;
+	const bool first_load = sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK;
 	sqlite3_close(db);
 	db = nullptr;
 
 	// now create the db if it wasn't already present (!first_load means it's already been created)
 	// we're not actually going to use this db as we want to use WithDb to ensure pragmas are set
-	const bool db_ready = !first_load || sqlite3_open_v2(s_dbPath.c_str(), &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr) == SQLITE_OK;
+	const bool db_ready = !first_load || sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr) == SQLITE_OK;
 	if (db != nullptr)
 	{
 		// don't do anything if the second open call wasn't attempted
@@ -2613,8 +2505,3 @@ bool login::db::InitDatabase(const std::string& path)
 	return true;
 }
 
-void login::db::ShutdownDatabase()
-{
-	s_connections.clear();
-}
-
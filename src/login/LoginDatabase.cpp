@@ -0,0 +1,301 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "LoginDatabase.h"
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <thread>
+
+#include <spdlog/spdlog.h>
+
+#include "sqlite3.h"
+
+static std::string s_dbPath;
+
+// Connections are per thread, so that queries can be run from the database worker thread without
+// sharing a connection (and its cached statements) with the main thread.
+static thread_local std::map<int, std::shared_ptr<WithDb>> s_connections;
+
+void login::db::SetDatabasePath(const std::string& path)
+{
+	s_dbPath = path;
+}
+
+WithDb::WithDb(const int flags)
+{
+	if (sqlite3_open_v2(s_dbPath.c_str(), &m_db, flags, nullptr) != SQLITE_OK)
+	{
+		SPDLOG_ERROR("AutoLogin Error failed to open database {}: {}", s_dbPath, sqlite3_errmsg(m_db));
+		sqlite3_close(m_db);
+		m_db = nullptr;
+	}
+	else
+	{
+		// pragmas don't need return values, just execute them
+		sqlite3_exec(m_db, "PRAGMA journal_mode = WAL", nullptr, nullptr, nullptr);
+		sqlite3_exec(m_db, "PRAGMA synchronous = normal", nullptr, nullptr, nullptr);
+		sqlite3_exec(m_db, "PRAGMA temp_store = memory", nullptr, nullptr, nullptr);
+		sqlite3_exec(m_db, "PRAGMA mmap_size = 100000000", nullptr, nullptr, nullptr);
+		sqlite3_exec(m_db, "PRAGMA foreign_keys = ON", nullptr, nullptr, nullptr);
+	}
+}
+
+WithDb::~WithDb()
+{
+	for (auto& [_, statement] : m_statements)
+		sqlite3_finalize(statement.stmt);
+	m_statements.clear();
+
+	if (m_db != nullptr) sqlite3_close(m_db);
+}
+
+const std::shared_ptr<WithDb>& WithDb::Get(int flags)
+{
+	if (flags == SQLITE_OPEN_READONLY)
+	{
+		auto writer = s_connections.find(SQLITE_OPEN_READWRITE);
+		if (writer != s_connections.end() && writer->second->InTransaction())
+			return writer->second;
+	}
+
+	return GetOwn(flags);
+}
+
+const std::shared_ptr<WithDb>& WithDb::GetOwn(int flags)
+{
+	auto connection = s_connections.find(flags);
+	if (connection == s_connections.end())
+		connection = s_connections.emplace_hint(connection, flags, std::make_shared<WithDb>(flags));
+
+	return connection->second;
+}
+
+void WithDb::Close(int flags)
+{
+	s_connections.erase(flags);
+}
+
+void WithDb::CloseAll()
+{
+	s_connections.clear();
+}
+
+sqlite3_stmt* WithDb::AcquireStatement(const std::string& query)
+{
+	auto iter = m_statements.find(query);
+	if (iter != m_statements.end() && !iter->second.inUse)
+	{
+		iter->second.inUse = true;
+		return iter->second.stmt;
+	}
+
+	sqlite3_stmt* stmt = nullptr;
+	if (sqlite3_prepare_v2(m_db, query.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+	{
+		SPDLOG_ERROR("{}", sqlite3_errmsg(m_db));
+		sqlite3_finalize(stmt);
+		return nullptr;
+	}
+
+	if (stmt != nullptr && iter == m_statements.end())
+		m_statements.emplace(query, CachedStatement{ stmt, true });
+
+	return stmt;
+}
+
+void WithDb::ReleaseStatement(const std::string& query, sqlite3_stmt* stmt)
+{
+	if (stmt == nullptr)
+		return;
+
+	auto iter = m_statements.find(query);
+	if (iter != m_statements.end() && iter->second.stmt == stmt)
+	{
+		sqlite3_reset(stmt);
+		sqlite3_clear_bindings(stmt);
+		iter->second.inUse = false;
+	}
+	else
+	{
+		sqlite3_finalize(stmt);
+	}
+}
+
+void WithDb::BeginTransaction(bool readOnly)
+{
+	std::scoped_lock lock(m_mutex);
+
+	if (m_transactionDepth++ > 0)
+		return;
+
+	m_rollbackOnly = false;
+
+	char* err_msg = nullptr;
+	m_transactionActive = sqlite3_exec(m_db,
+		readOnly ? "BEGIN DEFERRED TRANSACTION" : "BEGIN IMMEDIATE TRANSACTION",
+		nullptr, nullptr, &err_msg) == SQLITE_OK;
+
+	if (!m_transactionActive)
+	{
+		SPDLOG_ERROR("AutoLogin Error failed to begin transaction: {}", err_msg ? err_msg : "no database");
+		sqlite3_free(err_msg);
+	}
+}
+
+void WithDb::EndTransaction(bool rollback)
+{
+	std::scoped_lock lock(m_mutex);
+
+	if (rollback)
+		m_rollbackOnly = true;
+
+	if (m_transactionDepth == 0 || --m_transactionDepth > 0 || !m_transactionActive)
+		return;
+
+	m_transactionActive = false;
+
+	const char* statement = m_rollbackOnly ? "ROLLBACK TRANSACTION" : "COMMIT TRANSACTION";
+	char* err_msg = nullptr;
+	if (sqlite3_exec(m_db, statement, nullptr, nullptr, &err_msg) != SQLITE_OK)
+	{
+		SPDLOG_ERROR("AutoLogin Error failed to end transaction ({}): {}", statement, err_msg ? err_msg : "no database");
+		sqlite3_free(err_msg);
+	}
+}
+
+bool WithDb::InTransaction()
+{
+	std::scoped_lock lock(m_mutex);
+	return m_transactionDepth > 0;
+}
+
+login::db::StatementHelper::StatementHelper(
+	const std::shared_ptr<WithDb>& db,
+	const std::string& query,
+	const std::function<void(sqlite3_stmt*, sqlite3*)>& bind)
+	: m_connection(db)
+	, m_query(query)
+	, m_db(db->GetDB())
+	, m_stmt(db->AcquireStatement(query))
+{
+	bind(m_stmt, m_db);
+}
+
+login::db::StatementHelper::~StatementHelper()
+{
+	m_connection->ReleaseStatement(m_query, m_stmt);
+}
+
+bool login::db::StatementHelper::Step() const
+{
+	return sqlite3_step(m_stmt) != SQLITE_ROW;
+}
+
+login::db::Transaction::Transaction(bool readOnly)
+	: m_connection(WithDb::Get(readOnly ? SQLITE_OPEN_READONLY : SQLITE_OPEN_READWRITE))
+{
+	m_connection->BeginTransaction(readOnly);
+}
+
+login::db::Transaction::~Transaction()
+{
+	Commit();
+}
+
+void login::db::Transaction::Commit()
+{
+	End(false);
+}
+
+void login::db::Transaction::Rollback()
+{
+	End(true);
+}
+
+void login::db::Transaction::End(bool rollback)
+{
+	if (m_ended)
+		return;
+
+	m_ended = true;
+	m_connection->EndTransaction(rollback);
+}
+
+// A single worker thread for database work that shouldn't block the caller. It is started on
+// first use and stopped by ShutdownDatabase.
+static std::mutex s_workMutex;
+static std::condition_variable s_workCondition;
+static std::deque<std::function<void()>> s_workQueue;
+static std::thread s_workThread;
+static bool s_workStop = false;
+
+static void DatabaseWorker()
+{
+	while (true)
+	{
+		std::function<void()> work;
+		{
+			std::unique_lock lock(s_workMutex);
+			s_workCondition.wait(lock, [] { return s_workStop || !s_workQueue.empty(); });
+
+			if (s_workQueue.empty())
+				break;
+
+			work = std::move(s_workQueue.front());
+			s_workQueue.pop_front();
+		}
+
+		work();
+	}
+
+	// release this thread's connections before the thread goes away
+	s_connections.clear();
+}
+
+void login::db::QueueWork(std::function<void()>&& work)
+{
+	{
+		std::scoped_lock lock(s_workMutex);
+		if (!s_workThread.joinable())
+		{
+			s_workStop = false;
+			s_workThread = std::thread(DatabaseWorker);
+		}
+
+		s_workQueue.push_back(std::move(work));
+	}
+
+	s_workCondition.notify_one();
+}
+
+static void StopDatabaseWorker()
+{
+	{
+		std::scoped_lock lock(s_workMutex);
+		s_workStop = true;
+	}
+
+	s_workCondition.notify_one();
+
+	if (s_workThread.joinable())
+		s_workThread.join();
+}
+
+void login::db::ShutdownDatabase()
+{
+	StopDatabaseWorker();
+	s_connections.clear();
+}
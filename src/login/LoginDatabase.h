@@ -0,0 +1,295 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// The sqlite connection layer under the login database: per thread connections with their cached
+// statements, transactions, and the database worker thread. It only depends on sqlite, so it can be
+// built and tested on its own (see src/tests/LoginDatabaseTests).
+
+#pragma once
+
+#include <cassert>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+class WithDb
+{
+public:
+	template <typename T>
+	using DoQuery = std::function<T(sqlite3_stmt*, sqlite3*)>;
+
+	explicit WithDb(int flags);
+	~WithDb();
+
+	[[nodiscard]] sqlite3* GetDB() const { return m_db; }
+
+	template <typename T>
+	static T Query(const int flags, const std::string& query, const DoQuery<T>& action)
+	{
+		return Query<T>(Get(flags), query, action);
+	}
+
+	template <typename T>
+	static T Query(const std::shared_ptr<WithDb>& connection, const std::string& query, const DoQuery<T>& action)
+	{
+		return WithStatement<T>(*connection, query).Execute(action);
+	}
+
+	WithDb(const WithDb&) = delete;
+	WithDb(WithDb&&) = delete;
+	WithDb& operator=(const WithDb&) = delete;
+	WithDb& operator=(WithDb&&) = delete;
+
+	// Returns this thread's connection for the given flags. Reads made while a write transaction is
+	// open on this thread go through the writing connection instead, so that they see the rows the
+	// transaction has written but not yet committed.
+	static const std::shared_ptr<WithDb>& Get(int flags);
+
+	// Returns this thread's connection for the given flags, even if a transaction is open on another one.
+	static const std::shared_ptr<WithDb>& GetOwn(int flags);
+
+	static void Close(int flags);
+
+	// Closes every connection this thread has open.
+	static void CloseAll();
+
+	// Statements are prepared once per connection and then reused, keyed by their sql text. If the
+	// cached statement is already in use (a Results that is still being iterated, for example) then
+	// a new one is prepared for the nested use and finalized when it is released.
+	sqlite3_stmt* AcquireStatement(const std::string& query);
+	void ReleaseStatement(const std::string& query, sqlite3_stmt* stmt);
+
+	// Starts a transaction, or joins the one already open on this connection.
+	void BeginTransaction(bool readOnly);
+
+	// Leaves one level of transaction. A rollback at any level rolls back the whole transaction
+	// when the outermost level ends.
+	void EndTransaction(bool rollback);
+
+	bool InTransaction();
+
+private:
+	template <typename T>
+	class WithStatement
+	{
+	public:
+		WithStatement(WithDb& connection, const std::string& query)
+			: m_connection(connection)
+			, m_query(query)
+			, m_stmt(connection.AcquireStatement(query))
+		{
+		}
+
+		~WithStatement()
+		{
+			m_connection.ReleaseStatement(m_query, m_stmt);
+		}
+
+		T Execute(const DoQuery<T>& action) const
+		{
+			return action(m_stmt, m_connection.m_db);
+		}
+
+		WithStatement(const WithStatement&) = delete;
+		WithStatement(WithStatement&&) = delete;
+		WithStatement& operator=(const WithStatement&) = delete;
+		WithStatement& operator=(WithStatement&&) = delete;
+
+	private:
+		WithDb& m_connection;
+		std::string m_query;
+		sqlite3_stmt* m_stmt;
+	};
+
+	struct CachedStatement
+	{
+		sqlite3_stmt* stmt;
+		bool inUse;
+	};
+
+	sqlite3* m_db = nullptr;
+	std::unordered_map<std::string, CachedStatement> m_statements;
+
+	// transaction nesting on this connection
+	std::mutex m_mutex;
+	int m_transactionDepth = 0;
+	bool m_transactionActive = false;
+	bool m_rollbackOnly = false;
+};
+
+namespace login::db {
+
+// Sets the file that connections opened from now on use.
+void SetDatabasePath(const std::string& path);
+
+class StatementHelper
+{
+public:
+	StatementHelper(
+		const std::shared_ptr<WithDb>& db,
+		const std::string& query,
+		const std::function<void(sqlite3_stmt*, sqlite3*)>& bind);
+	~StatementHelper();
+
+	[[nodiscard]] bool Step() const;
+
+	template <typename T>
+	T Result(const std::function<T(sqlite3_stmt*, sqlite3*)>& result) const { return result(m_stmt, m_db); }
+
+	StatementHelper(const StatementHelper&) = delete;
+	StatementHelper(StatementHelper&&) = delete;
+	StatementHelper& operator=(const StatementHelper&) = delete;
+	StatementHelper& operator=(StatementHelper&&) = delete;
+
+private:
+	std::shared_ptr<WithDb> m_connection;
+	std::string m_query;
+	sqlite3* m_db;
+	sqlite3_stmt* m_stmt;
+};
+
+// Groups the queries made on this thread's connection into a single transaction, which is committed
+// when the Transaction goes out of scope. Nested transactions are folded into the outermost one:
+// committing a nested transaction only leaves it, and rolling one back makes the outermost one roll
+// back when it ends. While a write transaction is open, this thread's reads go through its connection.
+class Transaction
+{
+public:
+	explicit Transaction(bool readOnly = false);
+	~Transaction();
+
+	void Commit();
+	void Rollback();
+
+	Transaction(const Transaction&) = delete;
+	Transaction(Transaction&&) = delete;
+	Transaction& operator=(const Transaction&) = delete;
+	Transaction& operator=(Transaction&&) = delete;
+
+private:
+	void End(bool rollback);
+
+	std::shared_ptr<WithDb> m_connection;
+	bool m_ended = false;
+};
+
+// Runs work on the database worker thread. The worker has its own connections, so any of the
+// login::db functions can be used from it. Callers are responsible for any state they share with it.
+void QueueWork(std::function<void()>&& work);
+
+template <typename Func>
+auto RunAsync(Func&& func) -> std::future<std::invoke_result_t<Func>>
+{
+	auto task = std::make_shared<std::packaged_task<std::invoke_result_t<Func>()>>(std::forward<Func>(func));
+	auto future = task->get_future();
+
+	QueueWork([task] { (*task)(); });
+	return future;
+}
+
+// Stops the database worker thread and closes this thread's connections.
+void ShutdownDatabase();
+
+template <typename T>
+class Results
+{
+public:
+	using Type = T;
+
+	class Iterator
+	{
+	public:
+		using iterator_category = std::input_iterator_tag;
+		using difference_type = std::ptrdiff_t;
+		using value_type = T const;
+		using pointer = T const* const;
+		using reference = T const&;
+
+		explicit Iterator(Results const* results)
+			: m_done(false)
+			, m_results(results)
+		{
+			m_done = m_results->m_stmt.Step();
+			if (!m_done)
+				m_current = m_results->m_stmt.Result(m_results->m_result);
+		}
+
+		explicit operator bool() const { return !m_done; }
+
+		reference operator*() const { return m_current; }
+		pointer operator->() const { return &m_current; }
+
+		Iterator& operator++()
+		{
+			assert(!m_done);
+
+			m_done = m_results->m_stmt.Step();
+			if (!m_done)
+				m_current = m_results->m_stmt.Result(m_results->m_result);
+
+			return *this;
+		}
+
+		friend bool operator==(Iterator l, Iterator r) { return l.m_current == r.m_current; }
+		friend bool operator!=(Iterator l, Iterator r) { return !(l == r); }
+
+		class Sentinel {};
+		friend bool operator==(Iterator it, Sentinel) { return it.m_done; }
+		friend bool operator!=(Iterator it, Sentinel) { return !(it == Sentinel{}); }
+		friend bool operator==(Sentinel, Iterator it) { return it == Sentinel{}; }
+		friend bool operator!=(Sentinel, Iterator it) { return it != Sentinel{}; }
+
+	private:
+		bool m_done;
+		T m_current;
+		Results const* m_results;
+	};
+
+	Results(
+		const std::shared_ptr<WithDb>& db,
+		const std::string& query,
+		const std::function<void(sqlite3_stmt*, sqlite3*)>& bind,
+		const std::function<T(sqlite3_stmt*, sqlite3*)>& result)
+		: m_db(db)
+		, m_stmt(db, query, bind)
+		, m_result(result)
+	{}
+
+	[[nodiscard]] Iterator begin() const { return Iterator(this); }
+	[[nodiscard]] typename Iterator::Sentinel end() const { return typename Iterator::Sentinel(); }
+
+	[[nodiscard]] std::vector<T> vector() const
+	{
+		std::vector<T> vec; // we don't know the size, so we can't reserve
+		for (auto t : *this)
+			vec.emplace_back(std::move(t));
+		return vec;
+	}
+
+private:
+	std::shared_ptr<WithDb> m_db;
+	StatementHelper m_stmt;
+	std::function<T(sqlite3_stmt*, sqlite3*)> m_result;
+};
+
+} // namespace login::db
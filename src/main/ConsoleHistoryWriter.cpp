@@ -0,0 +1,177 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "ConsoleHistoryWriter.h"
+
+#include <fmt/format.h>
+
+#include <iterator>
+
+#include "sqlite3.h"
+
+namespace mq {
+
+ConsoleHistoryWriter::ConsoleHistoryWriter(sqlite3* db, int process_id, int max_entries,
+	TimestampFunc timestamp, ErrorFunc error)
+	: m_db(db)
+	, m_processId(process_id)
+	, m_maxEntries(max_entries)
+	, m_timestamp(std::move(timestamp))
+	, m_error(std::move(error))
+{
+	const char* query = "INSERT INTO entries (entry_timestamp, pid, command) VALUES (?, ?, ?);";
+	if (sqlite3_prepare_v2(m_db, query, -1, &m_insertStmt, nullptr) != SQLITE_OK)
+	{
+		ReportError("preparing query for console buffer insertion");
+		return;
+	}
+
+	m_thread = std::thread([this] { Run(); });
+}
+
+ConsoleHistoryWriter::~ConsoleHistoryWriter()
+{
+	{
+		std::scoped_lock lock(m_mutex);
+		m_stop = true;
+	}
+
+	m_condition.notify_one();
+
+	if (m_thread.joinable())
+		m_thread.join();
+
+	sqlite3_finalize(m_insertStmt);
+}
+
+void ConsoleHistoryWriter::AddEntry(std::string_view entry)
+{
+	// Capture the timestamp now so that entries keep the time they were entered, not the time
+	// that they were written.
+	Entry newEntry;
+	newEntry.timestamp = m_timestamp();
+	newEntry.command = entry;
+
+	{
+		std::scoped_lock lock(m_mutex);
+
+		if (m_queue.size() >= MaxQueueSize)
+		{
+			++m_dropped;
+			return;
+		}
+
+		m_queue.push_back(std::move(newEntry));
+		if (m_queue.size() < BatchSize)
+			return;
+	}
+
+	m_condition.notify_one();
+}
+
+void ConsoleHistoryWriter::Run()
+{
+	// trim anything left over from previous sessions before we start adding to it
+	TrimEntries();
+
+	std::vector<Entry> batch;
+	batch.reserve(BatchSize);
+
+	while (true)
+	{
+		{
+			std::unique_lock lock(m_mutex);
+			m_condition.wait_for(lock, FlushInterval, [this] { return m_stop || m_queue.size() >= BatchSize; });
+
+			std::move(m_queue.begin(), m_queue.end(), std::back_inserter(batch));
+			m_queue.clear();
+		}
+
+		if (!batch.empty())
+		{
+			WriteBatch(batch);
+			batch.clear();
+		}
+
+		if (m_sinceTrim >= TrimInterval)
+			TrimEntries();
+
+		std::scoped_lock lock(m_mutex);
+		if (m_stop && m_queue.empty())
+			break;
+	}
+}
+
+void ConsoleHistoryWriter::WriteBatch(const std::vector<Entry>& batch)
+{
+	sqlite3_exec(m_db, "BEGIN TRANSACTION", nullptr, nullptr, nullptr);
+
+	for (const Entry& entry : batch)
+	{
+		sqlite3_bind_text(m_insertStmt, 1, entry.timestamp.c_str(), static_cast<int>(entry.timestamp.length()), SQLITE_STATIC);
+		sqlite3_bind_int(m_insertStmt, 2, m_processId);
+		sqlite3_bind_text(m_insertStmt, 3, entry.command.c_str(), static_cast<int>(entry.command.length()), SQLITE_STATIC);
+
+		if (sqlite3_step(m_insertStmt) != SQLITE_DONE)
+		{
+			ReportError("inserting into console buffer");
+		}
+
+		sqlite3_reset(m_insertStmt);
+	}
+
+	sqlite3_clear_bindings(m_insertStmt);
+
+	if (sqlite3_exec(m_db, "COMMIT TRANSACTION", nullptr, nullptr, nullptr) != SQLITE_OK)
+	{
+		ReportError("committing console buffer entries");
+		sqlite3_exec(m_db, "ROLLBACK TRANSACTION", nullptr, nullptr, nullptr);
+		return;
+	}
+
+	m_written += batch.size();
+	m_sinceTrim += static_cast<int>(batch.size());
+}
+
+void ConsoleHistoryWriter::TrimEntries()
+{
+	m_sinceTrim = 0;
+
+	if (m_maxEntries <= 0)
+		return;
+
+	sqlite3_stmt* stmt;
+	const char* query = "DELETE FROM entries WHERE rowid <= (SELECT rowid FROM entries ORDER BY rowid DESC LIMIT 1 OFFSET ?);";
+	if (sqlite3_prepare_v2(m_db, query, -1, &stmt, nullptr) != SQLITE_OK)
+	{
+		ReportError("preparing query for console buffer trim");
+		return;
+	}
+
+	sqlite3_bind_int(stmt, 1, m_maxEntries);
+	if (sqlite3_step(stmt) != SQLITE_DONE)
+	{
+		ReportError("trimming console buffer");
+	}
+
+	sqlite3_finalize(stmt);
+}
+
+void ConsoleHistoryWriter::ReportError(std::string_view context)
+{
+	if (m_error)
+		m_error(fmt::format("MQ Console Error {}: {}", context, sqlite3_errmsg(m_db)));
+}
+
+} // namespace mq
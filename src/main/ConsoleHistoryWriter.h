@@ -0,0 +1,104 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+namespace mq {
+
+//============================================================================
+
+// Writes console command history to the database from a background thread. Entries are queued
+// from the main thread and written in batches using a single prepared statement, one transaction
+// per batch. The queue is bounded: if the writer falls behind, new entries are dropped and counted.
+//
+// The table is expected to be entries (entry_timestamp TEXT, pid INTEGER, command TEXT).
+class ConsoleHistoryWriter
+{
+public:
+	static constexpr size_t MaxQueueSize = 1024;
+	static constexpr size_t BatchSize = 64;
+	static constexpr std::chrono::milliseconds FlushInterval{ 1000 };
+	static constexpr int TrimInterval = 256;
+
+	// Returns the timestamp stored with an entry, called when the entry is added.
+	using TimestampFunc = std::function<std::string()>;
+
+	// Reports a database error. This is called from the writer thread.
+	using ErrorFunc = std::function<void(std::string_view)>;
+
+	// max_entries is the number of rows kept in the table, 0 or less keeps every row. If the insert
+	// statement can't be prepared, the error is reported and no writer thread is started.
+	ConsoleHistoryWriter(sqlite3* db, int process_id, int max_entries,
+		TimestampFunc timestamp, ErrorFunc error);
+
+	// Writes any queued entries before returning. The database must stay open until then.
+	~ConsoleHistoryWriter();
+
+	ConsoleHistoryWriter(const ConsoleHistoryWriter&) = delete;
+	ConsoleHistoryWriter& operator=(const ConsoleHistoryWriter&) = delete;
+
+	void AddEntry(std::string_view entry);
+
+	uint64_t GetDroppedCount() const { return m_dropped; }
+	uint64_t GetWrittenCount() const { return m_written; }
+
+private:
+	struct Entry
+	{
+		std::string timestamp;
+		std::string command;
+	};
+
+	void Run();
+	void WriteBatch(const std::vector<Entry>& batch);
+
+	// Keep only the most recent m_maxEntries rows, removing the older ones in a single statement.
+	void TrimEntries();
+
+	void ReportError(std::string_view context);
+
+	sqlite3* m_db;
+	sqlite3_stmt* m_insertStmt = nullptr;
+	int m_processId;
+	int m_maxEntries;
+	int m_sinceTrim = 0;
+	TimestampFunc m_timestamp;
+	ErrorFunc m_error;
+
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	std::deque<Entry> m_queue;
+	bool m_stop = false;
+
+	std::atomic<uint64_t> m_dropped = 0;
+	std::atomic<uint64_t> m_written = 0;
+};
+
+} // namespace mq
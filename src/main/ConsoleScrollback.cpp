@@ -0,0 +1,165 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "ConsoleScrollback.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+
+namespace mq {
+
+//============================================================================
+
+static bool ContainsNoCase(std::string_view haystack, std::string_view needle)
+{
+	auto iter = std::search(haystack.begin(), haystack.end(), needle.begin(), needle.end(),
+		[](char a, char b)
+		{
+			return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+		});
+
+	return iter != haystack.end();
+}
+
+//============================================================================
+
+ConsoleScrollback::ConsoleScrollback(size_t maxLines)
+	: m_maxLines(std::max<size_t>(maxLines, 1))
+{
+}
+
+ConsoleScrollback::~ConsoleScrollback()
+{
+	if (m_searchCancel)
+		*m_searchCancel = true;
+
+	if (m_search.valid())
+		m_search.wait();
+}
+
+void ConsoleScrollback::Append(ConsoleLine line)
+{
+	if (m_segments.empty() || m_segments.back()->size() == SegmentSize)
+	{
+		auto segment = std::make_shared<Segment>();
+		segment->reserve(SegmentSize);
+		m_segments.push_back(std::move(segment));
+	}
+
+	m_segments.back()->push_back(std::move(line));
+	++m_lineCount;
+
+	Trim();
+}
+
+void ConsoleScrollback::Clear()
+{
+	// A search that is running keeps its own references to the segments.
+	m_firstLineNumber += m_lineCount;
+	m_segments.clear();
+	m_lineCount = 0;
+}
+
+void ConsoleScrollback::SetMaxLines(size_t maxLines)
+{
+	m_maxLines = std::max<size_t>(maxLines, 1);
+	Trim();
+}
+
+const ConsoleLine& ConsoleScrollback::GetLine(size_t index) const
+{
+	// Every segment but the last is full
+	return (*m_segments[index / SegmentSize])[index % SegmentSize];
+}
+
+void ConsoleScrollback::Trim()
+{
+	while (!m_segments.empty() && m_lineCount - m_segments.front()->size() >= m_maxLines)
+	{
+		m_lineCount -= m_segments.front()->size();
+		m_firstLineNumber += m_segments.front()->size();
+		m_segments.pop_front();
+	}
+}
+
+void ConsoleScrollback::StartSearch(std::string needle, size_t maxResults)
+{
+	if (m_searchCancel)
+		*m_searchCancel = true;
+
+	// Full segments are shared with the search as they are. The last one is still being added
+	// to, so the search gets its own copy of it.
+	std::vector<std::shared_ptr<const Segment>> segments(m_segments.begin(), m_segments.end());
+	if (!segments.empty() && segments.back()->size() < SegmentSize)
+		segments.back() = std::make_shared<const Segment>(*segments.back());
+
+	auto cancel = std::make_shared<std::atomic<bool>>(false);
+	m_searchCancel = cancel;
+
+	m_search = std::async(std::launch::async,
+		[segments = std::move(segments), needle = std::move(needle), maxResults, firstLine = m_firstLineNumber, cancel]()
+		{
+			auto start = std::chrono::steady_clock::now();
+
+			ConsoleSearchResults results;
+			results.needle = needle;
+
+			std::deque<ConsoleSearchResult> matches;
+			uint64_t lineNumber = firstLine;
+
+			for (const auto& segment : segments)
+			{
+				if (*cancel)
+					break;
+
+				for (const ConsoleLine& line : *segment)
+				{
+					if (ContainsNoCase(line.text, needle))
+					{
+						++results.totalMatches;
+						matches.push_back({ lineNumber, line.text });
+
+						if (matches.size() > maxResults)
+							matches.pop_front();
+					}
+
+					++lineNumber;
+				}
+
+				results.linesSearched += segment->size();
+			}
+
+			results.matches.assign(std::make_move_iterator(matches.begin()), std::make_move_iterator(matches.end()));
+			results.elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			return results;
+		});
+}
+
+bool ConsoleScrollback::IsSearching() const
+{
+	return m_search.valid() && m_search.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+}
+
+std::optional<ConsoleSearchResults> ConsoleScrollback::TakeSearchResults()
+{
+	if (!m_search.valid() || IsSearching())
+		return std::nullopt;
+
+	return m_search.get();
+}
+
+//============================================================================
+
+} // namespace mq
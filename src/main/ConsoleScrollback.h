@@ -0,0 +1,115 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mq {
+
+//============================================================================
+
+// A run of console text in a single color. Offsets are into ConsoleLine::text.
+struct ConsoleColorSpan
+{
+	uint32_t start = 0;
+	uint32_t length = 0;
+	uint32_t color = 0;
+};
+
+// A line of console output with its color codes already parsed out.
+struct ConsoleLine
+{
+	std::string text;
+	std::vector<ConsoleColorSpan> spans;
+	bool newline = false;
+};
+
+struct ConsoleSearchResult
+{
+	uint64_t lineNumber = 0;      // number of the line since the scrollback was created
+	std::string text;
+};
+
+struct ConsoleSearchResults
+{
+	std::string needle;
+	std::vector<ConsoleSearchResult> matches;   // oldest first
+	size_t totalMatches = 0;
+	size_t linesSearched = 0;
+	double elapsedMs = 0;
+};
+
+// Console output history, kept in fixed size segments. Old lines are trimmed a whole segment at
+// a time, so trimming never moves the lines that are kept. Full segments are never modified
+// again, which lets a search run over them on another thread while new lines keep arriving.
+class ConsoleScrollback
+{
+public:
+	static constexpr size_t SegmentSize = 1024;
+
+	explicit ConsoleScrollback(size_t maxLines);
+	~ConsoleScrollback();
+
+	ConsoleScrollback(const ConsoleScrollback&) = delete;
+	ConsoleScrollback& operator=(const ConsoleScrollback&) = delete;
+
+	void Append(ConsoleLine line);
+	void Clear();
+
+	// At least maxLines are kept, and at most one segment more.
+	void SetMaxLines(size_t maxLines);
+	size_t GetMaxLines() const { return m_maxLines; }
+
+	size_t GetLineCount() const { return m_lineCount; }
+
+	// Lines are indexed oldest first
+	const ConsoleLine& GetLine(size_t index) const;
+
+	// Number of the oldest line that is still kept. Line numbers keep counting up across trims.
+	uint64_t GetFirstLineNumber() const { return m_firstLineNumber; }
+
+	// Starts a case insensitive search over the scrollback as it is now. Any search already
+	// running is abandoned. At most maxResults of the newest matches are kept.
+	void StartSearch(std::string needle, size_t maxResults);
+	bool IsSearching() const;
+
+	// Returns the results once the search has finished.
+	std::optional<ConsoleSearchResults> TakeSearchResults();
+
+private:
+	using Segment = std::vector<ConsoleLine>;
+
+	void Trim();
+
+	std::deque<std::shared_ptr<Segment>> m_segments;
+	size_t m_maxLines;
+	size_t m_lineCount = 0;
+	uint64_t m_firstLineNumber = 0;
+
+	std::future<ConsoleSearchResults> m_search;
+	std::shared_ptr<std::atomic<bool>> m_searchCancel;
+};
+
+//============================================================================
+
+} // namespace mq
@@ -1429,8 +1429,8 @@ void ImGuiManager_Initialize()
 
 	// TODO: application-wide keybinds could use an encapsulated interface. For now I'm just dumping his here since we need it to
 	// connect to the win32 hook and control the imgui console.
-	::GetPrivateProfileStringA("MacroQuest", "ToggleConsoleKey", gToggleConsoleDefaultBind,
-		gToggleConsoleHotkey.keybind, static_cast<DWORD>(lengthof(gToggleConsoleHotkey.keybind)), mq::internal_paths::MQini.c_str());
+	GetPrivateProfileString("MacroQuest", "ToggleConsoleKey", gToggleConsoleDefaultBind,
+		gToggleConsoleHotkey.keybind, lengthof(gToggleConsoleHotkey.keybind), mq::internal_paths::MQini.c_str());
 
 	if (!gbToggleConsoleHotkeyReady)
 	{
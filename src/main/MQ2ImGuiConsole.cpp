@@ -14,6 +14,8 @@
 
 #include "pch.h"
 
+#include "ConsoleHistoryWriter.h"
+#include "ConsoleScrollback.h"
 #include "MQ2DeveloperTools.h"
 #include "MQ2ImGuiTools.h"
 #include "MQ2Utilities.h"
@@ -74,6 +76,9 @@ static bool s_consoleVisibleOnStartup = false;
 static bool s_resetConsolePosition = false;
 static bool s_setFocus = false;
 static bool s_consolePersistentCommandHistory = false;
+static int s_consoleHistoryMaxEntries = 10000;
+static int s_consoleScrollbackLines = 100000;
+static constexpr size_t s_consoleSearchMaxResults = 25;
 
 class ImGuiConsole;
 ImGuiConsole* gImGuiConsole = nullptr;
@@ -245,6 +250,51 @@ static std::pair<std::string_view, ImU32> ParseColorTags(std::string_view line,
 	return { { pos, (size_t)(end - pos) }, color };
 }
 
+// Splits a line of console output into its text and the colors of each part. This is done once,
+// when the line arrives.
+static ConsoleLine ParseConsoleLine(std::string_view text, ImU32 defaultColor, bool newline)
+{
+	ConsoleLine line;
+	line.text.reserve(text.length());
+	line.newline = newline;
+
+	std::string_view lineView = text;
+	ImU32 currentColor = defaultColor;
+
+	std::vector<ImU32> colorStack;
+
+	while (!lineView.empty())
+	{
+		auto colorPos = lineView.find("\a");
+
+		// this is everything before the color code.
+		auto beforeColor = lineView.substr(0, colorPos);
+		if (!beforeColor.empty())
+		{
+			line.spans.push_back({ static_cast<uint32_t>(line.text.length()), static_cast<uint32_t>(beforeColor.length()), currentColor });
+			line.text.append(beforeColor);
+		}
+
+		// did we find a color?
+		if (colorPos == std::string_view::npos)
+			break;
+
+		lineView = lineView.substr(colorPos);
+
+		// Parse the color and get the next segment. We pass in the
+		// default color to handle \ax properly
+		auto [nextSegment, nextColor] = ParseColorTags(lineView, colorStack, defaultColor);
+
+		if (nextSegment.empty())
+			break;
+
+		currentColor = nextColor;
+		lineView = nextSegment;
+	}
+
+	return line;
+}
+
 //============================================================================
 
 #pragma region Zep Integration
@@ -453,7 +503,7 @@ public:
 				m_syntax.erase(m_syntax.begin() + spBufferMsg->startLocation.Index(),
 					m_syntax.begin() + spBufferMsg->endLocation.Index());
 
-				m_latestPosition -= (spBufferMsg->endLocation.Index() - spBufferMsg->endLocation.Index());
+				m_latestPosition -= (spBufferMsg->endLocation.Index() - spBufferMsg->startLocation.Index());
 			}
 			else if (spBufferMsg->type == Zep::BufferMessageType::TextAdded
 				|| spBufferMsg->type == Zep::BufferMessageType::Loaded)
@@ -604,6 +654,10 @@ struct ImGuiZepConsole : public mq::imgui::ConsoleWidget, public mq::imgui::ImGu
 	bool m_autoScroll = true;
 	std::string m_id;
 
+	// Everything that was written to the console. The editor buffer only holds the newest
+	// m_maxBufferLines of it. Only the main console keeps one, other widgets just have the buffer.
+	std::unique_ptr<ConsoleScrollback> m_scrollback;
+
 	ImGuiZepConsole(std::string_view id)
 		: m_id(std::string(id))
 	{
@@ -640,11 +694,25 @@ struct ImGuiZepConsole : public mq::imgui::ConsoleWidget, public mq::imgui::ImGu
 	void Clear() override
 	{
 		m_buffer->Clear();
+
+		if (m_scrollback)
+			m_scrollback->Clear();
 	}
 
 	Zep::ZepWindow* GetWindow() const { return m_window; }
 	Zep::ZepBuffer* GetBuffer() const { return m_buffer; }
 
+	void EnableScrollback(size_t maxLines)
+	{
+		if (m_scrollback)
+			m_scrollback->SetMaxLines(maxLines);
+		else
+			m_scrollback = std::make_unique<ConsoleScrollback>(maxLines);
+	}
+
+	// nullptr unless EnableScrollback was called
+	ConsoleScrollback* GetScrollback() const { return m_scrollback.get(); }
+
 	Zep::GlyphIterator InsertText(Zep::GlyphIterator position, std::string_view text, ImU32 color = -1)
 	{
 		if (color != -1)
@@ -768,43 +836,19 @@ struct ImGuiZepConsole : public mq::imgui::ConsoleWidget, public mq::imgui::ImGu
 		Zep::GlyphIterator cursor = m_window->GetBufferCursor();
 		bool cursorAtEnd = m_window->IsAtBottom();
 
-		std::string_view lineView = text;
-		ImU32 currentColor = defaultColor;
-
-		std::vector<ImU32> colorStack;
+		ConsoleLine line = ParseConsoleLine(text, defaultColor, newline);
 
-		while (!lineView.empty())
+		std::string_view lineText = line.text;
+		for (const ConsoleColorSpan& span : line.spans)
 		{
-			auto colorPos = lineView.find("\a");
-
-			// this is everything before the color code.
-			auto beforeColor = lineView.substr(0, colorPos);
-			if (!beforeColor.empty())
-			{
-				// no color codes, write out with current color
-				InsertFormattedText(m_buffer->End(), beforeColor, currentColor);
-			}
-
-			// did we find a color?
-			if (colorPos == std::string_view::npos)
-				break;
-
-			lineView = lineView.substr(colorPos);
-
-			auto& [nextSegment, nextColor] = ParseColorTags(lineView, colorStack, defaultColor);
-			// Parse the color and get the next segment. We pass in the
-			// default color to handle \ax properly
-
-			if (nextSegment.empty())
-				break;
-
-			currentColor = nextColor;
-			lineView = nextSegment;
+			InsertFormattedText(m_buffer->End(), lineText.substr(span.start, span.length), span.color);
 		}
 
 		if (newline)
 			InsertText(m_buffer->End(), "\n");
 
+		if (m_scrollback)
+			m_scrollback->Append(std::move(line));
 		PruneBuffer();
 
 		if (cursorAtEnd)
@@ -838,8 +882,12 @@ struct ImGuiZepConsole : public mq::imgui::ConsoleWidget, public mq::imgui::ImGu
 
 	void PruneBuffer()
 	{
+		// Deleting from the front of the buffer moves everything after it, so let a few lines
+		// pile up and remove them together instead of one line per append.
+		const int pruneSlack = std::clamp(m_maxBufferLines / 10, 16, static_cast<int>(ConsoleScrollback::SegmentSize));
+
 		int lineCount = m_buffer->GetLineCount();
-		if (lineCount > m_maxBufferLines + 1)
+		if (lineCount > m_maxBufferLines + 1 + pruneSlack)
 		{
 			int linesToDelete = lineCount - (m_maxBufferLines + 1);
 
@@ -1033,30 +1081,6 @@ std::vector<std::string> InitConsoleDatabase(sqlite3*& db, int process_id)
 	return history;
 }
 
-void AddEntryToDatabase(sqlite3* db, int process_id, const char* entry)
-{
-	if (db != nullptr)
-	{
-		const char* query = "INSERT INTO entries (entry_timestamp, pid, command) VALUES (strftime('%Y-%m-%d %H:%M:%f', 'now', 'localtime'), ?, ?);";
-		sqlite3_stmt* stmt;
-		if (sqlite3_prepare_v2(db, query, -1, &stmt, nullptr) != SQLITE_OK)
-		{
-			WriteChatf("MQ Console Error preparing query for console buffer insertion: %s", sqlite3_errmsg(db));
-		}
-		else
-		{
-			sqlite3_bind_int(stmt, 1, process_id);
-			sqlite3_bind_text(stmt, 2, entry, -1, SQLITE_STATIC);
-
-			if (sqlite3_step(stmt) != SQLITE_DONE)
-			{
-				WriteChatf("MQ Console Error inserting into console buffer: %s", sqlite3_errmsg(db));
-			}
-
-			sqlite3_finalize(stmt);
-		}
-	}
-}
 //============================================================================
 
 #pragma region ImGui Console
@@ -1068,6 +1092,7 @@ public:
 	ImVector<const char*> m_commands;
 	std::vector<std::string> m_history;
 	sqlite3* m_db = nullptr;
+	std::unique_ptr<ConsoleHistoryWriter> m_historyWriter;
 	int current_pid = GetCurrentProcessId();
 	int m_historyPos = -1;    // -1: new line, 0..History.Size-1 browsing history.
 	bool m_scrollToBottom = true;
@@ -1087,12 +1112,33 @@ public:
 
 		int maxBufferLines = GetPrivateProfileInt("Console", "MaxBufferLines", m_zepEditor->GetMaxBufferLines(), internal_paths::MQini);
 		m_zepEditor->SetMaxBufferLines(maxBufferLines);
+
+		s_consoleScrollbackLines = GetPrivateProfileInt("Console", "ScrollbackLines", s_consoleScrollbackLines, internal_paths::MQini);
+		m_zepEditor->EnableScrollback(std::max(s_consoleScrollbackLines, maxBufferLines));
+
 		m_history = InitConsoleDatabase(m_db, current_pid);
+		if (m_db != nullptr)
+		{
+			m_historyWriter = std::make_unique<ConsoleHistoryWriter>(m_db, current_pid, s_consoleHistoryMaxEntries,
+				[]
+				{
+					SYSTEMTIME time;
+					GetLocalTime(&time);
+
+					return fmt::format("{:04}-{:02}-{:02} {:02}:{:02}:{:02}.{:03}",
+						time.wYear, time.wMonth, time.wDay, time.wHour, time.wMinute, time.wSecond, time.wMilliseconds);
+				},
+				[](std::string_view message) { SPDLOG_ERROR("{}", message); });
+		}
 	}
 
 	~ImGuiConsole()
 	{
 		ClearLog();
+
+		// finish writing any queued history before the database is closed
+		m_historyWriter.reset();
+
 		if (m_db != nullptr)
 		{
 			sqlite3_close(m_db);
@@ -1124,6 +1170,33 @@ public:
 		m_zepEditor->AppendFormattedText(line, defaultColor, newline);
 	}
 
+	void SearchScrollback(std::string_view needle)
+	{
+		ConsoleScrollback* scrollback = m_zepEditor->GetScrollback();
+
+		AddLog(s_defaultColor, "Searching {} lines for \"{}\"...\n", scrollback->GetLineCount(), needle);
+		scrollback->StartSearch(std::string(needle), s_consoleSearchMaxResults);
+	}
+
+	// Searches run on a worker thread, this prints the results once one finishes.
+	void ProcessSearchResults()
+	{
+		std::optional<ConsoleSearchResults> results = m_zepEditor->GetScrollback()->TakeSearchResults();
+		if (!results)
+			return;
+
+		AddLog(s_defaultColor, "Found {} matches for \"{}\" in {} lines ({:.2f} ms)\n",
+			results->totalMatches, results->needle, results->linesSearched, results->elapsedMs);
+
+		if (results->matches.size() < results->totalMatches)
+			AddLog(s_defaultColor, "Showing the newest {}:\n", results->matches.size());
+
+		for (const ConsoleSearchResult& match : results->matches)
+		{
+			AddLog(s_defaultColor, "  {:>8}: {}\n", match.lineNumber, match.text);
+		}
+	}
+
 	void Draw(bool* pOpen)
 	{
 		ImGuiWindowFlags windowFlags = ImGuiWindowFlags_MenuBar;
@@ -1298,7 +1371,8 @@ public:
 			}
 		}
 		m_history.emplace_back(commandLine);
-		AddEntryToDatabase(m_db, current_pid, commandLine);
+		if (m_historyWriter)
+			m_historyWriter->AddEntry(commandLine);
 
 		// Process command
 		if (ci_equals(commandLine, "clear"))
@@ -1584,6 +1658,9 @@ void UpdateImGuiConsole()
 		}
 	}
 
+	if (gImGuiConsole)
+		gImGuiConsole->ProcessSearchResults();
+
 	if (s_consoleVisible)
 	{
 		if (s_setFocus)
@@ -1709,6 +1786,55 @@ void UpdateImGuiConsole()
 	}
 }
 
+// Measures the scrollback without the editor: adding lines, trimming them, reading the lines
+// a window would show, and searching all of it.
+static void ConsoleScrollbackBenchmark(int lineCount)
+{
+	using clock = std::chrono::steady_clock;
+	auto elapsedMs = [](clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+	};
+
+	ConsoleScrollback scrollback(lineCount);
+
+	// Half again as many lines as are kept, so that the last third of them are trimming.
+	const int appendCount = lineCount + lineCount / 2;
+
+	auto start = clock::now();
+	for (int i = 0; i < appendCount; ++i)
+	{
+		std::string text = fmt::format("\ayA goblin\ax hits \agYOU\ax for \ar{}\ax points of damage. ({})", i % 500, i);
+		scrollback.Append(ParseConsoleLine(text, s_defaultColor, true));
+	}
+	const double appendMs = elapsedMs(start);
+
+	// A window's worth of lines from all over the scrollback
+	constexpr int visibleLines = 60;
+	constexpr int windows = 1000;
+	size_t visibleBytes = 0;
+
+	start = clock::now();
+	for (int window = 0; window < windows; ++window)
+	{
+		size_t first = (static_cast<size_t>(window) * 7919) % (scrollback.GetLineCount() - std::min<size_t>(visibleLines, scrollback.GetLineCount()) + 1);
+		for (size_t index = first; index < first + visibleLines && index < scrollback.GetLineCount(); ++index)
+			visibleBytes += scrollback.GetLine(index).text.length();
+	}
+	const double visibleMs = elapsedMs(start);
+
+	scrollback.StartSearch("points of damage. (7", s_consoleSearchMaxResults);
+	std::optional<ConsoleSearchResults> results;
+	while (!(results = scrollback.TakeSearchResults()))
+		std::this_thread::yield();
+
+	WriteChatf("Console scrollback, \ay%d\ax lines: append \ag%.2f\ax ms (%.3f us/line), %d windows \ag%.3f\ax ms, search \ag%.2f\ax ms (%d matches)",
+		lineCount, appendMs, appendMs * 1000.0 / appendCount, windows, visibleMs, results->elapsedMs, static_cast<int>(results->totalMatches));
+
+	if (visibleBytes == 0)
+		WriteChatf("\arConsole scrollback benchmark read no lines.");
+}
+
 void MQConsoleCommand(SPAWNINFO* pChar, char* Line)
 {
 	char szCommand[MAX_STRING] = { 0 };
@@ -1740,8 +1866,39 @@ void MQConsoleCommand(SPAWNINFO* pChar, char* Line)
 		return;
 	}
 
+	if (ci_equals("search", szCommand))
+	{
+		std::string_view needle = trim(GetNextArg(Line));
+		if (needle.empty())
+		{
+			WriteChatf("Usage: /mqconsole search <text>");
+		}
+		else if (gImGuiConsole != nullptr)
+		{
+			gImGuiConsole->SearchScrollback(needle);
+		}
+
+		return;
+	}
+
+	if (ci_equals("benchmark", szCommand))
+	{
+		int lineCount = GetIntFromString(GetNextArg(Line), 0);
+		if (lineCount > 0)
+		{
+			ConsoleScrollbackBenchmark(std::clamp(lineCount, 100, 2000000));
+		}
+		else
+		{
+			for (int count : { 10000, 100000, 1000000 })
+				ConsoleScrollbackBenchmark(count);
+		}
+
+		return;
+	}
+
 	WriteChatf("Usage: /mqconsole [command]");
-	WriteChatf("  Commands: clear, toggle, show, hide");
+	WriteChatf("  Commands: clear, toggle, show, hide, search <text>, benchmark [lines]");
 }
 
 static void ConsoleSettings()
@@ -1762,6 +1919,28 @@ static void ConsoleSettings()
 	ImGui::SameLine();
 	mq::imgui::HelpMarker("This feature stores commands between sessions. Use at your own risk.");
 
+	if (s_consolePersistentCommandHistory)
+	{
+		if (ImGui::InputInt("Saved Command History Entries", &s_consoleHistoryMaxEntries))
+		{
+			s_consoleHistoryMaxEntries = std::max(s_consoleHistoryMaxEntries, 0);
+		}
+
+		// only save once the edit is finished, not for every keystroke
+		if (ImGui::IsItemDeactivatedAfterEdit())
+		{
+			WritePrivateProfileInt("Console", "PersistentCommandHistoryMaxEntries", s_consoleHistoryMaxEntries, mq::internal_paths::MQini);
+		}
+		ImGui::SameLine();
+		mq::imgui::HelpMarker("The number of commands to keep in the saved history. Older entries are removed, 0 keeps every entry. Takes effect the next time MacroQuest is loaded.");
+
+		if (gImGuiConsole != nullptr && gImGuiConsole->m_historyWriter)
+		{
+			ImGui::TextDisabled("Saved this session: %llu, dropped: %llu",
+				gImGuiConsole->m_historyWriter->GetWrittenCount(), gImGuiConsole->m_historyWriter->GetDroppedCount());
+		}
+	}
+
 	ImGui::NewLine();
 
 	if (gImGuiConsole != nullptr)
@@ -1778,6 +1957,18 @@ static void ConsoleSettings()
 		ImGui::SameLine();
 		mq::imgui::HelpMarker("Set the number of lines to keep in the scrollback buffer. Any lines above this amount will be deleted from the top of the buffer and won't be available for viewing in the console. Larger numbers here may cause performance issues like hitching or FPS slowdowns.");
 
+		ImGui::Text("Searchable History Lines");
+
+		if (ImGui::InputInt("##ScrollbackLinesEntry", &s_consoleScrollbackLines, 1000, 10000))
+		{
+			s_consoleScrollbackLines = std::max(s_consoleScrollbackLines, 0);
+			WritePrivateProfileInt("Console", "ScrollbackLines", s_consoleScrollbackLines, internal_paths::MQini);
+			gImGuiConsole->m_zepEditor->EnableScrollback(std::max(s_consoleScrollbackLines, maxBufferLines));
+		}
+
+		ImGui::SameLine();
+		mq::imgui::HelpMarker("Set the number of lines kept for /mqconsole search. This history is stored outside of the console window, so it can be much larger than the scrollback buffer without slowing it down.");
+
 		ImGui::NewLine();
 	}
 
@@ -1795,6 +1986,7 @@ void InitializeImGuiConsole()
 	s_consoleVisibleOnStartup = GetPrivateProfileBool("MacroQuest", "ShowMacroQuestConsole", false, mq::internal_paths::MQini);
 	s_consoleVisible = s_consoleVisibleOnStartup;
 	s_consolePersistentCommandHistory = GetPrivateProfileBool("Console", "PersistentCommandHistory", false, mq::internal_paths::MQini);
+	s_consoleHistoryMaxEntries = std::max(GetPrivateProfileInt("Console", "PersistentCommandHistoryMaxEntries", s_consoleHistoryMaxEntries, mq::internal_paths::MQini), 0);
 	if (gbWriteAllConfig)
 	{
 		WritePrivateProfileBool("MacroQuest", "ShowMacroQuestConsole", s_consoleVisibleOnStartup, mq::internal_paths::MQini);
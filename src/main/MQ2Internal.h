@@ -916,6 +916,12 @@ public:
 		postoffice::Dropbox*& dropbox,
 		const MQPluginHandle& pluginHandle) override;
 
+	void SubscribeActor(
+		postoffice::Dropbox* dropbox,
+		const std::string& topic,
+		bool subscribe,
+		const MQPluginHandle& pluginHandle) override;
+
 	// Commands
 	bool AddCommand(
 		std::string_view command,
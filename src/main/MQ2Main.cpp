@@ -1238,6 +1238,15 @@ void MainImpl::RemoveActor(
 	pActorAPI->RemoveActor(dropbox, pluginHandle);
 }
 
+void MainImpl::SubscribeActor(
+	postoffice::Dropbox* dropbox,
+	const std::string& topic,
+	bool subscribe,
+	const MQPluginHandle& pluginHandle)
+{
+	pActorAPI->SubscribeActor(dropbox, topic, subscribe, pluginHandle);
+}
+
 bool MainImpl::AddCommand(
 	std::string_view command,
 	MQCommandHandler handler,
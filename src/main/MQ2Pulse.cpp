@@ -458,6 +458,9 @@ static void Pulse()
 	// handle queued events.
 	ProcessQueuedEvents();
 
+	// write out any ini files that have pending changes
+	GetIniCache().Flush();
+
 	//CheckGameState();
 	CheckGameValidity();
 	if (!s_isValid && !s_hasNotified)
@@ -873,6 +876,9 @@ void InitializeMQ2Pulse()
 	{
 		EQW_GetDisplayWindow = (fEQW_GetDisplayWindow)GetProcAddress(EQWhMod, "EQW_GetDisplayWindow");
 	}
+
+	// Now that we have a pulse to flush from, let writes to ini files be batched up.
+	GetIniCache().SetWriteBehindDelay(std::chrono::milliseconds(250));
 }
 
 void ShutdownMQ2Pulse()
@@ -882,6 +888,9 @@ void ShutdownMQ2Pulse()
 	RemoveDetour(reinterpret_cast<uintptr_t>(ProcessGameEvents));
 	RemoveDetour(CEverQuest__SetGameState);
 	RemoveDetour(CMerchantWnd__PurchasePageHandler__UpdateList);
+
+	GetIniCache().SetWriteBehindDelay(std::chrono::milliseconds(0));
+	GetIniCache().Flush(true);
 }
 
 } // namespace mq
@@ -24,6 +24,8 @@ static void Spawns_Shutdown();
 static void Spawns_Pulse();
 static void Spawns_BeginZone();
 static void Spawns_SpawnRemoved(SPAWNINFO* pSpawn);
+static void InvalidateCaption(SPAWNINFO* pSpawn);
+static void CaptionBenchmark(int spawnCount);
 
 static MQModule gSpawnsModule = {
 	"Spawns",                     // Name
@@ -122,6 +124,8 @@ static int gMaxSpawnCaptions = 35;
 static bool gMQCaptions = true;
 
 static constexpr int CAPTION_UPDATE_FRAMES = 20; // number of frames between caption updates
+static constexpr int CAPTION_SCAN_FACTOR = 4;     // how many spawns a pass may look at, as a multiple of gMaxSpawnCaptions
+static constexpr int CAPTION_MAX_AGE = 15;        // passes before a cached caption is rendered again regardless
 
 static char gszSpawnPlayerName[8][MAX_STRING] = {
 	/* 0 */ "",
@@ -215,7 +219,7 @@ static void CaptionCmd(SPAWNINFO* pChar, char* szLine)
 
 	if (!Arg1[0])
 	{
-		SyntaxError("Usage: /caption <list|type <value>|update #|MQCaptions <on|off>>");
+		SyntaxError("Usage: /caption <list|type <value>|update #|MQCaptions <on|off>|benchmark [count]>");
 		return;
 	}
 
@@ -325,6 +329,20 @@ static void CaptionCmd(SPAWNINFO* pChar, char* szLine)
 		MacroError("Anon is no longer accessed through /caption, please use /mqanon");
 		return;
 	}
+	else if (ci_equals(Arg1, "benchmark"))
+	{
+		int spawnCount = GetIntFromString(GetNextArg(szLine), 0);
+		if (spawnCount <= 0)
+		{
+			for (int count : { 100, 200, 300 })
+				CaptionBenchmark(count);
+		}
+		else
+		{
+			CaptionBenchmark(std::clamp(spawnCount, 1, 1000));
+		}
+		return;
+	}
 	else
 	{
 		MacroError("Invalid caption type '%s'", Arg1);
@@ -511,7 +529,10 @@ public:
 	int SetNameSpriteState_Detour(bool Show)
 	{
 		if (gGameState != GAMESTATE_INGAME || !Show || !gMQCaptions)
+		{
+			InvalidateCaption(reinterpret_cast<SPAWNINFO*>(this));
 			return SetNameSpriteState_Trampoline(Show);
+		}
 
 		return 1;
 	}
@@ -621,23 +642,258 @@ static void SetNameSpriteTint(SPAWNINFO* pSpawn)
 		pSpawn->GetActor()->SetStringSpriteTint((RGB*)&NewColor);
 }
 
+//----------------------------------------------------------------------------
+// caption cache
+//----------------------------------------------------------------------------
+
+// The NamingSpawn members a caption template can read that we know how to check for changes
+// without evaluating the template.
+enum class CaptionField : uint8_t
+{
+	Mark, Trader, Invis, DisplayName, Name, AFK, Linkdead, LFG, GroupLeader, Assist, PctHPs,
+	Surname, Guild, AARank, Title, Suffix, Master, Owner, Type, Level, ID, Class, Race,
+};
+
+static const std::pair<std::string_view, CaptionField> s_captionFieldNames[] = {
+	{ "Mark", CaptionField::Mark },               { "Trader", CaptionField::Trader },
+	{ "Invis", CaptionField::Invis },             { "DisplayName", CaptionField::DisplayName },
+	{ "Name", CaptionField::Name },               { "CleanName", CaptionField::Name },
+	{ "AFK", CaptionField::AFK },                 { "Linkdead", CaptionField::Linkdead },
+	{ "LFG", CaptionField::LFG },                 { "GroupLeader", CaptionField::GroupLeader },
+	{ "Assist", CaptionField::Assist },           { "PctHPs", CaptionField::PctHPs },
+	{ "Surname", CaptionField::Surname },         { "Guild", CaptionField::Guild },
+	{ "AARank", CaptionField::AARank },           { "AATitle", CaptionField::Title },
+	{ "Title", CaptionField::Title },             { "Suffix", CaptionField::Suffix },
+	{ "Master", CaptionField::Master },           { "Owner", CaptionField::Owner },
+	{ "Type", CaptionField::Type },               { "Level", CaptionField::Level },
+	{ "ID", CaptionField::ID },                   { "Class", CaptionField::Class },
+	{ "Race", CaptionField::Race },
+};
+
+// Master and Owner are only tracked by who they are (MasterID and Lastname), so only these
+// members of them can be cached. Anything else, like their health or level, is volatile.
+static const std::string_view s_captionIdentityMembers[] = { "Type", "Name", "CleanName", "DisplayName" };
+
+// TLOs that only transform what is passed to them
+static const std::string_view s_captionPureTLOs[] = { "If", "Select", "String", "Int", "Float", "Bool", "Math" };
+
+// A caption template, reduced to the list of spawn fields it reads. A template that reads
+// anything else is volatile, and is evaluated every time.
+struct CaptionTemplate
+{
+	std::string               source;
+	std::vector<CaptionField> fields;
+	bool                      isVolatile = false;
+	uint32_t                  id = 0;
+};
+
+// A rendered caption and the state it was rendered from
+struct CaptionCacheEntry
+{
+	uint32_t                  templateId = 0;
+	uint64_t                  key = 0;
+	uint32_t                  pass = 0;
+	std::string               caption;
+};
+
+static std::unordered_map<const char*, CaptionTemplate> s_captionTemplates;
+static std::unordered_map<SPAWNINFO*, CaptionCacheEntry> s_captionCache;
+static uint32_t s_captionTemplateId = 0;
+static uint32_t s_captionPass = 0;
+static uint32_t s_captionsRendered = 0;
+static bool s_captionCacheEnabled = true;
+
+static void CompileCaptionTemplate(CaptionTemplate& tmpl, const char* source)
+{
+	tmpl.source = source;
+	tmpl.fields.clear();
+	tmpl.isVolatile = false;
+	tmpl.id = ++s_captionTemplateId;
+
+	auto readIdentifier = [](const char*& pos)
+	{
+		const char* start = pos;
+		while (isalnum(static_cast<unsigned char>(*pos)) || *pos == '_')
+			++pos;
+		return std::string_view(start, pos - start);
+	};
+
+	const char* pos = source;
+	while ((pos = strstr(pos, "${")) != nullptr)
+	{
+		pos += 2;
+		std::string_view tlo = readIdentifier(pos);
+
+		if (ci_equals(tlo, "NamingSpawn"))
+		{
+			CaptionField field = CaptionField::Name;
+
+			if (*pos == '.')
+			{
+				++pos;
+				std::string_view member = readIdentifier(pos);
+
+				auto iter = std::find_if(std::begin(s_captionFieldNames), std::end(s_captionFieldNames),
+					[member](const auto& entry) { return ci_equals(entry.first, member); });
+				if (iter == std::end(s_captionFieldNames)
+					|| (iter->second == CaptionField::Invis && *pos == '['))
+				{
+					tmpl.isVolatile = true;
+					return;
+				}
+
+				field = iter->second;
+
+				if ((field == CaptionField::Master || field == CaptionField::Owner) && *pos == '.')
+				{
+					++pos;
+					std::string_view subMember = readIdentifier(pos);
+
+					if (std::none_of(std::begin(s_captionIdentityMembers), std::end(s_captionIdentityMembers),
+						[subMember](std::string_view identity) { return ci_equals(identity, subMember); }))
+					{
+						tmpl.isVolatile = true;
+						return;
+					}
+				}
+			}
+
+			if (std::find(tmpl.fields.begin(), tmpl.fields.end(), field) == tmpl.fields.end())
+				tmpl.fields.push_back(field);
+		}
+		else if (std::none_of(std::begin(s_captionPureTLOs), std::end(s_captionPureTLOs),
+			[tlo](std::string_view pure) { return ci_equals(pure, tlo); }))
+		{
+			tmpl.isVolatile = true;
+			return;
+		}
+	}
+}
+
+// The templates are edited in place by /caption, so they are compiled again whenever their text changes.
+static const CaptionTemplate& GetCaptionTemplate(const char* source)
+{
+	CaptionTemplate& tmpl = s_captionTemplates[source];
+	if (tmpl.id == 0 || tmpl.source != source)
+		CompileCaptionTemplate(tmpl, source);
+
+	return tmpl;
+}
+
+static uint64_t HashCaptionBytes(uint64_t hash, const void* data, size_t size)
+{
+	// FNV-1a
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+static uint64_t HashCaptionValue(uint64_t hash, int64_t value)
+{
+	return HashCaptionBytes(hash, &value, sizeof(value));
+}
+
+static uint64_t HashCaptionValue(uint64_t hash, const char* value)
+{
+	return HashCaptionBytes(hash, value, strlen(value) + 1);
+}
+
+static uint64_t GetCaptionKey(const CaptionTemplate& tmpl, SPAWNINFO* pSpawn)
+{
+	uint64_t hash = 14695981039346656037ULL;
+
+	// The sprite belongs to the actor, a new actor needs the caption again
+	hash = HashCaptionValue(hash, reinterpret_cast<int64_t>(pSpawn->GetActor()));
+	hash = HashCaptionValue(hash, IsAnonymized());
+
+	for (CaptionField field : tmpl.fields)
+	{
+		switch (field)
+		{
+		case CaptionField::Mark:        hash = HashCaptionValue(hash, GetNPCMarkNumber(pSpawn)); break;
+		case CaptionField::Trader:      hash = HashCaptionValue(hash, pSpawn->Trader); break;
+		case CaptionField::Invis:       hash = HashCaptionValue(hash, pSpawn->HideMode); break;
+		case CaptionField::DisplayName: hash = HashCaptionValue(hash, pSpawn->DisplayedName); break;
+		case CaptionField::Name:        hash = HashCaptionValue(hash, pSpawn->Name); break;
+		case CaptionField::AFK:         hash = HashCaptionValue(hash, pSpawn->AFK); break;
+		case CaptionField::Linkdead:    hash = HashCaptionValue(hash, pSpawn->Linkdead); break;
+		case CaptionField::LFG:         hash = HashCaptionValue(hash, pSpawn->LFG); break;
+		case CaptionField::Assist:      hash = HashCaptionValue(hash, IsAssistNPC(pSpawn)); break;
+		case CaptionField::PctHPs:      hash = HashCaptionValue(hash, pSpawn->HPMax == 0 ? 0 : pSpawn->HPCurrent * 100 / pSpawn->HPMax); break;
+		case CaptionField::Surname:     hash = HashCaptionValue(hash, pSpawn->Lastname); break;
+		case CaptionField::Guild:       hash = HashCaptionValue(hash, pSpawn->GuildID); break;
+		case CaptionField::AARank:      hash = HashCaptionValue(hash, pSpawn->AARank); break;
+		case CaptionField::Title:       hash = HashCaptionValue(hash, pSpawn->Title); break;
+		case CaptionField::Suffix:      hash = HashCaptionValue(hash, pSpawn->Suffix); break;
+		case CaptionField::Master:      hash = HashCaptionValue(hash, pSpawn->MasterID); break;
+		case CaptionField::Type:        hash = HashCaptionValue(hash, GetSpawnType(pSpawn)); break;
+		case CaptionField::Level:       hash = HashCaptionValue(hash, pSpawn->Level); break;
+		case CaptionField::ID:          hash = HashCaptionValue(hash, pSpawn->SpawnID); break;
+		case CaptionField::Class:       hash = HashCaptionValue(hash, pSpawn->GetClass()); break;
+		case CaptionField::Race:        hash = HashCaptionValue(hash, pSpawn->GetRace()); break;
+
+		case CaptionField::Owner:
+			hash = HashCaptionValue(hash, pSpawn->Mercenary);
+			hash = HashCaptionValue(hash, pSpawn->Lastname);
+			break;
+
+		case CaptionField::GroupLeader:
+			hash = HashCaptionValue(hash, pLocalPC && pLocalPC->Group && pLocalPC->Group->GetGroupLeader()
+				? reinterpret_cast<int64_t>(pLocalPC->Group->GetGroupLeader()) : 0);
+			hash = HashCaptionValue(hash, pSpawn->Name);
+			break;
+		}
+	}
+
+	return hash;
+}
+
+// Forget what was rendered for a spawn, for when its caption was changed or hidden by something else.
+static void InvalidateCaption(SPAWNINFO* pSpawn)
+{
+	s_captionCache.erase(pSpawn);
+}
+
 static bool SetCaption(SPAWNINFO* pSpawn, const char* CaptionString)
 {
 	if (CaptionString[0])
 	{
+		const CaptionTemplate& tmpl = GetCaptionTemplate(CaptionString);
+		CaptionCacheEntry& entry = s_captionCache[pSpawn];
+
+		uint64_t key = tmpl.isVolatile ? 0 : GetCaptionKey(tmpl, pSpawn);
+		if (s_captionCacheEnabled && !tmpl.isVolatile && entry.templateId == tmpl.id && entry.key == key
+			&& s_captionPass - entry.pass < CAPTION_MAX_AGE)
+		{
+			// Nothing the caption shows has changed
+			return true;
+		}
+
 		pNamingSpawn = pSpawn;
 
 		std::string str = ModifyMacroString(CaptionString);
+		++s_captionsRendered;
 
 		if (MaybeAnonymize(str))
 		{
-			pSpawn->ChangeBoneStringSprite(0, Anonymize(CXStr{ str }).c_str());
+			str = Anonymize(CXStr{ str }).c_str();
 		}
-		else
+
+		if (!s_captionCacheEnabled || entry.templateId == 0 || entry.caption != str)
 		{
 			pSpawn->ChangeBoneStringSprite(0, str.c_str());
 		}
 
+		entry.templateId = tmpl.id;
+		entry.key = key;
+		entry.pass = s_captionPass;
+		entry.caption = std::move(str);
+
 		pNamingSpawn = nullptr;
 		return true;
 	}
@@ -650,6 +906,7 @@ bool SetNameSpriteState(SPAWNINFO* pSpawn, bool Show)
 	//DebugSpew("SetNameSpriteState(%s) --race %d body %d)",pSpawn->Name,pSpawn->Race,GetBodyType(pSpawn));
 	if (!Show || !gMQCaptions)
 	{
+		InvalidateCaption(pSpawn);
 		return reinterpret_cast<PlayerClientHook*>(pSpawn)->SetNameSpriteState_Trampoline(Show) != 0;
 	}
 
@@ -706,7 +963,13 @@ static void UpdateSpawnCaptions()
 	if (!gMQCaptions)
 		return;
 
-	int count = 0;
+	++s_captionPass;
+
+	// Only captions that actually had to be rendered count against the budget. Captions that are
+	// still current are cheap, so more of the nearby spawns can be looked at each pass.
+	const uint32_t renderedBefore = s_captionsRendered;
+	int scanned = 0;
+
 	for (const MQSpawnArrayItem& item : gSpawnsArray)
 	{
 		SPAWNINFO* pSpawn = item.GetSpawn();
@@ -717,14 +980,74 @@ static void UpdateSpawnCaptions()
 		if (SetNameSpriteState(pSpawn, true))
 		{
 			SetNameSpriteTint(pSpawn);
-			++count;
 		}
 
-		if (count >= gMaxSpawnCaptions)
+		if (static_cast<int>(s_captionsRendered - renderedBefore) >= gMaxSpawnCaptions
+			|| ++scanned >= gMaxSpawnCaptions * CAPTION_SCAN_FACTOR)
+		{
 			break;
+		}
 	}
 }
 
+static void ClearCaptionCache()
+{
+	s_captionCache.clear();
+}
+
+static void CaptionBenchmark(int spawnCount)
+{
+	if (gGameState != GAMESTATE_INGAME || !gMQCaptions)
+	{
+		WriteChatf("\arCaption benchmark needs MQCaptions on and to be in game.");
+		return;
+	}
+
+	std::vector<SPAWNINFO*> spawns;
+	for (const MQSpawnArrayItem& item : gSpawnsArray)
+	{
+		if (SPAWNINFO* pSpawn = item.GetSpawn(); pSpawn && pSpawn != pTarget)
+			spawns.push_back(pSpawn);
+	}
+
+	if (spawns.empty())
+	{
+		WriteChatf("\arNo spawns to benchmark captions with.");
+		return;
+	}
+
+	// Repeat the nearby spawns to get up to the requested count, it is the per caption cost that matters
+	std::vector<SPAWNINFO*> passSpawns;
+	passSpawns.reserve(spawnCount);
+	for (int i = 0; i < spawnCount; ++i)
+		passSpawns.push_back(spawns[i % spawns.size()]);
+
+	constexpr int passes = 10;
+
+	auto runPasses = [&](bool cold)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		for (int pass = 0; pass < passes; ++pass)
+		{
+			if (cold)
+				ClearCaptionCache();
+
+			++s_captionPass;
+			for (SPAWNINFO* pSpawn : passSpawns)
+				SetNameSpriteState(pSpawn, true);
+		}
+
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / passes;
+	};
+
+	const double coldMs = runPasses(true);
+	const double cachedMs = runPasses(false);
+
+	WriteChatf("Caption benchmark, \ay%d\ax captions (\ay%d\ax unique spawns): rendered every pass \ag%.3f\ax ms, cached \ag%.3f\ax ms",
+		spawnCount, static_cast<int>(spawns.size()), coldMs, cachedMs);
+}
+
 static void LoadCaptionSettings()
 {
 	const auto& iniFile = mq::internal_paths::MQini;
@@ -1047,6 +1370,7 @@ static void Spawns_Shutdown()
 	EQP_DistArray = nullptr;
 	gSpawnCount = 0;
 	gSpawnsArray.clear();
+	ClearCaptionCache();
 
 	RemoveMQ2Benchmark(bmUpdateSpawnSort);
 	RemoveMQ2Benchmark(bmUpdateSpawnCaptions);
@@ -1098,10 +1422,13 @@ static void Spawns_Pulse()
 static void Spawns_BeginZone()
 {
 	gSpawnsArray.clear();
+	ClearCaptionCache();
 }
 
 static void Spawns_SpawnRemoved(SPAWNINFO* pSpawn)
 {
+	InvalidateCaption(pSpawn);
+
 	if (gSpawnsArray.empty())
 		return;
 
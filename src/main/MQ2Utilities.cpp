@@ -7499,6 +7499,11 @@ std::string GetCurrentUI()
 	return "Default";
 }
 
+IniCache* GetMainIniCache()
+{
+	return &GetIniCache();
+}
+
 void FormatBytes(char* szBuffer, size_t bufferLength, uint64_t bytes)
 {
 	if (bytes < 1024)
@@ -20,6 +20,9 @@
 
 namespace mq {
 
+// The ini cache behind the Config.h functions in MQ2Main. Plugins use it instead of their own.
+MQLIB_OBJECT IniCache* GetMainIniCache();
+
 // Format a number of bytes into a string with the appropriate unit.
 MQLIB_API void FormatBytes(char* szBuffer, size_t bufferLength, uint64_t bytes);
 
@@ -85,7 +85,9 @@ void MQActorAPI::SendToActor(
 	else if (address.Name)
 		addr.set_name(*address.Name);
 
-	if (address.Mailbox && (address.AbsoluteMailbox || owner == nullptr))
+	if (address.Topic)
+		addr.set_topic(*address.Topic); // a topic goes to all of its subscribers, so there's no mailbox
+	else if (address.Mailbox && (address.AbsoluteMailbox || owner == nullptr))
 		addr.set_mailbox(*address.Mailbox);
 	else if (address.Mailbox && owner != nullptr)
 		addr.set_mailbox(fmt::format("{}:{}", owner->name, *address.Mailbox));
@@ -112,12 +114,13 @@ void MQActorAPI::SendToActor(
 				// assume that the sender is the address we sent to
 				if (message->GetMessageId() == MQMessageId::MSG_ROUTE)
 				{
-					auto envelope = ProtoMessage::Parse<proto::routing::Envelope>(message);
+					postoffice::EnvelopeHeader envelope;
+					const bool wellFormed = envelope.Peek(message);
 
 					std::optional<postoffice::Address> sender;
-					if (envelope.has_return_address())
+					if (envelope.hasReturnAddress)
 					{
-						auto s = envelope.return_address();
+						const auto& s = envelope.returnAddress;
 						sender = postoffice::Address{
 							s.has_pid() ? std::make_optional(s.pid()) : std::nullopt,
 							s.has_name() ? std::make_optional(s.name()) : std::nullopt,
@@ -130,8 +133,12 @@ void MQActorAPI::SendToActor(
 					}
 
 					std::optional<std::string> data;
-					if (envelope.has_payload())
-						data = envelope.payload();
+					if (wellFormed && envelope.hasPayload)
+					{
+						std::string payload(envelope.GetPayloadSize(), '\0');
+						if (envelope.ReadPayload(payload.data()))
+							data = std::move(payload);
+					}
 
 					callback(status, std::make_shared<postoffice::Message>(
 						postoffice::Message{message.get(), sender, data}));
@@ -253,6 +260,21 @@ void MQActorAPI::RemoveActor(
 	}
 }
 
+void MQActorAPI::SubscribeActor(
+	postoffice::Dropbox* dropbox,
+	const std::string& topic,
+	bool subscribe,
+	const MQPluginHandle& pluginHandle)
+{
+	if (dropbox != nullptr)
+	{
+		if (subscribe)
+			dropbox->Subscribe(topic);
+		else
+			dropbox->Unsubscribe(topic);
+	}
+}
+
 void MQActorAPI::OnUnloadPlugin(MQPlugin* plugin)
 {
 }
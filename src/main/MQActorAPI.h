@@ -49,6 +49,12 @@ public:
 		postoffice::Dropbox*& dropbox,
 		const MQPluginHandle& pluginHandle = mqplugin::ThisPluginHandle);
 
+	void SubscribeActor(
+		postoffice::Dropbox* dropbox,
+		const std::string& topic,
+		bool subscribe,
+		const MQPluginHandle& pluginHandle = mqplugin::ThisPluginHandle);
+
 	void OnUnloadPlugin(MQPlugin* plugin);
 };
 
@@ -636,6 +636,9 @@ bool UnloadPlugin(std::string_view pluginName, bool save /* = false */)
 
 	ShutdownPlugin(rec);
 
+	// The plugin shares our ini cache. Write out its pending ini changes while their code is still loaded.
+	GetIniCache().Flush(true);
+
 	// Cleanup
 	if (FreeLibrary(pPlugin->hModule))
 	{
@@ -17,6 +17,7 @@
 #include "CrashHandler.h"
 
 #include "MQ2Main.h"
+#include "MQ2DeveloperTools.h"
 
 #include "routing/PostOffice.h"
 
@@ -50,6 +51,19 @@ static MQModule s_PostOfficeModule = {
 };
 MQModule* GetPostOfficeModule() { return &s_PostOfficeModule; }
 
+static const char* s_overflowPolicyNames[] = { "DropOldest", "DropNewest", "Reject" };
+
+static MailboxOverflowPolicy GetOverflowPolicyFromName(std::string_view name)
+{
+	for (size_t i = 0; i < lengthof(s_overflowPolicyNames); ++i)
+	{
+		if (ci_equals(name, s_overflowPolicyNames[i]))
+			return static_cast<MailboxOverflowPolicy>(i);
+	}
+
+	return MailboxOverflowPolicy::DropOldest;
+}
+
 class MQPostOffice : public PostOffice
 {
 private:
@@ -76,13 +90,33 @@ private:
 			{
 			case MQMessageId::MSG_ROUTE:
 			{
-				auto envelope = ProtoMessage::Parse<proto::routing::Envelope>(message);
-				auto address = envelope.has_address() ? std::make_optional(envelope.address()) : std::nullopt;
+				EnvelopeHeader envelope;
+				envelope.Peek(message);
+				auto address = envelope.hasAddress ? std::make_optional(envelope.address) : std::nullopt;
+				auto routing_failed = [&envelope](int status, PipeMessagePtr&& message)
+					{
+						RoutingFailed(envelope, status, std::move(message), nullptr);
+					};
+
 				// either this message is coming off the pipe, so assume it was routed correctly by the server,
 				// or it was routed internally after checking to make sure that the destination of the message
 				// was within the client. In either case, we can safely assume that we should route it to an
 				// internal mailbox
-				if (address && address->has_mailbox())
+				if (address && address->has_topic())
+				{
+					// the launcher only sends topic messages to clients that subscribed, so every local
+					// subscriber gets it. An RPC message still needs exactly one recipient.
+					auto topic_it = m_postOffice->m_topics.find(address->topic());
+					const size_t subscribers = topic_it == m_postOffice->m_topics.end() ? 0 : topic_it->second.size();
+
+					if (message->GetRequestMode() == MQRequestMode::CallAndResponse && subscribers == 0)
+						RoutingFailed(envelope, MsgError_RoutingFailed, std::move(message), nullptr);
+					else if (message->GetRequestMode() == MQRequestMode::CallAndResponse && subscribers > 1)
+						RoutingFailed(envelope, MsgError_AmbiguousRecipient, std::move(message), nullptr);
+					else
+						m_postOffice->DeliverToTopic(address->topic(), std::move(message), routing_failed);
+				}
+				else if (address && address->has_mailbox())
 				{
 					// we need to loop all mailboxes and deliver to all of them that end with the address
 					// if this is an RPC message, then we need to ensure that we have only one
@@ -95,7 +129,7 @@ private:
 						else if (m_postOffice->FindMailbox(*address, std::next(mailbox)) != m_postOffice->m_mailboxes.end()) // multiple addresses
 							RoutingFailed(envelope, MsgError_AmbiguousRecipient, std::move(message), nullptr);
 						else // we have exactly one recipient, this is valid
-							m_postOffice->DeliverTo(address->mailbox(), std::move(message));
+							m_postOffice->DeliverTo(address->mailbox(), std::move(message), routing_failed);
 					}
 					else
 					{
@@ -226,6 +260,10 @@ private:
 
 			// and then ask for the list of all ID's
 			m_postOffice->m_pipeClient.SendMessage(MQMessageId::MSG_IDENTIFICATION, nullptr, 0);
+
+			// the launcher might have restarted, so tell it about all of our subscriptions again
+			for (const auto& [topic, _] : m_postOffice->m_topics)
+				m_postOffice->OnSubscriptionChanged(topic, true);
 		}
 
 	private:
@@ -251,15 +289,15 @@ public:
 	}
 
 	static void RoutingFailed(
-		const proto::routing::Envelope& envelope,
+		const EnvelopeHeader& envelope,
 		int status,
 		PipeMessagePtr&& message,
 		const PipeMessageResponseCb& callback)
 	{
 		// we can't assume that the mailbox exists here, so manually create the reply
 		proto::routing::Envelope outbound;
-		*outbound.mutable_address() = envelope.return_address();
-		outbound.set_payload(envelope.address().SerializeAsString());
+		*outbound.mutable_address() = envelope.returnAddress;
+		outbound.set_payload(envelope.address.SerializeAsString());
 
 		std::string data = outbound.SerializeAsString();
 		if (callback == nullptr)
@@ -284,24 +322,29 @@ public:
 	{
 		if (message->GetMessageId() == MQMessageId::MSG_ROUTE)
 		{
-			auto& envelope = ProtoMessage::Parse<proto::routing::Envelope>(message);
+			EnvelopeHeader envelope;
+			envelope.Peek(message);
 
-			// always enrich the return address if in game
-			if (pLocalPC)
+			// always enrich the return address if in game. Messages posted through a dropbox
+			// already had this filled in when they were put in their envelope.
+			if (pLocalPC && !envelope.returnAddress.has_character())
 			{
-				envelope.mutable_return_address()->set_account(GetLoginName());
-				envelope.mutable_return_address()->set_server(GetServerShortName());
-				envelope.mutable_return_address()->set_character(pLocalPC->Name);
+				FillReturnAddress(envelope.returnAddress);
+
+				auto stuffed = StuffEnvelope(envelope.address, envelope.returnAddress, EnvelopePayload(envelope));
+				stuffed->SetRequestMode(message->GetRequestMode());
+				stuffed->SetSequenceId(message->GetSequenceId());
 
-				std::string data(envelope.SerializeAsString());
-				message = std::make_unique<PipeMessage>(*message->GetHeader(), &data[0], data.size());
+				message = std::move(stuffed);
+				envelope.Peek(message);
 			}
 
-			if (envelope.has_address())
+			if (envelope.hasAddress)
 			{
-				auto address = envelope.address();
+				const auto& address = envelope.address;
 				if ((address.has_pid() && address.pid() != GetCurrentProcessId()) ||
 					address.has_name() ||
+					address.has_topic() ||
 					address.has_account() ||
 					address.has_server() ||
 					address.has_character() ||
@@ -350,6 +393,27 @@ public:
 		}
 	}
 
+	void FillReturnAddress(proto::routing::Address& returnAddress) override
+	{
+		if (pLocalPC)
+		{
+			returnAddress.set_account(GetLoginName());
+			returnAddress.set_server(GetServerShortName());
+			returnAddress.set_character(pLocalPC->Name);
+		}
+	}
+
+	void OnSubscriptionChanged(const std::string& topic, bool subscribed) override
+	{
+		// the launcher keeps track of which clients want a topic, so let it know
+		proto::routing::Subscription subscription;
+		subscription.set_pid(GetCurrentProcessId());
+		subscription.set_topic(topic);
+		subscription.set_subscribe(subscribed);
+
+		m_pipeClient.SendProtoMessage(MQMessageId::MSG_SUBSCRIPTION, subscription);
+	}
+
 	void ProcessPipeClient()
 	{
 		m_pipeClient.Process();
@@ -448,6 +512,19 @@ public:
 
 	void Initialize()
 	{
+		// limit how much mail can pile up for mailboxes that aren't keeping up
+		MailboxLimits limits;
+		limits.maxQueueSize = GetPrivateProfileInt("Actors", "MailboxQueueSize",
+			static_cast<int>(DEFAULT_MAILBOX_QUEUE_SIZE), mq::internal_paths::MQini);
+		limits.policy = GetOverflowPolicyFromName(GetPrivateProfileString("Actors", "MailboxOverflowPolicy",
+			s_overflowPolicyNames[static_cast<int>(limits.policy)], mq::internal_paths::MQini));
+
+		SetDefaultMailboxLimits(limits);
+		ForEachMailbox([&limits](const Mailbox& mailbox) { mailbox.SetLimits(limits); });
+
+		m_pipeClient.SetMaxPendingMessages(GetPrivateProfileInt("Actors", "MaxPendingMessages",
+			static_cast<int>(DEFAULT_MAX_PENDING_MESSAGES), mq::internal_paths::MQini));
+
 		m_pipeClient.SetHandler(std::make_shared<PipeEventsHandler>(this));
 		m_pipeClient.Start();
 		::atexit(StopPipeClient);
@@ -465,6 +542,8 @@ public:
 		m_pipeClient.Stop();
 	}
 
+	NamedPipeClient& GetPipeClient() { return m_pipeClient; }
+
 private:
 	ProtoPipeClient m_pipeClient;
 	Dropbox m_clientDropbox;
@@ -482,6 +561,155 @@ PostOffice& postoffice::GetPostOffice()
 	return s_postOffice;
 }
 
+//============================================================================
+
+class MailboxInspector : public ImGuiWindowBase
+{
+public:
+	MailboxInspector()
+		: ImGuiWindowBase("Actor Mailboxes")
+	{
+		SetDefaultSize(ImVec2(900, 400));
+	}
+
+	void Draw() override
+	{
+		MQPostOffice& postOffice = static_cast<MQPostOffice&>(GetPostOffice());
+
+		Draw_PipeQueue(postOffice.GetPipeClient());
+		ImGui::Separator();
+
+		Draw_DefaultLimits(postOffice);
+		ImGui::Separator();
+
+		Draw_MailboxTable(postOffice);
+	}
+
+	void Draw_PipeQueue(NamedPipeClient& pipeClient)
+	{
+		ImGui::Text("Incoming messages waiting for the main thread: %d", static_cast<int>(pipeClient.GetPendingMessageCount()));
+		ImGui::Text("Dropped because the main thread fell behind: %llu", pipeClient.GetDroppedMessageCount());
+
+		int maxPending = static_cast<int>(pipeClient.GetMaxPendingMessages());
+		ImGui::SetNextItemWidth(150);
+		if (ImGui::InputInt("Max waiting messages (0 = unbounded)", &maxPending, 1024, 4096))
+			pipeClient.SetMaxPendingMessages(static_cast<size_t>(std::max(0, maxPending)));
+	}
+
+	void Draw_DefaultLimits(PostOffice& postOffice)
+	{
+		MailboxLimits limits = postOffice.GetDefaultMailboxLimits();
+		bool changed = false;
+
+		int queueSize = static_cast<int>(limits.maxQueueSize);
+		ImGui::SetNextItemWidth(150);
+		if (ImGui::InputInt("Mailbox queue size (0 = unbounded)", &queueSize, 256, 1024))
+		{
+			limits.maxQueueSize = static_cast<size_t>(std::max(0, queueSize));
+			changed = true;
+		}
+
+		int policy = static_cast<int>(limits.policy);
+		ImGui::SetNextItemWidth(150);
+		if (ImGui::Combo("Overflow policy", &policy, s_overflowPolicyNames, static_cast<int>(lengthof(s_overflowPolicyNames))))
+		{
+			limits.policy = static_cast<MailboxOverflowPolicy>(policy);
+			changed = true;
+		}
+
+		if (changed)
+			postOffice.SetDefaultMailboxLimits(limits);
+
+		if (ImGui::Button("Apply to all mailboxes"))
+			postOffice.ForEachMailbox([&limits](const Mailbox& mailbox) { mailbox.SetLimits(limits); });
+
+		ImGui::SameLine();
+		if (ImGui::Button("Reset counters"))
+			postOffice.ForEachMailbox([](const Mailbox& mailbox) { mailbox.ResetStats(); });
+	}
+
+	void Draw_MailboxTable(PostOffice& postOffice)
+	{
+		ImGuiTableFlags tableFlags = ImGuiTableFlags_SizingFixedFit
+			| ImGuiTableFlags_ScrollY
+			| ImGuiTableFlags_BordersV
+			| ImGuiTableFlags_BordersOuterH
+			| ImGuiTableFlags_Resizable
+			| ImGuiTableFlags_RowBg;
+
+		if (ImGui::BeginTable("##MailboxTable", 11, tableFlags, ImGui::GetContentRegionAvail()))
+		{
+			ImGui::TableSetupScrollFreeze(1, 1);
+			ImGui::TableSetupColumn("Mailbox", ImGuiTableColumnFlags_WidthStretch);
+			ImGui::TableSetupColumn("Depth");
+			ImGui::TableSetupColumn("Peak");
+			ImGui::TableSetupColumn("Limit");
+			ImGui::TableSetupColumn("Policy");
+			ImGui::TableSetupColumn("Enqueued");
+			ImGui::TableSetupColumn("Delivered");
+			ImGui::TableSetupColumn("Dropped");
+			ImGui::TableSetupColumn("Rejected");
+			ImGui::TableSetupColumn("Avg Latency");
+			ImGui::TableSetupColumn("Max Latency");
+			ImGui::TableHeadersRow();
+
+			postOffice.ForEachMailbox([](const Mailbox& mailbox)
+				{
+					const MailboxStats& stats = mailbox.GetStats();
+					const MailboxLimits& limits = mailbox.GetLimits();
+
+					ImGui::TableNextRow();
+
+					ImGui::TableNextColumn();
+					ImGui::TextUnformatted(mailbox.GetAddress().c_str());
+
+					ImGui::TableNextColumn();
+					ImGui::Text("%d", static_cast<int>(stats.queueDepth));
+
+					ImGui::TableNextColumn();
+					ImGui::Text("%d", static_cast<int>(stats.peakQueueDepth));
+
+					ImGui::TableNextColumn();
+					if (limits.maxQueueSize > 0)
+						ImGui::Text("%d", static_cast<int>(limits.maxQueueSize));
+					else
+						ImGui::TextUnformatted("-");
+
+					ImGui::TableNextColumn();
+					ImGui::TextUnformatted(s_overflowPolicyNames[static_cast<int>(limits.policy)]);
+
+					ImGui::TableNextColumn();
+					ImGui::Text("%llu", stats.enqueued);
+
+					ImGui::TableNextColumn();
+					ImGui::Text("%llu", stats.delivered);
+
+					ImGui::TableNextColumn();
+					if (stats.dropped > 0)
+						ImGui::TextColored(ImColor(255, 255, 0), "%llu", stats.dropped);
+					else
+						ImGui::TextUnformatted("0");
+
+					ImGui::TableNextColumn();
+					if (stats.rejected > 0)
+						ImGui::TextColored(ImColor(255, 0, 0), "%llu", stats.rejected);
+					else
+						ImGui::TextUnformatted("0");
+
+					ImGui::TableNextColumn();
+					ImGui::Text("%.3f ms", stats.GetAverageLatency().count() / 1000.0f);
+
+					ImGui::TableNextColumn();
+					ImGui::Text("%.3f ms", stats.maxLatency.count() / 1000.0f);
+				});
+
+			ImGui::EndTable();
+		}
+	}
+};
+
+static MailboxInspector* s_mailboxInspector = nullptr;
+
 namespace pipeclient {
 
 void NotifyIsForegroundWindow(bool isForeground)
@@ -502,10 +730,16 @@ void SendNotification(const std::string& message, const std::string& title)
 void InitializePostOffice()
 {
 	static_cast<MQPostOffice&>(GetPostOffice()).Initialize();
+
+	s_mailboxInspector = new MailboxInspector();
+	DeveloperTools_RegisterMenuItem(s_mailboxInspector, "Actor Mailboxes", s_menuNameInspectors);
 }
 
 void ShutdownPostOffice()
 {
+	DeveloperTools_UnregisterMenuItem(s_mailboxInspector);
+	delete s_mailboxInspector; s_mailboxInspector = nullptr;
+
 	static_cast<MQPostOffice&>(GetPostOffice()).Shutdown();
 }
 
@@ -1458,6 +1458,7 @@ class MQIniType : public MQ2Type
 {
 public:
 	MQIniType();
+	~MQIniType() override;
 
 	bool GetMember(MQVarPtr VarPtr, const char* Member, char* Index, MQTypeVar& Dest) override;
 
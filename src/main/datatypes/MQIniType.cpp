@@ -20,6 +20,7 @@ namespace mq::datatypes {
 static std::string MQIniFile;
 static std::string MQIniFileSection;
 static std::string MQIniFileSectionKey;
+static uint32_t bmIniRead = 0;
 
 enum class IniFileSectionKeyTypeMembers
 {
@@ -260,9 +261,8 @@ bool MQIniFileType::GetMember(MQVarPtr VarPtr, const char* Member, char* Index,
 	{
 	case IniFileTypeMembers::Exists:
 	{
-		std::error_code ec;
 		Dest.Type = pBoolType;
-		Dest.Set(std::filesystem::exists(MQIniFile, ec));
+		Dest.Set(PrivateProfileFileExists(MQIniFile));
 		return true;
 	}
 	case IniFileTypeMembers::Section:
@@ -292,6 +292,13 @@ enum class IniTypeMembers
 MQIniType::MQIniType() : MQ2Type("iniadv")
 {
 	ScopedTypeMember(IniTypeMembers, File);
+
+	bmIniRead = AddMQ2Benchmark("IniRead");
+}
+
+MQIniType::~MQIniType()
+{
+	RemoveMQ2Benchmark(bmIniRead);
 }
 
 bool MQIniType::GetMember(MQVarPtr VarPtr, const char* Member, char* Index, MQTypeVar& Dest)
@@ -382,10 +389,13 @@ bool MQIniType::dataIni(const char* szIndex, MQTypeVar& Ret)
 
 	const std::filesystem::path pathIniFile = GetMacroIni(internal_paths::Config, internal_paths::Macros, IniFile);
 
-	std::error_code ec_exists;
-	if (std::filesystem::exists(pathIniFile, ec_exists))
+	if (PrivateProfileFileExists(pathIniFile.string()))
 	{
-		const int nSize = GetPrivateProfileString(Section, Key, Default, DataTypeTemp, MAX_STRING, pathIniFile.string());
+		int nSize;
+		{
+			MQScopedBenchmark bm(bmIniRead);
+			nSize = GetPrivateProfileString(Section, Key, Default, DataTypeTemp, MAX_STRING, pathIniFile.string());
+		}
 
 		if (nSize)
 		{
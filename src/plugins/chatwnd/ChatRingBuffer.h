@@ -0,0 +1,95 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+//============================================================================
+
+// Fixed capacity queue of chat lines. Once it is full, pushing a new line replaces the
+// oldest one, so a burst of chat never holds more lines than the window could show.
+template <typename T>
+class ChatRingBuffer
+{
+public:
+	explicit ChatRingBuffer(size_t capacity)
+		: m_items(std::max<size_t>(capacity, 1))
+	{
+	}
+
+	// Returns true if the oldest line had to be dropped to make room.
+	bool push_back(T item)
+	{
+		bool dropped = false;
+
+		if (m_size == m_items.size())
+		{
+			m_head = Wrap(m_head + 1);
+			--m_size;
+			++m_dropped;
+			dropped = true;
+		}
+
+		m_items[Wrap(m_head + m_size)] = std::move(item);
+		++m_size;
+
+		return dropped;
+	}
+
+	// Removes up to count of the oldest lines at once.
+	void pop_front(size_t count = 1)
+	{
+		count = std::min(count, m_size);
+
+		for (size_t i = 0; i < count; ++i)
+			m_items[Wrap(m_head + i)] = T{};
+
+		m_head = Wrap(m_head + count);
+		m_size -= count;
+	}
+
+	void clear()
+	{
+		pop_front(m_size);
+		m_head = 0;
+	}
+
+	// Lines are indexed oldest first
+	T& operator[](size_t index) { return m_items[Wrap(m_head + index)]; }
+	const T& operator[](size_t index) const { return m_items[Wrap(m_head + index)]; }
+
+	T& front() { return (*this)[0]; }
+	T& back() { return (*this)[m_size - 1]; }
+
+	size_t size() const { return m_size; }
+	size_t capacity() const { return m_items.size(); }
+	bool empty() const { return m_size == 0; }
+	bool full() const { return m_size == m_items.size(); }
+
+	// Number of lines that were dropped because the buffer was full, since the last reset.
+	size_t dropped() const { return m_dropped; }
+	void reset_dropped() { m_dropped = 0; }
+
+private:
+	size_t Wrap(size_t index) const { return index % m_items.size(); }
+
+	std::vector<T> m_items;
+	size_t m_head = 0;
+	size_t m_size = 0;
+	size_t m_dropped = 0;
+};
@@ -14,6 +14,9 @@
 
 #include <mq/Plugin.h>
 
+#include "ChatRingBuffer.h"
+
+#include <chrono>
 #include <vector>
 #include <list>
 #include <string>
@@ -23,11 +26,14 @@
 
 PreSetup("MQ2ChatWnd");
 
-static constexpr auto LINES_PER_FRAME = 3;
 static constexpr auto CMD_HIST_MAX = 50;
 static constexpr auto MAX_LINES_OUTBOX = 700;
+static constexpr auto LINES_PER_APPEND = 16;                  // lines joined into each AppendSTML call
+static constexpr auto DRAIN_BUDGET = std::chrono::microseconds(1500); // time per frame spent adding chat to the window
 
-std::list<CXStr> sPendingChat;
+// Lines waiting to be added to the window, already converted to STML. It never holds more than
+// the window can show, anything older would have been trimmed from the window before it was seen.
+ChatRingBuffer<CXStr> sPendingChat(MAX_LINES_OUTBOX);
 DWORD ulOldVScrollPos = 0;
 DWORD bmStripFirstStmlLines = 0;
 char szChatINISection[MAX_STRING] = { 0 };
@@ -426,6 +432,48 @@ void MQChatMin(SPAWNINFO* pChar, char* Line)
 	}
 }
 
+static CXStr ConvertChatLine(const char* Line, DWORD Color)
+{
+	char* szProcessed = new char[MAX_STRING];
+
+	MQToSTML(Line, szProcessed, MAX_STRING - 4, Color);
+
+	CXStr text = szProcessed;
+	text.append("<br>");
+
+	ConvertItemTags(text);
+
+	delete[] szProcessed;
+	return text;
+}
+
+// Measures how fast chat can be taken in, without touching the window.
+static void ChatIngestBenchmark(int lineCount)
+{
+	std::vector<std::string> lines;
+	lines.reserve(lineCount);
+	for (int i = 0; i < lineCount; ++i)
+		lines.push_back(fmt::format("\ayA goblin\ax hits YOU for \ar{}\ax points of damage. (line {})", i % 500, i));
+
+	auto timeIngest = [&](auto&& push)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (const std::string& line : lines)
+			push(ConvertChatLine(line.c_str(), 0xFFFFFFFF));
+
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	};
+
+	std::list<CXStr> list;
+	const double listMs = timeIngest([&](CXStr&& text) { list.push_back(std::move(text)); });
+
+	ChatRingBuffer<CXStr> ring(MAX_LINES_OUTBOX);
+	const double ringMs = timeIngest([&](CXStr&& text) { ring.push_back(std::move(text)); });
+
+	WriteChatf("Chat ingest, \ay%d\ax lines: list \ag%.2f\ax ms (%d kept), ring \ag%.2f\ax ms (%d kept, %d dropped)",
+		lineCount, listMs, static_cast<int>(list.size()), ringMs, static_cast<int>(ring.size()), static_cast<int>(ring.dropped()));
+}
+
 void MQChat(SPAWNINFO* pChar, char* Line)
 {
 	char Arg[MAX_STRING] = { 0 };
@@ -533,9 +581,14 @@ void MQChat(SPAWNINFO* pChar, char* Line)
 	{
 		EzCommand("/mqsettings plugins/ChatWnd");
 	}
+	else if (!_stricmp(Arg, "benchmark"))
+	{
+		GetArg(Arg, Line, 2);
+		ChatIngestBenchmark(std::clamp(GetIntFromString(Arg, 2000), 1, 100000));
+	}
 	else
 	{
-		WriteChatf("%s was not a valid option. Valid options are: reset, autoscroll, nocharselect, and savebychar", Arg);
+		WriteChatf("%s was not a valid option. Valid options are: reset, autoscroll, nocharselect, savebychar, and benchmark", Arg);
 	}
 }
 
@@ -665,19 +718,40 @@ PLUGIN_API DWORD OnWriteChatColor(char* Line, DWORD Color, DWORD Filter)
 		pFilter = pFilter->pNext;
 	}
 
-	Color = pChatManager->GetRGBAFromIndex(Color);
-	char* szProcessed = new char[MAX_STRING];
+	sPendingChat.push_back(ConvertChatLine(Line, pChatManager->GetRGBAFromIndex(Color)));
+	return 0;
+}
 
-	int pos = MQToSTML(Line, szProcessed, MAX_STRING - 4, Color);
+static CXStr JoinPendingChat(size_t count)
+{
+	CXStr text;
+	for (size_t i = 0; i < count; ++i)
+		text.append(sPendingChat[i].c_str());
 
-	CXStr text = szProcessed;
-	text.append("<br>");
+	sPendingChat.pop_front(count);
+	return text;
+}
 
-	ConvertItemTags(text);
-	sPendingChat.push_back(text);
+static void DrainPendingChat()
+{
+	if (sPendingChat.full() && sPendingChat.dropped() > 0)
+	{
+		// Everything in the window would be pushed out by what is waiting, so replace the window
+		// text in one go instead of appending and trimming a line at a time.
+		MQChatWnd->OutputBox->SetSTMLText(JoinPendingChat(sPendingChat.size()));
+		MQChatWnd->OutputBox->ForceParseNow();
 
-	delete[] szProcessed;
-	return 0;
+		sPendingChat.reset_dropped();
+		return;
+	}
+
+	sPendingChat.reset_dropped();
+
+	const auto deadline = std::chrono::steady_clock::now() + DRAIN_BUDGET;
+	do
+	{
+		MQChatWnd->OutputBox->AppendSTML(JoinPendingChat(std::min<size_t>(sPendingChat.size(), LINES_PER_APPEND)));
+	} while (!sPendingChat.empty() && std::chrono::steady_clock::now() < deadline);
 }
 
 PLUGIN_API void OnPulse()
@@ -713,20 +787,7 @@ PLUGIN_API void OnPulse()
 			// scroll down if autoscroll enabled, or current position is the bottom of chatwnd
 			bool bScrollDown = bAutoScroll || (MQChatWnd->OutputBox->GetVScrollPos() == MQChatWnd->OutputBox->GetVScrollMax());
 
-			size_t ThisPulse = sPendingChat.size();
-			if (ThisPulse > LINES_PER_FRAME)
-			{
-				ThisPulse = LINES_PER_FRAME;
-			}
-
-			for (size_t N = 0; N < ThisPulse; N++)
-			{
-				if (!sPendingChat.empty())
-				{
-					MQChatWnd->OutputBox->AppendSTML(*sPendingChat.begin());
-					sPendingChat.pop_front();
-				}
-			}
+			DrainPendingChat();
 
 			if (bScrollDown)
 			{
@@ -17,7 +17,10 @@
 
 #include <mq/Plugin.h>
 
+#include <chrono>
+#include <filesystem>
 #include <mutex>
+#include <vector>
 
 PreSetup("MQ2HUD");
 
@@ -30,6 +33,16 @@ enum HudType
 	HUDTYPE_MACRO      = 0x0010,
 };
 
+// What an element's text reads from, which decides how often it has to be parsed again.
+enum HudDependency
+{
+	HUDDEP_NONE        = 0x0000,   // plain text, parsed once
+	HUDDEP_ZONE        = 0x0001,   // only changes when zoning, refreshed every StaticParse frames
+	HUDDEP_TARGET      = 0x0002,   // refreshed when the target changes, and every SkipParse frames while there is one
+	HUDDEP_SELF        = 0x0004,   // refreshed every SkipParse frames
+	HUDDEP_OTHER       = 0x0008,   // anything we don't know about, refreshed every SkipParse frames
+};
+
 struct HUDELEMENT
 {
 	HudType     Type;
@@ -40,15 +53,26 @@ struct HUDELEMENT
 	char        Text[MAX_STRING];
 	char        PreParsed[MAX_STRING];
 
+	// Filled in by CompileElement
+	int         Dependencies = HUDDEP_NONE;
+	std::vector<std::string> MacroNames;
+	bool        Dirty = true;
+	uint32_t    NextParse = 0;
+
 	HUDELEMENT* pNext;
 };
 HUDELEMENT* pHud = nullptr;
 
 struct _stat LastRead;
+HANDLE hINIChange = INVALID_HANDLE_VALUE;
 char HUDNames[MAX_STRING] = "Elements";
 char HUDSection[MAX_STRING] = "MQ2HUD";
 int SkipParse = 1;
+int StaticParse = 100;
 int CheckINI = 10;
+uint32_t HUDFrame = 0;
+uint32_t LastTargetID = 0;
+uint32_t bmHUDRefresh = 0;
 bool bBGUpdate = true;
 bool bClassHUD = true;
 bool bZoneHUD = true;
@@ -56,6 +80,8 @@ bool bUseFontSize = false;
 bool bEQHasFocus = true;
 std::recursive_mutex s_mutex;
 
+bool ParseMacroLine(char* szOriginal, size_t BufferSize, std::list<std::string>& out);
+
 bool Stat(const char* Filename, struct _stat& Dest)
 {
 	int client = 0;
@@ -67,6 +93,155 @@ bool Stat(const char* Filename, struct _stat& Dest)
 	return true;
 }
 
+void StopWatchingINI()
+{
+	if (hINIChange != INVALID_HANDLE_VALUE)
+	{
+		FindCloseChangeNotification(hINIChange);
+		hINIChange = INVALID_HANDLE_VALUE;
+	}
+}
+
+void WatchINI()
+{
+	StopWatchingINI();
+
+	std::filesystem::path directory = std::filesystem::path(INIFileName).parent_path();
+	hINIChange = FindFirstChangeNotificationA(directory.string().c_str(), FALSE,
+		FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+}
+
+// Returns true if something in the INI's directory was written since the last call. If the
+// directory can't be watched this always returns true, and the INI is checked every CheckINI frames.
+bool INIMightHaveChanged()
+{
+	if (hINIChange == INVALID_HANDLE_VALUE)
+		return true;
+
+	if (WaitForSingleObject(hINIChange, 0) != WAIT_OBJECT_0)
+		return false;
+
+	FindNextChangeNotification(hINIChange);
+	return true;
+}
+
+int GetDependency(std::string_view Name)
+{
+	if (ci_equals(Name, "Target"))
+		return HUDDEP_TARGET;
+
+	if (ci_equals(Name, "Me") || ci_equals(Name, "Pet") || ci_equals(Name, "Mercenary")
+		|| ci_equals(Name, "Group") || ci_equals(Name, "Cursor"))
+	{
+		return HUDDEP_SELF;
+	}
+
+	// These only change when zoning, or are just functions of whatever is nested in them.
+	if (ci_equals(Name, "Zone") || ci_equals(Name, "HUD") || ci_equals(Name, "Math")
+		|| ci_equals(Name, "If") || ci_equals(Name, "Select") || ci_equals(Name, "Int")
+		|| ci_equals(Name, "Float") || ci_equals(Name, "Bool") || ci_equals(Name, "String"))
+	{
+		return HUDDEP_ZONE;
+	}
+
+	// Everything else, including EverQuest (ping, fps, game state), MacroQuest (paused, running
+	// macro) and Ini (files written by anyone), can change at any time.
+	return HUDDEP_OTHER;
+}
+
+// Works out what an element depends on, once, so that OnDrawHUD only parses what might have changed.
+void CompileElement(HUDELEMENT* pElement)
+{
+	pElement->Dependencies = HUDDEP_NONE;
+
+	// Every ${ starts a TLO name, including the nested ones
+	const char* pPos = pElement->Text;
+	while ((pPos = strstr(pPos, "${")) != nullptr)
+	{
+		pPos += 2;
+
+		const char* pEnd = pPos;
+		while (isalnum(static_cast<unsigned char>(*pEnd)) || *pEnd == '_')
+			++pEnd;
+
+		pElement->Dependencies |= GetDependency(std::string_view(pPos, pEnd - pPos));
+	}
+
+	if (pElement->Type & HUDTYPE_MACRO)
+	{
+		// Macro elements are only evaluated once all of these exist, and can come and go with the macro.
+		pElement->Dependencies |= HUDDEP_OTHER;
+
+		char szTemp[MAX_STRING] = { 0 };
+		strcpy_s(szTemp, pElement->Text);
+
+		std::list<std::string> out;
+		ParseMacroLine(szTemp, MAX_STRING, out);
+		pElement->MacroNames.assign(std::make_move_iterator(out.begin()), std::make_move_iterator(out.end()));
+	}
+
+	pElement->Dirty = true;
+}
+
+void MarkElementsDirty(int Dependencies)
+{
+	for (HUDELEMENT* pElement = pHud; pElement; pElement = pElement->pNext)
+	{
+		if (pElement->Dependencies & Dependencies)
+			pElement->Dirty = true;
+	}
+}
+
+bool NeedsParse(const HUDELEMENT* pElement, bool bCheckParse, uint32_t Frame)
+{
+	if (pElement->Dirty)
+		return true;
+
+	if (pElement->Dependencies & (HUDDEP_SELF | HUDDEP_OTHER))
+		return bCheckParse;
+
+	// With no target, target members don't change until a new target is picked
+	if ((pElement->Dependencies & HUDDEP_TARGET) && bCheckParse && pTarget)
+		return true;
+
+	if ((pElement->Dependencies & HUDDEP_ZONE) && Frame >= pElement->NextParse)
+		return true;
+
+	return false;
+}
+
+void ParseElement(HUDELEMENT* pElement, uint32_t Frame)
+{
+	bool bOkToCheck = true;
+	strcpy_s(pElement->PreParsed, pElement->Text);
+
+	if ((pElement->Type & HUDTYPE_MACRO) && gRunning)
+	{
+		for (const std::string& name : pElement->MacroNames)
+		{
+			// ok fine we didn't find it in the tlo map... lets check variables
+			if (!FindTopLevelObject(name.c_str()) && !IsMacroVariable(name.c_str()))
+			{
+				// still not found...
+				bOkToCheck = false;
+				break;
+			}
+		}
+	}
+
+	if (bOkToCheck)
+	{
+		ParseMacroParameter(pElement->PreParsed);
+	}
+	else
+	{
+		pElement->PreParsed[0] = '\0';
+	}
+
+	pElement->Dirty = false;
+	pElement->NextParse = Frame + StaticParse;
+}
+
 void ClearElements()
 {
 	std::scoped_lock lock(s_mutex);
@@ -166,6 +341,7 @@ void AddElement(char* IniString)
 	strcpy_s(pElement->Text, IniString);
 	ZeroMemory(pElement->PreParsed, sizeof(pElement->PreParsed));
 	pElement->Size = Size;
+	CompileElement(pElement);
 
 	DebugSpew("New element '%s' in color %X", pElement->Text, pElement->Color);
 }
@@ -258,6 +434,9 @@ void HandleINI()
 	SkipParse = GetPrivateProfileInt(HUDSection, "SkipParse", 1, INIFileName);
 	SkipParse = SkipParse < 1 ? 1 : SkipParse;
 
+	StaticParse = GetPrivateProfileInt(HUDSection, "StaticParse", 100, INIFileName);
+	StaticParse = StaticParse < SkipParse ? SkipParse : StaticParse;
+
 	CheckINI = GetPrivateProfileInt(HUDSection, "CheckINI", 10, INIFileName);
 	CheckINI = CheckINI < 10 ? 10 : CheckINI;
 
@@ -275,6 +454,7 @@ void HandleINI()
 
 	// Write the SkipParse and CheckINI section, in case they didn't have one
 	WritePrivateProfileString(HUDSection, "SkipParse", std::to_string(SkipParse), INIFileName);
+	WritePrivateProfileString(HUDSection, "StaticParse", std::to_string(StaticParse), INIFileName);
 	WritePrivateProfileString(HUDSection, "CheckINI", std::to_string(CheckINI), INIFileName);
 	WritePrivateProfileString(HUDSection, "UpdateInBackground", bBGUpdate ? "on" : "off", INIFileName);
 	WritePrivateProfileString(HUDSection, "ClassHUD", bClassHUD ? "on" : "off", INIFileName);
@@ -410,6 +590,83 @@ void ZoneHUD(SPAWNINFO* pChar, char* szLine)
 	HandleINI();
 }
 
+// Compares parsing every element on every refresh with the compiled elements, for a few HUD sizes.
+void HUDBenchmark(SPAWNINFO* pChar, char* szLine)
+{
+	if (gGameState != GAMESTATE_INGAME)
+	{
+		WriteChatColor("MQ2HUD::/hudbench only works in game");
+		return;
+	}
+
+	std::vector<int> counts = { 50, 150, 500 };
+	if (szLine[0])
+		counts = { std::clamp(GetIntFromString(szLine, 50), 1, 5000) };
+
+	// A mix of what raid HUDs usually show
+	static const char* SampleText[] = {
+		"${Me.PctHPs}% ${Me.CurrentMana}",
+		"${Target.CleanName} ${Target.PctHPs}%",
+		"${Target.Distance} ${Target.Class}",
+		"${Zone.Name}",
+		"${Me.Buff[1].Name} ${Me.Buff[1].Duration}",
+		"Static label",
+		"${Group.Member[1].Name} ${Group.Member[1].PctHPs}",
+		"${If[${Me.Combat},In Combat,]}",
+	};
+
+	std::scoped_lock lock(s_mutex);
+
+	constexpr int Frames = 100;
+	using clock = std::chrono::steady_clock;
+
+	for (int count : counts)
+	{
+		std::vector<HUDELEMENT*> elements;
+		elements.reserve(count);
+
+		for (int i = 0; i < count; ++i)
+		{
+			HUDELEMENT* pElement = new HUDELEMENT{};
+			pElement->Type = static_cast<HudType>(HUDTYPE_NORMAL | HUDTYPE_FULLSCREEN);
+			strcpy_s(pElement->Text, SampleText[i % lengthof(SampleText)]);
+			CompileElement(pElement);
+			elements.push_back(pElement);
+		}
+
+		auto start = clock::now();
+		for (int frame = 0; frame < Frames; ++frame)
+		{
+			for (HUDELEMENT* pElement : elements)
+			{
+				strcpy_s(pElement->PreParsed, pElement->Text);
+				ParseMacroParameter(pElement->PreParsed);
+			}
+		}
+		auto parseAll = clock::now() - start;
+
+		start = clock::now();
+		for (int frame = 0; frame < Frames; ++frame)
+		{
+			bool bCheckParse = !(frame % SkipParse);
+
+			for (HUDELEMENT* pElement : elements)
+			{
+				if (NeedsParse(pElement, bCheckParse, frame))
+					ParseElement(pElement, frame);
+			}
+		}
+		auto compiled = clock::now() - start;
+
+		for (HUDELEMENT* pElement : elements)
+			delete pElement;
+
+		WriteChatf("MQ2HUD::%d elements: %.3f ms per frame parsing everything, %.3f ms compiled", count,
+			std::chrono::duration<double, std::milli>(parseAll).count() / Frames,
+			std::chrono::duration<double, std::milli>(compiled).count() / Frames);
+	}
+}
+
 bool dataHUD(const char* szIndex, MQTypeVar& Ret)
 {
 	Ret.Ptr = HUDNames;
@@ -421,6 +678,9 @@ PLUGIN_API void InitializePlugin()
 {
 	GetPrivateProfileString(HUDSection, "Last", "Elements", HUDNames, MAX_STRING, INIFileName);
 	HandleINI();
+	WatchINI();
+
+	bmHUDRefresh = AddMQ2Benchmark("HUD Refresh");
 
 	AddCommand("/defaulthud", DefaultHUD);
 	AddCommand("/loadhud", LoadHUD);
@@ -428,12 +688,16 @@ PLUGIN_API void InitializePlugin()
 	AddCommand("/backgroundhud", BackgroundHUD);
 	AddCommand("/classhud", ClassHUD);
 	AddCommand("/zonehud", ZoneHUD);
+	AddCommand("/hudbench", HUDBenchmark);
 	AddMQ2Data("HUD", dataHUD);
 }
 
 PLUGIN_API void ShutdownPlugin()
 {
 	ClearElements();
+	StopWatchingINI();
+
+	RemoveMQ2Benchmark(bmHUDRefresh);
 
 	RemoveCommand("/loadhud");
 	RemoveCommand("/unloadhud");
@@ -441,6 +705,7 @@ PLUGIN_API void ShutdownPlugin()
 	RemoveCommand("/backgroundhud");
 	RemoveCommand("/classhud");
 	RemoveCommand("/zonehud");
+	RemoveCommand("/hudbench");
 	RemoveMQ2Data("HUD");
 }
 
@@ -457,7 +722,10 @@ PLUGIN_API void SetGameState(DWORD GameState)
 // Called after entering a new zone
 PLUGIN_API void OnZoned()
 {
-	if (bZoneHUD) HandleINI();
+	if (bZoneHUD)
+		HandleINI();
+	else
+		MarkElementsDirty(HUDDEP_ZONE);
 }
 
 bool ParseMacroLine(char* szOriginal, size_t BufferSize, std::list<std::string>& out)
@@ -577,16 +845,17 @@ PLUGIN_API void OnDrawHUD()
 {
 	std::scoped_lock lock(s_mutex);
 
-	static bool bOkToCheck = true;
 	static int FrameCount = 0;
 	char szBuffer[MAX_STRING] = { 0 };
 
+	++HUDFrame;
+
 	if (++FrameCount > CheckINI)
 	{
 		FrameCount = 0;
 
 		struct _stat now;
-		if (Stat(INIFileName, now) && now.st_mtime != LastRead.st_mtime)
+		if (INIMightHaveChanged() && Stat(INIFileName, now) && now.st_mtime != LastRead.st_mtime)
 			LoadElements();
 
 		// check for EQ in foreground
@@ -605,6 +874,15 @@ PLUGIN_API void OnDrawHUD()
 		SY = ScreenY;
 	}
 
+	uint32_t TargetID = pTarget ? pTarget->SpawnID : 0;
+	if (TargetID != LastTargetID)
+	{
+		LastTargetID = TargetID;
+		MarkElementsDirty(HUDDEP_TARGET);
+	}
+
+	MQScopedBenchmark bm(bmHUDRefresh);
+
 	HUDELEMENT* pElement = pHud;
 	bool bCheckParse = !(FrameCount % SkipParse);
 
@@ -627,60 +905,9 @@ PLUGIN_API void OnDrawHUD()
 				Y = SX + pElement->Y;
 			}
 
-			if (bCheckParse)
+			if (NeedsParse(pElement, bCheckParse, HUDFrame))
 			{
-				bOkToCheck = true;
-				strcpy_s(pElement->PreParsed, pElement->Text);
-
-				if (pElement->Type & HUDTYPE_MACRO)
-				{
-					if (gRunning)
-					{
-						char szTemp[MAX_STRING] = { 0 };
-						strcpy_s(szTemp, pElement->Text);
-
-						std::list<std::string> out;
-						ParseMacroLine(szTemp, MAX_STRING, out);
-
-						for (auto& line : out)
-						{
-							bOkToCheck = false;
-							const char* pChar = line.c_str();
-
-							if (FindTopLevelObject(pChar))
-							{
-								bOkToCheck = true;
-								continue;
-							}
-
-							if (!bOkToCheck)
-							{
-								// ok fine we didn't find it in the tlo map...
-								// lets check variables
-								if (IsMacroVariable(pChar))
-								{
-									bOkToCheck = true;
-									continue;
-								}
-							}
-
-							if (!bOkToCheck)
-							{
-								// still not found...
-								break;
-							}
-						}
-					}
-				}
-
-				if (bOkToCheck)
-				{
-					ParseMacroParameter(pElement->PreParsed);
-				}
-				else
-				{
-					pElement->PreParsed[0] = '\0';
-				}
+				ParseElement(pElement, HUDFrame);
 			}
 
 			strcpy_s(szBuffer, pElement->PreParsed);
@@ -21,6 +21,7 @@
 #include "Actor.pb.h"
 
 #include "LuaActor.h"
+#include "LuaActorPayload.h"
 #include "LuaThread.h"
 #include "LuaCoroutine.h"
 
@@ -40,119 +41,57 @@ using namespace mq::postoffice;
 
 namespace messaging = proto::lua::actor;
 
-sol::object DeserializeProto(const messaging::Variant& data, sol::state_view s)
-{
-	switch (data.value_case())
+// ImVec2 and ImVec4 are sol usertypes, so the payload code goes through sol to read and make them
+static const LuaPayloadVectors s_payloadVectors = {
+	[](lua_State* L, int index, float* components)
 	{
-	case messaging::Variant::ValueCase::kNumber:
-		return sol::make_object(s, data.number());
-	case messaging::Variant::ValueCase::kBoolean:
-		return sol::make_object(s, data.boolean());
-	case messaging::Variant::ValueCase::kStr:
-		return sol::make_object(s, data.str());
-	case messaging::Variant::ValueCase::kTable:
+		if (!sol::stack::check<ImVec2>(L, index, sol::no_panic))
+			return false;
+
+		const ImVec2& vec = sol::stack::get<ImVec2>(L, index);
+		components[0] = vec.x;
+		components[1] = vec.y;
+		return true;
+	},
+	[](lua_State* L, int index, float* components)
 	{
-		if (data.has_table())
-		{
-			auto table = s.create_table(0, static_cast<int>(data.table().entries().size() + data.table().arr().size()));
-
-			for (const auto& [k, v] : data.table().entries())
-			{
-				table[k] = DeserializeProto(v, s);
-			}
-
-			for (const auto& [k, v] : data.table().arr())
-			{
-				table[k] = DeserializeProto(v, s);
-			}
-
-			return sol::make_object(s, table);
-		}
-		
-		return sol::lua_nil;
-	}
-	case messaging::Variant::ValueCase::kImvec2:
-		return sol::make_object(s, ImVec2(
-			data.imvec2().x(),
-			data.imvec2().y()));
-	case messaging::Variant::ValueCase::kImvec4:
-		return sol::make_object(s, ImVec4(
-			data.imvec4().x(),
-			data.imvec4().y(),
-			data.imvec4().z(),
-			data.imvec4().w()
-		));
-	default:
-		return sol::nil;
-	}
-}
-
-messaging::Variant SerializeProto(const sol::object& data)
-{
-	messaging::Variant variant;
-
-	switch (data.get_type())
+		if (!sol::stack::check<ImVec4>(L, index, sol::no_panic))
+			return false;
+
+		const ImVec4& vec = sol::stack::get<ImVec4>(L, index);
+		components[0] = vec.x;
+		components[1] = vec.y;
+		components[2] = vec.z;
+		components[3] = vec.w;
+		return true;
+	},
+	[](lua_State* L, const float* components)
 	{
-	case sol::type::string:
-		variant.set_str(data.as<std::string>());
-		break;
-	case sol::type::number:
-		variant.set_number(data.as<double>());
-		break;
-	case sol::type::boolean:
-		variant.set_boolean(data.as<bool>());
-		break;
-	case sol::type::table:
+		sol::stack::push(L, ImVec2(components[0], components[1]));
+	},
+	[](lua_State* L, const float* components)
 	{
-		messaging::Table table;
-		google::protobuf::Map<std::string, messaging::Variant> entries;
-		google::protobuf::Map<uint32_t, messaging::Variant> arr;
-		for (const auto& [k, v] : data.as<sol::table>())
-		{
-			// a limitation of proto: keys can't be messages, so we have to limit it here
-			if (k.is<std::string_view>())
-			{
-				entries[k.as<std::string_view>()] = SerializeProto(v);
-			}
-			else if (k.is<uint32_t>())
-			{
-				arr[k.as<uint32_t>()] = SerializeProto(v);
-			}
-		}
+		sol::stack::push(L, ImVec4(components[0], components[1], components[2], components[3]));
+	},
+};
 
-		if (!entries.empty())
-			*table.mutable_entries() = entries;
+sol::object DeserializeProto(std::string_view data, sol::state_view s)
+{
+	ReadLuaPayload(s.lua_state(), data, s_payloadVectors);
+	return sol::stack::pop<sol::object>(s.lua_state());
+}
 
-		if (!arr.empty())
-			*table.mutable_arr() = arr;
+std::string SerializeProto(const sol::object& data)
+{
+	lua_State* L = data.lua_state();
+	if (L == nullptr)
+		return std::string();
 
-		if (!entries.empty() || !arr.empty())
-			*variant.mutable_table() = table;
-		break;
-	}
-	case sol::type::userdata:
-		if (data.is<ImVec2>())
-		{
-			auto vec = data.as<ImVec2>();
-			*variant.mutable_imvec2() = messaging::ImVec2();
-			(*variant.mutable_imvec2()).set_x(vec.x);
-			(*variant.mutable_imvec2()).set_y(vec.y);
-		}
-		else if (data.is<ImVec4>())
-		{
-			auto vec = data.as<ImVec4>();
-			*variant.mutable_imvec4() = messaging::ImVec4();
-			(*variant.mutable_imvec4()).set_x(vec.x);
-			(*variant.mutable_imvec4()).set_y(vec.y);
-			(*variant.mutable_imvec4()).set_z(vec.z);
-			(*variant.mutable_imvec4()).set_w(vec.w);
-		}
-		break;
-	default:
-		break;
-	}
+	sol::stack::push(L, data);
+	std::string serialized = WriteLuaPayload(L, -1, s_payloadVectors);
+	lua_pop(L, 1);
 
-	return variant;
+	return serialized;
 }
 
 
@@ -166,20 +105,17 @@ struct LuaMessage
 {
 	const LuaDropbox* const dropbox;
 	std::shared_ptr<Message> message;
-	messaging::Variant data;
-	bool has_data = false;
 
 	LuaMessage(const LuaDropbox* const dropbox_, const std::shared_ptr<Message>& message_)
 		: dropbox(dropbox_)
 		, message(message_)
 	{
-		has_data = message && message->Payload && data.ParseFromString(*message->Payload);
 	}
 
 	sol::object Get(sol::this_state s)
 	{
-		if (has_data)
-			return DeserializeProto(data, s);
+		if (message && message->Payload)
+			return DeserializeProto(*message->Payload, s);
 
 		return sol::lua_nil;
 	}
@@ -268,6 +204,8 @@ public:
 	static std::shared_ptr<LuaDropbox> RegisterWithName(const std::string& name, const sol::function& callback, sol::this_state s);
 	static std::shared_ptr<LuaDropbox> Register(const sol::function& callback, sol::this_state s);
 	void Unregister();
+	void Subscribe(const std::string& topic) const;
+	void Unsubscribe(const std::string& topic) const;
 
 	Address ParseHeader(sol::table header) const;
 	static Address ParseHeader(sol::table header, const std::shared_ptr<LuaThread>& thread, std::string_view script_name);
@@ -379,6 +317,11 @@ Address LuaDropbox::ParseHeader(sol::table header, const std::shared_ptr<LuaThre
 	Address addr;
 	addr.Mailbox = header.get<std::optional<std::string>>("mailbox");
 	addr.AbsoluteMailbox = header.get<std::optional<bool>>("absolute_mailbox").value_or(false);
+
+	// a topic goes to every mailbox subscribed to it, so there is no mailbox to construct
+	addr.Topic = header.get<std::optional<std::string>>("topic");
+	if (addr.Topic)
+		addr.AbsoluteMailbox = true;
 	
 	// also grab the script if its available for mailbox construction
 	std::optional<std::string_view> script = header["script"];
@@ -421,6 +364,16 @@ Address LuaDropbox::ParseHeader(sol::table header, const std::shared_ptr<LuaThre
 	return addr;
 }
 
+void LuaDropbox::Subscribe(const std::string& topic) const
+{
+	m_dropbox.Subscribe(topic);
+}
+
+void LuaDropbox::Unsubscribe(const std::string& topic) const
+{
+	m_dropbox.Unsubscribe(topic);
+}
+
 void LuaDropbox::Send(sol::object payload) const
 {
 	Send(sol::state_view(payload.lua_state()).create_table(), payload);
@@ -445,7 +398,6 @@ void LuaDropbox::Send(sol::table header, sol::object payload, sol::function resp
 		{
 			callback->m_status = status;
 			callback->m_message.message = message;
-			callback->m_message.has_data = message && message->Payload && callback->m_message.data.ParseFromString(*message->Payload);
 			m_queue.push_back(std::unique_ptr<CallbackInstance>(callback));
 		});
 }
@@ -517,7 +469,6 @@ void Send(sol::table header, sol::object payload, sol::function response_callbac
 			{
 				callback->m_status = status;
 				callback->m_message.message = message;
-				callback->m_message.has_data = message && message->Payload && callback->m_message.data.ParseFromString(*message->Payload);
 				s_queue.push_back(std::unique_ptr<CallbackInstance>(callback));
 			});
 	}
@@ -580,6 +531,8 @@ sol::table LuaActors::RegisterLua(sol::state_view s)
 			sol::resolve<void(sol::object, sol::function)>(&LuaDropbox::Send),
 			sol::resolve<void(sol::table, sol::object) const>(&LuaDropbox::Send),
 			sol::resolve<void(sol::table, sol::object, sol::function)>(&LuaDropbox::Send)),
+		"subscribe", &LuaDropbox::Subscribe,
+		"unsubscribe", &LuaDropbox::Unsubscribe,
 		"unregister", &LuaDropbox::Unregister);
 
 	actors.new_usertype<LuaMessage>(
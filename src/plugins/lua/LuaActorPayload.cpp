@@ -0,0 +1,655 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "LuaActorPayload.h"
+
+#include "Actor.pb.h"
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+#include <lua.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace mq::lua {
+
+namespace messaging = proto::lua::actor;
+
+// Lua values are written straight from the lua stack into the outgoing buffer and read straight
+// from the wire back onto the lua stack. The bytes are exactly what a serialized messaging::Variant
+// looks like, so C++ actors can still use Actor.proto to read and write them, but no intermediate
+// Variant, Table or Map objects are ever built.
+
+using google::protobuf::internal::WireFormatLite;
+using google::protobuf::io::CodedInputStream;
+using google::protobuf::io::CodedOutputStream;
+
+// map<K, V> entries are messages with the key in field 1 and the value in field 2
+constexpr int MAP_KEY_FIELD = 1;
+constexpr int MAP_VALUE_FIELD = 2;
+
+constexpr uint32_t MakeTag(int field, WireFormatLite::WireType type)
+{
+	return WireFormatLite::MakeTag(field, type);
+}
+
+constexpr uint32_t TAG_NUMBER = MakeTag(messaging::Variant::kNumberFieldNumber, WireFormatLite::WIRETYPE_FIXED64);
+constexpr uint32_t TAG_BOOLEAN = MakeTag(messaging::Variant::kBooleanFieldNumber, WireFormatLite::WIRETYPE_VARINT);
+constexpr uint32_t TAG_STR = MakeTag(messaging::Variant::kStrFieldNumber, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+constexpr uint32_t TAG_TABLE = MakeTag(messaging::Variant::kTableFieldNumber, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+constexpr uint32_t TAG_IMVEC2 = MakeTag(messaging::Variant::kImvec2FieldNumber, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+constexpr uint32_t TAG_IMVEC4 = MakeTag(messaging::Variant::kImvec4FieldNumber, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+constexpr uint32_t TAG_ENTRIES = MakeTag(messaging::Table::kEntriesFieldNumber, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+constexpr uint32_t TAG_ARR = MakeTag(messaging::Table::kArrFieldNumber, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+constexpr uint32_t TAG_STRING_KEY = MakeTag(MAP_KEY_FIELD, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+constexpr uint32_t TAG_NUMBER_KEY = MakeTag(MAP_KEY_FIELD, WireFormatLite::WIRETYPE_VARINT);
+constexpr uint32_t TAG_VALUE = MakeTag(MAP_VALUE_FIELD, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+
+// the sizes of the ImVec messages, with every component set
+constexpr uint32_t IMVEC2_SIZE = 2 * (1 + sizeof(float));
+constexpr uint32_t IMVEC4_SIZE = 4 * (1 + sizeof(float));
+
+static uint32_t VarintSize(uint32_t value)
+{
+	return static_cast<uint32_t>(CodedOutputStream::VarintSize32(value));
+}
+
+// size of a length delimited field (with a one byte tag) holding size bytes
+static uint32_t DelimitedSize(uint32_t size)
+{
+	return 1 + VarintSize(size) + size;
+}
+
+static int AbsoluteIndex(lua_State* L, int index)
+{
+	return index < 0 && index > LUA_REGISTRYINDEX ? lua_gettop(L) + index + 1 : index;
+}
+
+/**
+ * Writes a lua value as a serialized Variant.
+ *
+ * This takes two passes over the value. The first measures every table, since each message on the
+ * wire is prefixed by its size, and the second writes the bytes into a buffer of exactly the right
+ * size. Both passes visit tables in the same order, so the second just consumes the sizes measured
+ * by the first.
+ *
+ * Values that a Variant can't hold (functions, other userdata, ...), keys that aren't strings or
+ * whole numbers that fit in 32 bits, and tables that would recurse into themselves are skipped.
+ * Empty tables are sent as nothing at all, which arrives as nil.
+ */
+class VariantWriter
+{
+public:
+	VariantWriter(lua_State* L, const LuaPayloadVectors& vectors) : m_L(L), m_vectors(vectors) {}
+
+	std::string Write(int index)
+	{
+		index = AbsoluteIndex(m_L, index);
+
+		// walking each level of tables takes a key and a value on the stack
+		if (!lua_checkstack(m_L, 2 * MAX_VARIANT_DEPTH + 2))
+			return std::string();
+
+		const uint32_t size = Measure(index, 0);
+
+		std::string output(size, '\0');
+		if (size > 0)
+		{
+			m_next = 0;
+			uint8_t* target = WriteValue(index, 0, reinterpret_cast<uint8_t*>(output.data()));
+			assert(target == reinterpret_cast<uint8_t*>(output.data()) + size);
+		}
+
+		return output;
+	}
+
+private:
+	enum class Kind { None, Number, Boolean, String, Table, ImVec2, ImVec4 };
+
+	struct TableSize
+	{
+		uint32_t size;              // the size of the Table message
+		size_t end;                 // the first slot after the ones for this table's children
+	};
+
+	Kind GetKind(int index) const
+	{
+		switch (lua_type(m_L, index))
+		{
+		case LUA_TNUMBER: return Kind::Number;
+		case LUA_TBOOLEAN: return Kind::Boolean;
+		case LUA_TSTRING: return Kind::String;
+		case LUA_TTABLE: return Kind::Table;
+		case LUA_TUSERDATA:
+		{
+			float components[4];
+			if (m_vectors.getVec2 != nullptr && m_vectors.getVec2(m_L, index, components))
+				return Kind::ImVec2;
+			if (m_vectors.getVec4 != nullptr && m_vectors.getVec4(m_L, index, components))
+				return Kind::ImVec4;
+			return Kind::None;
+		}
+		default: return Kind::None;
+		}
+	}
+
+	// tables that will be walked (and so have a slot) are the ones that don't lead back to
+	// a table we're already inside of, and aren't nested too deeply
+	bool CanWalk(int index, int depth) const
+	{
+		if (depth >= MAX_VARIANT_DEPTH)
+			return false;
+
+		const void* table = lua_topointer(m_L, index);
+		return std::find(m_tables.begin(), m_tables.end(), table) == m_tables.end();
+	}
+
+	// the size of the key (tag included) of the entry on top of the stack, or 0 if the key is
+	// not something that can be sent. Uses the key at -2 when called inside lua_next.
+	uint32_t KeySize(bool& stringKey, uint32_t& numberKey) const
+	{
+		if (lua_type(m_L, -2) == LUA_TSTRING)
+		{
+			stringKey = true;
+			return DelimitedSize(static_cast<uint32_t>(lua_objlen(m_L, -2)));
+		}
+
+		if (lua_type(m_L, -2) == LUA_TNUMBER)
+		{
+			const lua_Number key = lua_tonumber(m_L, -2);
+			if (key >= 0 && key <= static_cast<lua_Number>(UINT32_MAX) && key == std::floor(key))
+			{
+				stringKey = false;
+				numberKey = static_cast<uint32_t>(key);
+				return 1 + VarintSize(numberKey);
+			}
+		}
+
+		return 0;
+	}
+
+	// size of the Variant for a value that isn't a table
+	uint32_t ScalarSize(Kind kind, int index) const
+	{
+		switch (kind)
+		{
+		case Kind::Number: return 1 + sizeof(double);
+		case Kind::Boolean: return 2;
+		case Kind::String: return DelimitedSize(static_cast<uint32_t>(lua_objlen(m_L, index)));
+		case Kind::ImVec2: return DelimitedSize(IMVEC2_SIZE);
+		case Kind::ImVec4: return DelimitedSize(IMVEC4_SIZE);
+		default: return 0;
+		}
+	}
+
+	// first pass: returns the size of the Variant for the value at index, recording table sizes
+	uint32_t Measure(int index, int depth)
+	{
+		const Kind kind = GetKind(index);
+		if (kind != Kind::Table)
+			return ScalarSize(kind, index);
+
+		if (!CanWalk(index, depth))
+			return 0;
+
+		const size_t slot = m_sizes.size();
+		m_sizes.push_back({ 0, 0 });
+		m_tables.push_back(lua_topointer(m_L, index));
+
+		uint32_t tableSize = 0;
+		lua_pushnil(m_L);
+		while (lua_next(m_L, index) != 0)
+		{
+			bool stringKey;
+			uint32_t numberKey;
+			if (const uint32_t keySize = KeySize(stringKey, numberKey))
+			{
+				if (const uint32_t valueSize = Measure(lua_gettop(m_L), depth + 1))
+					tableSize += DelimitedSize(keySize + DelimitedSize(valueSize));
+			}
+
+			lua_pop(m_L, 1);
+		}
+
+		m_tables.pop_back();
+		m_sizes[slot] = { tableSize, m_sizes.size() };
+
+		return tableSize > 0 ? DelimitedSize(tableSize) : 0;
+	}
+
+	// second pass: the size of the Variant for the value at index, from the first pass
+	uint32_t MeasuredSize(Kind kind, int index, int depth) const
+	{
+		if (kind != Kind::Table)
+			return ScalarSize(kind, index);
+
+		if (!CanWalk(index, depth))
+			return 0;
+
+		const uint32_t tableSize = m_sizes[m_next].size;
+		return tableSize > 0 ? DelimitedSize(tableSize) : 0;
+	}
+
+	uint8_t* WriteValue(int index, int depth, uint8_t* target)
+	{
+		const Kind kind = GetKind(index);
+		switch (kind)
+		{
+		case Kind::Number:
+			target = CodedOutputStream::WriteTagToArray(TAG_NUMBER, target);
+			return WireFormatLite::WriteDoubleNoTagToArray(lua_tonumber(m_L, index), target);
+
+		case Kind::Boolean:
+			target = CodedOutputStream::WriteTagToArray(TAG_BOOLEAN, target);
+			return WireFormatLite::WriteBoolNoTagToArray(lua_toboolean(m_L, index) != 0, target);
+
+		case Kind::String:
+		{
+			size_t length = 0;
+			const char* str = lua_tolstring(m_L, index, &length);
+
+			target = CodedOutputStream::WriteTagToArray(TAG_STR, target);
+			target = CodedOutputStream::WriteVarint32ToArray(static_cast<uint32_t>(length), target);
+			return CodedOutputStream::WriteRawToArray(str, static_cast<int>(length), target);
+		}
+
+		case Kind::ImVec2:
+		{
+			float vec[2];
+			m_vectors.getVec2(m_L, index, vec);
+
+			target = CodedOutputStream::WriteTagToArray(TAG_IMVEC2, target);
+			target = CodedOutputStream::WriteVarint32ToArray(IMVEC2_SIZE, target);
+			target = WireFormatLite::WriteFloatToArray(messaging::ImVec2::kXFieldNumber, vec[0], target);
+			return WireFormatLite::WriteFloatToArray(messaging::ImVec2::kYFieldNumber, vec[1], target);
+		}
+
+		case Kind::ImVec4:
+		{
+			float vec[4];
+			m_vectors.getVec4(m_L, index, vec);
+
+			target = CodedOutputStream::WriteTagToArray(TAG_IMVEC4, target);
+			target = CodedOutputStream::WriteVarint32ToArray(IMVEC4_SIZE, target);
+			target = WireFormatLite::WriteFloatToArray(messaging::ImVec4::kXFieldNumber, vec[0], target);
+			target = WireFormatLite::WriteFloatToArray(messaging::ImVec4::kYFieldNumber, vec[1], target);
+			target = WireFormatLite::WriteFloatToArray(messaging::ImVec4::kZFieldNumber, vec[2], target);
+			return WireFormatLite::WriteFloatToArray(messaging::ImVec4::kWFieldNumber, vec[3], target);
+		}
+
+		case Kind::Table:
+			return WriteTable(index, depth, target);
+
+		default:
+			return target;
+		}
+	}
+
+	uint8_t* WriteTable(int index, int depth, uint8_t* target)
+	{
+		if (!CanWalk(index, depth))
+			return target;
+
+		const TableSize& tableSize = m_sizes[m_next++];
+		if (tableSize.size == 0)
+		{
+			// nothing in here made it into the first pass, so skip over everything it measured
+			m_next = tableSize.end;
+			return target;
+		}
+
+		target = CodedOutputStream::WriteTagToArray(TAG_TABLE, target);
+		target = CodedOutputStream::WriteVarint32ToArray(tableSize.size, target);
+
+		m_tables.push_back(lua_topointer(m_L, index));
+
+		lua_pushnil(m_L);
+		while (lua_next(m_L, index) != 0)
+		{
+			bool stringKey;
+			uint32_t numberKey;
+			if (const uint32_t keySize = KeySize(stringKey, numberKey))
+			{
+				const int valueIndex = lua_gettop(m_L);
+				const Kind kind = GetKind(valueIndex);
+
+				if (const uint32_t valueSize = MeasuredSize(kind, valueIndex, depth + 1))
+				{
+					target = CodedOutputStream::WriteTagToArray(stringKey ? TAG_ENTRIES : TAG_ARR, target);
+					target = CodedOutputStream::WriteVarint32ToArray(keySize + DelimitedSize(valueSize), target);
+
+					if (stringKey)
+					{
+						size_t length = 0;
+						const char* key = lua_tolstring(m_L, -2, &length);
+
+						target = CodedOutputStream::WriteTagToArray(TAG_STRING_KEY, target);
+						target = CodedOutputStream::WriteVarint32ToArray(static_cast<uint32_t>(length), target);
+						target = CodedOutputStream::WriteRawToArray(key, static_cast<int>(length), target);
+					}
+					else
+					{
+						target = CodedOutputStream::WriteTagToArray(TAG_NUMBER_KEY, target);
+						target = CodedOutputStream::WriteVarint32ToArray(numberKey, target);
+					}
+
+					target = CodedOutputStream::WriteTagToArray(TAG_VALUE, target);
+					target = CodedOutputStream::WriteVarint32ToArray(valueSize, target);
+					target = WriteValue(valueIndex, depth + 1, target);
+				}
+				else if (kind == Kind::Table && CanWalk(valueIndex, depth + 1))
+				{
+					// an empty table, step over the slots it measured
+					m_next = m_sizes[m_next].end;
+				}
+			}
+
+			lua_pop(m_L, 1);
+		}
+
+		m_tables.pop_back();
+		return target;
+	}
+
+	lua_State* m_L;
+	const LuaPayloadVectors& m_vectors;
+	std::vector<TableSize> m_sizes;
+	std::vector<const void*> m_tables;
+	size_t m_next = 0;
+};
+
+/**
+ * Reads a serialized Variant straight onto the lua stack.
+ *
+ * Anything malformed fails the whole read, which leaves the stack as it was.
+ */
+class VariantReader
+{
+public:
+	VariantReader(lua_State* L, const LuaPayloadVectors& vectors) : m_L(L), m_vectors(vectors) {}
+
+	// pushes exactly one value, which is nil if the data couldn't be read
+	bool Read(std::string_view data)
+	{
+		const int top = lua_gettop(m_L);
+
+		CodedInputStream input(reinterpret_cast<const uint8_t*>(data.data()), static_cast<int>(data.size()));
+		if (!ReadVariant(input, 0) || !input.ConsumedEntireMessage())
+		{
+			lua_settop(m_L, top);
+			lua_pushnil(m_L);
+			return false;
+		}
+
+		return true;
+	}
+
+private:
+	// reads the length of a length delimited field and limits the input to it
+	static bool BeginDelimited(uint32_t tag, CodedInputStream& input, CodedInputStream::Limit& limit)
+	{
+		uint32_t length = 0;
+		if (WireFormatLite::GetTagWireType(tag) != WireFormatLite::WIRETYPE_LENGTH_DELIMITED || !input.ReadVarint32(&length))
+			return false;
+
+		// the limit is clamped to the input, and running out of input looks just like the end of
+		// the field, so a field that is cut short has to be caught here
+		if (length > static_cast<uint32_t>(std::max(input.BytesUntilLimit(), 0)))
+			return false;
+
+		limit = input.PushLimit(static_cast<int>(length));
+		return true;
+	}
+
+	static bool EndDelimited(CodedInputStream& input, CodedInputStream::Limit limit)
+	{
+		if (!input.ConsumedEntireMessage())
+			return false;
+
+		input.PopLimit(limit);
+		return true;
+	}
+
+	bool PushString(uint32_t tag, CodedInputStream& input)
+	{
+		uint32_t length = 0;
+		if (WireFormatLite::GetTagWireType(tag) != WireFormatLite::WIRETYPE_LENGTH_DELIMITED || !input.ReadVarint32(&length))
+			return false;
+
+		if (length == 0)
+		{
+			lua_pushlstring(m_L, "", 0);
+			return true;
+		}
+
+		// the input is always a single flat buffer, so strings can be pushed straight out of it
+		const void* data = nullptr;
+		int available = 0;
+		if (!input.GetDirectBufferPointer(&data, &available) || available < static_cast<int>(length))
+			return false;
+
+		lua_pushlstring(m_L, static_cast<const char*>(data), length);
+		return input.Skip(static_cast<int>(length));
+	}
+
+	// reads an ImVec2 or ImVec4 message, whose fields are the components in order
+	template <size_t Count>
+	static bool ReadFloats(uint32_t tag, CodedInputStream& input, float (&components)[Count])
+	{
+		CodedInputStream::Limit limit;
+		if (!BeginDelimited(tag, input, limit))
+			return false;
+
+		while (uint32_t field = input.ReadTag())
+		{
+			const int number = WireFormatLite::GetTagFieldNumber(field);
+			if (number >= 1 && number <= static_cast<int>(Count)
+				&& WireFormatLite::GetTagWireType(field) == WireFormatLite::WIRETYPE_FIXED32)
+			{
+				if (!WireFormatLite::ReadPrimitive<float, WireFormatLite::TYPE_FLOAT>(&input, &components[number - 1]))
+					return false;
+			}
+			else if (!WireFormatLite::SkipField(&input, field))
+			{
+				return false;
+			}
+		}
+
+		return EndDelimited(input, limit);
+	}
+
+	bool ReadVariant(CodedInputStream& input, int depth)
+	{
+		if (!lua_checkstack(m_L, 4))
+			return false;
+
+		// the last value on the wire wins, just like it would for a oneof
+		lua_pushnil(m_L);
+
+		while (uint32_t tag = input.ReadTag())
+		{
+			bool pushed = true;
+			switch (WireFormatLite::GetTagFieldNumber(tag))
+			{
+			case messaging::Variant::kNumberFieldNumber:
+			{
+				double number = 0;
+				if (WireFormatLite::GetTagWireType(tag) != WireFormatLite::WIRETYPE_FIXED64
+					|| !WireFormatLite::ReadPrimitive<double, WireFormatLite::TYPE_DOUBLE>(&input, &number))
+					return false;
+				lua_pushnumber(m_L, number);
+				break;
+			}
+
+			case messaging::Variant::kBooleanFieldNumber:
+			{
+				bool boolean = false;
+				if (WireFormatLite::GetTagWireType(tag) != WireFormatLite::WIRETYPE_VARINT
+					|| !WireFormatLite::ReadPrimitive<bool, WireFormatLite::TYPE_BOOL>(&input, &boolean))
+					return false;
+				lua_pushboolean(m_L, boolean);
+				break;
+			}
+
+			case messaging::Variant::kStrFieldNumber:
+				if (!PushString(tag, input))
+					return false;
+				break;
+
+			case messaging::Variant::kTableFieldNumber:
+			{
+				// the same limit the writer has, so anything it sends can be read
+				CodedInputStream::Limit limit;
+				if (depth >= MAX_VARIANT_DEPTH || !BeginDelimited(tag, input, limit))
+					return false;
+
+				lua_newtable(m_L);
+				if (!ReadTable(input, depth) || !EndDelimited(input, limit))
+					return false;
+				break;
+			}
+
+			case messaging::Variant::kImvec2FieldNumber:
+			{
+				float vec[2] = {};
+				if (!ReadFloats(tag, input, vec))
+					return false;
+				if (m_vectors.pushVec2 != nullptr)
+					m_vectors.pushVec2(m_L, vec);
+				else
+					lua_pushnil(m_L);
+				break;
+			}
+
+			case messaging::Variant::kImvec4FieldNumber:
+			{
+				float vec[4] = {};
+				if (!ReadFloats(tag, input, vec))
+					return false;
+				if (m_vectors.pushVec4 != nullptr)
+					m_vectors.pushVec4(m_L, vec);
+				else
+					lua_pushnil(m_L);
+				break;
+			}
+
+			default:
+				if (!WireFormatLite::SkipField(&input, tag))
+					return false;
+				pushed = false;
+				break;
+			}
+
+			if (pushed)
+				lua_replace(m_L, -2);
+		}
+
+		return true;
+	}
+
+	// reads the fields of a Table into the table on top of the stack
+	bool ReadTable(CodedInputStream& input, int depth)
+	{
+		while (uint32_t tag = input.ReadTag())
+		{
+			const int field = WireFormatLite::GetTagFieldNumber(tag);
+			if (field == messaging::Table::kEntriesFieldNumber || field == messaging::Table::kArrFieldNumber)
+			{
+				CodedInputStream::Limit limit;
+				if (!BeginDelimited(tag, input, limit)
+					|| !ReadEntry(input, field == messaging::Table::kEntriesFieldNumber, depth)
+					|| !EndDelimited(input, limit))
+					return false;
+			}
+			else if (!WireFormatLite::SkipField(&input, tag))
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// reads one map entry and sets it in the table on top of the stack
+	bool ReadEntry(CodedInputStream& input, bool stringKey, int depth)
+	{
+		// missing keys and values get their defaults, like any other map entry
+		std::string key;
+		uint32_t numberKey = 0;
+		lua_pushnil(m_L);
+
+		while (uint32_t tag = input.ReadTag())
+		{
+			const int field = WireFormatLite::GetTagFieldNumber(tag);
+			if (field == MAP_KEY_FIELD && stringKey)
+			{
+				if (WireFormatLite::GetTagWireType(tag) != WireFormatLite::WIRETYPE_LENGTH_DELIMITED
+					|| !WireFormatLite::ReadString(&input, &key))
+					return false;
+			}
+			else if (field == MAP_KEY_FIELD)
+			{
+				if (WireFormatLite::GetTagWireType(tag) != WireFormatLite::WIRETYPE_VARINT || !input.ReadVarint32(&numberKey))
+					return false;
+			}
+			else if (field == MAP_VALUE_FIELD)
+			{
+				CodedInputStream::Limit limit;
+				if (!BeginDelimited(tag, input, limit)
+					|| !ReadVariant(input, depth + 1)
+					|| !EndDelimited(input, limit))
+					return false;
+				lua_replace(m_L, -2);
+			}
+			else if (!WireFormatLite::SkipField(&input, tag))
+			{
+				return false;
+			}
+		}
+
+		if (lua_isnil(m_L, -1))
+		{
+			lua_pop(m_L, 1);
+			return true;
+		}
+
+		if (stringKey)
+			lua_pushlstring(m_L, key.data(), key.size());
+		else
+			lua_pushnumber(m_L, numberKey);
+
+		lua_insert(m_L, -2);
+		lua_rawset(m_L, -3);
+		return true;
+	}
+
+	lua_State* m_L;
+	const LuaPayloadVectors& m_vectors;
+};
+
+std::string WriteLuaPayload(lua_State* L, int index, const LuaPayloadVectors& vectors)
+{
+	return VariantWriter(L, vectors).Write(index);
+}
+
+bool ReadLuaPayload(lua_State* L, std::string_view data, const LuaPayloadVectors& vectors)
+{
+	return VariantReader(L, vectors).Read(data);
+}
+
+} // namespace mq::lua
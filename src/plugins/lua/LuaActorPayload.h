@@ -0,0 +1,67 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+
+struct lua_State;
+
+namespace mq::lua {
+
+// Tables nested deeper than this are dropped when sending and rejected when receiving
+constexpr int MAX_VARIANT_DEPTH = 64;
+
+/**
+ * How the vector userdata a Variant can hold (ImVec2 and ImVec4) is read from and pushed onto the
+ * lua stack. The payload code only knows the lua C API, so the plugin supplies these from its
+ * usertypes. Without them, userdata is skipped when writing and vectors are read as nil.
+ */
+struct LuaPayloadVectors
+{
+	// returns true and fills in the components if the value at index is that kind of vector
+	bool (*getVec2)(lua_State* L, int index, float* components) = nullptr;
+	bool (*getVec4)(lua_State* L, int index, float* components) = nullptr;
+
+	void (*pushVec2)(lua_State* L, const float* components) = nullptr;
+	void (*pushVec4)(lua_State* L, const float* components) = nullptr;
+};
+
+/**
+ * Writes a lua value as a serialized proto::lua::actor::Variant, straight from the lua stack
+ *
+ * Values that a Variant can't hold (functions, other userdata, ...), keys that aren't strings or
+ * whole numbers that fit in 32 bits, and tables that would recurse into themselves are skipped.
+ * Empty tables are sent as nothing at all, which arrives as nil.
+ *
+ * @param L the lua state holding the value
+ * @param index the stack index of the value
+ * @param vectors how to read vector userdata
+ * @return the serialized Variant
+ */
+std::string WriteLuaPayload(lua_State* L, int index, const LuaPayloadVectors& vectors = {});
+
+/**
+ * Reads a serialized proto::lua::actor::Variant straight onto the lua stack
+ *
+ * @param L the lua state to push the value to
+ * @param data the serialized Variant
+ * @param vectors how to push vector userdata
+ * @return true if the data was read. Exactly one value is pushed either way, which is nil if the
+ *         data was malformed.
+ */
+bool ReadLuaPayload(lua_State* L, std::string_view data, const LuaPayloadVectors& vectors = {});
+
+} // namespace mq::lua
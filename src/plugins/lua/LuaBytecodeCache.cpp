@@ -0,0 +1,212 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "LuaBytecodeCache.h"
+
+#include "mq/base/String.h"
+
+#include <fmt/format.h>
+
+#include <fstream>
+#include <iterator>
+
+namespace fs = std::filesystem;
+
+namespace mq::lua {
+
+//============================================================================
+
+static uint64_t HashBytes(std::string_view data)
+{
+	// FNV-1a, only used to notice that a file changed
+	uint64_t hash = 14695981039346656037ULL;
+	for (char c : data)
+	{
+		hash ^= static_cast<uint8_t>(c);
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+static bool ReadWholeFile(const fs::path& path, std::string& contents)
+{
+	std::ifstream file(path, std::ios::in | std::ios::binary);
+	if (!file)
+		return false;
+
+	contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	return !file.bad();
+}
+
+static int WriteBytecode(lua_State*, const void* data, size_t size, void* userData)
+{
+	static_cast<std::string*>(userData)->append(static_cast<const char*>(data), size);
+	return 0;
+}
+
+// Paths are case insensitive, and the same file can be spelled a few different ways.
+static std::string GetCacheKey(const fs::path& path)
+{
+	return to_lower_copy(path.lexically_normal().string());
+}
+
+//============================================================================
+
+int LuaBytecodeCache::LoadFile(lua_State* L, const std::string& path)
+{
+	std::error_code ec;
+	const fs::path filePath{ path };
+
+	auto writeTime = fs::last_write_time(filePath, ec);
+	uintmax_t size = ec ? 0 : fs::file_size(filePath, ec);
+	if (ec)
+	{
+		// Let lua report the error the usual way
+		return luaL_loadfile(L, path.c_str());
+	}
+
+	const std::string chunkName = "@" + path;
+	const std::string key = GetCacheKey(filePath);
+
+	std::scoped_lock lock(m_mutex);
+
+	auto iter = m_entries.find(key);
+	if (iter != m_entries.end() && iter->second.writeTime == writeTime && iter->second.size == size)
+	{
+		++m_stats.hits;
+		return luaL_loadbuffer(L, iter->second.bytecode.data(), iter->second.bytecode.size(), chunkName.c_str());
+	}
+
+	std::string source;
+	if (!ReadWholeFile(filePath, source))
+		return luaL_loadfile(L, path.c_str());
+
+	const uint64_t hash = HashBytes(source);
+
+	if (iter != m_entries.end())
+	{
+		if (iter->second.hash == hash)
+		{
+			// Only the timestamp changed, the bytecode is still good.
+			iter->second.writeTime = writeTime;
+			iter->second.size = size;
+
+			++m_stats.hits;
+			return luaL_loadbuffer(L, iter->second.bytecode.data(), iter->second.bytecode.size(), chunkName.c_str());
+		}
+
+		if (!m_persistDirectory.empty())
+			fs::remove(GetPersistPath(key, iter->second.hash), ec);
+
+		++m_stats.invalidations;
+		m_entries.erase(iter);
+	}
+
+	Entry entry;
+	entry.writeTime = writeTime;
+	entry.size = size;
+	entry.hash = hash;
+
+	if (!m_persistDirectory.empty() && LoadFromDisk(key, entry))
+	{
+		if (luaL_loadbuffer(L, entry.bytecode.data(), entry.bytecode.size(), chunkName.c_str()) == 0)
+		{
+			++m_stats.diskHits;
+			m_entries.emplace(key, std::move(entry));
+			return 0;
+		}
+
+		// Probably written by a different build of LuaJIT, compile it again and replace it.
+		lua_pop(L, 1);
+		entry.bytecode.clear();
+	}
+
+	int status = luaL_loadbuffer(L, source.data(), source.size(), chunkName.c_str());
+	if (status != 0)
+		return status;
+
+	++m_stats.compiles;
+
+	if (lua_dump(L, &WriteBytecode, &entry.bytecode) == 0 && !entry.bytecode.empty())
+	{
+		if (!m_persistDirectory.empty())
+			SaveToDisk(key, entry);
+
+		m_entries.emplace(key, std::move(entry));
+	}
+
+	return status;
+}
+
+void LuaBytecodeCache::SetPersistDirectory(const std::string& directory)
+{
+	std::scoped_lock lock(m_mutex);
+
+	m_persistDirectory = directory;
+	if (!m_persistDirectory.empty())
+	{
+		std::error_code ec;
+		fs::create_directories(m_persistDirectory, ec);
+	}
+}
+
+void LuaBytecodeCache::Clear()
+{
+	std::scoped_lock lock(m_mutex);
+
+	if (!m_persistDirectory.empty())
+	{
+		std::error_code ec;
+		for (const auto& [key, entry] : m_entries)
+			fs::remove(GetPersistPath(key, entry.hash), ec);
+	}
+
+	m_entries.clear();
+	m_stats = Stats{};
+}
+
+LuaBytecodeCache::Stats LuaBytecodeCache::GetStats() const
+{
+	std::scoped_lock lock(m_mutex);
+	return m_stats;
+}
+
+size_t LuaBytecodeCache::GetEntryCount() const
+{
+	std::scoped_lock lock(m_mutex);
+	return m_entries.size();
+}
+
+fs::path LuaBytecodeCache::GetPersistPath(const std::string& key, uint64_t hash) const
+{
+	// The name covers both the path and the contents, so a file that exists is always current.
+	return fs::path{ m_persistDirectory } / fmt::format("{:016x}-{:016x}.luac", HashBytes(key), hash);
+}
+
+bool LuaBytecodeCache::LoadFromDisk(const std::string& key, Entry& entry)
+{
+	return ReadWholeFile(GetPersistPath(key, entry.hash), entry.bytecode) && !entry.bytecode.empty();
+}
+
+void LuaBytecodeCache::SaveToDisk(const std::string& key, const Entry& entry)
+{
+	std::ofstream file(GetPersistPath(key, entry.hash), std::ios::out | std::ios::binary | std::ios::trunc);
+	if (file)
+		file.write(entry.bytecode.data(), entry.bytecode.size());
+}
+
+//============================================================================
+
+} // namespace mq::lua
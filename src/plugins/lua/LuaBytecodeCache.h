@@ -0,0 +1,76 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#pragma once
+
+#include <lua.hpp>
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace mq::lua {
+
+//============================================================================
+
+// Compiled bytecode for lua source files, shared by every script in the process. Scripts
+// that require the same library only compile it once, and it is only compiled again when
+// the source changes. Optionally the bytecode is also written to disk so that it survives
+// restarts.
+class LuaBytecodeCache
+{
+public:
+	struct Stats
+	{
+		uint32_t hits = 0;            // loaded from memory without reading the source
+		uint32_t diskHits = 0;        // loaded from the persisted cache
+		uint32_t compiles = 0;        // compiled from source
+		uint32_t invalidations = 0;   // cached bytecode was thrown out because the source changed
+	};
+
+	// Loads the file as a chunk and pushes it onto the stack, the same as luaL_loadfile.
+	// Returns the lua status code. On failure the error message is pushed instead.
+	int LoadFile(lua_State* L, const std::string& path);
+
+	// Directory to persist bytecode to. An empty directory keeps the cache in memory only.
+	void SetPersistDirectory(const std::string& directory);
+	const std::string& GetPersistDirectory() const { return m_persistDirectory; }
+
+	void Clear();
+
+	Stats GetStats() const;
+	size_t GetEntryCount() const;
+
+private:
+	struct Entry
+	{
+		std::filesystem::file_time_type writeTime;
+		uintmax_t size = 0;
+		uint64_t hash = 0;
+		std::string bytecode;
+	};
+
+	bool LoadFromDisk(const std::string& key, Entry& entry);
+	void SaveToDisk(const std::string& key, const Entry& entry);
+	std::filesystem::path GetPersistPath(const std::string& key, uint64_t hash) const;
+
+	mutable std::mutex m_mutex;
+	std::unordered_map<std::string, Entry> m_entries;
+	std::string m_persistDirectory;
+	Stats m_stats;
+};
+
+} // namespace mq::lua
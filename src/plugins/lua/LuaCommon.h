@@ -28,6 +28,10 @@ using CoroutineResult = std::optional<sol::protected_function_result>;
 void DebugStackTrace(lua_State* L, const char* message);
 bool DoStatus();
 
+// Benchmarks for starting scripts and registering their bindings
+extern uint32_t bmLuaScriptStart;
+extern uint32_t bmLuaBindings;
+
 using Writer = void(*)(const char*, ...);
 
 template <typename... Args>
@@ -50,6 +54,8 @@ namespace bindings {
 }
 using bindings::lua_join;
 
+class LuaBytecodeCache;
+
 class LuaEnvironmentSettings
 {
 public:
@@ -63,6 +69,12 @@ public:
 	std::vector<std::string> luaRequirePaths;
 	std::vector<std::string> dllRequirePaths;
 
+	// Shared cache for compiled lua files, or null to always load from source.
+	LuaBytecodeCache* bytecodeCache = nullptr;
+
+	// Milliseconds between checks of an mq.delay condition. Zero checks every frame.
+	uint32_t delayConditionInterval = 0;
+
 private:
 	bool m_initialized = false;
 	std::string m_packagePath;
@@ -75,15 +75,16 @@ bool LuaCoroutine::CheckCondition(std::optional<sol::function>& func)
 	if (!func)
 		return false;
 
-	try
-	{
-		auto check_thread = sol::thread::create(thread.state());
-		sol::function check(check_thread.state(), *func);
-		return check();
-	}
-	catch (sol::error& ex)
+	lua_State* L = thread.state();
+	func->push(L);
+
+	std::string error;
+	if (m_conditionThread.Check(L, error))
+		return true;
+
+	if (!error.empty())
 	{
-		LuaError("Failed to check delay condition check with error '%s'", ex.what());
+		LuaError("Failed to check delay condition check with error '%s'", error.c_str());
 		func = std::nullopt;
 	}
 
@@ -146,17 +147,22 @@ void LuaCoroutine::SetDelay(uint64_t time, std::optional<sol::function> conditio
 	{
 		luaThread->DoYield();
 		//lua_yield(coroutine.lua_state(), 0); // only yield from the current coroutine
-		m_delayTime = time;
+		m_delay.Start(time, condition.has_value(), MQGetTickCount64(), luaThread->GetDelayConditionInterval());
 		m_delayCondition = condition;
 	}
 }
 
 void LuaCoroutine::ClearDelay()
 {
-	m_delayTime = 0L;
+	m_delay.Clear();
 	m_delayCondition = std::nullopt;
 }
 
+uint64_t LuaCoroutine::GetWakeTime() const
+{
+	return m_delay.GetWakeTime();
+}
+
 bool LuaCoroutine::ShouldRun()
 {
 	if (luaThread == nullptr || luaThread->IsPaused())
@@ -165,10 +171,25 @@ bool LuaCoroutine::ShouldRun()
 	}
 
 	// check delayed status
-	if (m_delayTime <= MQGetTickCount64() || CheckCondition(m_delayCondition))
+	switch (m_delay.Update(MQGetTickCount64(), luaThread->GetDelayConditionInterval()))
 	{
+	case LuaDelayTimer::Status::Expired:
 		ClearDelay();
 		return true;
+
+	case LuaDelayTimer::Status::CheckCondition:
+		if (CheckCondition(m_delayCondition))
+		{
+			ClearDelay();
+			return true;
+		}
+
+		// a condition that failed is dropped, and the delay just runs out
+		m_delay.hasCondition = m_delayCondition.has_value();
+		break;
+
+	case LuaDelayTimer::Status::Waiting:
+		break;
 	}
 
 	return false;
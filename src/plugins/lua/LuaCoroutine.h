@@ -15,6 +15,7 @@
 #pragma once
 
 #include "LuaCommon.h"
+#include "LuaScheduler.h"
 
 #include <sol/sol.hpp>
 
@@ -28,8 +29,9 @@ struct LuaCoroutine
 
 	sol::coroutine coroutine;
 	sol::thread thread;
-	uint64_t m_delayTime = 0L;
+	LuaDelayTimer m_delay;
 	std::optional<sol::function> m_delayCondition = std::nullopt;
+	LuaConditionThread m_conditionThread;
 
 	bool CheckCondition(std::optional<sol::function>& func);
 	void Delay(sol::object delayObj, std::optional<sol::object> conditionObj, sol::state_view s);
@@ -37,6 +39,10 @@ struct LuaCoroutine
 	void ClearDelay();
 
 	bool ShouldRun();
+
+	// Tick count at which the current delay needs to be looked at again (either it expires or
+	// its condition is due to be checked).
+	uint64_t GetWakeTime() const;
 	CoroutineResult RunCoroutine();
 	CoroutineResult RunCoroutine(const std::vector<std::string>& args);
 	CoroutineResult RunCoroutine(const std::vector<sol::object>& args);
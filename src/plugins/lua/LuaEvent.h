@@ -134,6 +134,13 @@ public:
 
 	LuaThread* GetThread() const { return m_thread; }
 
+	// True if there are binds waiting to run or events/binds in progress, all of which need the
+	// thread to keep running even while the script itself is waiting on a delay.
+	bool HasPendingWork() const
+	{
+		return !m_bindsPending.empty() || !m_bindsRunning.empty() || !m_eventsRunning.empty();
+	}
+
 	void HandleBlechEvent(LuaEvent* event, BLECHVALUE* pValues);
 	void HandleBindCallback(LuaBind* bind, const char* args);
 
@@ -26,7 +26,6 @@ namespace mq::lua {
 
 LuaImGuiProcessor::LuaImGuiProcessor(const LuaThread* thread)
 	: m_thread(thread)
-	, m_imPlotContext(std::shared_ptr<ImPlotContext>(ImPlot::CreateContext(), &ImPlot::DestroyContext))
 {
 }
 
@@ -36,6 +35,10 @@ LuaImGuiProcessor::~LuaImGuiProcessor()
 
 void LuaImGuiProcessor::AddCallback(std::string_view name, sol::function callback)
 {
+	// Most scripts never draw anything, so don't create a plot context until one does.
+	if (!m_imPlotContext)
+		m_imPlotContext = std::shared_ptr<ImPlotContext>(ImPlot::CreateContext(), &ImPlot::DestroyContext);
+
 	m_imguis.emplace_back(new LuaImGui(name, m_thread->GetLuaThread(), callback));
 }
 
@@ -54,7 +57,7 @@ bool LuaImGuiProcessor::HasCallback(std::string_view name)
 
 void LuaImGuiProcessor::Pulse()
 {
-	if (m_thread->IsPaused()) return;
+	if (m_thread->IsPaused() || m_imguis.empty()) return;
 
 	// Backup context and set our own
 	ImPlotContext* context = ImPlot::GetCurrentContext();
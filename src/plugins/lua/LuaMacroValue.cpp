@@ -0,0 +1,48 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "LuaMacroValue.h"
+
+#include <lua.hpp>
+
+#include <type_traits>
+
+namespace mq::lua {
+
+int PushLuaMacroScalar(lua_State* L, const LuaMacroScalar& scalar)
+{
+	std::visit(
+		[L](const auto& value)
+		{
+			using T = std::decay_t<decltype(value)>;
+
+			if constexpr (std::is_same_v<T, std::monostate>)
+				lua_pushnil(L);
+			else if constexpr (std::is_same_v<T, bool>)
+				lua_pushboolean(L, value);
+			else if constexpr (std::is_same_v<T, const char*>)
+			{
+				if (value != nullptr)
+					lua_pushstring(L, value);
+				else
+					lua_pushnil(L);
+			}
+			else
+				lua_pushnumber(L, static_cast<lua_Number>(value));
+		}, scalar.value);
+
+	return 1;
+}
+
+} // namespace mq::lua
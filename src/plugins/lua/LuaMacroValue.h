@@ -0,0 +1,53 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <variant>
+
+struct lua_State;
+
+namespace mq::lua {
+
+/**
+ * A macro value that lua holds directly: nil, a boolean, a number or a string. These are pushed
+ * straight onto the lua stack when a TLO member is actualized, instead of being held in a
+ * sol::object (and a registry reference) on the way there.
+ *
+ * Strings are not copied. The pointer is usually into DataTypeTemp, which the next macro
+ * evaluation writes over, so a value has to be pushed before anything else is evaluated and must
+ * never be kept. The alternatives are always named explicitly when constructing one, so that
+ * nothing converts to bool by accident.
+ */
+struct LuaMacroScalar
+{
+	using Value = std::variant<std::monostate, bool, int, int64_t, uint8_t, float, double, const char*>;
+
+	Value value;
+};
+
+/**
+ * Pushes a macro value onto the lua stack, the same as sol pushes each type
+ *
+ * Numbers of every width become lua numbers (a byte is a number, not a one character string),
+ * and a null string is nil.
+ *
+ * @param L the lua state
+ * @param scalar the value to push
+ * @return the number of values pushed, which is always 1
+ */
+int PushLuaMacroScalar(lua_State* L, const LuaMacroScalar& scalar);
+
+} // namespace mq::lua
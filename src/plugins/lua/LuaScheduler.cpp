@@ -0,0 +1,108 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "LuaScheduler.h"
+
+#include <lua.hpp>
+
+#include <algorithm>
+
+namespace mq::lua {
+
+//============================================================================
+
+void LuaDelayTimer::Start(uint64_t time, bool condition, uint64_t now, uint32_t conditionInterval)
+{
+	delayTime = time;
+	hasCondition = condition;
+	nextConditionCheck = now + conditionInterval;
+}
+
+void LuaDelayTimer::Clear()
+{
+	delayTime = 0;
+	nextConditionCheck = 0;
+	hasCondition = false;
+}
+
+LuaDelayTimer::Status LuaDelayTimer::Update(uint64_t now, uint32_t conditionInterval)
+{
+	if (delayTime <= now)
+		return Status::Expired;
+
+	// conditions are only checked as often as the environment allows
+	if (hasCondition && now >= nextConditionCheck)
+	{
+		nextConditionCheck = now + conditionInterval;
+		return Status::CheckCondition;
+	}
+
+	return Status::Waiting;
+}
+
+uint64_t LuaDelayTimer::GetWakeTime() const
+{
+	if (hasCondition)
+		return std::min(delayTime, nextConditionCheck);
+
+	return delayTime;
+}
+
+//============================================================================
+
+LuaConditionThread::~LuaConditionThread()
+{
+	Reset();
+}
+
+bool LuaConditionThread::Check(lua_State* L, std::string& error)
+{
+	if (m_thread == nullptr)
+	{
+		m_owner = L;
+		m_thread = lua_newthread(L);
+		m_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+	}
+
+	lua_xmove(L, m_thread, 1);
+
+	if (lua_pcall(m_thread, 0, 1, 0) != 0)
+	{
+		const char* message = lua_tostring(m_thread, -1);
+		error = message != nullptr ? message : "unknown error";
+
+		lua_settop(m_thread, 0);
+		Reset();
+		return false;
+	}
+
+	const bool result = lua_toboolean(m_thread, -1) != 0;
+	lua_settop(m_thread, 0);
+
+	return result;
+}
+
+void LuaConditionThread::Reset()
+{
+	if (m_thread != nullptr)
+		luaL_unref(m_owner, LUA_REGISTRYINDEX, m_ref);
+
+	m_owner = nullptr;
+	m_thread = nullptr;
+	m_ref = LUA_NOREF;
+}
+
+//============================================================================
+
+} // namespace mq::lua
@@ -0,0 +1,170 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#pragma once
+
+#include <lua.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+
+namespace mq::lua {
+
+/**
+ * The timing of an mq.delay: when it runs out, and when its condition (if it has one) is
+ * checked next. Times are tick counts in milliseconds.
+ */
+struct LuaDelayTimer
+{
+	enum class Status
+	{
+		Waiting,          // nothing to do yet
+		Expired,          // the delay ran out
+		CheckCondition,   // the condition is due to be checked, the check after it is already scheduled
+	};
+
+	uint64_t delayTime = 0;
+	uint64_t nextConditionCheck = 0;
+	bool hasCondition = false;
+
+	/**
+	 * Starts a delay
+	 *
+	 * @param time the tick count the delay runs out at
+	 * @param condition true if the delay has a condition that can end it early
+	 * @param now the current tick count
+	 * @param conditionInterval milliseconds between checks of the condition, zero checks every frame
+	 */
+	void Start(uint64_t time, bool condition, uint64_t now, uint32_t conditionInterval);
+	void Clear();
+
+	bool IsActive() const { return delayTime != 0; }
+
+	/**
+	 * Looks at the delay at the current tick count
+	 *
+	 * @param now the current tick count
+	 * @param conditionInterval milliseconds between checks of the condition
+	 * @return whether the delay ran out, or its condition should be checked now
+	 */
+	Status Update(uint64_t now, uint32_t conditionInterval);
+
+	// Tick count at which the delay needs to be looked at again, either because it runs out or
+	// because its condition is due to be checked
+	uint64_t GetWakeTime() const;
+};
+
+/**
+ * The lua thread that mq.delay conditions are called on. It is created by the first check and
+ * reused for every check after that. A check that fails throws it away, so a thread that was left
+ * in an error state is never reused.
+ */
+class LuaConditionThread
+{
+public:
+	LuaConditionThread() = default;
+	~LuaConditionThread();
+
+	LuaConditionThread(const LuaConditionThread&) = delete;
+	LuaConditionThread& operator=(const LuaConditionThread&) = delete;
+
+	/**
+	 * Pops the function on top of the stack and calls it on the condition thread
+	 *
+	 * @param L the state the function is on, the condition thread is created from it
+	 * @param error set to the error if the function failed
+	 * @return the result of the function as a boolean, false if it failed
+	 */
+	bool Check(lua_State* L, std::string& error);
+
+	// Releases the condition thread, the next check creates a new one
+	void Reset();
+
+	lua_State* GetThread() const { return m_thread; }
+
+private:
+	lua_State* m_owner = nullptr;
+	lua_State* m_thread = nullptr;
+	int m_ref = LUA_NOREF;
+};
+
+/**
+ * Scripts that are parked on mq.delay, ordered by when they need to run again
+ *
+ * A script is parked with the time it needs to run again, and is woken once that time comes. A
+ * script can also be woken early (a bind came in, or it was told to exit) or be parked again for a
+ * different time, in which case the entry it had is just discarded when it comes due. The same
+ * goes for scripts that have ended. Thread needs GetParkedUntil(), Park(time) and Wake().
+ */
+template <typename Thread>
+class LuaTimerQueue
+{
+public:
+	/**
+	 * Parks a thread until its wake time
+	 *
+	 * @param thread the thread to park
+	 * @param wakeTime the tick count to wake it at
+	 */
+	void Park(const std::shared_ptr<Thread>& thread, uint64_t wakeTime)
+	{
+		thread->Park(wakeTime);
+		m_timers.push({ wakeTime, thread });
+	}
+
+	/**
+	 * Wakes every parked thread whose wake time has come, earliest first
+	 *
+	 * @param now the current tick count
+	 * @return the number of threads that were woken
+	 */
+	size_t WakeDue(uint64_t now)
+	{
+		size_t woken = 0;
+
+		while (!m_timers.empty() && m_timers.top().wakeTime <= now)
+		{
+			std::shared_ptr<Thread> thread = m_timers.top().thread.lock();
+			if (thread && thread->GetParkedUntil() == m_timers.top().wakeTime)
+			{
+				thread->Wake();
+				++woken;
+			}
+
+			m_timers.pop();
+		}
+
+		return woken;
+	}
+
+	size_t GetSize() const { return m_timers.size(); }
+	bool IsEmpty() const { return m_timers.empty(); }
+
+private:
+	struct Timer
+	{
+		uint64_t wakeTime;
+		std::weak_ptr<Thread> thread;
+
+		bool operator>(const Timer& other) const { return wakeTime > other.wakeTime; }
+	};
+
+	std::priority_queue<Timer, std::vector<Timer>, std::greater<>> m_timers;
+};
+
+} // namespace mq::lua
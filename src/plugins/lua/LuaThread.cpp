@@ -18,6 +18,8 @@
 #include "LuaEvent.h"
 #include "LuaImGui.h"
 #include "LuaActor.h"
+#include "LuaBytecodeCache.h"
+#include "LuaTimeSlice.h"
 #include "bindings/lua_Bindings.h"
 
 #include <mq/Plugin.h>
@@ -144,6 +146,10 @@ void LuaThread::Initialize()
 	bindings::RegisterBindings_Bit32(m_globalState);
 
 	m_globalState.add_package_loader(LuaThread::lua_PackageLoader);
+
+	// Lua files are searched for ahead of the standard searcher so they can come from the bytecode cache
+	sol::function insert = m_globalState["table"]["insert"];
+	insert(m_globalState["package"]["loaders"], 2, LuaThread::lua_FileLoader);
 }
 
 void LuaThread::EnableImGui()
@@ -193,11 +199,12 @@ void LuaThread::RemoveThread(uint32_t index)
 
 sol::table LuaThread::RegisterMQNamespace(sol::this_state L)
 {
+	MQScopedBenchmark bm(bmLuaBindings);
 	sol::state_view sv{ L };
 
+	// Most of the namespace is registered the first time it is used, see RegisterBindings_MQ.
 	auto mq = sv.create_table();
 	bindings::RegisterBindings_MQ(this, mq);
-	bindings::RegisterBindings_MQMacroData(mq);
 
 	return mq;
 }
@@ -233,6 +240,50 @@ int LuaThread::PackageLoader(const std::string& pkg, lua_State* L)
 	return 0;
 }
 
+sol::load_result LuaThread::LoadFile(sol::state_view sv, const std::string& path)
+{
+	LuaBytecodeCache* cache = m_luaEnvironmentSettings->bytecodeCache;
+	if (cache == nullptr)
+		return sv.load_file(path);
+
+	lua_State* L = sv.lua_state();
+	int status = cache->LoadFile(L, path);
+
+	return sol::load_result(L, sol::absolute_index(L, -1), 1, 1, static_cast<sol::load_status>(status));
+}
+
+/*static*/ int LuaThread::lua_FileLoader(lua_State* L)
+{
+	{
+		std::shared_ptr<LuaThread> thread_ptr = LuaThread::get_from(L);
+		if (!thread_ptr || thread_ptr->m_luaEnvironmentSettings->bytecodeCache == nullptr)
+			return 0;
+
+		std::string name = sol::stack::get<std::string>(L, 1);
+
+		// Nothing found falls through to the standard searcher, which reports the paths it tried
+		sol::state_view sv{ L };
+		sol::optional<sol::function> searchpath = sv["package"]["searchpath"];
+		if (!searchpath)
+			return 0;
+
+		sol::optional<std::string> path = (*searchpath)(name, sv["package"]["path"].get<std::string>());
+		if (!path)
+			return 0;
+
+		if (thread_ptr->m_luaEnvironmentSettings->bytecodeCache->LoadFile(L, *path) == 0)
+			return 1;
+
+		std::string message = fmt::format("error loading module '{}' from file '{}':\n\t{}",
+			name, *path, sol::stack::get<std::string>(L, -1));
+		lua_pop(L, 1);
+		sol::stack::push(L, message);
+	}
+
+	// raise the error after everything above has been cleaned up
+	return lua_error(L);
+}
+
 /*static*/ int LuaThread::lua_PackageLoader(lua_State* L)
 {
 	std::string pkg = sol::stack::get<std::string>(L);
@@ -291,7 +342,7 @@ std::optional<LuaThreadInfo> LuaThread::StartFile(
 	m_name = GetCanonicalScriptName(script_path, m_luaEnvironmentSettings->luaDir);
 	m_path = script_path;
 
-	auto co = m_coroutine->thread.state().load_file(script_path);
+	auto co = LoadFile(m_coroutine->thread.state(), script_path);
 	if (!co.valid())
 	{
 		sol::error err = co;
@@ -300,7 +351,7 @@ std::optional<LuaThreadInfo> LuaThread::StartFile(
 	}
 
 	m_coroutine->coroutine = co;
-	YieldAt(m_turboNum);
+	StartTimeSlice();
 
 	auto start_time = std::chrono::system_clock::now();
 	CoroutineResult result = m_coroutine->RunCoroutine(args);
@@ -363,7 +414,7 @@ std::optional<LuaThreadInfo> LuaThread::StartString(std::string_view script,
 		}
 	}
 
-	YieldAt(m_turboNum);
+	StartTimeSlice();
 
 	auto start_time = std::chrono::system_clock::now();
 	CoroutineResult result = m_coroutine->RunCoroutine();
@@ -392,7 +443,11 @@ LuaThread::RunResult LuaThread::Run()
 {
 	if (m_coroutine->coroutine.status() == sol::call_status::yielded)
 	{
-		return RunOnce();
+		auto start = std::chrono::steady_clock::now();
+		RunResult result = RunOnce();
+		RecordRunTime(std::chrono::steady_clock::now() - start);
+
+		return result;
 	}
 
 	return { static_cast<sol::thread_status>(m_coroutine->coroutine.status()), std::nullopt };
@@ -478,7 +533,7 @@ LuaThread::RunResult LuaThread::RunOnce()
 		m_eventProcessor->PrepareBinds();
 	}
 
-	YieldAt(m_turboNum);
+	StartTimeSlice();
 	m_yieldToFrame = false;
 
 	if (m_eventProcessor)
@@ -494,6 +549,7 @@ LuaThread::RunResult LuaThread::RunOnce()
 
 	if (!m_yieldToFrame)
 	{
+		++m_resumeCount;
 		CoroutineResult result = m_coroutine->RunCoroutine();
 		sol::thread_status status = result ? static_cast<sol::thread_status>(result->status()) : sol::thread_status::dead;
 		DataTypeTemp.pop_buffer();
@@ -510,11 +566,28 @@ LuaThread::RunResult LuaThread::RunOnce()
 	return { m_coroutine->thread.status(), std::nullopt };
 }
 
+bool LuaThread::HasPendingWork() const
+{
+	// a script that was told to exit needs to run once more to finish
+	if (!m_coroutine->thread.valid())
+		return true;
+
+	return m_eventProcessor && m_eventProcessor->HasPendingWork();
+}
+
+uint64_t LuaThread::GetWakeTime() const
+{
+	if (!m_coroutine->m_delay.IsActive() || HasPendingWork())
+		return 0;
+
+	return m_coroutine->GetWakeTime();
+}
+
 LuaThreadStatus LuaThread::Pause()
 {
 	if (m_paused)
 	{
-		YieldAt(m_turboNum);
+		StartTimeSlice();
 
 		WriteChatStatus("Resuming paused lua script '%s' with PID %d", m_name.c_str(), m_pid);
 		m_paused = false;
@@ -544,6 +617,10 @@ void LuaThread::SetAllowYield(bool allowYield, YieldDisabledReason reason)
 	{
 		if (std::shared_ptr<LuaThread> thread_ptr = get_from(L))
 		{
+			// the count hook only yields once the time slice is used up
+			if (D->event == LUA_HOOKCOUNT && !thread_ptr->CheckTimeSlice(L))
+				return;
+
 			thread_ptr->m_yieldToFrame = true;
 		}
 
@@ -564,6 +641,47 @@ void LuaThread::YieldAt(int count) const
 	}
 }
 
+void LuaThread::StartTimeSlice()
+{
+	auto now = std::chrono::steady_clock::now();
+
+	m_sliceDeadline = now + m_timeSlice;
+	m_lastHookTime = now;
+
+	YieldAt(m_timeSlice.count() > 0 ? m_hookInterval : static_cast<int>(m_turboNum));
+}
+
+// Returns true if the script has used up its time slice and should yield.
+bool LuaThread::CheckTimeSlice(lua_State* L)
+{
+	if (m_timeSlice.count() <= 0)
+		return true;
+
+	auto now = std::chrono::steady_clock::now();
+	if (now >= m_sliceDeadline)
+		return true;
+
+	int interval = GetHookInterval(m_hookInterval, now - m_lastHookTime);
+	m_lastHookTime = now;
+
+	if (interval != m_hookInterval)
+	{
+		m_hookInterval = interval;
+		lua_sethook(L, &LuaThread::lua_forceYield, LUA_MASKCOUNT, m_hookInterval);
+	}
+
+	return false;
+}
+
+void LuaThread::RecordRunTime(std::chrono::nanoseconds runTime)
+{
+	m_cpuTime += runTime;
+
+	// smooth over the last few dozen frames
+	double frameTime = std::chrono::duration<double, std::micro>(runTime).count();
+	m_averageFrameTime += (frameTime - m_averageFrameTime) * 0.05;
+}
+
 //============================================================================
 
 bool LuaThread::AddTopLevelObject(const char* name, MQTopLevelObjectFunction func)
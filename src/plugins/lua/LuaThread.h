@@ -127,7 +127,28 @@ public:
 	char buffer[SGlobalBuffer::bufferSize] = { 0 };
 
 	void InjectMQNamespace();
-	void SetTurbo(uint32_t turboVal) { m_turboNum = turboVal; }
+	void SetTurbo(uint32_t turboVal) { m_turboNum = turboVal; m_hookInterval = static_cast<int>(turboVal); }
+
+	// Wall clock time the script may run each frame before it is yielded. Zero yields after
+	// the turbo instruction count instead.
+	void SetTimeSlice(std::chrono::microseconds timeSlice) { m_timeSlice = timeSlice; }
+	std::chrono::microseconds GetTimeSlice() const { return m_timeSlice; }
+
+	// Time spent running the script, in total and averaged over recent frames.
+	std::chrono::nanoseconds GetCPUTime() const { return m_cpuTime; }
+	std::chrono::microseconds GetAverageFrameTime() const { return std::chrono::microseconds(static_cast<int64_t>(m_averageFrameTime)); }
+	int GetHookInterval() const { return m_hookInterval; }
+
+	// Scheduling. A script that is waiting on mq.delay with nothing else to do is parked until its
+	// wake time and isn't run at all in the meantime.
+	uint64_t GetWakeTime() const;
+	bool HasPendingWork() const;
+	uint64_t GetParkedUntil() const { return m_parkedUntil; }
+	void Park(uint64_t wakeTime) { m_parkedUntil = wakeTime; }
+	void Wake() { m_parkedUntil = 0; ++m_wakeCount; }
+	uint32_t GetWakeCount() const { return m_wakeCount; }
+	uint32_t GetResumeCount() const { return m_resumeCount; }
+	uint32_t GetDelayConditionInterval() const { return m_luaEnvironmentSettings->delayConditionInterval; }
 	void SetEvaluateResult(bool evaluate) { m_evaluateResult = evaluate; }
 	bool GetEvaluateResult() const { return m_evaluateResult; }
 
@@ -197,10 +218,15 @@ private:
 	void Initialize();
 
 	void YieldAt(int count) const;
+	void StartTimeSlice();
+	bool CheckTimeSlice(lua_State* L);
+	void RecordRunTime(std::chrono::nanoseconds runTime);
 
 	int PackageLoader(const std::string& pkg, lua_State* L);
+	sol::load_result LoadFile(sol::state_view sv, const std::string& path);
 
 	static int lua_PackageLoader(lua_State* L);
+	static int lua_FileLoader(lua_State* L);
 	static void lua_forceYield(lua_State* L, lua_Debug* D);
 
 private:
@@ -218,6 +244,20 @@ private:
 	uint32_t m_pid = 0;
 	uint32_t m_turboNum = 500;
 	bool m_yieldToFrame = false;
+
+	// time slicing
+	std::chrono::microseconds m_timeSlice{ 0 };
+	std::chrono::steady_clock::time_point m_sliceDeadline;
+	std::chrono::steady_clock::time_point m_lastHookTime;
+	int m_hookInterval = 500;
+	std::chrono::nanoseconds m_cpuTime{ 0 };
+	double m_averageFrameTime = 0.0;
+
+	// scheduling
+	uint64_t m_parkedUntil = 0;
+	uint32_t m_wakeCount = 0;
+	uint32_t m_resumeCount = 0;
+
 	bool m_isString = false;
 	bool m_paused = false;
 	bool m_evaluateResult = false;
@@ -0,0 +1,39 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "LuaTimeSlice.h"
+
+#include <cstdint>
+
+namespace mq::lua {
+
+std::chrono::microseconds GetTimeSlice(std::chrono::microseconds frameBudget, std::chrono::nanoseconds used, size_t scriptsLeft)
+{
+	if (frameBudget.count() <= 0)
+		return std::chrono::microseconds{ 0 };
+
+	const auto left = frameBudget - std::chrono::duration_cast<std::chrono::microseconds>(used);
+	return std::max(left / static_cast<int64_t>(std::max<size_t>(scriptsLeft, 1)), MIN_TIME_SLICE);
+}
+
+int GetHookInterval(int interval, std::chrono::nanoseconds elapsed)
+{
+	if (elapsed.count() <= 0)
+		return interval;
+
+	const int64_t target = static_cast<int64_t>(interval) * std::chrono::nanoseconds(HOOK_CHECK_PERIOD).count() / elapsed.count();
+	return static_cast<int>(std::clamp<int64_t>((interval + target) / 2, MIN_HOOK_INTERVAL, MAX_HOOK_INTERVAL));
+}
+
+} // namespace mq::lua
@@ -0,0 +1,73 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+namespace mq::lua {
+
+// The least time a script gets each frame, even once the frame's budget is spent
+constexpr std::chrono::microseconds MIN_TIME_SLICE{ 50 };
+
+// How often the count hook should check the clock while a script is inside its time slice
+constexpr std::chrono::microseconds HOOK_CHECK_PERIOD{ 25 };
+constexpr int MIN_HOOK_INTERVAL = 100;
+constexpr int MAX_HOOK_INTERVAL = 1'000'000;
+
+/**
+ * The time slice of the next script to run in a frame
+ *
+ * Each script gets an even share of what is left of the frame's budget when it runs, so scripts
+ * that finish early leave more for the ones after them. A script that finds the budget already
+ * spent still gets MIN_TIME_SLICE, so that every script runs every frame.
+ *
+ * @param frameBudget the lua time for the whole frame, zero to yield on the instruction count instead
+ * @param used the time the frame's scripts have run so far
+ * @param scriptsLeft the scripts still to run this frame, including this one
+ * @return the script's time slice, zero if there is no budget
+ */
+std::chrono::microseconds GetTimeSlice(std::chrono::microseconds frameBudget, std::chrono::nanoseconds used, size_t scriptsLeft);
+
+/**
+ * The number of instructions between the count hook's next clock checks
+ *
+ * Scales the interval by how long the last batch of instructions took, so that checks land about
+ * every HOOK_CHECK_PERIOD. The time includes whatever the script called (TLOs and such), so
+ * scripts that make expensive calls are checked more often than scripts that just crunch numbers.
+ * Moves halfway to the target each time, so that one slow call doesn't throw it off.
+ *
+ * @param interval the current interval
+ * @param elapsed how long the last interval's instructions took
+ * @return the new interval, between MIN_HOOK_INTERVAL and MAX_HOOK_INTERVAL
+ */
+int GetHookInterval(int interval, std::chrono::nanoseconds elapsed);
+
+/**
+ * Rotates the order scripts run in, once per frame, so that it isn't always the same scripts
+ * that run last and get what is left of the budget
+ */
+template <typename T>
+void RotateRunOrder(std::vector<T>& running)
+{
+	if (running.size() > 1)
+	{
+		std::rotate(running.begin(), running.begin() + 1, running.end());
+	}
+}
+
+} // namespace mq::lua
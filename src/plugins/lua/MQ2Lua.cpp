@@ -19,6 +19,9 @@
 #include "LuaThread.h"
 #include "LuaEvent.h"
 #include "LuaActor.h"
+#include "LuaBytecodeCache.h"
+#include "LuaScheduler.h"
+#include "LuaTimeSlice.h"
 #include "LuaImGui.h"
 #include "bindings/lua_Bindings.h"
 #include "imgui/ImGuiUtils.h"
@@ -51,6 +54,8 @@ namespace mq::lua {
 
 // provide option strings here
 static const std::string KEY_TURBO_NUM = "turboNum";
+static const std::string KEY_TURBO_BUDGET = "turboBudget";
+static const std::string KEY_DELAY_CONDITION_INTERVAL = "delayConditionInterval";
 static const std::string KEY_LUA_DIR = "luaDir";
 static const std::string KEY_MODULE_DIR = "moduleDir";
 static const std::string KEY_LUA_REQUIRE_PATHS = "luaRequirePaths";
@@ -58,12 +63,16 @@ static const std::string KEY_DLL_REQUIRE_PATHS = "dllRequirePaths";
 static const std::string KEY_INFO_GC = "infoGC";
 static const std::string KEY_SQUELCH_STATUS = "squelchStatus";
 static const std::string KEY_SHOW_MENU = "showMenu";
+static const std::string KEY_BYTECODE_CACHE = "bytecodeCache";
+static const std::string KEY_PERSIST_BYTECODE_CACHE = "persistBytecodeCache";
 
 // configurable options, defaults provided where needed
 static uint32_t s_turboNum = 500;
+static uint32_t s_turboBudget = 2000; // microseconds of lua per frame, shared by all running scripts
 static std::string s_luaDirName = "lua";
 static std::string s_moduleDirName = "modules";
 static LuaEnvironmentSettings s_environment;
+static LuaBytecodeCache s_bytecodeCache;
 static std::chrono::milliseconds s_infoGC = 3600s; // 1 hour
 static bool s_squelchStatus = false;
 static bool s_verboseErrors = true;
@@ -85,6 +94,12 @@ std::vector<std::shared_ptr<LuaThread>> s_pending;
 
 std::unordered_map<uint32_t, LuaThreadInfo> s_infoMap;
 
+// Scripts that are parked on mq.delay, ordered by when they need to run again
+static LuaTimerQueue<LuaThread> s_timers;
+
+uint32_t bmLuaScriptStart = 0;
+uint32_t bmLuaBindings = 0;
+
 #pragma region Shared Function Definitions
 
 void DebugStackTrace(lua_State* L, const char* message)
@@ -582,6 +597,7 @@ static uint32_t LuaRunCommand(const std::string& script, const std::vector<std::
 		s_infoMap.erase(info_it);
 	}
 
+	MQScopedBenchmark bm(bmLuaScriptStart);
 	std::shared_ptr<LuaThread> entry = LuaThread::Create(&s_environment);
 	entry->SetTurbo(s_turboNum);
 	entry->EnableEvents();
@@ -623,6 +639,7 @@ static uint32_t LuaParseCommand(const std::string& script, std::string_view name
 	}
 
 	// Create LuaThread with mq namespace already injected.
+	MQScopedBenchmark bm(bmLuaScriptStart);
 	std::shared_ptr<LuaThread> entry = LuaThread::Create(&s_environment);
 	entry->SetTurbo(s_turboNum);
 	entry->InjectMQNamespace();
@@ -836,6 +853,16 @@ void SetModuleDirName(const std::string& moduleDir)
 	s_configNode[KEY_MODULE_DIR] = s_moduleDirName;
 }
 
+static void ApplyBytecodeCacheSettings()
+{
+	s_environment.bytecodeCache = s_configNode[KEY_BYTECODE_CACHE].as<bool>(true) ? &s_bytecodeCache : nullptr;
+
+	if (s_configNode[KEY_PERSIST_BYTECODE_CACHE].as<bool>(false))
+		s_bytecodeCache.SetPersistDirectory((std::filesystem::path(gPathResources) / "LuaCache").string());
+	else
+		s_bytecodeCache.SetPersistDirectory({});
+}
+
 static void WriteSettings()
 {
 	std::fstream file(s_configPath, std::ios::out);
@@ -870,6 +897,8 @@ static void ReadSettings()
 		}
 	}
 
+	s_turboBudget = s_configNode[KEY_TURBO_BUDGET].as<uint32_t>(s_turboBudget);
+	s_environment.delayConditionInterval = s_configNode[KEY_DELAY_CONDITION_INTERVAL].as<uint32_t>(s_environment.delayConditionInterval);
 	s_verboseErrors = s_configNode["verboseErrors"].as<bool>(false);
 
 	std::string tempDirName = s_luaDirName;
@@ -940,6 +969,8 @@ static void ReadSettings()
 
 	s_squelchStatus = s_configNode[KEY_SQUELCH_STATUS].as<bool>(s_squelchStatus);
 	s_showMenu = s_configNode[KEY_SHOW_MENU].as<bool>(s_showMenu);
+
+	ApplyBytecodeCacheSettings();
 }
 
 static void LuaConfCommand(const std::string& setting, const std::string& value)
@@ -1398,6 +1429,31 @@ static void DrawLuaSettings()
 		s_configNode["verboseErrors"] = s_verboseErrors;
 	}
 
+	bool bytecodeCache = s_configNode[KEY_BYTECODE_CACHE].as<bool>(true);
+	if (ImGui::Checkbox("Cache Compiled Lua Files", &bytecodeCache))
+	{
+		s_configNode[KEY_BYTECODE_CACHE] = bytecodeCache;
+		ApplyBytecodeCacheSettings();
+	}
+
+	ImGui::BeginDisabled(!bytecodeCache);
+	bool persistBytecodeCache = s_configNode[KEY_PERSIST_BYTECODE_CACHE].as<bool>(false);
+	if (ImGui::Checkbox("Save Compiled Lua Files to Disk", &persistBytecodeCache))
+	{
+		s_configNode[KEY_PERSIST_BYTECODE_CACHE] = persistBytecodeCache;
+		ApplyBytecodeCacheSettings();
+	}
+
+	LuaBytecodeCache::Stats stats = s_bytecodeCache.GetStats();
+	ImGui::TextDisabled("%d files cached: %u hits, %u loaded from disk, %u compiled, %u invalidated",
+		static_cast<int>(s_bytecodeCache.GetEntryCount()), stats.hits, stats.diskHits, stats.compiles, stats.invalidations);
+	ImGui::SameLine();
+	if (ImGui::SmallButton("Clear"))
+	{
+		s_bytecodeCache.Clear();
+	}
+	ImGui::EndDisabled();
+
 	ImGui::NewLine();
 
 	ImGui::Text("Turbo Num:");
@@ -1409,6 +1465,27 @@ static void DrawLuaSettings()
 		s_configNode[KEY_TURBO_NUM] = s_turboNum;
 	}
 
+	ImGui::Text("Turbo Budget:");
+	uint32_t budget_selected = s_configNode[KEY_TURBO_BUDGET].as<uint32_t>(s_turboBudget), budget_min = 0U, budget_max = 10000U;
+	ImGui::SetNextItemWidth(-1.0f);
+	if (ImGui::SliderScalar("##turboBudgetslider", ImGuiDataType_U32, &budget_selected, &budget_min, &budget_max,
+		budget_selected == 0 ? "Off (Turbo Num only)" : "%u us per Frame", ImGuiSliderFlags_None))
+	{
+		s_turboBudget = budget_selected;
+		s_configNode[KEY_TURBO_BUDGET] = s_turboBudget;
+	}
+	ImGui::TextDisabled("Shared by all running scripts. Turbo Num is how often a script starts out checking the time.");
+
+	ImGui::Text("Delay Condition Interval:");
+	uint32_t interval_selected = s_configNode[KEY_DELAY_CONDITION_INTERVAL].as<uint32_t>(s_environment.delayConditionInterval), interval_min = 0U, interval_max = 1000U;
+	ImGui::SetNextItemWidth(-1.0f);
+	if (ImGui::SliderScalar("##delayConditionslider", ImGuiDataType_U32, &interval_selected, &interval_min, &interval_max,
+		interval_selected == 0 ? "Every Frame" : "%u ms between mq.delay Condition Checks", ImGuiSliderFlags_None))
+	{
+		s_environment.delayConditionInterval = interval_selected;
+		s_configNode[KEY_DELAY_CONDITION_INTERVAL] = s_environment.delayConditionInterval;
+	}
+
 
 	ImGui::Text("Lua Directory:");
 	auto dirDisplay = s_configNode[KEY_LUA_DIR].as<std::string>(s_luaDirName);
@@ -1678,6 +1755,9 @@ PLUGIN_API void InitializePlugin()
 
 	s_pluginInterface = new LuaPluginInterfaceImpl();
 
+	bmLuaScriptStart = AddMQ2Benchmark("Lua Script Start");
+	bmLuaBindings = AddMQ2Benchmark("Lua Bindings");
+
 	bindings::InitializeBindings_MQMacroData();
 
 	LuaActors::Start();
@@ -1691,6 +1771,9 @@ PLUGIN_API void ShutdownPlugin()
 
 	bindings::ShutdownBindings_MQMacroData();
 
+	RemoveMQ2Benchmark(bmLuaScriptStart);
+	RemoveMQ2Benchmark(bmLuaBindings);
+
 	RemoveCommand("/lua");
 
 	RemoveMQ2Data("Lua");
@@ -1718,9 +1801,34 @@ PLUGIN_API void OnPulse()
 		s_pending.clear();
 	}
 
+	// Split the frame's budget between the running scripts (see GetTimeSlice), in an order that
+	// rotates each frame.
+	RotateRunOrder(s_running);
+
+	const uint64_t now = MQGetTickCount64();
+	s_timers.WakeDue(now);
+
+	const auto frameStart = std::chrono::steady_clock::now();
+	const std::chrono::microseconds frameBudget{ s_turboBudget };
+	size_t scriptsLeft = s_running.size();
+
 	s_running.erase(std::remove_if(s_running.begin(), s_running.end(),
-		[](const std::shared_ptr<LuaThread>& thread) -> bool
+		[&](const std::shared_ptr<LuaThread>& thread) -> bool
 		{
+			if (thread->GetParkedUntil() != 0)
+			{
+				if (!thread->HasPendingWork())
+				{
+					--scriptsLeft;
+					return false;
+				}
+
+				thread->Wake();
+			}
+
+			thread->SetTimeSlice(GetTimeSlice(frameBudget, std::chrono::steady_clock::now() - frameStart, scriptsLeft));
+			--scriptsLeft;
+
 			LuaThread::RunResult result = thread->Run();
 
 			if (result.first != sol::thread_status::yielded)
@@ -1729,6 +1837,12 @@ PLUGIN_API void OnPulse()
 				return true;
 			}
 
+			uint64_t wakeTime = thread->GetWakeTime();
+			if (wakeTime > now)
+			{
+				s_timers.Park(thread, wakeTime);
+			}
+
 			return false;
 		}), s_running.end());
 
@@ -1882,6 +1996,21 @@ PLUGIN_API void OnUpdateImGui()
 			std::string_view status = info.status_string();
 			ImGui::LabelText("Status", "%.*s", status.size(), status.data());
 
+			auto threadIter = std::find_if(s_running.begin(), s_running.end(),
+				[&info](const std::shared_ptr<LuaThread>& thread) { return thread->GetPID() == info.pid; });
+			if (threadIter != s_running.end())
+			{
+				const std::shared_ptr<LuaThread>& thread = *threadIter;
+				double cpuTime = std::chrono::duration<double, std::milli>(thread->GetCPUTime()).count();
+				double runTime = std::chrono::duration<double, std::milli>(std::chrono::system_clock::now() - info.startTime).count();
+
+				ImGui::LabelText("CPU Time", "%.1f ms (%.2f%%)", cpuTime, runTime > 0 ? cpuTime * 100.0 / runTime : 0.0);
+				ImGui::LabelText("Frame Time", "%lld us avg, %lld us slice",
+					static_cast<long long>(thread->GetAverageFrameTime().count()), static_cast<long long>(thread->GetTimeSlice().count()));
+				ImGui::LabelText("Scheduling", "%u resumes, %u timer wakes%s", thread->GetResumeCount(), thread->GetWakeCount(),
+					thread->GetParkedUntil() != 0 ? " (sleeping)" : "");
+			}
+
 			if (!info.returnValues.empty())
 			{
 				ImGui::LabelText("Return Values", "%s", join(info.returnValues, ", ").c_str());
@@ -2074,10 +2203,20 @@ PLUGIN_API PluginInterface* GetPluginInterface()
 	return mq::lua::s_pluginInterface;
 }
 
+PLUGIN_API void OnLoadPlugin(const char* pluginName)
+{
+	using namespace mq::lua;
+
+	// the plugin may have added datatypes or extended existing ones
+	bindings::ClearMacroDataMemberCache();
+}
+
 PLUGIN_API void OnUnloadPlugin(const char* pluginName)
 {
 	using namespace mq::lua;
 
+	bindings::ClearMacroDataMemberCache();
+
 	// Visit all of our currently running scripts and terminate any that might be utilizing this plugin as a dependency.
 	MQPlugin* plugin = GetPlugin(pluginName);
 
@@ -29,5 +29,6 @@ sol::table RegisterBindings_ImPlot(sol::this_state L);
 void RegisterBindings_MQMacroData(sol::table& lua);
 void InitializeBindings_MQMacroData();
 void ShutdownBindings_MQMacroData();
+void ClearMacroDataMemberCache();
 
 } // namespace mq::lua::bindings
@@ -23,6 +23,9 @@
 
 #include <mq/Plugin.h>
 
+#include <array>
+#include <unordered_map>
+
 #include "lua_Bindings.h"
 
 namespace mq::lua::bindings {
@@ -512,6 +515,131 @@ static sol::object lua_unpickle(sol::this_state L, std::string_view file_path)
 
 //============================================================================
 
+#pragma region Lazy Bindings
+
+static void RegisterBindings_MQCommands(LuaThread* thread, sol::table& mq)
+{
+	mq.new_usertype<lua_MQCommand>(
+		"command",                               sol::no_constructor);
+	mq.new_usertype<lua_MQDoCommand>(
+		"docommand",                             sol::no_constructor,
+		sol::meta_function::index,               &lua_MQDoCommand::Get);
+
+	mq.set("cmd",                                lua_MQDoCommand());
+	mq.set_function("cmdf",                      &lua_MQDoCommand::command_format);
+}
+
+static void RegisterBindings_MQTextures(LuaThread* thread, sol::table& mq)
+{
+	mq.new_usertype<mq::MQTexture>(
+		"MQTexture"                  , sol::no_constructor,
+		"size"                       , sol::property([](const MQTexture& mThis) -> ImVec2 { return mThis.GetTextureSize(); }),
+		"fileName"                   , sol::property(&mq::MQTexture::GetFilename),
+		"GetTextureID"               , &mq::MQTexture::GetTextureID
+	);
+	mq.set_function("CreateTexture", [](const std::string& name) { return CreateTexturePtr(name); });
+}
+
+// Parts of the mq namespace that aren't registered until a script first looks up one of
+// their names. Most scripts only touch a handful of these, and building the usertypes is a
+// large part of the cost of starting a script. The names listed here must match what the
+// registration function puts in the table.
+enum LazyBindingGroup
+{
+	LazyBindings_MacroData,
+	LazyBindings_EQ,
+	LazyBindings_Commands,
+	LazyBindings_Textures,
+
+	LazyBindings_Count
+};
+
+struct LazyBindings
+{
+	std::vector<std::string_view> names;
+	void (*registerBindings)(LuaThread* thread, sol::table& mq);
+	int dependsOn = -1;
+};
+
+static const LazyBindings s_lazyBindings[LazyBindings_Count] = {
+	{
+		{ "type", "data", "tlo", "TLO", "null", "gettype", "DataType", "AddTopLevelObject", "RemoveTopLevelObject" },
+		[](LuaThread*, sol::table& mq) { RegisterBindings_MQMacroData(mq); }
+	},
+	{
+		// The spawn and ground item functions hand back TLO types, so those need to exist first.
+		{ "CTextureAnimation", "FindTextureAnimation", "AttachSpellToCursor", "RemoveCursorAttachment",
+			"ExtractLinks", "ExecuteTextLink", "FormatAchievementLink", "FormatDialogLink", "FormatItemLink",
+			"FormatSpellLink", "ParseDialogLink", "ParseItemLink", "ParseSpellLink", "StripTextLinks",
+			"TextTagInfo", "LinkTypes", "DialogLinkInfo", "ItemLinkInfo", "SpellLinkInfo", "MAX_AUG_SOCKETS",
+			"getAllSpawns", "getFilteredSpawns", "getAllGroundItems", "getFilteredGroundItems" },
+		&RegisterBindings_EQ,
+		LazyBindings_MacroData
+	},
+	{
+		{ "command", "docommand", "cmd", "cmdf" },
+		&RegisterBindings_MQCommands
+	},
+	{
+		{ "MQTexture", "CreateTexture" },
+		&RegisterBindings_MQTextures
+	},
+};
+
+using LazyBindingsState = std::array<bool, LazyBindings_Count>;
+
+static void RegisterLazyGroup(LuaThread* thread, sol::table& mq, int group, LazyBindingsState& registered)
+{
+	if (registered[group])
+		return;
+
+	// Mark it first so a group can't recurse back into itself through a lookup.
+	registered[group] = true;
+
+	if (s_lazyBindings[group].dependsOn != -1)
+		RegisterLazyGroup(thread, mq, s_lazyBindings[group].dependsOn, registered);
+
+	MQScopedBenchmark bm(bmLuaBindings);
+	s_lazyBindings[group].registerBindings(thread, mq);
+}
+
+static void RegisterLazyBindings(LuaThread* thread, sol::table& mq)
+{
+	static const std::unordered_map<std::string_view, int> s_lazyNames = []()
+	{
+		std::unordered_map<std::string_view, int> names;
+		for (int group = 0; group < LazyBindings_Count; ++group)
+		{
+			for (std::string_view name : s_lazyBindings[group].names)
+				names.emplace(name, group);
+		}
+		return names;
+	}();
+
+	// Each namespace table keeps track of what has been registered into it.
+	auto registered = std::make_shared<LazyBindingsState>();
+
+	sol::table meta = sol::state_view(mq.lua_state()).create_table();
+	meta[sol::meta_function::index] = [thread, registered](sol::table self, sol::stack_object key) -> sol::object
+	{
+		if (key.get_type() != sol::type::string)
+			return sol::lua_nil;
+
+		auto iter = s_lazyNames.find(key.as<std::string_view>());
+		if (iter == s_lazyNames.end() || (*registered)[iter->second])
+			return sol::lua_nil;
+
+		RegisterLazyGroup(thread, self, iter->second, *registered);
+		return self.raw_get<sol::object>(key);
+	};
+
+	mq[sol::metatable_key] = meta;
+}
+
+#pragma endregion
+
+//============================================================================
+
 void RegisterBindings_MQ(LuaThread* thread, sol::table& mq)
 {
 	// values
@@ -547,31 +675,7 @@ void RegisterBindings_MQ(LuaThread* thread, sol::table& mq)
 		"exists",                                &lua_hasimgui
 	);
 
-	//----------------------------------------------------------------------------
-
-	RegisterBindings_EQ(thread, mq);
-
-	//----------------------------------------------------------------------------
-	// command bindings
-
-	mq.new_usertype<lua_MQCommand>(
-		"command",                               sol::no_constructor);
-	mq.new_usertype<lua_MQDoCommand>(
-		"docommand",                             sol::no_constructor,
-		sol::meta_function::index,               &lua_MQDoCommand::Get);
-
-	mq.set("cmd",                                lua_MQDoCommand());
-	mq.set_function("cmdf",                      &lua_MQDoCommand::command_format);
-
-	//----------------------------------------------------------------------------
-
-	mq.new_usertype<mq::MQTexture>(
-		"MQTexture"                  , sol::no_constructor,
-		"size"                       , sol::property([](const MQTexture& mThis) -> ImVec2 { return mThis.GetTextureSize(); }),
-		"fileName"                   , sol::property(&mq::MQTexture::GetFilename),
-		"GetTextureID"               , &mq::MQTexture::GetTextureID
-	);
-	mq.set_function("CreateTexture", [](const std::string& name) { return CreateTexturePtr(name); });
+	RegisterLazyBindings(thread, mq);
 }
 
 } // namespace mq::lua::bindings
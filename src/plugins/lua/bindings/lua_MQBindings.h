@@ -15,6 +15,7 @@
 #pragma once
 
 #include "LuaCommon.h"
+#include "LuaMacroValue.h"
 #include <mq/Plugin.h>
 
 namespace mq {
@@ -28,6 +29,11 @@ namespace mq::datatypes {
 
 namespace mq::lua {
 	std::tuple<const std::string&, const std::string&, int, bool> GetArgInfo(sol::function func);
+
+	inline int sol_lua_push(sol::types<LuaMacroScalar>, lua_State* L, const LuaMacroScalar& scalar)
+	{
+		return PushLuaMacroScalar(L, scalar);
+	}
 }
 
 namespace mq::lua::bindings {
@@ -48,6 +54,10 @@ public:
 
 class lua_MQTopLevelObject;
 
+// The result of actualizing a macro value in lua. Nil, booleans, numbers and strings are pushed
+// straight onto the lua stack (see LuaMacroValue.h). Anything else is converted to an object.
+using LuaMacroValue = std::variant<LuaMacroScalar, sol::object>;
+
 class lua_MQTypeVar
 {
 	friend class lua_MQTopLevelObject;
@@ -69,7 +79,7 @@ public:
 	sol::object Call(std::string index, sol::this_state L) const;
 	sol::object CallInt(int index, sol::this_state L) const;
 	sol::object CallVA(sol::this_state L, sol::variadic_args args) const;
-	sol::object CallEmpty(sol::this_state L) const;
+	LuaMacroValue CallEmpty(sol::this_state L) const;
 	sol::object Get(sol::stack_object key, sol::this_state L) const;
 	datatypes::MQ2Type* GetType() const;
 
@@ -99,7 +109,7 @@ public:
 	sol::object Call(const std::string& index, sol::this_state L) const;
 	sol::object CallInt(int index, sol::this_state L) const;
 	sol::object CallVA(sol::this_state L, sol::variadic_args args) const;
-	sol::object CallEmpty(sol::this_state L) const;
+	LuaMacroValue CallEmpty(sol::this_state L) const;
 	sol::object Get(sol::stack_object key, sol::this_state L) const;
 
 	datatypes::MQ2Type* GetType() const;
@@ -19,6 +19,8 @@
 
 #include <mq/Plugin.h>
 
+#include <charconv>
+
 namespace mq::lua {
 
 std::tuple<const std::string&, const std::string&, int, bool> GetArgInfo(sol::function func)
@@ -114,29 +116,36 @@ static sol::table FillExtent(const std::shared_ptr<datatypes::CDataArray>& arr,
 	return table;
 }
 
-static sol::object ConvertTypeVarToLua(sol::this_state L, const MQTypeVar& result)
+template <typename T>
+static LuaMacroValue MacroScalar(T value)
+{
+	// The alternative is named explicitly so that nothing converts to bool by accident.
+	return LuaMacroScalar{ LuaMacroScalar::Value(std::in_place_type<T>, value) };
+}
+
+static LuaMacroValue ConvertTypeVarToLua(sol::this_state L, const MQTypeVar& result)
 {
 	if (result.Type == nullptr)
-		return sol::object(L, sol::in_place, sol::lua_nil);
+		return LuaMacroScalar{};
 
 	if (result.Type == mq::datatypes::pArrayType)
 		return sol::object(L, sol::in_place, FillExtent(result.Get<datatypes::CDataArray>(), 0, 0, sol::state_view(L)));
 	if (result.Type == mq::datatypes::pBoolType)
-		return sol::object(L, sol::in_place, result.Get<bool>());
+		return MacroScalar<bool>(result.Get<bool>());
 	if (result.Type == mq::datatypes::pIntType)
-		return sol::object(L, sol::in_place, result.Get<int>());
+		return MacroScalar<int>(result.Get<int>());
 	if (result.Type == mq::datatypes::pInt64Type)
-		return sol::object(L, sol::in_place, result.Get<int64_t>());
+		return MacroScalar<int64_t>(result.Get<int64_t>());
 	if (result.Type == mq::datatypes::pByteType)
-		return sol::object(L, sol::in_place, result.Get<uint8_t>());
+		return MacroScalar<uint8_t>(result.Get<uint8_t>());
 	if (result.Type == mq::datatypes::pFloatType)
-		return sol::object(L, sol::in_place, result.Get<float>());
+		return MacroScalar<float>(result.Get<float>());
 	if (result.Type == mq::datatypes::pDoubleType)
-		return sol::object(L, sol::in_place, result.Get<double>());
+		return MacroScalar<double>(result.Get<double>());
 	if (result.Type == mq::datatypes::pStringType)
-		return sol::object(L, sol::in_place, (const char*)result.Ptr);
+		return MacroScalar<const char*>((const char*)result.Ptr);
 	if (result.Type == mq::datatypes::pTimeStampType)
-		return sol::object(L, sol::in_place, result.Get<int64_t>());
+		return MacroScalar<int64_t>(result.Get<int64_t>());
 
 	// Transfer a table type over to the new lua state
 	if (result.Type == s_luaTableType)
@@ -144,12 +153,13 @@ static sol::object ConvertTypeVarToLua(sol::this_state L, const MQTypeVar& resul
 		if (auto obj = result.Get<sol::object>())
 			return CloneObject(*obj, L);
 
-		return sol::nil;
+		return LuaMacroScalar{};
 	}
 
 	// by default run it through the tostring conversion because we are assuming calling with empty parens means
 	// to actualize the data in the native lua space
-	char buf[MAX_STRING] = { 0 };
+	char buf[MAX_STRING];
+	buf[0] = 0;
 	if (result.Type->ToString(result.GetVarPtr(), buf))
 		return sol::object(L, sol::in_place, buf);
 
@@ -279,6 +289,42 @@ static bool CreateMacroTypeFromLua(sol::object object, MQTypeVar& Dest)
 
 //============================================================================
 
+// Results of FindMacroDataMember, by type and member name. Scripts read the same few members
+// over and over, and the full lookup goes through the type extensions and the member and
+// method maps each time. Types and extensions only come and go as plugins (or lua datatypes)
+// are loaded and unloaded, so the cache is cleared then.
+struct MemberNameHash
+{
+	using is_transparent = void;
+
+	size_t operator()(std::string_view name) const { return std::hash<std::string_view>{}(name); }
+};
+
+using MemberLookupMap = std::unordered_map<std::string, bool, MemberNameHash, std::equal_to<>>;
+static std::unordered_map<MQ2Type*, MemberLookupMap> s_memberLookupCache;
+
+static bool HasMacroDataMember(MQ2Type* type, const std::string& member)
+{
+	// lua datatypes can change at any time, so always ask them
+	if (sorted_contains(s_proxyTypes, type))
+		return FindMacroDataMember(type, member);
+
+	MemberLookupMap& members = s_memberLookupCache[type];
+
+	auto iter = members.find(std::string_view{ member });
+	if (iter == members.end())
+		iter = members.emplace(member, FindMacroDataMember(type, member)).first;
+
+	return iter->second;
+}
+
+void ClearMacroDataMemberCache()
+{
+	s_memberLookupCache.clear();
+}
+
+//============================================================================
+
 #pragma region Macro Data Bindings
 
 lua_MQTypeVar::lua_MQTypeVar(const std::string& str)
@@ -334,7 +380,8 @@ std::string lua_MQTypeVar::ToString(const lua_MQTypeVar& obj)
 
 	if (var.Type != nullptr)
 	{
-		char buf[MAX_STRING] = { 0 };
+		char buf[MAX_STRING];
+		buf[0] = 0;
 		if (var.Type->ToString(var, buf))
 			return std::string(buf);
 	}
@@ -349,7 +396,10 @@ sol::object lua_MQTypeVar::Call(std::string index, sol::this_state L) const
 
 sol::object lua_MQTypeVar::CallInt(int index, sol::this_state L) const
 {
-	return Call(std::to_string(index), L);
+	char buffer[16];
+	*std::to_chars(std::begin(buffer), std::end(buffer) - 1, index).ptr = 0;
+
+	return sol::object(L, sol::in_place, lua_MQTypeVar(EvaluateMember(buffer)));
 }
 
 sol::object lua_MQTypeVar::CallVA(sol::this_state L, sol::variadic_args args) const
@@ -357,7 +407,7 @@ sol::object lua_MQTypeVar::CallVA(sol::this_state L, sol::variadic_args args) co
 	return Call(lua_join(L, ",", args), L);
 }
 
-sol::object lua_MQTypeVar::CallEmpty(sol::this_state L) const
+LuaMacroValue lua_MQTypeVar::CallEmpty(sol::this_state L) const
 {
 	MQTypeVar result = EvaluateMember();
 
@@ -397,7 +447,7 @@ sol::object lua_MQTypeVar::Get(sol::stack_object key, sol::this_state L) const
 		var.m_member = *maybe_key;
 
 		// make sure that the macro data member even exists if we have the type info
-		if (var.m_self.Type && !FindMacroDataMember(var.m_self.Type, var.m_member))
+		if (var.m_self.Type && !HasMacroDataMember(var.m_self.Type, var.m_member))
 		{
 			return sol::object(L, sol::in_place, sol::lua_nil);
 		}
@@ -477,7 +527,14 @@ sol::object lua_MQTopLevelObject::Call(const std::string& index, sol::this_state
 
 sol::object lua_MQTopLevelObject::CallInt(int index, sol::this_state L) const
 {
-	return Call(std::to_string(index), L);
+	char buffer[16];
+	*std::to_chars(std::begin(buffer), std::end(buffer) - 1, index).ptr = 0;
+
+	MQTypeVar result;
+	if (self != nullptr && self->Function(buffer, result))
+		return sol::object(L, sol::in_place, lua_MQTypeVar(result));
+
+	return sol::object(L, sol::in_place, lua_MQTypeVar(MQTypeVar()));
 }
 
 sol::object lua_MQTopLevelObject::CallVA(sol::this_state L, sol::variadic_args args) const
@@ -485,13 +542,13 @@ sol::object lua_MQTopLevelObject::CallVA(sol::this_state L, sol::variadic_args a
 	return Call(lua_join(L, ",", args), L);
 }
 
-sol::object lua_MQTopLevelObject::CallEmpty(sol::this_state L) const
+LuaMacroValue lua_MQTopLevelObject::CallEmpty(sol::this_state L) const
 {
 	MQTypeVar result;
 	if (self != nullptr && self->Function("", result))
 		return lua_MQTypeVar(result).CallEmpty(L);
 
-	return sol::object(L, sol::in_place, sol::lua_nil);
+	return LuaMacroScalar{};
 }
 
 sol::object lua_MQTopLevelObject::Get(sol::stack_object key, sol::this_state L) const
@@ -754,6 +811,9 @@ LuaProxyType::LuaProxyType(const std::string& typeName, LuaAbstractDataType* lua
 LuaProxyType::~LuaProxyType()
 {
 	remove_sorted(s_proxyTypes, this);
+
+	// the address can be reused by the next type
+	ClearMacroDataMemberCache();
 }
 
 bool LuaProxyType::FromData(MQVarPtr& VarPtr, const MQTypeVar& Source)
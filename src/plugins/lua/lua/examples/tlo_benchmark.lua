@@ -0,0 +1,36 @@
+-- usage: /lua run examples/tlo_benchmark [iterations]
+-- times a handful of common TLO reads so changes to the TLO bindings can be compared
+
+local mq = require('mq')
+
+local args = { ... }
+local iterations = tonumber(args[1]) or 10000
+
+local reads = {
+    { 'Me.PctHPs()',        function() return mq.TLO.Me.PctHPs() end },
+    { 'Me.Name()',          function() return mq.TLO.Me.Name() end },
+    { 'Me.Combat()',        function() return mq.TLO.Me.Combat() end },
+    { 'Me.Buff(1).Name()',  function() return mq.TLO.Me.Buff(1).Name() end },
+    { 'Me.X()',             function() return mq.TLO.Me.X() end },
+    { 'Me.Heading.Degrees()', function() return mq.TLO.Me.Heading.Degrees() end },
+    { 'Target.ID()',        function() return mq.TLO.Target.ID() end },
+    { 'Spawn(1).Distance()', function() return mq.TLO.Spawn(1).Distance() end },
+    { 'Me (cached).PctHPs()', function()
+        local me = mq.TLO.Me
+        return me.PctHPs()
+    end },
+}
+
+printf('TLO benchmark, %d iterations each', iterations)
+
+for _, read in ipairs(reads) do
+    local name, fn = read[1], read[2]
+
+    local start = os.clock()
+    for _ = 1, iterations do
+        fn()
+    end
+    local elapsed = os.clock() - start
+
+    printf('  %-24s %8.3f ms total, %6.3f us per read', name, elapsed * 1000, elapsed * 1000000 / iterations)
+end
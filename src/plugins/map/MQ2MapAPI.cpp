@@ -20,7 +20,6 @@
 #include <fmt/format.h>
 #include <sstream>
 
-extern MapObject* gpActiveMapObjects;
 extern MapViewLabel* gpLabelList;
 extern MapViewLabel* gpLabelListTail;
 
@@ -206,23 +205,57 @@ void MapUpdate()
 		{
 			pLastTarget = AddSpawn(pTarget);
 		}
+
+		if (pLastTarget && pLastTarget != pOldLastTarget)
+		{
+			pLastTarget->MarkDirty(MapDirty_All);
+		}
+	}
+
+	// Con colors depend on our level, and group members are colored below, so if either
+	// changes every color has to be worked out again.
+	static int lastLevel = 0;
+	static std::array<SPAWNINFO*, MAX_GROUP_SIZE> lastGroup = {};
+
+	std::array<SPAWNINFO*, MAX_GROUP_SIZE> group = {};
+	if (pLocalPC->Group)
+	{
+		for (int i = 1; i < MAX_GROUP_SIZE; i++)
+		{
+			if (CGroupMember* pMember = pLocalPC->Group->GetGroupMember(i))
+				group[i] = (SPAWNINFO*)pMember->GetPlayer();
+		}
 	}
 
-	MapObject* mapObject = gpActiveMapObjects;
-	while (mapObject)
+	int level = pLocalPlayer ? pLocalPlayer->Level : 0;
+	if (group != lastGroup || level != lastLevel)
+	{
+		lastGroup = group;
+		lastLevel = level;
+		gMapObjectStore.MarkAllDirty(MapDirty_Color);
+	}
+
+	// Only objects whose spawn changed, or that were changed from outside, need to do anything.
+	// Removing an object moves the last one into its slot, so the slot is checked again.
+	gMapObjectStore.SyncSpawns();
+
+	for (uint32_t slot = 0; slot < gMapObjectStore.Size();)
 	{
+		MapObject* mapObject = gMapObjectStore.GetObject(slot);
+
 		bool forced = (mapObject == pOldLastTarget) && bTargetChanged;
-		mapObject->Update(forced);
+		if (forced || mapObject->IsDirty() || mapObject->IsHighlighted())
+		{
+			mapObject->Update(forced);
+		}
 
 		if (!mapObject->CanDisplayObject())
 		{
-			MapObject* pNext = mapObject->GetNext();
 			RemoveMapObject(mapObject);
-			mapObject = pNext;
 		}
 		else
 		{
-			mapObject = mapObject->GetNext();
+			++slot;
 		}
 	}
 
@@ -522,30 +555,26 @@ int MapHighlight(MQSpawnSearch* pSearch)
 {
 	if (!pSearch)
 	{
-		MapObject* pMapSpawn = gpActiveMapObjects;
-		while (pMapSpawn)
+		for (uint32_t slot = 0; slot < gMapObjectStore.Size(); ++slot)
 		{
-			pMapSpawn->SetHighlight(false);
-			pMapSpawn = pMapSpawn->GetNext();
+			gMapObjectStore.GetObject(slot)->SetHighlight(false);
 		}
 
 		return 0;
 	}
 
 	uint32_t Count = 0;
-	MAPSPAWN* pMapSpawn = gpActiveMapObjects;
 
-	while (pMapSpawn)
+	for (uint32_t slot = 0; slot < gMapObjectStore.Size(); ++slot)
 	{
 		// update!
+		MAPSPAWN* pMapSpawn = gMapObjectStore.GetObject(slot);
 		SPAWNINFO* pSpawn = pMapSpawn->GetSpawn();
 		if (pSpawn && SpawnMatchesSearch(pSearch, pLocalPlayer, pSpawn))
 		{
 			pMapSpawn->SetHighlight(true);
 			Count++;
 		}
-
-		pMapSpawn = pMapSpawn->GetNext();
 	}
 
 	return Count;
@@ -553,22 +582,20 @@ int MapHighlight(MQSpawnSearch* pSearch)
 
 int MapHide(MQSpawnSearch& Search)
 {
-	MapObject* pMapSpawn = gpActiveMapObjects;
 	uint32_t Count = 0;
 
-	while (pMapSpawn)
+	for (uint32_t slot = 0; slot < gMapObjectStore.Size();)
 	{
+		MapObject* pMapSpawn = gMapObjectStore.GetObject(slot);
 		SPAWNINFO* pSpawn = pMapSpawn->GetSpawn();
 		if (pSpawn && SpawnMatchesSearch(&Search, pLocalPlayer, pSpawn))
 		{
-			MapObject* pNext = pMapSpawn->GetNext();
 			RemoveMapObject(pMapSpawn);
-			pMapSpawn = pNext;
 			Count++;
 		}
 		else
 		{
-			pMapSpawn = pMapSpawn->GetNext();
+			++slot;
 		}
 	}
 
@@ -155,13 +155,16 @@ void MapFilterSetting(PlayerClient* pChar, MapFilter nMapFilter, const char* szV
 	if (szValue)
 	{
 		WritePrivateProfileBool("Map Filters", pMapFilter->szName, pMapFilter->Enabled, INIFileName);
+
+		// Colors depend on options (con colors, group, mercenaries...), and are otherwise only worked out again when the spawn changes.
+		gMapObjectStore.MarkAllDirty(MapDirty_Color);
 	}
 }
 
 void MapFilterColorSetting(MapFilter nMapFilter, const char* szValue)
 {
 	char szArg[MAX_STRING] = { 0 };
-	MapFilterOption option = MapFilterOptions[static_cast<size_t>(nMapFilter)];
+	MapFilterOption& option = MapFilterOptions[static_cast<size_t>(nMapFilter)];
 
 	if (!option.HasColor())
 	{
@@ -188,6 +191,8 @@ void MapFilterColorSetting(MapFilter nMapFilter, const char* szValue)
 
 		WriteChatf("Option '%s' color set to: %d %d %d", option.szName, color.Red, color.Green, color.Blue);
 		WritePrivateProfileInt("Map Filters", fmt::format("{}-Color", option.szName), option.Color.ToRGB(), INIFileName);
+
+		gMapObjectStore.MarkAllDirty(MapDirty_Color);
 	}
 }
 
@@ -1380,6 +1385,8 @@ static bool AddMapFilterOptionAsImGuiSetting(MapFilterOption* option, std::stack
 		if (option->IsToggle())
 			WritePrivateProfileBool("Map Filters", option->szName, option->Enabled, INIFileName);
 		// option->HasColor() managed via "Colors" tab
+
+		gMapObjectStore.MarkAllDirty(MapDirty_Color);
 	}
 
 	if (!isRequirementMet)
@@ -1576,6 +1583,9 @@ static void DrawMapSettings_Colors()
 		ImGui::PopID();
 		ImGui::Separator();
 
+		if (changed)
+			gMapObjectStore.MarkAllDirty(MapDirty_Color);
+
 		if (changed && option.IsRegenerateOnChange())
 			regenerate = true;
 	}
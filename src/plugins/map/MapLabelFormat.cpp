@@ -0,0 +1,70 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "MapLabelFormat.h"
+
+static uint32_t s_nextFormatId = 0;
+
+bool MapLabelFormat::Compile(std::string_view format)
+{
+	if (m_compiled && format == m_source)
+		return false;
+
+	m_source = format;
+	m_ops.clear();
+	m_compiled = true;
+
+	if (++s_nextFormatId == 0)
+		++s_nextFormatId;
+	m_id = s_nextFormatId;
+
+	auto appendLiteral = [this](std::string_view text)
+	{
+		if (m_ops.empty() || m_ops.back().spec != 0)
+			m_ops.emplace_back();
+
+		m_ops.back().text.append(text);
+	};
+
+	size_t pos = 0;
+	while (pos < format.size())
+	{
+		size_t percent = format.find('%', pos);
+		if (percent == std::string_view::npos)
+		{
+			appendLiteral(format.substr(pos));
+			break;
+		}
+
+		if (percent > pos)
+			appendLiteral(format.substr(pos, percent - pos));
+
+		// A trailing % has no specifier, keep it as text
+		if (percent + 1 == format.size())
+		{
+			appendLiteral("%");
+			break;
+		}
+
+		char spec = format[percent + 1];
+		if (spec == '%')
+			appendLiteral("%");
+		else
+			m_ops.push_back(Op{ spec, {} });
+
+		pos = percent + 2;
+	}
+
+	return true;
+}
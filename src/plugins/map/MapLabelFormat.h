@@ -0,0 +1,121 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+//============================================================================
+
+// A map label format such as "%N (%l %R %C)", compiled once into runs of literal text and
+// the format specifiers between them.
+class MapLabelFormat
+{
+public:
+	struct Op
+	{
+		char        spec = 0;   // format specifier, or 0 for literal text
+		std::string text;       // the literal text
+	};
+
+	MapLabelFormat() = default;
+	explicit MapLabelFormat(std::string_view format) { Compile(format); }
+
+	// Compiles the format, unless it is the one that is already compiled. Returns true if
+	// the format changed.
+	bool Compile(std::string_view format);
+
+	const std::vector<Op>& GetOps() const { return m_ops; }
+
+	// Hashes the fields a label rendered from this format shows. hashSpecifier(spec, hash)
+	// mixes in the value of every field that spec reads. Literal text isn't hashed, a label
+	// rendered from another format is told apart by the id instead.
+	template <typename HashSpecifier>
+	uint64_t HashFields(HashSpecifier&& hashSpecifier) const;
+	const std::string& GetSource() const { return m_source; }
+
+	// Every compiled format gets a new id, so labels rendered from an older format can be
+	// told apart. Zero is never used.
+	uint32_t GetId() const { return m_id; }
+
+private:
+	std::string     m_source;
+	std::vector<Op> m_ops;
+	uint32_t        m_id = 0;
+	bool            m_compiled = false;
+};
+
+//============================================================================
+
+// Helpers for hashing the fields a label reads, so the label is only rendered again
+// when one of them changes. FNV-1a.
+
+constexpr uint64_t LabelHashSeed = 14695981039346656037ULL;
+
+inline uint64_t HashLabelBytes(uint64_t hash, const void* data, size_t size)
+{
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+inline uint64_t HashLabelField(uint64_t hash, std::string_view value)
+{
+	// end with a terminator so that neighboring strings can't run into each other
+	static constexpr char terminator = 0;
+
+	hash = HashLabelBytes(hash, value.data(), value.size());
+	return HashLabelBytes(hash, &terminator, 1);
+}
+
+inline uint64_t HashLabelField(uint64_t hash, const char* value)
+{
+	return HashLabelField(hash, std::string_view{ value ? value : "" });
+}
+
+inline uint64_t HashLabelField(uint64_t hash, int64_t value)
+{
+	return HashLabelBytes(hash, &value, sizeof(value));
+}
+
+inline uint64_t HashLabelField(uint64_t hash, float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return HashLabelBytes(hash, &bits, sizeof(bits));
+}
+
+//============================================================================
+
+template <typename HashSpecifier>
+uint64_t MapLabelFormat::HashFields(HashSpecifier&& hashSpecifier) const
+{
+	uint64_t hash = LabelHashSeed;
+	for (const Op& op : m_ops)
+	{
+		if (op.spec != 0)
+			hash = hashSpecifier(op.spec, HashLabelBytes(hash, &op.spec, 1));
+	}
+
+	return hash;
+}
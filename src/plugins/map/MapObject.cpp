@@ -15,7 +15,7 @@
 #include "MapObject.h"
 
 extern MapObject* pLastTarget;
-MapObject* gpActiveMapObjects = nullptr;
+MapObjectStore gMapObjectStore;
 
 std::vector<std::unique_ptr<MapLocTemplate>> gMapLocTemplates;
 MapLocParams gDefaultMapLocParams;
@@ -67,12 +67,8 @@ MapObject* GetMapObjectForLabel(MAPLABEL* pLabel)
 //============================================================================
 
 MapObject::MapObject()
+	: m_slot(gMapObjectStore.Add(this))
 {
-	// Add to beginning of list
-	m_pNext = gpActiveMapObjects;
-	if (gpActiveMapObjects)
-		gpActiveMapObjects->m_pLast = this;
-	gpActiveMapObjects = this;
 }
 
 void MapObject::PostInit()
@@ -99,22 +95,20 @@ MapObject::~MapObject()
 
 	RemoveMarker();
 
-	if (m_pNext)
-		m_pNext->m_pLast = m_pLast;
-
-	if (m_pLast)
-		m_pLast->m_pNext = m_pNext;
-	else
-		gpActiveMapObjects = m_pNext;
+	gMapObjectStore.Remove(m_slot);
 }
 
 void MapObject::Update(bool forced)
 {
-	if (m_label)
+	uint8_t& dirty = Dirty();
+	if (forced)
+		dirty = MapDirty_All;
+
+	if (m_label && (dirty & MapDirty_Position))
 	{
-		m_label->Location.X = -m_pos.X;
-		m_label->Location.Y = -m_pos.Y;
-		m_label->Location.Z = m_pos.Z;
+		m_label->Location.X = -Position().X;
+		m_label->Location.Y = -Position().Y;
+		m_label->Location.Z = Position().Z;
 	}
 
 	if (m_highlight)
@@ -122,11 +116,19 @@ void MapObject::Update(bool forced)
 		SetColor(HighlightColor);
 	}
 
-	// If marker is still enabled, update the marker. Otherwise, remove the marker.
+	// If marker is still enabled, update the marker. Otherwise, remove the marker. Highlighted
+	// markers pulse, so they are rebuilt every frame.
 	if (IsOptionEnabled(MapFilter::Marker))
-		UpdateMarker();
+	{
+		if ((dirty & (MapDirty_Position | MapDirty_Geometry)) || m_highlight)
+			UpdateMarker();
+	}
 	else
+	{
 		RemoveMarker();
+	}
+
+	dirty = MapDirty_None;
 }
 
 bool MapObject::CanDisplayObject() const
@@ -135,25 +137,39 @@ bool MapObject::CanDisplayObject() const
 }
 
 CXStr MapObject::FormatString(const char* formatString)
+{
+	return FormatString(MapLabelFormat(formatString));
+}
+
+CXStr MapObject::FormatString(const MapLabelFormat& format)
 {
 	CXStr sOutput;
 
-	for (int n = 0; formatString[n]; n++)
+	for (const MapLabelFormat::Op& op : format.GetOps())
 	{
-		if (formatString[n] != '%')
-		{
-			sOutput.append(1, formatString[n]);
-			continue;
-		}
-
-		// increment to format specifier.
-		char spec = formatString[++n];
-		HandleFormatSpecifier(spec, sOutput);
+		if (op.spec == 0)
+			sOutput.append(op.text);
+		else
+			HandleFormatSpecifier(op.spec, sOutput);
 	}
 
 	return sOutput;
 }
 
+void MapObject::SetTextFromFormat(const MapLabelFormat& format)
+{
+	const uint64_t hash = format.HashFields(
+		[this](char spec, uint64_t hash) { return HashFormatSpecifier(spec, hash); });
+
+	if (m_textFormatId == format.GetId() && m_textHash == hash)
+		return;
+
+	SetText(FormatString(format));
+
+	m_textFormatId = format.GetId();
+	m_textHash = hash;
+}
+
 void MapObject::HandleFormatSpecifier(char spec, CXStr& sOutput)
 {
 	switch (spec)
@@ -174,13 +190,13 @@ void MapObject::HandleFormatSpecifier(char spec, CXStr& sOutput)
 		return;
 
 	case 'x':
-		sOutput.append(std::to_string(m_pos.X));
+		sOutput.append(std::to_string(Position().X));
 		return;
 	case 'y':
-		sOutput.append(std::to_string(m_pos.Y));
+		sOutput.append(std::to_string(Position().Y));
 		return;
 	case 'z':
-		sOutput.append(std::to_string(m_pos.Z));
+		sOutput.append(std::to_string(Position().Z));
 		return;
 
 	case '%': // % literal
@@ -194,6 +210,27 @@ void MapObject::HandleFormatSpecifier(char spec, CXStr& sOutput)
 	}
 }
 
+// Mixes in the value of every field HandleFormatSpecifier reads for this specifier.
+uint64_t MapObject::HashFormatSpecifier(char spec, uint64_t hash) const
+{
+	switch (spec)
+	{
+	case 'N':
+	case 'n':
+		return HashLabelField(hash, std::string_view{ m_text });
+
+	case 'x':
+		return HashLabelField(hash, GetPosition().X);
+	case 'y':
+		return HashLabelField(hash, GetPosition().Y);
+	case 'z':
+		return HashLabelField(hash, GetPosition().Z);
+
+	default: // the rest are constant
+		return hash;
+	}
+}
+
 MapFilter MapObject::GetMapFilter() const
 {
 	return MapFilter::Invalid;
@@ -202,12 +239,12 @@ MapFilter MapObject::GetMapFilter() const
 void MapObject::GenerateLabel()
 {
 	m_label = InitLabel();
-	m_label->Location.X = -m_pos.X;
-	m_label->Location.Y = -m_pos.Y;
-	m_label->Location.Z = m_pos.Z;
+	m_label->Location.X = -Position().X;
+	m_label->Location.Y = -Position().Y;
+	m_label->Location.Z = Position().Z;
 	m_label->Layer = activeLayer;
 	m_label->Size = 3;
-	m_label->Color.ARGB = m_color.ToARGB();
+	m_label->Color.ARGB = gMapObjectStore.GetColor(m_slot).ToARGB();
 	m_label->Width = 20;
 	m_label->Height = 14;
 	m_label->OffsetX = 0;
@@ -219,6 +256,8 @@ void MapObject::GenerateLabel()
 
 void MapObject::SetText(std::string_view text)
 {
+	m_textFormatId = 0;
+
 	if (mq::test_and_set(m_text, text))
 	{
 		if (m_label)
@@ -233,18 +272,29 @@ void MapObject::SetText(std::string_view text)
 
 void MapObject::SetColor(MQColor color)
 {
-	if (mq::test_and_set(m_color, color))
+	if (mq::test_and_set(gMapObjectStore.GetColor(m_slot), color))
 	{
 		if (m_label)
 		{
 			m_label->Color.ARGB = color.ToARGB();
 		}
+
+		// marker lines take their color from the label
+		MarkDirty(MapDirty_Geometry);
+	}
+}
+
+void MapObject::SetHighlight(bool highlight)
+{
+	if (mq::test_and_set(m_highlight, highlight))
+	{
+		MarkDirty(MapDirty_Color | MapDirty_Geometry);
 	}
 }
 
 void MapObject::SetPosition(const CVector3& pos)
 {
-	if (mq::test_and_set(m_pos, pos))
+	if (mq::test_and_set(Position(), pos))
 	{
 		Update(true);
 	}
@@ -291,10 +341,10 @@ void MapObject::GenerateMarker()
 		MapViewLine* pNewLine = InitLine();
 		pNewLine->Start.X = 0;
 		pNewLine->Start.Y = 0;
-		pNewLine->Start.Z = m_pos.Z;
+		pNewLine->Start.Z = Position().Z;
 		pNewLine->End.X = 0;
 		pNewLine->End.Y = 0;
-		pNewLine->End.Z = m_pos.Z;
+		pNewLine->End.Z = Position().Z;
 		pNewLine->Layer = activeLayer;
 		pNewLine->Color = m_label->Color;
 
@@ -354,10 +404,10 @@ void MapObject::MakeSquareMarker()
 		}
 	}
 
-	x[0] = -m_pos.X - markerSideLen / 2;
-	x[1] = -m_pos.X + markerSideLen / 2;
-	y[0] = -m_pos.Y - markerSideLen / 2;
-	y[1] = -m_pos.Y + markerSideLen / 2;
+	x[0] = -Position().X - markerSideLen / 2;
+	x[1] = -Position().X + markerSideLen / 2;
+	y[0] = -Position().Y - markerSideLen / 2;
+	y[1] = -Position().Y + markerSideLen / 2;
 
 	for (int i = 0; i < GetNumMarkerSides(MarkerType::Square); i++)
 	{
@@ -373,8 +423,8 @@ void MapObject::MakeSquareMarker()
 		m_markerLines[i]->Start.Y = Y[0];
 		m_markerLines[i]->End.X = X[1];
 		m_markerLines[i]->End.Y = Y[1];
-		m_markerLines[i]->Start.Z = m_pos.Z;
-		m_markerLines[i]->End.Z = m_pos.Z;
+		m_markerLines[i]->Start.Z = Position().Z;
+		m_markerLines[i]->End.Z = Position().Z;
 
 		if (m_markerLines[i]->Color.ARGB != m_label->Color.ARGB)
 			m_markerLines[i]->Color = m_label->Color;
@@ -398,13 +448,13 @@ void MapObject::MakeTriangleMarker()
 		}
 	}
 
-	Angle = m_heading * 0.703125f;
-	x[0] = -m_pos.X + (markerSideLen * 1.5f) * sqrtf(3) / 3 * sinf((Angle + 180) / 180.0f * (float)PI);
-	x[1] = -m_pos.X - (markerSideLen * 1.5f) * sqrtf(3) / 3 * sinf((Angle + 210) / 180.0f * (float)PI);
-	x[2] = -m_pos.X + (markerSideLen * 1.5f) * sqrtf(3) / 3 * sinf((Angle + 330) / 180.0f * (float)PI);
-	y[0] = -m_pos.Y + (markerSideLen * 1.5f) * sqrtf(3) / 3 * cosf((Angle + 180) / 180.0f * (float)PI);
-	y[1] = -m_pos.Y - (markerSideLen * 1.5f) * sqrtf(3) / 3 * cosf((Angle + 210) / 180.0f * (float)PI);
-	y[2] = -m_pos.Y + (markerSideLen * 1.5f) * sqrtf(3) / 3 * cosf((Angle + 330) / 180.0f * (float)PI);
+	Angle = Heading() * 0.703125f;
+	x[0] = -Position().X + (markerSideLen * 1.5f) * sqrtf(3) / 3 * sinf((Angle + 180) / 180.0f * (float)PI);
+	x[1] = -Position().X - (markerSideLen * 1.5f) * sqrtf(3) / 3 * sinf((Angle + 210) / 180.0f * (float)PI);
+	x[2] = -Position().X + (markerSideLen * 1.5f) * sqrtf(3) / 3 * sinf((Angle + 330) / 180.0f * (float)PI);
+	y[0] = -Position().Y + (markerSideLen * 1.5f) * sqrtf(3) / 3 * cosf((Angle + 180) / 180.0f * (float)PI);
+	y[1] = -Position().Y - (markerSideLen * 1.5f) * sqrtf(3) / 3 * cosf((Angle + 210) / 180.0f * (float)PI);
+	y[2] = -Position().Y + (markerSideLen * 1.5f) * sqrtf(3) / 3 * cosf((Angle + 330) / 180.0f * (float)PI);
 
 	for (int i = 0; i < GetNumMarkerSides(MarkerType::Triangle); i++)
 	{
@@ -419,8 +469,8 @@ void MapObject::MakeTriangleMarker()
 		m_markerLines[i]->Start.Y = Y[0];
 		m_markerLines[i]->End.X = X[1];
 		m_markerLines[i]->End.Y = Y[1];
-		m_markerLines[i]->Start.Z = m_pos.Z;
-		m_markerLines[i]->End.Z = m_pos.Z;
+		m_markerLines[i]->Start.Z = Position().Z;
+		m_markerLines[i]->End.Z = Position().Z;
 
 		if (m_markerLines[i]->Color.ARGB != m_label->Color.ARGB)
 			m_markerLines[i]->Color = m_label->Color;
@@ -444,12 +494,12 @@ void MapObject::MakeDiamondMarker()
 		}
 	}
 
-	x[0] = -m_pos.X;
-	x[1] = -m_pos.X + markerSideLen * .71f;   // sqrt(2)/2
-	x[2] = -m_pos.X - markerSideLen * .71f;
-	y[0] = -m_pos.Y - markerSideLen * .71f;
-	y[1] = -m_pos.Y;
-	y[2] = -m_pos.Y + markerSideLen * .71f;
+	x[0] = -Position().X;
+	x[1] = -Position().X + markerSideLen * .71f;   // sqrt(2)/2
+	x[2] = -Position().X - markerSideLen * .71f;
+	y[0] = -Position().Y - markerSideLen * .71f;
+	y[1] = -Position().Y;
+	y[2] = -Position().Y + markerSideLen * .71f;
 
 	for (int i = 0; i < GetNumMarkerSides(MarkerType::Diamond); i++)
 	{
@@ -465,8 +515,8 @@ void MapObject::MakeDiamondMarker()
 		m_markerLines[i]->Start.Y = Y[0];
 		m_markerLines[i]->End.X = X[1];
 		m_markerLines[i]->End.Y = Y[1];
-		m_markerLines[i]->Start.Z = m_pos.Z;
-		m_markerLines[i]->End.Z = m_pos.Z;
+		m_markerLines[i]->Start.Z = Position().Z;
+		m_markerLines[i]->End.Z = Position().Z;
 
 		if (m_markerLines[i]->Color.ARGB != m_label->Color.ARGB)
 			m_markerLines[i]->Color = m_label->Color;
@@ -491,12 +541,12 @@ void MapObject::MakeRingMarker()
 
 	for (int i = 0; i < GetNumMarkerSides(MarkerType::Ring); i++)
 	{
-		m_markerLines[i]->Start.X = -m_pos.X + markerSideLen * sinf((i * 45 + (float)22.5) / 180.0f * (float)PI);
-		m_markerLines[i]->Start.Y = -m_pos.Y + markerSideLen * cosf((i * 45 + (float)22.5) / 180.0f * (float)PI);
-		m_markerLines[i]->End.X = -m_pos.X + markerSideLen * sinf(((i + 1) * 45 + (float)22.5) / 180.0f * (float)PI);
-		m_markerLines[i]->End.Y = -m_pos.Y + markerSideLen * cosf(((i + 1) * 45 + (float)22.5) / 180.0f * (float)PI);
-		m_markerLines[i]->Start.Z = m_pos.Z;
-		m_markerLines[i]->End.Z = m_pos.Z;
+		m_markerLines[i]->Start.X = -Position().X + markerSideLen * sinf((i * 45 + (float)22.5) / 180.0f * (float)PI);
+		m_markerLines[i]->Start.Y = -Position().Y + markerSideLen * cosf((i * 45 + (float)22.5) / 180.0f * (float)PI);
+		m_markerLines[i]->End.X = -Position().X + markerSideLen * sinf(((i + 1) * 45 + (float)22.5) / 180.0f * (float)PI);
+		m_markerLines[i]->End.Y = -Position().Y + markerSideLen * cosf(((i + 1) * 45 + (float)22.5) / 180.0f * (float)PI);
+		m_markerLines[i]->Start.Z = Position().Z;
+		m_markerLines[i]->End.Z = Position().Z;
 
 		if (m_markerLines[i]->Color.ARGB != m_label->Color.ARGB)
 			m_markerLines[i]->Color = m_label->Color;
@@ -507,16 +557,99 @@ void MapObject::MakeRingMarker()
 
 //============================================================================
 
+// Hands out fixed size blocks for one type of object, carved out of larger allocations.
+// Freed blocks are kept for reuse until the plugin unloads.
+template <typename T, size_t BlockCount = 256>
+class MapObjectPool
+{
+public:
+	void* Allocate()
+	{
+		if (!m_free)
+		{
+			m_chunks.push_back(std::make_unique<Block[]>(BlockCount));
+
+			Block* chunk = m_chunks.back().get();
+			for (size_t i = 0; i < BlockCount; ++i)
+			{
+				chunk[i].next = m_free;
+				m_free = &chunk[i];
+			}
+		}
+
+		Block* block = m_free;
+		m_free = block->next;
+		return block;
+	}
+
+	void Free(void* ptr)
+	{
+		Block* block = static_cast<Block*>(ptr);
+		block->next = m_free;
+		m_free = block;
+	}
+
+private:
+	union Block
+	{
+		Block* next;
+		alignas(T) std::byte storage[sizeof(T)];
+	};
+
+	std::vector<std::unique_ptr<Block[]>> m_chunks;
+	Block* m_free = nullptr;
+};
+
+static MapObjectPool<MapObjectSpawn>& GetSpawnObjectPool()
+{
+	static MapObjectPool<MapObjectSpawn> s_pool;
+	return s_pool;
+}
+
+//============================================================================
+
 static std::map<SPAWNINFO*, MapObject*> SpawnMap;
 
+// The naming schemes can be changed at any time, compiling only does anything when they have.
+static const MapLabelFormat& GetNameFormat()
+{
+	static MapLabelFormat s_format;
+	s_format.Compile(MapNameString);
+	return s_format;
+}
+
+static const MapLabelFormat& GetTargetNameFormat()
+{
+	static MapLabelFormat s_format;
+	s_format.Compile(MapTargetNameString);
+	return s_format;
+}
+
+void* MapObjectSpawn::operator new(size_t size)
+{
+	if (size != sizeof(MapObjectSpawn))
+		return ::operator new(size);
+
+	return GetSpawnObjectPool().Allocate();
+}
+
+void MapObjectSpawn::operator delete(void* ptr, size_t size)
+{
+	if (size != sizeof(MapObjectSpawn))
+		return ::operator delete(ptr);
+
+	GetSpawnObjectPool().Free(ptr);
+}
+
 MapObjectSpawn::MapObjectSpawn(SPAWNINFO* pSpawn, bool Explicit)
 	: m_spawn(pSpawn)
 	, m_type(GetSpawnType(pSpawn))
 	, m_explicit(Explicit)
 {
+	gMapObjectStore.SetSpawn(GetSlot(), pSpawn);
 	GenerateLabel();
 
-	SetText(FormatString(MapNameString));
+	SetTextFromFormat(GetNameFormat());
 	SetColor(GetSpawnColor());
 
 	SpawnMap[m_spawn] = this;
@@ -544,22 +677,22 @@ void MapObjectSpawn::PostInit()
 
 void MapObjectSpawn::Update(bool forced)
 {
+	// Position and heading were already copied from the spawn by MapObjectStore::SyncSpawns
+	uint8_t dirty = forced ? MapDirty_All : Dirty();
 	bool changed = false;
 
-	changed |= test_and_set(m_type, GetSpawnType(m_spawn));
-
-	m_pos.X = m_spawn->X;
-	m_pos.Y = m_spawn->Y;
-	m_pos.Z = m_spawn->Z;
-	m_heading = m_spawn->Heading;
+	if (dirty & (MapDirty_Label | MapDirty_Color))
+	{
+		changed |= test_and_set(m_type, GetSpawnType(m_spawn));
+	}
 
 	// If something changed update the label
 	if (changed || forced)
 	{
-		SetText(FormatString(MapNameString));
+		SetTextFromFormat(GetNameFormat());
 		SetColor(GetSpawnColor());
 	}
-	else if (!m_highlight)
+	else if (!m_highlight && (dirty & MapDirty_Color))
 	{
 		SetColor(GetSpawnColor());
 	}
@@ -569,7 +702,9 @@ void MapObjectSpawn::Update(bool forced)
 	if (pLastTarget == this)
 	{
 		SetColor(GetMapFilterOption(MapFilter::Target).Color);
-		SetText(FormatString(MapTargetNameString));
+
+		// The target's label can show health and location, it is only rendered again if they changed
+		SetTextFromFormat(GetTargetNameFormat());
 	}
 }
 
@@ -684,6 +819,45 @@ void MapObjectSpawn::HandleFormatSpecifier(char spec, CXStr& sOutput)
 	}
 }
 
+uint64_t MapObjectSpawn::HashFormatSpecifier(char spec, uint64_t hash) const
+{
+	switch (spec)
+	{
+	case 'N':
+		hash = HashLabelField(hash, m_spawn->DisplayedName);
+		return HashLabelField(hash, static_cast<int64_t>(m_type == CORPSE));
+
+	case 'n':
+		return HashLabelField(hash, m_spawn->Name);
+
+	case 'h':
+		return HashLabelField(hash, static_cast<int64_t>(m_spawn->HPCurrent));
+
+	case 'i':
+		return HashLabelField(hash, static_cast<int64_t>(m_spawn->SpawnID));
+
+	case 'x':
+		return HashLabelField(hash, m_spawn->X);
+	case 'y':
+		return HashLabelField(hash, m_spawn->Y);
+	case 'z':
+		return HashLabelField(hash, m_spawn->Z);
+
+	case 'R':
+	case 'C':
+	case 'c':
+		// all of these come from race and class
+		hash = HashLabelField(hash, static_cast<int64_t>(m_spawn->GetRace()));
+		return HashLabelField(hash, static_cast<int64_t>(m_spawn->GetClass()));
+
+	case 'l':
+		return HashLabelField(hash, static_cast<int64_t>(m_spawn->Level));
+
+	default:
+		return MapObject::HashFormatSpecifier(spec, hash);
+	}
+}
+
 MapFilter MapObjectSpawn::GetMapFilter() const
 {
 	switch (m_type)
@@ -859,7 +1033,7 @@ MapObjectGroundSpawn::MapObjectGroundSpawn(EQGroundItem* pGroundItem)
 {
 	GenerateLabel();
 
-	SetText(FormatString(MapNameString));
+	SetTextFromFormat(GetNameFormat());
 	SetColor(GetMapFilterOption(MapFilter::Ground).Color);
 
 	GroundItemMap[m_groundItem] = this;
@@ -877,10 +1051,11 @@ void MapObjectGroundSpawn::PostInit()
 
 void MapObjectGroundSpawn::Update(bool forced)
 {
-	m_pos.X = m_groundItem->X;
-	m_pos.Y = m_groundItem->Y;
-	m_pos.Z = m_groundItem->Z;
-	m_heading = m_groundItem->Heading;
+	// Ground items don't move, this is only called when something else made them dirty
+	Position().X = m_groundItem->X;
+	Position().Y = m_groundItem->Y;
+	Position().Z = m_groundItem->Z;
+	Heading() = m_groundItem->Heading;
 
 	MapObject::Update(forced);
 }
@@ -915,6 +1090,19 @@ void MapObjectGroundSpawn::HandleFormatSpecifier(char spec, CXStr& sOutput)
 	}
 }
 
+uint64_t MapObjectGroundSpawn::HashFormatSpecifier(char spec, uint64_t hash) const
+{
+	switch (spec)
+	{
+	case 'N':
+	case 'n':
+		return HashLabelField(hash, std::string_view{ m_friendlyName });
+
+	default:
+		return MapObject::HashFormatSpecifier(spec, hash);
+	}
+}
+
 //============================================================================
 
 MapObject* MakeMapObject(SPAWNINFO* pSpawn, bool Explicit)
@@ -968,9 +1156,9 @@ void MapObjects_Clear()
 	GroundItemMap.clear();
 	SpawnMap.clear();
 
-	while (gpActiveMapObjects)
+	while (gMapObjectStore.Size() > 0)
 	{
-		delete gpActiveMapObjects;    // deleting the object will remove it from the list
+		delete gMapObjectStore.GetObject(gMapObjectStore.Size() - 1);    // deleting the object will remove it from the store
 	}
 }
 
@@ -1180,24 +1368,24 @@ void MapObjectMapLoc::UpdateMapObject()
 			line = InitLine();
 			line->Layer = activeLayer;
 			line->Color.ARGB = colorARGB;
-			line->Start.X = -m_pos.X - params.lineSize;
-			line->Start.Y = -m_pos.Y - params.lineSize;
-			line->Start.Z = m_pos.Z;
-			line->End.X = -m_pos.X + params.lineSize;
-			line->End.Y = -m_pos.Y + params.lineSize;
-			line->End.Z = m_pos.Z;
+			line->Start.X = -Position().X - params.lineSize;
+			line->Start.Y = -Position().Y - params.lineSize;
+			line->Start.Z = Position().Z;
+			line->End.X = -Position().X + params.lineSize;
+			line->End.Y = -Position().Y + params.lineSize;
+			line->End.Z = Position().Z;
 			m_lines.push_back(line);
 
 			// Forwardslash
 			line = InitLine();
 			line->Layer = activeLayer;
 			line->Color.ARGB = colorARGB;
-			line->Start.X = -m_pos.X - params.lineSize;
-			line->Start.Y = -m_pos.Y + params.lineSize;
-			line->Start.Z = m_pos.Z;
-			line->End.X = -m_pos.X + params.lineSize;
-			line->End.Y = -m_pos.Y - params.lineSize;
-			line->End.Z = m_pos.Z;
+			line->Start.X = -Position().X - params.lineSize;
+			line->Start.Y = -Position().Y + params.lineSize;
+			line->Start.Z = Position().Z;
+			line->End.X = -Position().X + params.lineSize;
+			line->End.Y = -Position().Y - params.lineSize;
+			line->End.Z = Position().Z;
 			m_lines.push_back(line);
 		}
 		else
@@ -1206,48 +1394,48 @@ void MapObjectMapLoc::UpdateMapObject()
 			line = InitLine();
 			line->Layer = activeLayer;
 			line->Color.ARGB = colorARGB;
-			line->Start.X = -m_pos.X - params.lineSize;
-			line->Start.Y = -m_pos.Y - params.lineSize + xWidth - 1;
-			line->Start.Z = m_pos.Z;
-			line->End.X = -m_pos.X + params.lineSize - xWidth + 1;
-			line->End.Y = -m_pos.Y + params.lineSize;
-			line->End.Z = m_pos.Z;
+			line->Start.X = -Position().X - params.lineSize;
+			line->Start.Y = -Position().Y - params.lineSize + xWidth - 1;
+			line->Start.Z = Position().Z;
+			line->End.X = -Position().X + params.lineSize - xWidth + 1;
+			line->End.Y = -Position().Y + params.lineSize;
+			line->End.Z = Position().Z;
 			m_lines.push_back(line);
 
 			// Forwardslash lower
 			line = InitLine();
 			line->Layer = activeLayer;
 			line->Color.ARGB = colorARGB;
-			line->Start.X = -m_pos.X - params.lineSize + xWidth - 1;
-			line->Start.Y = -m_pos.Y + params.lineSize;
-			line->Start.Z = m_pos.Z;
-			line->End.X = -m_pos.X + params.lineSize;
-			line->End.Y = -m_pos.Y - params.lineSize + xWidth - 1;
-			line->End.Z = m_pos.Z;
+			line->Start.X = -Position().X - params.lineSize + xWidth - 1;
+			line->Start.Y = -Position().Y + params.lineSize;
+			line->Start.Z = Position().Z;
+			line->End.X = -Position().X + params.lineSize;
+			line->End.Y = -Position().Y - params.lineSize + xWidth - 1;
+			line->End.Z = Position().Z;
 			m_lines.push_back(line);
 
 			// Backslash upper
 			line = InitLine();
 			line->Layer = activeLayer;
 			line->Color.ARGB = colorARGB;
-			line->Start.X = -m_pos.X - params.lineSize + xWidth - 1;
-			line->Start.Y = -m_pos.Y - params.lineSize;
-			line->Start.Z = m_pos.Z;
-			line->End.X = -m_pos.X + params.lineSize;
-			line->End.Y = -m_pos.Y + params.lineSize - xWidth + 1;
-			line->End.Z = m_pos.Z;
+			line->Start.X = -Position().X - params.lineSize + xWidth - 1;
+			line->Start.Y = -Position().Y - params.lineSize;
+			line->Start.Z = Position().Z;
+			line->End.X = -Position().X + params.lineSize;
+			line->End.Y = -Position().Y + params.lineSize - xWidth + 1;
+			line->End.Z = Position().Z;
 			m_lines.push_back(line);
 
 			// Forwardslash upper
 			line = InitLine();
 			line->Layer = activeLayer;
 			line->Color.ARGB = colorARGB;
-			line->Start.X = -m_pos.X - params.lineSize;
-			line->Start.Y = -m_pos.Y + params.lineSize - xWidth + 1;
-			line->Start.Z = m_pos.Z;
-			line->End.X = -m_pos.X + params.lineSize - xWidth + 1;
-			line->End.Y = -m_pos.Y - params.lineSize;
-			line->End.Z = m_pos.Z;
+			line->Start.X = -Position().X - params.lineSize;
+			line->Start.Y = -Position().Y + params.lineSize - xWidth + 1;
+			line->Start.Z = Position().Z;
+			line->End.X = -Position().X + params.lineSize - xWidth + 1;
+			line->End.Y = -Position().Y - params.lineSize;
+			line->End.Z = Position().Z;
 			m_lines.push_back(line);
 		}
 	}
@@ -1255,7 +1443,7 @@ void MapObjectMapLoc::UpdateMapObject()
 	// Create the Radius
 	if (params.circleRadius > 0)
 	{
-		m_circle.UpdateCircle(params.circleColor, params.circleRadius, m_pos.X, m_pos.Y, m_pos.Z);
+		m_circle.UpdateCircle(params.circleColor, params.circleRadius, Position().X, Position().Y, Position().Z);
 	}
 	else
 	{
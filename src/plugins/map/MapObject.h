@@ -15,11 +15,20 @@
 #pragma once
 
 #include "MQ2Map.h"
+#include "MapLabelFormat.h"
+#include "MapObjectStore.h"
 
 #include <mq/Plugin.h>
 
 //============================================================================
 
+class MapObject;
+
+using MapObjectStore = BasicMapObjectStore<MapObject, SPAWNINFO, CVector3, MQColor>;
+extern MapObjectStore gMapObjectStore;
+
+//============================================================================
+
 class MapObject
 {
 public:
@@ -30,27 +39,35 @@ public:
 	virtual void Update(bool forced);       // called each frame to sync the map item with the game object.
 
 	CXStr FormatString(const char* str);    // format a string with the current MapObject
+	CXStr FormatString(const MapLabelFormat& format);
 	virtual MapFilter GetMapFilter() const;  // get applicable map filter for this object
 
 	virtual bool CanDisplayObject() const;  // determines if this object should be displayed. Will be removed if not.
 
 	void SetText(std::string_view text);
+
+	// Sets the text from a label format. The text is only rendered again if the format or
+	// one of the fields it shows has changed since the last time.
+	void SetTextFromFormat(const MapLabelFormat& format);
 	CXStr GetText() const { return m_text; }
 	void SetColor(MQColor color);
 
-	void SetHighlight(bool highlight) { m_highlight = highlight; }
+	void SetHighlight(bool highlight);
+	bool IsHighlighted() const { return m_highlight; }
 	void SetPosition(float x, float y, float z) { SetPosition(CVector3{ x, y, z }); }
 	void SetPosition(const CVector3& pos);
-	CVector3 GetPosition() const { return m_pos; }
+	CVector3 GetPosition() const { return gMapObjectStore.GetPosition(m_slot); }
 
-	MapObject* GetNext() const { return m_pNext; }
-	MapObject* GetPrev() const { return m_pLast; }
+	uint32_t GetSlot() const { return m_slot; }
+	void MarkDirty(uint8_t flags) { gMapObjectStore.GetDirty(m_slot) |= flags; }
+	bool IsDirty() const { return gMapObjectStore.GetDirty(m_slot) != MapDirty_None; }
 
 	virtual SPAWNINFO* GetSpawn() const { return nullptr; }
 	virtual GROUNDITEM* GetGroundItem() const { return nullptr; }
 
 protected:
 	virtual void HandleFormatSpecifier(char spec, CXStr& output);
+	virtual uint64_t HashFormatSpecifier(char spec, uint64_t hash) const;
 
 	void GenerateLabel();
 
@@ -58,8 +75,9 @@ protected:
 	void UpdateMarker();
 	void RemoveMarker();
 
-	CVector3              m_pos;
-	float                 m_heading = 0.0f;
+	CVector3& Position() { return gMapObjectStore.GetPosition(m_slot); }
+	float& Heading() { return gMapObjectStore.GetHeading(m_slot); }
+	uint8_t& Dirty() { return gMapObjectStore.GetDirty(m_slot); }
 
 private:
 	void MakeTriangleMarker();
@@ -69,7 +87,6 @@ private:
 
 protected:
 	CXStr                 m_text;           // holds ownership of the text stored in m_label
-	MQColor               m_color;
 	MapViewLabel*         m_label = nullptr;
 	MapViewLine*          m_vector = nullptr;
 	bool                  m_highlight = false;
@@ -78,8 +95,11 @@ private:
 	MarkerType            m_marker = MarkerType::None;
 	uint32_t              m_markerSize = 0;
 	std::vector<MapViewLine*> m_markerLines;
-	MapObject*            m_pLast = nullptr;
-	MapObject*            m_pNext = nullptr;
+	uint32_t              m_slot = 0;
+	uint32_t              m_textFormatId = 0;   // format that m_text was rendered from, if any
+	uint64_t              m_textHash = 0;
+
+	friend MapObjectStore;
 };
 
 //============================================================================
@@ -99,8 +119,13 @@ public:
 
 	MQColor GetSpawnColor() const;
 
+	// Spawn objects are created and destroyed constantly, so they come from a pool
+	static void* operator new(size_t size);
+	static void operator delete(void* ptr, size_t size);
+
 private:
 	virtual void HandleFormatSpecifier(char spec, CXStr& output) override;
+	virtual uint64_t HashFormatSpecifier(char spec, uint64_t hash) const override;
 
 	// Helpers for managing the velocity vector (if enabled). Note this could be on the base
 	// class if we also stored velocity there
@@ -132,6 +157,7 @@ public:
 
 private:
 	virtual void HandleFormatSpecifier(char spec, CXStr& output) override;
+	virtual uint64_t HashFormatSpecifier(char spec, uint64_t hash) const override;
 
 private:
 	GROUNDITEM* m_groundItem = nullptr;
@@ -0,0 +1,197 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// What has changed about a map object since it was last updated.
+enum MapObjectDirty : uint8_t
+{
+	MapDirty_None     = 0x00,
+	MapDirty_Position = 0x01,   // moved or turned
+	MapDirty_Label    = 0x02,   // label text needs to be formatted again
+	MapDirty_Color    = 0x04,   // color needs to be worked out again
+	MapDirty_Health   = 0x08,   // only shown in the target's label
+	MapDirty_Geometry = 0x10,   // marker lines need to be rebuilt
+
+	MapDirty_All      = 0x1f,
+};
+
+// The per-frame state of every active map object, kept in parallel arrays indexed by the
+// object's slot. MapUpdate scans these for changes and only updates objects that are dirty.
+// Removing an object moves the last one into its slot, and tells it its new slot.
+//
+// This only depends on the fields it reads from the objects and spawns, so it can be used
+// with made up spawns outside of the game.
+template <typename Object, typename Spawn, typename Position, typename Color>
+class BasicMapObjectStore
+{
+public:
+	uint32_t Add(Object* object)
+	{
+		uint32_t slot = Size();
+
+		m_objects.push_back(object);
+		m_spawns.push_back(nullptr);
+		m_spawnStates.emplace_back();
+		m_positions.emplace_back();
+		m_headings.push_back(0.0f);
+		m_colors.emplace_back();
+		m_dirty.push_back(MapDirty_All);
+
+		return slot;
+	}
+
+	void Remove(uint32_t slot)
+	{
+		uint32_t last = Size() - 1;
+		if (slot != last)
+		{
+			m_objects[slot] = m_objects[last];
+			m_spawns[slot] = m_spawns[last];
+			m_spawnStates[slot] = std::move(m_spawnStates[last]);
+			m_positions[slot] = m_positions[last];
+			m_headings[slot] = m_headings[last];
+			m_colors[slot] = m_colors[last];
+			m_dirty[slot] = m_dirty[last];
+
+			m_objects[slot]->m_slot = slot;
+		}
+
+		m_objects.pop_back();
+		m_spawns.pop_back();
+		m_spawnStates.pop_back();
+		m_positions.pop_back();
+		m_headings.pop_back();
+		m_colors.pop_back();
+		m_dirty.pop_back();
+	}
+
+	uint32_t Size() const { return static_cast<uint32_t>(m_objects.size()); }
+	Object* GetObject(uint32_t slot) const { return m_objects[slot]; }
+
+	Position& GetPosition(uint32_t slot) { return m_positions[slot]; }
+	float& GetHeading(uint32_t slot) { return m_headings[slot]; }
+	Color& GetColor(uint32_t slot) { return m_colors[slot]; }
+	uint8_t& GetDirty(uint32_t slot) { return m_dirty[slot]; }
+
+	// Spawn backed objects are compared against their spawn every frame by SyncSpawns.
+	void SetSpawn(uint32_t slot, Spawn* pSpawn)
+	{
+		m_spawns[slot] = pSpawn;
+		m_positions[slot] = Position{ pSpawn->X, pSpawn->Y, pSpawn->Z };
+		m_headings[slot] = pSpawn->Heading;
+		m_spawnStates[slot].hp = pSpawn->HPCurrent;
+		m_spawnStates[slot].SetKind(pSpawn);
+		m_dirty[slot] = MapDirty_All;
+	}
+
+	// Compares each spawn against what was last seen and marks the objects that changed.
+	void SyncSpawns()
+	{
+		const uint32_t count = Size();
+
+		for (uint32_t slot = 0; slot < count; ++slot)
+		{
+			Spawn* pSpawn = m_spawns[slot];
+			if (!pSpawn)
+				continue;
+
+			uint8_t dirty = 0;
+
+			Position& pos = m_positions[slot];
+			if (pos.X != pSpawn->X || pos.Y != pSpawn->Y || pos.Z != pSpawn->Z || m_headings[slot] != pSpawn->Heading)
+			{
+				pos.X = pSpawn->X;
+				pos.Y = pSpawn->Y;
+				pos.Z = pSpawn->Z;
+				m_headings[slot] = pSpawn->Heading;
+
+				dirty |= MapDirty_Position | MapDirty_Geometry;
+			}
+
+			SpawnState& state = m_spawnStates[slot];
+			if (state.hp != pSpawn->HPCurrent)
+			{
+				state.hp = pSpawn->HPCurrent;
+				dirty |= MapDirty_Health;
+			}
+
+			if (state.KindChanged(pSpawn))
+			{
+				state.SetKind(pSpawn);
+				dirty |= MapDirty_Label | MapDirty_Color;
+			}
+
+			m_dirty[slot] |= dirty;
+		}
+	}
+
+	void MarkAllDirty(uint8_t flags)
+	{
+		for (uint8_t& dirty : m_dirty)
+			dirty |= flags;
+	}
+
+private:
+	struct SpawnState
+	{
+		int64_t hp = 0;
+
+		// Everything about a spawn that can change while it is up and that GetSpawnType or the
+		// con color look at. Becoming someone's pet or mount, or being renamed, changes the
+		// spawn type without changing its level or type.
+		uint8_t level = 0;
+		uint8_t type = 0;
+		uint8_t standState = 0;
+		uint32_t masterId = 0;
+		const void* rider = nullptr;
+		bool mercenary = false;
+		std::string displayedName;
+
+		bool KindChanged(const Spawn* pSpawn) const
+		{
+			return level != pSpawn->Level
+				|| type != pSpawn->Type
+				|| standState != pSpawn->StandState
+				|| masterId != pSpawn->MasterID
+				|| rider != pSpawn->Rider
+				|| mercenary != static_cast<bool>(pSpawn->Mercenary)
+				|| displayedName != pSpawn->DisplayedName;
+		}
+
+		void SetKind(const Spawn* pSpawn)
+		{
+			level = pSpawn->Level;
+			type = pSpawn->Type;
+			standState = pSpawn->StandState;
+			masterId = pSpawn->MasterID;
+			rider = pSpawn->Rider;
+			mercenary = static_cast<bool>(pSpawn->Mercenary);
+			displayedName = pSpawn->DisplayedName;
+		}
+	};
+
+	std::vector<Object*>     m_objects;
+	std::vector<Spawn*>      m_spawns;
+	std::vector<SpawnState>  m_spawnStates;
+	std::vector<Position>    m_positions;
+	std::vector<float>       m_headings;
+	std::vector<Color>       m_colors;
+	std::vector<uint8_t>     m_dirty;
+};
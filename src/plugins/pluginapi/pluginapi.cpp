@@ -49,6 +49,9 @@ bool PluginMain(HINSTANCE hModule, DWORD dwReason, void* lpReserved)
 		sprintf_s(INIFileName, "%s\\%s.ini", mq::gPathConfig, mqplugin::PluginName);
 
 		mqplugin::MainInterface = mq::GetMainInterface();
+
+		// Read and write ini files through MQ2Main's cache, so that every module sees the same values.
+		mq::SetIniCache(mq::GetMainIniCache());
 	}
 	else if (dwReason == DLL_PROCESS_DETACH)
 	{
@@ -91,6 +94,16 @@ void mq::postoffice::DropboxAPI::PostReply(const std::shared_ptr<mq::postoffice:
 	mqplugin::MainInterface->ReplyToActor(Dropbox, message, data, status, mqplugin::ThisPluginHandle);
 }
 
+void mq::postoffice::DropboxAPI::Subscribe(const std::string& topic) const
+{
+	mqplugin::MainInterface->SubscribeActor(Dropbox, topic, true, mqplugin::ThisPluginHandle);
+}
+
+void mq::postoffice::DropboxAPI::Unsubscribe(const std::string& topic) const
+{
+	mqplugin::MainInterface->SubscribeActor(Dropbox, topic, false, mqplugin::ThisPluginHandle);
+}
+
 void mq::postoffice::DropboxAPI::Remove()
 {
 	mqplugin::MainInterface->RemoveActor(Dropbox, mqplugin::ThisPluginHandle);
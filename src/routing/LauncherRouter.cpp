@@ -0,0 +1,422 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "LauncherRouter.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+
+namespace mq::postoffice {
+
+LauncherRouter::LauncherRouter(PostOffice& postOffice, uint32_t selfPid, GetConnectionCb getConnection, DispatchCb dispatchToSelf)
+	: m_postOffice(postOffice)
+	, m_selfPid(selfPid)
+	, m_getConnection(std::move(getConnection))
+	, m_dispatchToSelf(std::move(dispatchToSelf))
+{
+}
+
+void LauncherRouter::RoutingFailed(
+	const EnvelopeHeader& envelope,
+	int status,
+	PipeMessagePtr&& message,
+	const PipeMessageResponseCb& callback)
+{
+	// we can't assume that the mailbox exists here, so manually create the reply
+	proto::routing::Envelope outbound;
+	*outbound.mutable_address() = envelope.returnAddress;
+	outbound.set_payload(envelope.address.SerializeAsString());
+
+	std::string data = outbound.SerializeAsString();
+	if (callback == nullptr)
+		message->SendReply(MQMessageId::MSG_ROUTE, &data[0], data.size(), status);
+	else
+		callback(status, std::make_unique<PipeMessage>(MQMessageId::MSG_ROUTE, &data[0], data.size()));
+}
+
+bool LauncherRouter::IsRecipient(const proto::routing::Address& address, const ClientIdentification& id)
+{
+	return (!address.has_account() || ci_equals(address.account(), id.account)) &&
+		(!address.has_server() || ci_equals(address.server(), id.server)) &&
+		(!address.has_character() || ci_equals(address.character(), id.character));
+}
+
+bool LauncherRouter::AddIdentity(ClientIdentification&& client)
+{
+	const uint32_t pid = client.pid;
+	const bool added = !RemoveIdentity(pid);
+
+	m_accountIndex.emplace(client.account, pid);
+	m_serverIndex.emplace(client.server, pid);
+	m_characterIndex.emplace(client.character, pid);
+	m_identities.emplace(pid, std::move(client));
+
+	return added;
+}
+
+bool LauncherRouter::RemoveIdentity(uint32_t pid)
+{
+	auto ident_it = m_identities.find(pid);
+	if (ident_it == m_identities.end())
+		return false;
+
+	auto unindex = [pid](ci_unordered::multimap<std::string, uint32_t>& index, const std::string& key)
+		{
+			auto [begin, end] = index.equal_range(key);
+			for (auto it = begin; it != end; ++it)
+			{
+				if (it->second == pid)
+				{
+					index.erase(it);
+					break;
+				}
+			}
+		};
+
+	unindex(m_accountIndex, ident_it->second.account);
+	unindex(m_serverIndex, ident_it->second.server);
+	unindex(m_characterIndex, ident_it->second.character);
+	m_identities.erase(ident_it);
+
+	return true;
+}
+
+const LauncherRouter::ClientIdentification* LauncherRouter::GetIdentity(uint32_t pid) const
+{
+	auto ident_it = m_identities.find(pid);
+	return ident_it != m_identities.end() ? &ident_it->second : nullptr;
+}
+
+void LauncherRouter::AddName(const std::string& name, uint32_t pid)
+{
+	m_names.insert_or_assign(name, pid);
+}
+
+std::vector<std::string> LauncherRouter::RemoveNames(uint32_t pid)
+{
+	std::vector<std::string> removed;
+
+	for (auto name_it = m_names.begin(); name_it != m_names.end();)
+	{
+		if (name_it->second == pid)
+		{
+			removed.push_back(name_it->first);
+			name_it = m_names.erase(name_it);
+		}
+		else
+			++name_it;
+	}
+
+	return removed;
+}
+
+template <typename Func>
+void LauncherRouter::ForEachRecipient(const proto::routing::Address& address, Func&& func) const
+{
+	// any one of the index lookups is a superset of the recipients, so pick the most specific
+	// one that the address has and then filter it down with the rest of the address
+	const ci_unordered::multimap<std::string, uint32_t>* index = nullptr;
+	const std::string* key = nullptr;
+
+	if (address.has_character())
+	{
+		index = &m_characterIndex;
+		key = &address.character();
+	}
+	else if (address.has_account())
+	{
+		index = &m_accountIndex;
+		key = &address.account();
+	}
+	else if (address.has_server())
+	{
+		index = &m_serverIndex;
+		key = &address.server();
+	}
+
+	if (index == nullptr)
+	{
+		for (const auto& [pid, _] : m_identities)
+		{
+			if (!func(pid))
+				return;
+		}
+
+		return;
+	}
+
+	auto [begin, end] = index->equal_range(*key);
+	for (auto it = begin; it != end; ++it)
+	{
+		auto ident_it = m_identities.find(it->second);
+		if (ident_it != m_identities.end() && IsRecipient(address, ident_it->second) && !func(it->second))
+			return;
+	}
+}
+
+void LauncherRouter::AddSubscriber(const std::string& topic, uint32_t pid)
+{
+	auto& subscribers = m_subscribers[topic];
+	if (std::find(subscribers.begin(), subscribers.end(), pid) == subscribers.end())
+		subscribers.push_back(pid);
+}
+
+void LauncherRouter::RemoveSubscriber(const std::string& topic, uint32_t pid)
+{
+	auto topic_it = m_subscribers.find(topic);
+	if (topic_it != m_subscribers.end())
+	{
+		auto& subscribers = topic_it->second;
+		subscribers.erase(std::remove(subscribers.begin(), subscribers.end(), pid), subscribers.end());
+
+		if (subscribers.empty())
+			m_subscribers.erase(topic_it);
+	}
+}
+
+void LauncherRouter::RemoveSubscriber(uint32_t pid)
+{
+	for (auto topic_it = m_subscribers.begin(); topic_it != m_subscribers.end();)
+	{
+		auto& subscribers = topic_it->second;
+		subscribers.erase(std::remove(subscribers.begin(), subscribers.end(), pid), subscribers.end());
+
+		if (subscribers.empty())
+			topic_it = m_subscribers.erase(topic_it);
+		else
+			++topic_it;
+	}
+}
+
+template <typename Func>
+void LauncherRouter::ForEachSubscriber(const proto::routing::Address& address, Func&& func) const
+{
+	auto topic_it = m_subscribers.find(address.topic());
+	if (topic_it == m_subscribers.end())
+		return;
+
+	const bool filtered = address.has_account() || address.has_server() || address.has_character();
+	for (uint32_t pid : topic_it->second)
+	{
+		if (filtered)
+		{
+			auto ident_it = m_identities.find(pid);
+			if (ident_it == m_identities.end() || !IsRecipient(address, ident_it->second))
+				continue;
+		}
+
+		if (!func(pid))
+			return;
+	}
+}
+
+int LauncherRouter::FindSingleRecipient(const proto::routing::Address& address, uint32_t& pid) const
+{
+	int matches = 0;
+	auto match = [&matches, &pid](uint32_t recipient)
+		{
+			pid = recipient;
+			return ++matches < 2;
+		};
+
+	if (address.has_topic())
+		ForEachSubscriber(address, match);
+	else
+		ForEachRecipient(address, match);
+
+	if (matches == 0)
+		return MsgError_RoutingFailed;
+
+	if (matches > 1)
+		return MsgError_AmbiguousRecipient;
+
+	return 0;
+}
+
+void LauncherRouter::RouteMessage(PipeMessagePtr&& message, const PipeMessageResponseCb& callback)
+{
+	if (callback == nullptr) // simple message, just route it
+		RouteMessage(std::move(message));
+	else // routing will fail here if there are too many recipients
+	{
+		EnvelopeHeader envelope;
+		if (!envelope.Peek(message))
+		{
+			SPDLOG_WARN("Unable to read route message envelope, message route failed.");
+			callback(MsgError_RoutingFailed, std::move(message));
+			return;
+		}
+
+		const auto& address = envelope.address;
+
+		auto routing_failed = [&envelope, callback](int status, PipeMessagePtr&& message)
+			{
+				RoutingFailed(envelope, status, std::move(message), callback);
+			};
+
+		auto single_send = [callback](const PipeConnectionPtr& connection, PipeMessagePtr&& message)
+			{
+				connection->SendMessageWithResponse(std::move(message), callback);
+			};
+
+		if (address.has_pid())
+		{
+			SendMessageToPID(address.pid(), std::move(message), single_send, routing_failed);
+		}
+		else if (address.has_name())
+		{
+			auto pid_it = m_names.find(address.name());
+			if (pid_it == m_names.end())
+			{
+				routing_failed(MsgError_RoutingFailed, std::move(message));
+			}
+			else
+			{
+				SendMessageToPID(pid_it->second, std::move(message), single_send, routing_failed);
+			}
+		}
+		else
+		{
+			uint32_t pid = 0;
+			if (int status = FindSingleRecipient(address, pid); status != 0)
+				RoutingFailed(envelope, status, std::move(message), callback);
+			else
+			{
+				message->SetRequestMode(MQRequestMode::CallAndResponse);
+				if (address.has_topic())
+					SendMessageToSubscriber(pid, address.topic(), std::move(message), single_send, routing_failed);
+				else
+					SendMessageToPID(pid, std::move(message), single_send, routing_failed);
+			}
+		}
+	}
+}
+
+void LauncherRouter::RouteMessage(PipeMessagePtr&& message)
+{
+	EnvelopeHeader envelope;
+	if (!envelope.Peek(message))
+	{
+		SPDLOG_WARN("Unable to read route message envelope, message route failed.");
+		return;
+	}
+
+	const auto& address = envelope.address;
+	auto routing_failed = [&envelope](int status, PipeMessagePtr&& message)
+		{
+			RoutingFailed(envelope, status, std::move(message), nullptr);
+		};
+
+	auto single_send = [](const PipeConnectionPtr& connection, PipeMessagePtr&& message)
+		{
+			connection->SendMessage(std::move(message));
+		};
+
+	if (address.has_pid())
+	{
+		// a PID is necessarily a singular identifier, avoid the loop
+		SendMessageToPID(address.pid(), std::move(message), single_send, routing_failed);
+	}
+	else if (address.has_name())
+	{
+		// a name is also a singular identifier, avoid the loop here too
+		// route the message to a registered (named) client
+		auto pid_it = m_names.find(address.name());
+		if (pid_it == m_names.end())
+		{
+			routing_failed(MsgError_RoutingFailed, std::move(message));
+		}
+		else
+		{
+			SendMessageToPID(pid_it->second, std::move(message), single_send, routing_failed);
+		}
+	}
+	else if (message->GetRequestMode() == MQRequestMode::CallAndResponse)
+	{
+		// ensure that we have a singular target for an RPC message
+		uint32_t pid = 0;
+		if (int status = FindSingleRecipient(address, pid); status != 0)
+			RoutingFailed(envelope, status, std::move(message), nullptr);
+		else if (address.has_topic())
+			SendMessageToSubscriber(pid, address.topic(), std::move(message), single_send, routing_failed);
+		else
+			SendMessageToPID(pid, std::move(message), single_send, routing_failed);
+	}
+	else if (address.has_topic())
+	{
+		// only the clients that subscribed to the topic get a copy. They each get their own header,
+		// but the payload is shared between all of them instead of being copied per client
+		std::shared_ptr<const PipeMessage> shared = std::move(message);
+
+		ForEachSubscriber(address,
+			[&](uint32_t pid)
+			{
+				SendMessageToSubscriber(
+					pid,
+					address.topic(),
+					std::make_unique<PipeMessage>(*shared->GetHeader(), shared),
+					single_send,
+					routing_failed);
+				return true;
+			});
+	}
+	else
+	{
+		// we don't have a PID or a name and this is not an RPC, so we will send this message to
+		// all clients that match the address -- it's important to copy these messages
+		ForEachRecipient(address,
+			[&](uint32_t pid)
+			{
+				SendMessageToPID(
+					pid,
+					std::make_unique<PipeMessage>(*message->GetHeader(), message->get(), message->size()),
+					single_send,
+					routing_failed);
+				return true;
+			});
+	}
+}
+
+bool LauncherRouter::SendMessageToPID(uint32_t pid, PipeMessagePtr&& message, const SendCb& send, const FailedCb& failed)
+{
+	if (pid == m_selfPid)
+	{
+		// send to self, dispatch directly to the handler
+		m_dispatchToSelf(std::move(message));
+		return true;
+	}
+	else if (auto connection = m_getConnection(pid))
+	{
+		// found a connection to send it over
+		send(connection, std::move(message));
+		return true;
+	}
+
+	SPDLOG_WARN("Unable to get connection for PID {}, message route failed.", pid);
+	failed(MsgError_NoConnection, std::move(message));
+	return false;
+}
+
+bool LauncherRouter::SendMessageToSubscriber(uint32_t pid, const std::string& topic, PipeMessagePtr&& message,
+	const SendCb& send, const FailedCb& failed)
+{
+	// our own subscribers are delivered to directly, dispatching to self would just route the message again
+	if (pid == m_selfPid)
+		return m_postOffice.DeliverToTopic(topic, std::move(message), failed) > 0;
+
+	return SendMessageToPID(pid, std::move(message), send, failed);
+}
+
+} // namespace mq::postoffice
@@ -0,0 +1,192 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#pragma once
+
+#include "PostOffice.h"
+
+#include "mq/base/String.h"
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mq::postoffice {
+
+/**
+ * The launcher's routing table: which client is which, and who is subscribed to what
+ *
+ * Clients identify themselves to the launcher and subscribe to topics, and every routed message
+ * goes through here to find the connection(s) it should be sent over. This only knows about pids
+ * and connections, so the launcher's post office supplies how a pid becomes a connection and what
+ * to do with messages addressed to itself.
+ */
+class LauncherRouter
+{
+public:
+	struct ClientIdentification
+	{
+		uint32_t pid;
+		std::string account;
+		std::string server;
+		std::string character;
+	};
+
+	using GetConnectionCb = std::function<PipeConnectionPtr(uint32_t pid)>;
+	using DispatchCb = std::function<void(PipeMessagePtr&&)>;
+
+	/**
+	 * @param postOffice the post office that owns this router, messages to its own topic subscribers are delivered there
+	 * @param selfPid the pid of the process the router lives in
+	 * @param getConnection returns the connection to a client, or nullptr if it isn't connected
+	 * @param dispatchToSelf handles messages addressed to the router's own process
+	 */
+	LauncherRouter(PostOffice& postOffice, uint32_t selfPid, GetConnectionCb getConnection, DispatchCb dispatchToSelf);
+
+	/**
+	 * Replies to the sender of a message that couldn't be routed, with the address that failed
+	 *
+	 * @param envelope the envelope of the message that failed
+	 * @param status the reason it failed
+	 * @param message the message that failed, to reply to if there is no callback
+	 * @param callback the RPC callback of the message, if any
+	 */
+	static void RoutingFailed(
+		const EnvelopeHeader& envelope,
+		int status,
+		PipeMessagePtr&& message,
+		const PipeMessageResponseCb& callback);
+
+	/**
+	 * Adds or replaces the identification of a client
+	 *
+	 * @param client the client's identification
+	 * @return true if the client wasn't identified before
+	 */
+	bool AddIdentity(ClientIdentification&& client);
+
+	/**
+	 * Removes the identification of a client
+	 *
+	 * @param pid the client's pid
+	 * @return true if the client was identified
+	 */
+	bool RemoveIdentity(uint32_t pid);
+
+	const ClientIdentification* GetIdentity(uint32_t pid) const;
+	const std::unordered_map<uint32_t, ClientIdentification>& GetIdentities() const { return m_identities; }
+
+	/**
+	 * Registers a name that messages can be addressed to
+	 *
+	 * @param name the name, which is case insensitive
+	 * @param pid the pid of the client that has the name
+	 */
+	void AddName(const std::string& name, uint32_t pid);
+
+	/**
+	 * Removes every name that a client registered, for when it disconnects
+	 *
+	 * @param pid the client's pid
+	 * @return the names that were removed
+	 */
+	std::vector<std::string> RemoveNames(uint32_t pid);
+
+	const ci_unordered::map<std::string, uint32_t>& GetNames() const { return m_names; }
+
+	/**
+	 * Subscribes a client to a topic, messages sent to a topic only go to its subscribers
+	 *
+	 * @param topic the topic
+	 * @param pid the pid of the subscribing client
+	 */
+	void AddSubscriber(const std::string& topic, uint32_t pid);
+
+	/**
+	 * Unsubscribes a client from a topic
+	 *
+	 * @param topic the topic
+	 * @param pid the pid of the client
+	 */
+	void RemoveSubscriber(const std::string& topic, uint32_t pid);
+
+	/**
+	 * Removes a client from every topic, for when it disconnects
+	 *
+	 * @param pid the pid of the client
+	 */
+	void RemoveSubscriber(uint32_t pid);
+
+	/**
+	 * Finds the single client that matches the address
+	 *
+	 * @param address the address, which has neither a pid nor a name
+	 * @param pid set to the client that was found
+	 * @return 0 if there was exactly one, otherwise the routing error
+	 */
+	int FindSingleRecipient(const proto::routing::Address& address, uint32_t& pid) const;
+
+	/**
+	 * Routes an RPC message to its single recipient
+	 *
+	 * @param message the message to route, in an envelope
+	 * @param callback the callback for the response, routes without waiting for one if this is empty
+	 */
+	void RouteMessage(PipeMessagePtr&& message, const PipeMessageResponseCb& callback);
+
+	/**
+	 * Routes a message to every client that its address matches, or to the single one if it is an RPC
+	 *
+	 * @param message the message to route, in an envelope
+	 */
+	void RouteMessage(PipeMessagePtr&& message);
+
+private:
+	using SendCb = std::function<void(const PipeConnectionPtr&, PipeMessagePtr&&)>;
+	using FailedCb = std::function<void(int, PipeMessagePtr&&)>;
+
+	static bool IsRecipient(const proto::routing::Address& address, const ClientIdentification& id);
+
+	// Calls func with the pid of every client that matches the address, stopping early if func returns false
+	template <typename Func>
+	void ForEachRecipient(const proto::routing::Address& address, Func&& func) const;
+
+	// Calls func with the pid of every subscriber to the address's topic that also matches the rest of
+	// the address, stopping early if func returns false
+	template <typename Func>
+	void ForEachSubscriber(const proto::routing::Address& address, Func&& func) const;
+
+	bool SendMessageToPID(uint32_t pid, PipeMessagePtr&& message, const SendCb& send, const FailedCb& failed);
+	bool SendMessageToSubscriber(uint32_t pid, const std::string& topic, PipeMessagePtr&& message,
+		const SendCb& send, const FailedCb& failed);
+
+	PostOffice& m_postOffice;
+	uint32_t m_selfPid;
+	GetConnectionCb m_getConnection;
+	DispatchCb m_dispatchToSelf;
+
+	std::unordered_map<uint32_t, ClientIdentification> m_identities;
+	ci_unordered::map<std::string, uint32_t> m_names;
+
+	// secondary indexes into m_identities so that addressed messages don't need to scan every client
+	ci_unordered::multimap<std::string, uint32_t> m_accountIndex;
+	ci_unordered::multimap<std::string, uint32_t> m_serverIndex;
+	ci_unordered::multimap<std::string, uint32_t> m_characterIndex;
+
+	// the clients subscribed to each topic, messages sent to a topic only go to these
+	std::unordered_map<std::string, std::vector<uint32_t>> m_subscribers;
+};
+
+} // namespace mq::postoffice
@@ -16,25 +16,44 @@
 //#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
 
 #include "NamedPipes.h"
+#include "PostOffice.h"
+
+#if defined(_WIN32)
 #include "common/Common.h"
 #include "mq/base/WString.h"
 
 #include <windows.h>
-#include <stdio.h>
 #include <tchar.h>
 #include <strsafe.h>
+#else
+#include <pthread.h>
+#endif
+
+#include <stdio.h>
 #include <time.h>
-#include <fmt/os.h>
 #include <spdlog/spdlog.h>
 #include <spdlog/fmt/bin_to_hex.h>
-#include <wil/resource.h>
+
+#include <numeric>
 
 using namespace std::chrono_literals;
 
 namespace mq {
 
-constexpr int BUFFER_SIZE = 4096;
-constexpr int PIPE_TIMEOUT = 5000;
+// Initial size of the read ring buffer. Must be a power of two.
+constexpr size_t READ_BUFFER_SIZE = 16 * 1024;
+
+// Messages larger than this are read directly into their own buffer rather than the ring buffer.
+constexpr size_t LARGE_MESSAGE_SIZE = READ_BUFFER_SIZE / 2;
+
+// Upper bound on the size of a single message. Anything larger means the stream is corrupt.
+constexpr size_t MAX_MESSAGE_SIZE = 64 * 1024 * 1024;
+
+// Limits for combining queued messages into a single write. Only small messages are combined,
+// large messages are always written on their own.
+constexpr size_t COALESCE_MESSAGE_SIZE = 4096;
+constexpr size_t COALESCE_WRITE_SIZE = 64 * 1024;
+constexpr size_t COALESCE_MAX_MESSAGES = 64;
 
 //============================================================================
 // PipeMessage
@@ -60,6 +79,16 @@ PipeMessage::PipeMessage(const PipeMessage& message, const void* data, size_t le
 	SetConnection(message.m_connection.lock());
 }
 
+PipeMessage::PipeMessage(const MQMessageHeader& header, std::shared_ptr<const PipeMessage> payload)
+	: m_sharedPayload(std::move(payload))
+{
+	// only the header lives in this message's buffer
+	Init(header, nullptr, 0);
+	m_header->messageLength = static_cast<uint32_t>(m_sharedPayload->size());
+
+	SetConnection(m_sharedPayload->m_connection.lock());
+}
+
 PipeMessage::~PipeMessage()
 {
 }
@@ -117,6 +146,17 @@ bool PipeMessage::Parse(const std::vector<std::pair<std::unique_ptr<uint8_t[]>,
 	return Parse(std::move(buffer), length);
 }
 
+size_t PipeMessage::GetWriteBuffers(TransportBuffer* buffers) const
+{
+	buffers[0] = { m_buffer.get(), m_bufferLength };
+
+	if (m_sharedPayload == nullptr || m_sharedPayload->size() == 0)
+		return 1;
+
+	buffers[1] = { m_sharedPayload->get<uint8_t>(), m_sharedPayload->size() };
+	return 2;
+}
+
 void PipeMessage::Init(const void* data, size_t length)
 {
 	m_dataOffset = sizeof(MQMessageHeader);
@@ -188,6 +228,21 @@ void PipeMessage::SendReply(MQMessageId messageId, void* data, size_t length, ui
 	}
 }
 
+void PipeMessage::SendReply(std::unique_ptr<PipeMessage>&& reply, uint8_t status)
+{
+	if (m_header && m_header->mode == MQRequestMode::CallAndResponse && !m_replied)
+	{
+		reply->GetHeader()->mode = MQRequestMode::MessageReply;
+		reply->GetHeader()->status = status;
+		reply->GetHeader()->sequenceId = m_header->sequenceId;
+
+		if (auto connection = m_connection.lock())
+		{
+			connection->SendMessage(std::move(reply));
+		}
+	}
+}
+
 //============================================================================
 
 mq::PipeMessagePtr MakeSimpleMessageV0(MQMessageId messageId, const void* data, size_t dataLength)
@@ -214,22 +269,110 @@ mq::PipeMessagePtr MakeCallResponseReplyV0(MQMessageId messageId, const void* da
 	return message;
 }
 
+//============================================================================
+// PipeReadBuffer
+//============================================================================
+
+PipeReadBuffer::PipeReadBuffer(size_t capacity)
+	: m_buffer(std::make_unique<uint8_t[]>(capacity))
+	, m_initialCapacity(capacity)
+	, m_capacity(capacity)
+{
+	assert((capacity & (capacity - 1)) == 0);
+}
+
+std::pair<uint8_t*, size_t> PipeReadBuffer::GetWriteSpan(size_t minimum)
+{
+	if (m_size == 0)
+	{
+		// start over at the front so the whole buffer is contiguous
+		m_head = 0;
+	}
+
+	if (m_capacity - m_size < minimum)
+	{
+		size_t capacity = m_capacity;
+		while (capacity - m_size < minimum)
+			capacity *= 2;
+
+		Grow(capacity);
+	}
+
+	size_t tail = (m_head + m_size) & (m_capacity - 1);
+	size_t contiguous = tail >= m_head ? m_capacity - tail : m_head - tail;
+
+	// the free space is split around the end of the buffer. Take the larger part if it's
+	// split badly enough that the piece at the end can't satisfy the request.
+	if (m_size != 0 && contiguous < minimum)
+	{
+		Grow(m_capacity);
+		tail = m_size;
+		contiguous = m_capacity - m_size;
+	}
+
+	return { m_buffer.get() + tail, std::min(contiguous, m_capacity - m_size) };
+}
+
+void PipeReadBuffer::Commit(size_t length)
+{
+	assert(m_size + length <= m_capacity);
+	m_size += length;
+}
+
+void PipeReadBuffer::Copy(size_t offset, void* dest, size_t length) const
+{
+	assert(offset + length <= m_size);
+
+	size_t start = (m_head + offset) & (m_capacity - 1);
+	size_t first = std::min(length, m_capacity - start);
+
+	memcpy(dest, m_buffer.get() + start, first);
+	if (first < length)
+		memcpy(static_cast<uint8_t*>(dest) + first, m_buffer.get(), length - first);
+}
+
+void PipeReadBuffer::Consume(size_t length)
+{
+	assert(length <= m_size);
+
+	m_head = (m_head + length) & (m_capacity - 1);
+	m_size -= length;
+}
+
+void PipeReadBuffer::Compact()
+{
+	if (m_size == 0 && m_capacity > m_initialCapacity)
+	{
+		m_buffer = std::make_unique<uint8_t[]>(m_initialCapacity);
+		m_capacity = m_initialCapacity;
+		m_head = 0;
+	}
+}
+
+void PipeReadBuffer::Grow(size_t capacity)
+{
+	// also used to straighten out the data at the current capacity
+	auto buffer = std::make_unique<uint8_t[]>(capacity);
+	Copy(0, buffer.get(), m_size);
+
+	m_buffer = std::move(buffer);
+	m_capacity = capacity;
+	m_head = 0;
+}
+
 //============================================================================
 // PipeConnection
 //============================================================================
 
 int PipeConnection::s_nextConnectionId = 1;
 
-PipeConnection::PipeConnection(NamedPipeEndpointBase* parent, wil::unique_hfile hPipe)
-	: m_hPipe(std::move(hPipe))
+PipeConnection::PipeConnection(NamedPipeEndpointBase* parent, PipeTransportPtr transport)
+	: m_transport(std::move(transport))
 	, m_connectionId(s_nextConnectionId++)
 	, m_parent(parent)
+	, m_readBuffer(READ_BUFFER_SIZE)
 {
-	LPOVERLAPPED pOverlapped = GetOverlapped();
-	ZeroMemory(pOverlapped, sizeof(OVERLAPPED));
-	pOverlapped->hEvent = reinterpret_cast<HANDLE>(this);
-
-	GetNamedPipeClientProcessId(m_hPipe.get(), (PULONG)&m_processId);
+	m_processId = m_transport->GetPeerProcessId();
 
 	SPDLOG_DEBUG("Created PipeConnection: connectionId={} pid={}", m_connectionId, m_processId);
 }
@@ -241,127 +384,167 @@ PipeConnection::~PipeConnection()
 	SPDLOG_DEBUG("Destroyed PipeConnection: connectionId={} pid={}", m_connectionId, m_processId);
 }
 
+void PipeConnection::StartRead()
+{
+	MQMessagePipeCapabilities capabilities;
+	capabilities.flags = PipeCapability_HeaderFraming | PipeCapability_CompressedPayloads;
+	InternalSendMessage(MakeSimpleMessageV0(MQMessageId::MSG_PIPE_CAPABILITIES, &capabilities, sizeof(capabilities)));
+
+	InternalBeginRead();
+}
+
 void PipeConnection::InternalBeginRead()
 {
 	// this function *must* be called on the named pipe server thread
 	assert(std::this_thread::get_id() == m_parent->pipe_thread_id());
 
-	// This keeps the PipeConnection object alive while the ReadFileEx call is waiting.
-	m_self = shared_from_this();
+	// Large messages are read directly into the message buffer, everything else goes through the
+	// ring buffer.
+	uint8_t* buffer = nullptr;
+	size_t length = 0;
 
-	// We can use the hEvent field to store a reference to this connection, that we can
-	// use to read the response.
-	ZeroMemory(&m_overlapped, sizeof(OVERLAPPED));
-	m_overlapped.hEvent = reinterpret_cast<HANDLE>(this);
-
-	if (!m_readBuffer)
+	if (m_largeMessage)
 	{
-		m_readBuffer = std::make_unique<uint8_t[]>(BUFFER_SIZE);
-		m_readBufferSize = BUFFER_SIZE;
+		buffer = m_largeMessage.get() + m_largeMessageReceived;
+		length = m_largeMessageSize - m_largeMessageReceived;
 	}
-
-	// Start the read operation
-	bool readStarted = ::ReadFileEx(m_hPipe.get(), m_readBuffer.get(), static_cast<DWORD>(m_readBufferSize), &m_overlapped,
-		[](DWORD dwErrorCode, DWORD dwNumberOfBytesTransferred, LPOVERLAPPED lpOverlapped)
+	else
 	{
-		PipeConnection* connection = reinterpret_cast<PipeConnection*>(lpOverlapped->hEvent);
-
-		// extract self from the call. This will allow our connection to safely go out of scope when this
-		// callback completes.
+		std::tie(buffer, length) = m_readBuffer.GetWriteSpan(sizeof(MQMessageHeader));
+	}
 
-		// FIXME: Needs to be stored with request. Two requests = needs to be 2 ref count.
-		std::shared_ptr<PipeConnection> self = std::move(connection->m_self);
-		self->HandleReadComplete(dwErrorCode, dwNumberOfBytesTransferred);
-	});
+	// The callback keeps the PipeConnection object alive while the read is waiting. It is
+	// released when the callback completes, which allows our connection to safely go out of scope.
+	bool readStarted = m_transport->BeginRead(buffer, length,
+		[self = shared_from_this()](TransportStatus status, uint32_t errorCode, size_t bytesRead)
+		{
+			self->HandleReadComplete(status, errorCode, bytesRead);
+		});
 
 	if (!readStarted)
 	{
-		auto error = GetLastError();
-		if(error != ERROR_MORE_DATA) {
-			SPDLOG_ERROR("{} connectionId={}",
-				fmt::windows_error(error, "Failed at ::ReadFileEx").what(), m_connectionId);
-			m_parent->CloseConnection(this);
-		}
+		SPDLOG_ERROR("{}: {} connectionId={}",
+			"Failed to begin read", DescribeTransportError(GetLastTransportError()), m_connectionId);
+		m_parent->CloseConnection(this);
 	}
 }
 
-void PipeConnection::ProcessBuffers()
+bool PipeConnection::ProcessBuffers()
 {
-	// Check if we've got any buffers.
-	if (!m_readBuffers.empty())
+	// Finish a large message before looking at anything else
+	if (m_largeMessage)
 	{
-		size_t size = 0;
-		for (const auto& p : m_readBuffers)
-			size += p.second;
+		if (m_largeMessageReceived < m_largeMessageSize)
+			return true;
+
+		ReceiveBuffer(std::move(m_largeMessage), m_largeMessageSize);
+	}
 
-		auto message = std::make_unique<PipeMessage>();
-		if (message->Parse(m_readBuffers))
+	// Pull every complete message out of the buffer
+	while (m_readBuffer.size() >= sizeof(MQMessageHeader))
+	{
+		// the header might wrap around the end of the ring, so copy it out
+		MQMessageHeader header;
+		m_readBuffer.Copy(0, &header, sizeof(MQMessageHeader));
+
+		// we can't find the next message boundary if we don't understand this one
+		if (header.protoVersion != MQProtoVersion::V0 || header.messageLength > MAX_MESSAGE_SIZE)
 		{
-			InternalReceiveMessage(std::move(message));
+			SPDLOG_WARN("PipeConnection::ProcessBuffers: Failed to parse incoming message: connectionId={}",
+				m_connectionId);
+			return false;
 		}
-		else
+
+		size_t messageSize = sizeof(MQMessageHeader) + header.messageLength;
+		if (messageSize > LARGE_MESSAGE_SIZE)
 		{
-			SPDLOG_WARN("PipeConnection::HandleReadComplete: Failed to parse incoming message: connectionId={}",
-				m_connectionId);
+			// Move what we have into the message buffer and read the rest straight into it.
+			size_t available = std::min(m_readBuffer.size(), messageSize);
+
+			m_largeMessage = std::make_unique<uint8_t[]>(messageSize);
+			m_largeMessageSize = messageSize;
+			m_largeMessageReceived = available;
+
+			m_readBuffer.Copy(0, m_largeMessage.get(), available);
+			m_readBuffer.Consume(available);
+
+			if (available < messageSize)
+				break;
+
+			ReceiveBuffer(std::move(m_largeMessage), messageSize);
+			continue;
 		}
 
-		// Reclaim a buffer
-		m_readBuffer = std::move(m_readBuffers[0].first);
-		m_readBufferSize = m_readBuffers[0].second;
+		if (m_readBuffer.size() < messageSize)
+			break;
+
+		auto buffer = std::make_unique<uint8_t[]>(messageSize);
+		m_readBuffer.Copy(0, buffer.get(), messageSize);
+		m_readBuffer.Consume(messageSize);
 
-		m_readBuffers.clear();
+		ReceiveBuffer(std::move(buffer), messageSize);
+	}
+
+	m_readBuffer.Compact();
+	return true;
+}
+
+void PipeConnection::ReceiveBuffer(std::unique_ptr<uint8_t[]> buffer, size_t length)
+{
+	auto message = std::make_unique<PipeMessage>();
+	if (message->Parse(std::move(buffer), length))
+	{
+		InternalReceiveMessage(std::move(message));
+	}
+	else
+	{
+		SPDLOG_WARN("PipeConnection::ProcessBuffers: Failed to parse incoming message: connectionId={}",
+			m_connectionId);
 	}
 }
 
-void PipeConnection::HandleReadComplete(uint32_t errorCode, uint32_t bytesRead)
+void PipeConnection::HandleReadComplete(TransportStatus status, uint32_t errorCode, size_t bytesRead)
 {
 	// this function *must* be called on the named pipe server thread
 	assert(std::this_thread::get_id() == m_parent->pipe_thread_id());
 
-	DWORD dwBytesRead;
-	::GetOverlappedResult(m_hPipe.get(), &m_overlapped, &dwBytesRead, FALSE);
-	bool moreData = ::GetLastError() == ERROR_MORE_DATA;
-
-	SPDLOG_TRACE("PipeConnection::HandleReadComplete: errorCode={} bytesRead={} moreData={} connectionId={}",
-		errorCode, bytesRead, moreData, m_connectionId);
+	SPDLOG_TRACE("PipeConnection::HandleReadComplete: errorCode={} bytesRead={} connectionId={}",
+		errorCode, bytesRead, m_connectionId);
 
-	::SetLastError(ERROR_SUCCESS);
-
-	switch (errorCode)
+	switch (status)
 	{
-	case ERROR_BROKEN_PIPE:
+	case TransportStatus::Closed:
 		// The pipe was closed. Abandon the request.
 		SPDLOG_DEBUG("PipeConnection::HandleReadComplete: pipe closed. connectionId={}", m_connectionId);
 		Close();
 		return;
 
-	case ERROR_OPERATION_ABORTED:
+	case TransportStatus::Canceled:
 		// The request has been canceled. Abandon the request.
 		SPDLOG_DEBUG("PipeConnection::HandleReadComplete: operation canceled. connectionId={}", m_connectionId);
 		Close();
 		return;
 
-	case ERROR_INSUFFICIENT_BUFFER:
-	case ERROR_SUCCESS:
-	case ERROR_MORE_DATA:
-		// Store the data in our buffers, and try to read more. If we've got all the
-		// data we need we can process it right after the next call to ReadFileEx.
-		m_readBuffers.emplace_back(std::move(m_readBuffer), bytesRead);
+	case TransportStatus::Success:
+		// Store the data and process any messages that are complete, then start the next read.
+		if (m_largeMessage)
+			m_largeMessageReceived += bytesRead;
+		else
+			m_readBuffer.Commit(bytesRead);
 
-		if (!moreData && errorCode != ERROR_MORE_DATA)
+		if (!ProcessBuffers())
 		{
-			ProcessBuffers();
+			Close();
+			return;
 		}
 
-		// Start the next read
 		InternalBeginRead();
 		break;
 
 	default: // Some other error occurred.
 		SPDLOG_ERROR("PipeConnection::HandleReadComplete: Unexpected error. connectionId={} error={}",
 			m_connectionId,
-			fmt::windows_error(errorCode, "Failed to complete read operation").what());
-		m_readBuffers.clear(); // just in case we had some buffers already
+			DescribeTransportError(errorCode));
 		Close();
 	}
 }
@@ -425,7 +608,7 @@ void PipeConnection::InternalSendMessage(PipeMessagePtr&& message,
 	assert(std::this_thread::get_id() == m_parent->pipe_thread_id());
 
 	// If we're not connected anymore, bail out early
-	if (!m_hPipe)
+	if (!m_transport->IsOpen())
 	{
 		SPDLOG_WARN("Tried to send a message but the pipe was closed. connectionId={}",
 			m_connectionId);
@@ -439,6 +622,22 @@ void PipeConnection::InternalSendMessage(PipeMessagePtr&& message,
 		return;
 	}
 
+	if (!m_peerDecompressesPayloads && message->GetMessageId() == MQMessageId::MSG_ROUTE)
+	{
+		message = postoffice::DecompressEnvelope(std::move(message));
+		if (message == nullptr)
+		{
+			SPDLOG_WARN("Dropping routed message that could not be decompressed. connectionId={}", m_connectionId);
+
+			if (callback)
+			{
+				m_parent->PostToMainThread(
+					[callback]() { callback(MsgError_RoutingFailed, nullptr); });
+			}
+			return;
+		}
+	}
+
 	if (message->GetSequenceId() == 0)
 		message->SetSequenceId(m_nextSequenceId++);
 	message->SetConnection(shared_from_this());
@@ -454,10 +653,7 @@ void PipeConnection::InternalSendMessage(PipeMessagePtr&& message,
 		m_rpcRequests.emplace(request.sequenceId, std::move(request));
 	}
 
-	auto queuedOp = std::make_unique<QueuedOp>();
-	queuedOp->message = std::move(message);
-
-	m_writeQueue.push_back(std::move(queuedOp));
+	m_writeQueue.push_back(std::move(message));
 	InternalBeginSend();
 }
 
@@ -469,48 +665,70 @@ void PipeConnection::InternalBeginSend()
 	if (m_writeQueue.empty())
 		return;
 
-	QueuedOp* op = m_writeQueue[0].get();
-	op->ref = shared_from_this();
-	ZeroMemory(&op->overlapped, sizeof(OVERLAPPED));
-	op->overlapped.hEvent = reinterpret_cast<HANDLE>(op);
-	m_pendingWrite = true;
+	// Gather up the small messages at the front of the queue so they go out in one write.
+	// A large message is always written by itself. Older versions read each write on a named
+	// pipe as a single message, so they only ever get one message at a time.
+	const size_t maxMessages = m_peerFramesByHeader || !m_transport->PreservesMessageBoundaries()
+		? COALESCE_MAX_MESSAGES : 1;
 
-	bool writeStarted = ::WriteFileEx(m_hPipe.get(), op->message->buffer(), static_cast<DWORD>(op->message->buffer_size()), &op->overlapped,
-		[](DWORD dwErrorCode, DWORD dwNumberOfBytesTransferred, LPOVERLAPPED lpOverlapped)
+	m_writeBuffers.clear();
+	m_writeBatchCount = 0;
+	size_t total = 0;
+
+	for (const auto& message : m_writeQueue)
 	{
-		QueuedOp* op = reinterpret_cast<QueuedOp*>(lpOverlapped->hEvent);
+		size_t size = message->GetWriteSize();
 
-		// FIXME: Needs to be stored with request. Two requests = needs to be 2 ref count.
-		std::shared_ptr<PipeConnection> self = std::move(op->ref);
-		self->HandleWriteComplete(op, dwErrorCode, dwNumberOfBytesTransferred);
-	});
+		if (m_writeBatchCount > 0
+			&& (size > COALESCE_MESSAGE_SIZE
+				|| total + size > COALESCE_WRITE_SIZE
+				|| m_writeBatchCount >= maxMessages))
+		{
+			break;
+		}
+
+		TransportBuffer buffers[2];
+		size_t count = message->GetWriteBuffers(buffers);
+		m_writeBuffers.insert(m_writeBuffers.end(), buffers, buffers + count);
+
+		++m_writeBatchCount;
+		total += size;
+
+		if (size > COALESCE_MESSAGE_SIZE)
+			break;
+	}
+
+	m_pendingWrite = true;
+
+	// The callback keeps the connection alive until the write completes.
+	bool writeStarted = m_transport->BeginWrite(m_writeBuffers.data(), m_writeBuffers.size(),
+		[self = shared_from_this()](TransportStatus status, uint32_t errorCode, size_t bytesWritten)
+		{
+			self->HandleWriteComplete(status, errorCode, bytesWritten);
+		});
 
 	if (!writeStarted)
 	{
-		SPDLOG_ERROR("{}",
-			fmt::windows_error(GetLastError(), "Failed at PipeConnection::InternalBeginSend").what());
+		SPDLOG_ERROR("Failed at PipeConnection::InternalBeginSend: {}",
+			DescribeTransportError(GetLastTransportError()));
 
 		m_parent->CloseConnection(this);
 		m_pendingWrite = false;
 	}
 }
 
-void PipeConnection::HandleWriteComplete(QueuedOp* op, uint32_t dwErrorCode, uint32_t dwNumBytes)
+void PipeConnection::HandleWriteComplete(TransportStatus status, uint32_t errorCode, size_t bytesWritten)
 {
 	// this function *must* be called on the named pipe server thread
 	assert(std::this_thread::get_id() == m_parent->pipe_thread_id());
 
-	// Remove the op from the queue.
-	assert(op == m_writeQueue[0].get());
-
-	const auto& reply = op->message;
-	size_t bytesWritten = reply->buffer_size();
-
-	// this will delete the op
-	m_writeQueue.pop_front();
+	// Remove the written messages from the queue.
+	const size_t messageCount = m_writeBatchCount;
+	m_writeQueue.erase(m_writeQueue.begin(), m_writeQueue.begin() + messageCount);
+	m_writeBatchCount = 0;
 	m_pendingWrite = false;
 
-	if (dwErrorCode == ERROR_OPERATION_ABORTED)
+	if (status == TransportStatus::Canceled)
 	{
 		SPDLOG_INFO("PipeConnection::HandleWriteComplete: operation canceled");
 
@@ -518,43 +736,50 @@ void PipeConnection::HandleWriteComplete(QueuedOp* op, uint32_t dwErrorCode, uin
 		return;
 	}
 
-	SPDLOG_TRACE("PipeConnection::HandleWriteComplete: dwErrorCode={} dwNumBytes={} connectionId={}",
-		dwErrorCode, dwNumBytes, m_connectionId);
+	SPDLOG_TRACE("PipeConnection::HandleWriteComplete: errorCode={} bytesWritten={} messages={} connectionId={}",
+		errorCode, bytesWritten, messageCount, m_connectionId);
 
 	InternalBeginSend();
 }
 
 bool PipeConnection::InternalClose(bool disconnect)
 {
-	if (!m_hPipe)
+	if (!m_transport->IsOpen())
 		return false;
 
 	SPDLOG_TRACE("PipeConnection::Close: connectionId={} processId={}",
 		m_connectionId, m_processId);
 
-	::CancelIoEx(m_hPipe.get(), &m_overlapped);
+	m_transport->CancelRead();
 
 	for (const auto& [sequenceId, rpcRequest] : m_rpcRequests)
 	{
 		rpcRequest.callback(MsgError_ConnectionClosed, nullptr);
 	}
 
-	if (disconnect)
-	{
-		if (!::DisconnectNamedPipe(m_hPipe.get()))
-		{
-			SPDLOG_ERROR("PipeConnection::InternalClose: {}",
-				fmt::windows_error(GetLastError(), "Failed at DisconnectNamePipe").what());
-		}
-	}
-
 	m_rpcRequests.clear();
-	m_hPipe.reset();
+	m_transport->Close(disconnect);
 	return true;
 }
 
 void PipeConnection::InternalReceiveMessage(PipeMessagePtr&& message)
 {
+	// Capabilities only describe this connection, so they are handled here and never dispatched.
+	if (message->GetMessageId() == MQMessageId::MSG_PIPE_CAPABILITIES)
+	{
+		if (message->size() >= sizeof(MQMessagePipeCapabilities))
+		{
+			const uint32_t flags = message->get<MQMessagePipeCapabilities>()->flags;
+			m_peerFramesByHeader = (flags & PipeCapability_HeaderFraming) != 0;
+			m_peerDecompressesPayloads = (flags & PipeCapability_CompressedPayloads) != 0;
+
+			SPDLOG_DEBUG("PipeConnection: peer capabilities flags={:#x} connectionId={}",
+				message->get<MQMessagePipeCapabilities>()->flags, m_connectionId);
+		}
+
+		return;
+	}
+
 	message->SetConnection(shared_from_this());
 
 	if (message->GetRequestMode() == MQRequestMode::MessageReply)
@@ -588,7 +813,6 @@ NamedPipeEndpointBase::NamedPipeEndpointBase(std::string threadName, std::string
 	: m_threadName(std::move(threadName))
 	, m_pipeName(std::move(pipeName))
 {
-	m_interruptEvent.create();
 }
 
 NamedPipeEndpointBase::~NamedPipeEndpointBase()
@@ -613,6 +837,7 @@ void NamedPipeEndpointBase::Start()
 	m_thread = std::thread(
 		[this]()
 		{
+#if defined(_WIN32)
 			// SetThreadDescription only available on Windows 10 1607+
 			using fSetThreadDescription = HRESULT(WINAPI*)(HANDLE, PCWSTR);
 			auto SetThreadDescription = (fSetThreadDescription)GetProcAddress(GetModuleHandle("kernel32.dll"), "SetThreadDescription");
@@ -620,6 +845,10 @@ void NamedPipeEndpointBase::Start()
 			{
 				SetThreadDescription(GetCurrentThread(), utf8_to_wstring(m_threadName).c_str());
 			}
+#elif defined(__linux__)
+			// thread names are limited to 15 characters
+			pthread_setname_np(pthread_self(), m_threadName.substr(0, 15).c_str());
+#endif
 
 			m_pipeThreadId = std::this_thread::get_id();
 
@@ -646,14 +875,31 @@ void NamedPipeEndpointBase::Stop()
 	SPDLOG_INFO("Stopping {} thread for {}", m_threadName, m_pipeName);
 
 	m_running = false;
-	m_interruptEvent.SetEvent();
+	m_waiter.Interrupt();
 	m_thread.join();
 }
 
 void NamedPipeEndpointBase::DispatchMessage(PipeMessagePtr&& message)
 {
+	// if the main thread stalls, don't let incoming messages pile up without limit
+	const size_t maxPending = m_maxPendingMessages;
+	if (maxPending > 0 && m_pendingMessages >= maxPending)
+	{
+		if (!m_droppingMessages.exchange(true))
+			SPDLOG_WARN("{}: {} messages are waiting for the main thread, dropping new messages", m_threadName, maxPending);
+
+		++m_droppedMessages;
+		message->SendReply(static_cast<uint8_t>(MsgError_QueueFull));
+		return;
+	}
+
+	m_droppingMessages = false;
+	++m_pendingMessages;
+
 	PostToMainThread([message = message.release(), this]() mutable
 		{
+			--m_pendingMessages;
+
 			auto msg = std::unique_ptr<PipeMessage>(message);
 			if (m_handler)
 			{
@@ -694,7 +940,7 @@ void NamedPipeEndpointBase::PostToPipeThread(std::function<void()>&& callback)
 			m_threadQueue.push_back(std::move(callback));
 			m_threadQueueDirty = true;
 		}
-		m_interruptEvent.SetEvent();
+		m_waiter.Interrupt();
 	}
 }
 
@@ -739,11 +985,8 @@ void NamedPipeEndpointBase::ProcessMainThreadQueue()
 
 NamedPipeServer::NamedPipeServer(const char* pipeName)
 	: NamedPipeEndpointBase("NamedPipeServer", pipeName)
+	, m_listener(CreatePipeListener(m_pipeName))
 {
-	m_connectEvent.create(wil::EventOptions::ManualReset | wil::EventOptions::Signaled);
-
-	ZeroMemory(&m_oConnect, sizeof(m_oConnect));
-	m_oConnect.hEvent = m_connectEvent.get();
 }
 
 NamedPipeServer::~NamedPipeServer()
@@ -753,44 +996,24 @@ NamedPipeServer::~NamedPipeServer()
 
 void NamedPipeServer::NamedPipeThread()
 {
-	HANDLE waitEvents[2] =
-	{
-		m_connectEvent.get(),
-		m_interruptEvent.get(),
-	};
-
-	// initiate by creating the pipe
-	bool bPending = CreateAndConnect();
+	// initiate by creating the endpoint
+	m_listener->Listen();
 
 	while (IsRunning())
 	{
 		// Waiting here will result in three things:
 		// 1. A connection event (a new incoming connection)
-		// 2. A stop event (server shutting down)
+		// 2. An interrupt (work was queued, or the server is shutting down)
 		// 3. A background task being completed and executed while we wait.
-		DWORD dwWait = WaitForMultipleObjectsEx(2, waitEvents, FALSE, INFINITE, TRUE);
-
-		switch (dwWait)
+		switch (m_waiter.Wait(m_listener.get()))
 		{
-		case 0: // connect event
+		case TransportWaiter::Result::Accept: // connect event
 			SPDLOG_TRACE("NamedPipeServer::NamedPipeThread: woke up on connect event");
 
-			// If an operation is pending, get the result of the connect operation.
-			if (bPending)
+			if (auto transport = m_listener->Accept())
 			{
-				DWORD bytesRead = 0;
-				BOOL success = GetOverlappedResult(
-					m_hPipe.get(),      // pipe handle
-					&m_oConnect,        // OVERLAPPED structure
-					&bytesRead,         // bytes transferred (unused)
-					FALSE);             // do not wait
-				if (!success)
-					throw fmt::windows_error(GetLastError(), "Failed to get overlapped result while connecting");
-			}
-
-			{
-				// create new connection object and pass the pipe off to it.
-				auto connection = std::make_shared<PipeConnection>(this, std::move(m_hPipe));
+				// create new connection object and pass the transport off to it.
+				auto connection = std::make_shared<PipeConnection>(this, std::move(transport));
 				connection->StartRead();
 
 				std::scoped_lock<std::mutex> lock(m_mutex);
@@ -808,23 +1031,23 @@ void NamedPipeServer::NamedPipeThread()
 			}
 
 			// Start listening again.
-			bPending = CreateAndConnect();
+			m_listener->Listen();
 			break;
 
-		case 1: // interrupt event
+		case TransportWaiter::Result::Interrupt: // interrupt event
 			//SPDLOG_TRACE("NamedPipeServer::NamedPipeThread: woke up on interrupt event");
 			ProcessPipeThreadQueue();
 			break;
 
-		case WAIT_IO_COMPLETION:
+		case TransportWaiter::Result::Completion:
 			//SPDLOG_TRACE("NamedPipeServer::server_thread: woke up on io completion");
 
 			// The wait is satisfied by a completed read or write operation.
 			// This allows the system to execute the completion routine.
 			break;
 
-		default:
-			throw fmt::windows_error(GetLastError(), "Failed in WaitForMultipleObjectsEx");
+		case TransportWaiter::Result::Timeout:
+			break;
 		}
 	}
 
@@ -843,24 +1066,14 @@ void NamedPipeServer::NamedPipeThread()
 		}
 	}
 
-	if (m_hPipe)
-	{
-		SPDLOG_INFO("Canceling pending connect requests");
-		::CancelIoEx(m_hPipe.get(), &m_oConnect);
-
-		if (!::DisconnectNamedPipe(m_hPipe.get()))
-		{
-			SPDLOG_ERROR("NamedPipeServer::NamedPipeThread: {}",
-				fmt::windows_error(GetLastError(), "Failed at DisconnectNamePipe").what());
-		}
-	}
+	m_listener->Close();
 
 	auto startTime = std::chrono::steady_clock::now();
 
 	while (GetConnectionCount() > 0)
 	{
 		// Wait for remaining queued tasks to resolve
-		SleepEx(100, TRUE);
+		m_waiter.Wait(nullptr, 100ms);
 
 		SPDLOG_TRACE("Connections left: {}", GetConnectionCount());
 
@@ -870,51 +1083,6 @@ void NamedPipeServer::NamedPipeThread()
 	}
 }
 
-bool NamedPipeServer::CreateAndConnect()
-{
-	// the pipe should have been moved out by now...
-	m_hPipe.reset();
-
-	wil::unique_hfile hPipe(::CreateNamedPipe(
-		m_pipeName.c_str(),             // pipe name
-		PIPE_ACCESS_DUPLEX |            // read/write access
-		FILE_FLAG_OVERLAPPED,           // overlapped mode
-		PIPE_TYPE_MESSAGE |             // message-type pipe
-		PIPE_READMODE_MESSAGE |         // message read mode
-		PIPE_WAIT,                      // blocking mode
-		PIPE_UNLIMITED_INSTANCES,       // unlimited instances,
-		BUFFER_SIZE,                    // output buffer size,
-		BUFFER_SIZE,                    // input buffer size
-		PIPE_TIMEOUT,                   // client timeout
-		nullptr));                      // default security attributes
-	if (!hPipe.is_valid()) {
-		throw fmt::windows_error(::GetLastError(), "Failed to create named pipe on {}", m_pipeName);
-	}
-
-	// Start an overlapped connection for this pipe instance.
-	::ConnectNamedPipe(hPipe.get(), &m_oConnect);
-
-	DWORD lastErr = GetLastError();
-	bool pendingIO = false;
-
-	switch (lastErr)
-	{
-	case ERROR_IO_PENDING: // the overlapped connection is in progress
-		pendingIO = true;
-		break;
-
-	case ERROR_PIPE_CONNECTED: // the pipe is already connected, so signal an event
-		m_connectEvent.SetEvent();
-		break;
-
-	default:
-		throw fmt::windows_error(::GetLastError(), "Failed to connect to named pipe");
-	}
-
-	m_hPipe = std::move(hPipe);
-	return pendingIO;
-}
-
 void NamedPipeServer::CloseConnection(PipeConnection* connection)
 {
 	PostToMainThread(
@@ -1060,10 +1228,6 @@ NamedPipeClient::~NamedPipeClient()
 
 void NamedPipeClient::NamedPipeThread()
 {
-	HANDLE waitEvents[1] = {
-		m_interruptEvent.get(),
-	};
-
 	while (IsRunning())
 	{
 		// First loop will try to establish a connection
@@ -1071,84 +1235,46 @@ void NamedPipeClient::NamedPipeThread()
 		{
 			SPDLOG_TRACE("Attempting to connect to named pipe: {}", m_pipeName);
 
-			// If we're not connected to the server, we'll try to connect.
-			wil::unique_hfile hPipe(::CreateFileA(
-				m_pipeName.c_str(),                      // pipe name
-				GENERIC_READ | GENERIC_WRITE,            // need read and write access
-				0,                                       // no sharing
-				nullptr,                                 // default security attributes
-				OPEN_EXISTING,                           // open an existing named pipe
-				FILE_FLAG_OVERLAPPED,                    // enabled overlapped i/o
-				nullptr                                  // no template file
-			));
-
-			// If the pipe handle is valid, we're ready to roll.
-			if (hPipe.is_valid())
+			PipeTransportPtr transport;
+			bool wait = true;
+
+			switch (ConnectPipeTransport(m_pipeName, transport))
 			{
+			case TransportConnectResult::Connected:
 				SPDLOG_INFO("Connected to named pipe server.", m_pipeName);
 
-				// Switch pipe to message mode.
-				DWORD dwMessageMode = PIPE_READMODE_MESSAGE;
-				if (!::SetNamedPipeHandleState(hPipe.get(), &dwMessageMode, nullptr, nullptr))
-				{
-					SPDLOG_ERROR("{}",
-						fmt::windows_error(GetLastError(), "Failed to set message mode on named pipe!").what());
-				}
-				else
-				{
-					m_connection = std::make_shared<PipeConnection>(this, std::move(hPipe));
-					m_connection->StartRead();
+				m_connection = std::make_shared<PipeConnection>(this, std::move(transport));
+				m_connection->StartRead();
 
-					if (m_handler)
-					{
-						m_handler->OnClientConnected();
-					}
-					break;
+				if (m_handler)
+				{
+					m_handler->OnClientConnected();
 				}
-			}
+				break;
 
-			bool wait = true;
-			DWORD lastError = GetLastError();
-			switch (lastError)
-			{
-			case ERROR_FILE_NOT_FOUND:
+			case TransportConnectResult::NotFound:
 				// named pipe has not been created
 				SPDLOG_TRACE("Named pipe not found, waiting for it to be created...");
 				break;
 
-			case ERROR_PIPE_BUSY:
-				SPDLOG_TRACE("Named pipe is busy, waiting for it to not be busy...");
+			case TransportConnectResult::Busy:
+				// the transport already waited for the pipe to become available, so try again right away
 				wait = false;
-
-				// pipe is busy, likely due to another client connecting. Wait for a moment
-				// and try again.
-				if (!::WaitNamedPipe(m_pipeName.c_str(), 5000))
-				{
-					lastError = GetLastError();
-					if (lastError == ERROR_SEM_TIMEOUT)
-					{
-						SPDLOG_TRACE("Timed out waiting for named pipe server to become unbusy. Starting over...");
-					}
-					else
-					{
-						SPDLOG_TRACE("{}",
-							fmt::windows_error(lastError, "Unexpected error occurred while waiting for named pipe").what());
-						wait = true;
-					}
-				}
 				break;
 
 			default:
-				SPDLOG_TRACE("{}",
-					fmt::windows_error(lastError, "Unexpected error occurred trying to open named pipe").what());
+				SPDLOG_TRACE("Unexpected error occurred trying to open named pipe: {}",
+					DescribeTransportError(GetLastTransportError()));
 				break;
 			}
 
+			if (m_connection)
+				break;
+
 			if (wait)
 			{
 				// Wait 5 seconds and try again.
-				DWORD dwResult = WaitForSingleObject(m_interruptEvent.get(), 5000);
-				if (dwResult == WAIT_OBJECT_0)
+				if (m_waiter.Wait(nullptr, 5s) == TransportWaiter::Result::Interrupt)
 				{
 					ProcessPipeThreadQueue();
 					//SPDLOG_TRACE("Woke up to interrupt event");
@@ -1160,20 +1286,10 @@ void NamedPipeClient::NamedPipeThread()
 		// Second loop will try to process events on the connection
 		while (m_connection && IsRunning())
 		{
-			DWORD dwWait = WaitForMultipleObjectsEx(static_cast<DWORD>(lengthof(waitEvents)), waitEvents, FALSE, INFINITE, TRUE);
-
-			switch (dwWait)
+			if (m_waiter.Wait(nullptr) == TransportWaiter::Result::Interrupt)
 			{
-			case 0: // interrupt event
 				//SPDLOG_TRACE("Woke up to interrupt event");
 				ProcessPipeThreadQueue();
-				break;
-
-			case WAIT_IO_COMPLETION:
-				break;
-
-			default:
-				throw fmt::windows_error(GetLastError(), "Failed in WaitForMultipleObjectsEx");
 			}
 		}
 	}
@@ -1203,7 +1319,7 @@ void NamedPipeClient::CloseConnection(PipeConnection* connection)
 		m_connection.reset();
 
 		// Trigger interrupt to reboot the connection loop.
-		m_interruptEvent.SetEvent();
+		m_waiter.Interrupt();
 	}
 }
 
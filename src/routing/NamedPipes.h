@@ -15,8 +15,8 @@
 #pragma once
 
 #include "NamedPipesProtocol.h"
+#include "PipeTransport.h"
 
-#include <wil/resource.h>
 #include <atomic>
 #include <deque>
 #include <functional>
@@ -25,7 +25,11 @@
 #include <thread>
 #include <vector>
 
+#if defined(_WIN32)
 #include <windows.h>
+#else
+#include <unistd.h>
+#endif
 
 #if defined(DispatchMessage)
 #undef DispatchMessage
@@ -36,6 +40,10 @@
 
 namespace mq {
 
+#if !defined(_WIN32)
+inline uint32_t GetCurrentProcessId() { return static_cast<uint32_t>(getpid()); }
+#endif
+
 class NamedPipeEndpointBase;
 class PipeConnection;
 
@@ -56,6 +64,11 @@ public:
 	PipeMessage(const MQMessageHeader& header, const void* data, size_t length);
 	PipeMessage(const PipeMessage& message, const void* data, size_t length);
 
+	// Creates a message with its own copy of the header that shares the payload of another message
+	// instead of copying it, for sending the same payload to many connections. The payload must not
+	// be modified after it is shared.
+	PipeMessage(const MQMessageHeader& header, std::shared_ptr<const PipeMessage> payload);
+
 	virtual ~PipeMessage();
 
 	// parse an existing message buffer into a message. Returns false if this is not a
@@ -97,7 +110,11 @@ public:
 	}
 
 	template <typename T = void>
-	const T* get() const { return reinterpret_cast<T*>(m_buffer.get() + m_dataOffset); }
+	const T* get() const { return reinterpret_cast<const T*>(data()); }
+
+	// Writable access to the data, for serializing directly into a new message
+	template <typename T = void>
+	T* get() { return reinterpret_cast<T*>(data()); }
 
 	size_t size() const { return m_header ? m_header->messageLength : 0; }
 
@@ -112,14 +129,24 @@ public:
 	// A more thorough message reply
 	void SendReply(MQMessageId messageId, void* data, size_t length, uint8_t status = 0);
 
+	// Reply with a message that has already been built
+	void SendReply(std::unique_ptr<PipeMessage>&& reply, uint8_t status = 0);
+
 private:
 	void SetConnection(std::shared_ptr<PipeConnection> connection) { m_connection = connection; }
 
-	const uint8_t* buffer() const { return m_buffer.get(); }
-	size_t buffer_size() const { return m_bufferLength; }
+	uint8_t* data() const
+	{
+		return m_sharedPayload ? const_cast<uint8_t*>(m_sharedPayload->get<uint8_t>()) : m_buffer.get() + m_dataOffset;
+	}
+
+	// Fills in the buffers to write to send this message, returning how many there are (up to 2)
+	size_t GetWriteBuffers(TransportBuffer* buffers) const;
+	size_t GetWriteSize() const { return m_bufferLength + (m_sharedPayload ? m_sharedPayload->size() : 0); }
 
 private:
 	std::unique_ptr<uint8_t[]> m_buffer;
+	std::shared_ptr<const PipeMessage> m_sharedPayload;
 	size_t m_bufferLength = 0;
 	MQMessageHeader* m_header = nullptr;
 	size_t m_dataOffset = 0;
@@ -142,6 +169,44 @@ PipeMessagePtr MakeCallResponseMessageV0(MQMessageId messageId, const void* data
 PipeMessagePtr MakeCallResponseReplyV0(MQMessageId messageId, const void* data, size_t dataLength,
 	uint32_t sequenceId, uint8_t status = 0);
 
+//============================================================================
+// Growable ring buffer that incoming data is read into. Messages are framed by their
+// header, so the buffer holds whatever hasn't made up a complete message yet.
+
+class PipeReadBuffer
+{
+public:
+	explicit PipeReadBuffer(size_t capacity);
+
+	size_t size() const { return m_size; }
+	bool empty() const { return m_size == 0; }
+
+	// Gets the contiguous free space at the end of the buffer, growing the buffer if there is
+	// less than minimum bytes free.
+	std::pair<uint8_t*, size_t> GetWriteSpan(size_t minimum);
+
+	// Marks length bytes of the write span as filled.
+	void Commit(size_t length);
+
+	// Copies data out of the buffer, starting offset bytes in.
+	void Copy(size_t offset, void* dest, size_t length) const;
+
+	// Discards length bytes from the front of the buffer.
+	void Consume(size_t length);
+
+	// Shrinks the buffer back to its initial capacity if it's empty and has grown.
+	void Compact();
+
+private:
+	void Grow(size_t capacity);
+
+	std::unique_ptr<uint8_t[]> m_buffer;
+	size_t m_initialCapacity;
+	size_t m_capacity;
+	size_t m_head = 0;
+	size_t m_size = 0;
+};
+
 //============================================================================
 // Represents an established connetion to a named pipe.
 class PipeConnection
@@ -154,17 +219,15 @@ class PipeConnection
 	static int s_nextConnectionId;
 
 public:
-	PipeConnection(NamedPipeEndpointBase* parent, wil::unique_hfile hPipe);
+	PipeConnection(NamedPipeEndpointBase* parent, PipeTransportPtr transport);
 	~PipeConnection();
 
 	uint32_t GetProcessId() const { return m_processId; }
 	int GetConnectionId() const { return m_connectionId; }
-	OVERLAPPED* GetOverlapped() { return &m_overlapped; }
-	const OVERLAPPED* GetOverlapped() const { return &m_overlapped; }
 
-	void StartRead() { InternalBeginRead(); }
-	HANDLE GetNamedPipe() { return m_hPipe.get(); }
-	bool IsNamedPipeOpen() const { return m_hPipe.is_valid(); }
+	// Starts reading, after telling the other end what this connection can handle.
+	void StartRead();
+	bool IsNamedPipeOpen() const { return m_transport->IsOpen(); }
 
 	//----------------------------------------------------------------------------
 	// Send message variants
@@ -181,19 +244,11 @@ public:
 
 	void Close();
 private:
-	// Queued outgoing writes
-	struct QueuedOp
-	{
-		OVERLAPPED overlapped;
-		std::shared_ptr<PipeConnection> ref;
-		std::unique_ptr<PipeMessage> message;
-	};
+	// After a write is completed, start the next write.
+	void HandleWriteComplete(TransportStatus status, uint32_t errorCode, size_t bytesWritten);
 
-	// After a read is completed, start a write.
-	void HandleWriteComplete(QueuedOp* op, uint32_t dwErrorCode, uint32_t dwNumBytes);
-
-	// After a write is completed, start a read.
-	void HandleReadComplete(uint32_t dwErrorCode, uint32_t dwNumBytes);
+	// After a read is completed, process any complete messages and start the next read.
+	void HandleReadComplete(TransportStatus status, uint32_t errorCode, size_t bytesRead);
 
 	// This sends the message to the named pipe. It expects to be called from the named pipe thread.
 	void InternalSendMessage(PipeMessagePtr&& message,
@@ -202,13 +257,14 @@ private:
 	void InternalReceiveMessage(PipeMessagePtr&& message);
 
 	void InternalBeginRead();
-	void ProcessBuffers();
+	bool ProcessBuffers();
+	void ReceiveBuffer(std::unique_ptr<uint8_t[]> buffer, size_t length);
 	void InternalBeginSend();
 
 	bool InternalClose(bool disconnect);
 
 private:
-	wil::unique_hfile m_hPipe;
+	PipeTransportPtr m_transport;
 	NamedPipeEndpointBase* m_parent = nullptr;
 	uint32_t m_processId = 0;
 	bool m_pending = false;
@@ -216,15 +272,24 @@ private:
 	uint32_t m_nextSequenceId = 1;
 	bool m_connected = false;
 
-	// data used for reading
-	OVERLAPPED m_overlapped;              // used for reading only
-	std::unique_ptr<uint8_t[]> m_readBuffer;
-	std::vector<std::pair<std::unique_ptr<uint8_t[]>, size_t>> m_readBuffers;
-	size_t m_readBufferSize = 0;
-	std::shared_ptr<PipeConnection> m_self;
-
-	// data used for writing
-	std::deque<std::unique_ptr<QueuedOp>> m_writeQueue;
+	// data used for reading. Large messages skip the ring buffer and are read straight
+	// into the buffer that becomes the message.
+	PipeReadBuffer m_readBuffer;
+	std::unique_ptr<uint8_t[]> m_largeMessage;
+	size_t m_largeMessageSize = 0;
+	size_t m_largeMessageReceived = 0;
+
+	// data used for writing. Small messages at the front of the queue are written together, as
+	// long as the other end can separate them again: either the transport is a stream, or the
+	// other end said it frames reads by header (see MSG_PIPE_CAPABILITIES).
+	bool m_peerFramesByHeader = false;
+
+	// Routed messages with compressed payloads are decompressed before they are queued, unless
+	// the other end said it can decompress them itself.
+	bool m_peerDecompressesPayloads = false;
+	std::deque<PipeMessagePtr> m_writeQueue;
+	std::vector<TransportBuffer> m_writeBuffers;
+	size_t m_writeBatchCount = 0;
 	bool m_pendingWrite = false;
 
 	// mapping of sequence id to callbacks
@@ -262,6 +327,9 @@ public:
 
 //============================================================================
 
+// Incoming messages that can wait for the main thread before new ones are dropped
+constexpr size_t DEFAULT_MAX_PENDING_MESSAGES = 16 * 1024;
+
 class NamedPipeEndpointBase
 {
 	friend class PipeConnection;
@@ -286,6 +354,13 @@ public:
 	// dispatches a message to be handled by the client.
 	void DispatchMessage(PipeMessagePtr&& message);
 
+	// Limits how many incoming messages can wait for the main thread to handle them. Once the
+	// limit is hit, new messages are dropped (RPC senders get MsgError_QueueFull). 0 is unbounded.
+	void SetMaxPendingMessages(size_t maxPending) { m_maxPendingMessages = maxPending; }
+	size_t GetMaxPendingMessages() const { return m_maxPendingMessages; }
+	size_t GetPendingMessageCount() const { return m_pendingMessages; }
+	uint64_t GetDroppedMessageCount() const { return m_droppedMessages; }
+
 protected:
 	virtual void NamedPipeThread() = 0;
 	virtual void CloseConnection(PipeConnection* connection) = 0;
@@ -298,7 +373,7 @@ protected:
 
 protected:
 	std::string m_pipeName;
-	wil::unique_event m_interruptEvent;
+	TransportWaiter m_waiter;
 	std::shared_ptr<NamedPipeEvents> m_handler;
 
 private:
@@ -317,6 +392,12 @@ private:
 	std::vector<std::function<void()>> m_mainQueue;
 	std::mutex m_mainQueueMutex;
 	std::atomic_bool m_mainQueueDirty{ false };
+
+	// incoming messages waiting on the main thread
+	std::atomic<size_t> m_maxPendingMessages{ DEFAULT_MAX_PENDING_MESSAGES };
+	std::atomic<size_t> m_pendingMessages{ 0 };
+	std::atomic<uint64_t> m_droppedMessages{ 0 };
+	std::atomic_bool m_droppingMessages{ false };
 };
 
 //============================================================================
@@ -347,19 +428,13 @@ public:
 private:
 	void NamedPipeThread() override;
 
-	// This function creates a pipe instance and connect to the client. If it returns
-	// true, then the connection operation is pending. Otherwise returns false.
-	bool CreateAndConnect();
-
 	// clean up a connection
 	void CloseConnection(PipeConnection* connection) override;
 
 	int GetConnectionCount() const;
 
 private:
-	wil::unique_event m_connectEvent;
-	OVERLAPPED m_oConnect;
-	wil::unique_hfile m_hPipe;
+	PipeListenerPtr m_listener;
 	std::vector<std::shared_ptr<PipeConnection>> m_connections;
 	mutable std::mutex m_mutex;
 };
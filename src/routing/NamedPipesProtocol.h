@@ -19,6 +19,7 @@
 namespace mq {
 
 // The name of the named pipe used by the named pipe server to communicate with other clients.
+// Servers and clients also accept "unix:<path>" endpoints, which use a unix domain socket instead.
 constexpr const char* MQ2_PIPE_SERVER_PATH = R"(\\.\pipe\mqpipe)";
 
 enum class MQMessageId : uint16_t
@@ -28,6 +29,8 @@ enum class MQMessageId : uint16_t
 	MSG_ROUTE                              = 2,     // Route a message to a mailbox in a client
 	MSG_IDENTIFICATION                     = 3,     // Update routing information in server/client or request ID list
 	MSG_DROPPED                            = 4,     // Notify clients that an address is no longer connected
+	MSG_SUBSCRIPTION                       = 5,     // Subscribe or unsubscribe a client from a topic
+	MSG_PIPE_CAPABILITIES                  = 6,     // Tell the other end of a connection what it can handle. Never routed.
 
 	// FIXME: We really should have message ids separated by plugins or services. For now we will use a single enum
 	// and just change it later.
@@ -63,6 +66,7 @@ constexpr int MsgError_ConnectionClosed        = -1;                  // connect
 constexpr int MsgError_NoConnection            = -2;                  // no connection established
 constexpr int MsgError_RoutingFailed           = -3;                  // message routing failed
 constexpr int MsgError_AmbiguousRecipient      = -4;                  // RPC message couldn't determine single recipient
+constexpr int MsgError_QueueFull               = -5;                  // recipient's queue was full, so the message was dropped
 
 #pragma pack(push)
 #pragma pack(1)
@@ -83,6 +87,20 @@ struct MQMessageHeader
 
 #pragma pack(pop)
 
+// MSG_PIPE_CAPABILITIES -> sent by each end when a connection starts. Older versions ignore it.
+struct MQMessagePipeCapabilities
+{
+	uint32_t            flags = 0;
+};
+
+// Reads are framed by message headers, so a single write can hold any number of messages.
+// Older versions read one message per write on a named pipe.
+constexpr uint32_t PipeCapability_HeaderFraming = 0x1;
+
+// Routed payloads may be LZ4 compressed (see Envelope.compression). Older versions get every
+// payload uncompressed.
+constexpr uint32_t PipeCapability_CompressedPayloads = 0x2;
+
 // MSG_MAIN_PROCESS_LOADED
 struct MQMessageProcessLoadedFromMQ
 {
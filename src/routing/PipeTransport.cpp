@@ -0,0 +1,1352 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#if defined(_WIN32)
+// winsock2 needs to come before windows.h
+#include <winsock2.h>
+#include <afunix.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "PipeTransport.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <mutex>
+#include <system_error>
+#include <vector>
+
+#if defined(_WIN32)
+#include <fmt/os.h>
+#include <wil/resource.h>
+
+#pragma comment(lib, "Ws2_32")
+#endif
+
+namespace mq {
+
+#if defined(_WIN32)
+
+constexpr int PIPE_BUFFER_SIZE = 4096;
+constexpr int PIPE_TIMEOUT = 5000;
+
+//============================================================================
+// Named pipes
+//============================================================================
+
+class NamedPipeTransport : public PipeTransport
+{
+public:
+	explicit NamedPipeTransport(wil::unique_hfile hPipe)
+		: m_hPipe(std::move(hPipe))
+	{
+		ZeroMemory(&m_readOverlapped, sizeof(OVERLAPPED));
+		ZeroMemory(&m_writeOverlapped, sizeof(OVERLAPPED));
+
+		GetNamedPipeClientProcessId(m_hPipe.get(), (PULONG)&m_processId);
+	}
+
+	~NamedPipeTransport() override
+	{
+		Close(false);
+	}
+
+	bool IsOpen() const override { return m_hPipe.is_valid(); }
+	uint32_t GetPeerProcessId() const override { return m_processId; }
+	bool PreservesMessageBoundaries() const override { return true; }
+
+	bool BeginRead(uint8_t* buffer, size_t length, TransportCallback&& callback) override
+	{
+		// We can use the hEvent field to store a reference to this transport, that we can
+		// use to dispatch the completion.
+		ZeroMemory(&m_readOverlapped, sizeof(OVERLAPPED));
+		m_readOverlapped.hEvent = reinterpret_cast<HANDLE>(this);
+		m_readCallback = std::move(callback);
+
+		bool readStarted = ::ReadFileEx(m_hPipe.get(), buffer, static_cast<DWORD>(length), &m_readOverlapped,
+			[](DWORD dwErrorCode, DWORD dwNumberOfBytesTransferred, LPOVERLAPPED lpOverlapped)
+			{
+				NamedPipeTransport* transport = reinterpret_cast<NamedPipeTransport*>(lpOverlapped->hEvent);
+
+				// the callback can start the next read, so take it before calling it.
+				TransportCallback callback = std::move(transport->m_readCallback);
+				callback(TranslateError(dwErrorCode), dwErrorCode, dwNumberOfBytesTransferred);
+			});
+
+		// A message that is larger than the buffer still queues the completion routine
+		return readStarted || ::GetLastError() == ERROR_MORE_DATA;
+	}
+
+	bool BeginWrite(const TransportBuffer* buffers, size_t count, TransportCallback&& callback) override
+	{
+		ZeroMemory(&m_writeOverlapped, sizeof(OVERLAPPED));
+		m_writeOverlapped.hEvent = reinterpret_cast<HANDLE>(this);
+		m_writeCallback = std::move(callback);
+
+		const uint8_t* data = buffers[0].data;
+		size_t length = buffers[0].length;
+
+		// Pipes can't gather, so several buffers are staged into one. This is only used for
+		// batches of small messages, where the copy is much cheaper than a write per message.
+		if (count > 1)
+		{
+			m_writeStaging.clear();
+			for (size_t i = 0; i < count; ++i)
+				m_writeStaging.insert(m_writeStaging.end(), buffers[i].data, buffers[i].data + buffers[i].length);
+
+			data = m_writeStaging.data();
+			length = m_writeStaging.size();
+		}
+
+		return ::WriteFileEx(m_hPipe.get(), data, static_cast<DWORD>(length), &m_writeOverlapped,
+			[](DWORD dwErrorCode, DWORD dwNumberOfBytesTransferred, LPOVERLAPPED lpOverlapped)
+			{
+				NamedPipeTransport* transport = reinterpret_cast<NamedPipeTransport*>(lpOverlapped->hEvent);
+
+				TransportCallback callback = std::move(transport->m_writeCallback);
+				callback(TranslateError(dwErrorCode), dwErrorCode, dwNumberOfBytesTransferred);
+			});
+	}
+
+	void CancelRead() override
+	{
+		if (m_hPipe)
+			::CancelIoEx(m_hPipe.get(), &m_readOverlapped);
+	}
+
+	void Close(bool disconnect) override
+	{
+		if (!m_hPipe)
+			return;
+
+		if (disconnect && !::DisconnectNamedPipe(m_hPipe.get()))
+		{
+			SPDLOG_ERROR("NamedPipeTransport::Close: {}",
+				fmt::windows_error(GetLastError(), "Failed at DisconnectNamePipe").what());
+		}
+
+		m_hPipe.reset();
+	}
+
+private:
+	static TransportStatus TranslateError(DWORD errorCode)
+	{
+		switch (errorCode)
+		{
+		case ERROR_SUCCESS:
+		case ERROR_MORE_DATA:           // message mode pipe: the rest of the message comes with the next read
+		case ERROR_INSUFFICIENT_BUFFER:
+			return TransportStatus::Success;
+
+		case ERROR_BROKEN_PIPE:
+		case ERROR_PIPE_NOT_CONNECTED:
+			return TransportStatus::Closed;
+
+		case ERROR_OPERATION_ABORTED:
+			return TransportStatus::Canceled;
+
+		default:
+			return TransportStatus::Failed;
+		}
+	}
+
+	wil::unique_hfile m_hPipe;
+	uint32_t m_processId = 0;
+
+	OVERLAPPED m_readOverlapped;
+	TransportCallback m_readCallback;
+	OVERLAPPED m_writeOverlapped;
+	TransportCallback m_writeCallback;
+	std::vector<uint8_t> m_writeStaging;
+};
+
+class NamedPipeListener : public PipeListener
+{
+public:
+	explicit NamedPipeListener(std::string pipeName)
+		: m_pipeName(std::move(pipeName))
+	{
+		m_connectEvent.create(wil::EventOptions::ManualReset | wil::EventOptions::Signaled);
+
+		ZeroMemory(&m_oConnect, sizeof(m_oConnect));
+		m_oConnect.hEvent = m_connectEvent.get();
+	}
+
+	~NamedPipeListener() override
+	{
+		Close();
+	}
+
+	TransportWaitHandle GetAcceptHandle() const override { return m_connectEvent.get(); }
+
+	// This function creates a pipe instance and connects to the client.
+	void Listen() override
+	{
+		// the pipe should have been moved out by now...
+		m_hPipe.reset();
+
+		wil::unique_hfile hPipe(::CreateNamedPipe(
+			m_pipeName.c_str(),             // pipe name
+			PIPE_ACCESS_DUPLEX |            // read/write access
+			FILE_FLAG_OVERLAPPED,           // overlapped mode
+			PIPE_TYPE_MESSAGE |             // message-type pipe
+			PIPE_READMODE_MESSAGE |         // message read mode
+			PIPE_WAIT,                      // blocking mode
+			PIPE_UNLIMITED_INSTANCES,       // unlimited instances,
+			PIPE_BUFFER_SIZE,               // output buffer size,
+			PIPE_BUFFER_SIZE,               // input buffer size
+			PIPE_TIMEOUT,                   // client timeout
+			nullptr));                      // default security attributes
+		if (!hPipe.is_valid()) {
+			throw fmt::windows_error(::GetLastError(), "Failed to create named pipe on {}", m_pipeName);
+		}
+
+		// Start an overlapped connection for this pipe instance.
+		::ConnectNamedPipe(hPipe.get(), &m_oConnect);
+
+		DWORD lastErr = GetLastError();
+		m_pending = false;
+
+		switch (lastErr)
+		{
+		case ERROR_IO_PENDING: // the overlapped connection is in progress
+			m_pending = true;
+			break;
+
+		case ERROR_PIPE_CONNECTED: // the pipe is already connected, so signal an event
+			m_connectEvent.SetEvent();
+			break;
+
+		default:
+			throw fmt::windows_error(::GetLastError(), "Failed to connect to named pipe");
+		}
+
+		m_hPipe = std::move(hPipe);
+	}
+
+	PipeTransportPtr Accept() override
+	{
+		if (!m_hPipe)
+			return nullptr;
+
+		// If an operation is pending, get the result of the connect operation.
+		if (m_pending)
+		{
+			DWORD bytesRead = 0;
+			BOOL success = GetOverlappedResult(
+				m_hPipe.get(),      // pipe handle
+				&m_oConnect,        // OVERLAPPED structure
+				&bytesRead,         // bytes transferred (unused)
+				FALSE);             // do not wait
+			if (!success)
+				throw fmt::windows_error(GetLastError(), "Failed to get overlapped result while connecting");
+		}
+
+		return std::make_unique<NamedPipeTransport>(std::move(m_hPipe));
+	}
+
+	void Close() override
+	{
+		if (m_hPipe)
+		{
+			SPDLOG_INFO("Canceling pending connect requests");
+			::CancelIoEx(m_hPipe.get(), &m_oConnect);
+
+			if (!::DisconnectNamedPipe(m_hPipe.get()))
+			{
+				SPDLOG_ERROR("NamedPipeListener::Close: {}",
+					fmt::windows_error(GetLastError(), "Failed at DisconnectNamePipe").what());
+			}
+
+			m_hPipe.reset();
+		}
+	}
+
+private:
+	std::string m_pipeName;
+	wil::unique_event m_connectEvent;
+	OVERLAPPED m_oConnect;
+	wil::unique_hfile m_hPipe;
+	bool m_pending = false;
+};
+
+static TransportConnectResult ConnectToNamedPipe(const std::string& pipeName, PipeTransportPtr& transport)
+{
+	// If we're not connected to the server, we'll try to connect.
+	wil::unique_hfile hPipe(::CreateFileA(
+		pipeName.c_str(),                        // pipe name
+		GENERIC_READ | GENERIC_WRITE,            // need read and write access
+		0,                                       // no sharing
+		nullptr,                                 // default security attributes
+		OPEN_EXISTING,                           // open an existing named pipe
+		FILE_FLAG_OVERLAPPED,                    // enabled overlapped i/o
+		nullptr                                  // no template file
+	));
+
+	// If the pipe handle is valid, we're ready to roll.
+	if (hPipe.is_valid())
+	{
+		// Switch pipe to message mode.
+		DWORD dwMessageMode = PIPE_READMODE_MESSAGE;
+		if (!::SetNamedPipeHandleState(hPipe.get(), &dwMessageMode, nullptr, nullptr))
+		{
+			SPDLOG_ERROR("{}",
+				fmt::windows_error(GetLastError(), "Failed to set message mode on named pipe!").what());
+			return TransportConnectResult::Failed;
+		}
+
+		transport = std::make_unique<NamedPipeTransport>(std::move(hPipe));
+		return TransportConnectResult::Connected;
+	}
+
+	DWORD lastError = GetLastError();
+	switch (lastError)
+	{
+	case ERROR_FILE_NOT_FOUND:
+		// named pipe has not been created
+		return TransportConnectResult::NotFound;
+
+	case ERROR_PIPE_BUSY:
+		SPDLOG_TRACE("Named pipe is busy, waiting for it to not be busy...");
+
+		// pipe is busy, likely due to another client connecting. Wait for a moment
+		// and try again.
+		if (!::WaitNamedPipe(pipeName.c_str(), 5000))
+		{
+			lastError = GetLastError();
+			if (lastError != ERROR_SEM_TIMEOUT)
+			{
+				::SetLastError(lastError);
+				return TransportConnectResult::Failed;
+			}
+
+			SPDLOG_TRACE("Timed out waiting for named pipe server to become unbusy. Starting over...");
+		}
+		return TransportConnectResult::Busy;
+
+	default:
+		return TransportConnectResult::Failed;
+	}
+}
+
+//============================================================================
+// Unix domain sockets
+//============================================================================
+
+// Unix domain sockets on windows go through winsock, so make sure it is initialized
+// before the first socket is created.
+static bool InitializeWinsock()
+{
+	struct WinsockInit
+	{
+		bool initialized = false;
+
+		WinsockInit()
+		{
+			WSADATA wsaData;
+			initialized = ::WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+		}
+
+		~WinsockInit()
+		{
+			if (initialized)
+				::WSACleanup();
+		}
+	};
+
+	static WinsockInit s_winsock;
+	return s_winsock.initialized;
+}
+
+static bool MakeUnixSocketAddress(std::string_view endpointName, sockaddr_un& address)
+{
+	std::string_view path = endpointName.substr(UNIX_SOCKET_PREFIX.length());
+
+	ZeroMemory(&address, sizeof(address));
+	address.sun_family = AF_UNIX;
+
+	// sun_path needs to keep its null terminator
+	if (path.empty() || path.length() >= sizeof(address.sun_path))
+		return false;
+
+	memcpy(address.sun_path, path.data(), path.length());
+	return true;
+}
+
+static SOCKET CreateUnixSocket()
+{
+	return ::WSASocketW(AF_UNIX, SOCK_STREAM, 0, nullptr, 0, WSA_FLAG_OVERLAPPED);
+}
+
+class UnixSocketTransport : public PipeTransport
+{
+public:
+	explicit UnixSocketTransport(SOCKET socket)
+		: m_socket(socket)
+	{
+		ZeroMemory(&m_readOverlapped, sizeof(WSAOVERLAPPED));
+		ZeroMemory(&m_writeOverlapped, sizeof(WSAOVERLAPPED));
+
+		DWORD processId = 0;
+		DWORD bytesReturned = 0;
+		if (::WSAIoctl(m_socket, SIO_AF_UNIX_GETPEERPID, nullptr, 0, &processId, sizeof(processId),
+			&bytesReturned, nullptr, nullptr) == 0)
+		{
+			m_processId = processId;
+		}
+	}
+
+	~UnixSocketTransport() override
+	{
+		Close(false);
+	}
+
+	bool IsOpen() const override { return m_socket != INVALID_SOCKET; }
+	uint32_t GetPeerProcessId() const override { return m_processId; }
+	bool PreservesMessageBoundaries() const override { return false; }
+
+	bool BeginRead(uint8_t* buffer, size_t length, TransportCallback&& callback) override
+	{
+		// with a completion routine the hEvent field is ours to use
+		ZeroMemory(&m_readOverlapped, sizeof(WSAOVERLAPPED));
+		m_readOverlapped.hEvent = reinterpret_cast<HANDLE>(this);
+		m_readCallback = std::move(callback);
+
+		WSABUF wsaBuffer;
+		wsaBuffer.buf = reinterpret_cast<char*>(buffer);
+		wsaBuffer.len = static_cast<ULONG>(length);
+		DWORD flags = 0;
+
+		// Even if this completes immediately, the completion routine is queued for the next alertable wait.
+		if (::WSARecv(m_socket, &wsaBuffer, 1, nullptr, &flags, &m_readOverlapped,
+			[](DWORD dwError, DWORD cbTransferred, LPWSAOVERLAPPED lpOverlapped, DWORD dwFlags)
+			{
+				UnixSocketTransport* transport = reinterpret_cast<UnixSocketTransport*>(lpOverlapped->hEvent);
+
+				// a successful zero byte read is the other end closing the stream
+				TransportStatus status = TranslateError(dwError);
+				if (status == TransportStatus::Success && cbTransferred == 0)
+					status = TransportStatus::Closed;
+
+				TransportCallback callback = std::move(transport->m_readCallback);
+				callback(status, dwError, cbTransferred);
+			}) == SOCKET_ERROR)
+		{
+			int error = ::WSAGetLastError();
+			if (error != WSA_IO_PENDING)
+			{
+				::SetLastError(error);
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	bool BeginWrite(const TransportBuffer* buffers, size_t count, TransportCallback&& callback) override
+	{
+		m_writeBuffers.resize(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			m_writeBuffers[i].buf = const_cast<char*>(reinterpret_cast<const char*>(buffers[i].data));
+			m_writeBuffers[i].len = static_cast<ULONG>(buffers[i].length);
+		}
+
+		m_writeIndex = 0;
+		m_writeTotal = 0;
+		m_writeCallback = std::move(callback);
+
+		return ContinueWrite();
+	}
+
+	void CancelRead() override
+	{
+		if (m_socket != INVALID_SOCKET)
+			::CancelIoEx(reinterpret_cast<HANDLE>(m_socket), &m_readOverlapped);
+	}
+
+	void Close(bool) override
+	{
+		if (m_socket == INVALID_SOCKET)
+			return;
+
+		::closesocket(m_socket);
+		m_socket = INVALID_SOCKET;
+	}
+
+private:
+	// A stream socket can complete a send with only part of the data, so keep sending
+	// until all of it has been written before reporting the write as complete.
+	bool ContinueWrite()
+	{
+		ZeroMemory(&m_writeOverlapped, sizeof(WSAOVERLAPPED));
+		m_writeOverlapped.hEvent = reinterpret_cast<HANDLE>(this);
+
+		if (::WSASend(m_socket, &m_writeBuffers[m_writeIndex], static_cast<DWORD>(m_writeBuffers.size() - m_writeIndex),
+			nullptr, 0, &m_writeOverlapped,
+			[](DWORD dwError, DWORD cbTransferred, LPWSAOVERLAPPED lpOverlapped, DWORD dwFlags)
+			{
+				UnixSocketTransport* transport = reinterpret_cast<UnixSocketTransport*>(lpOverlapped->hEvent);
+				transport->m_writeTotal += cbTransferred;
+
+				TransportStatus status = TranslateError(dwError);
+				if (status == TransportStatus::Success && cbTransferred != 0
+					&& transport->AdvanceWrite(cbTransferred))
+				{
+					if (transport->ContinueWrite())
+						return;
+
+					dwError = ::GetLastError();
+					status = TranslateError(dwError);
+				}
+
+				TransportCallback callback = std::move(transport->m_writeCallback);
+				callback(status, dwError, transport->m_writeTotal);
+			}) == SOCKET_ERROR)
+		{
+			int error = ::WSAGetLastError();
+			if (error != WSA_IO_PENDING)
+			{
+				::SetLastError(error);
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// Skips past the bytes that were sent. Returns true if there is still more to send.
+	bool AdvanceWrite(size_t bytes)
+	{
+		while (m_writeIndex < m_writeBuffers.size() && bytes >= m_writeBuffers[m_writeIndex].len)
+		{
+			bytes -= m_writeBuffers[m_writeIndex].len;
+			++m_writeIndex;
+		}
+
+		if (m_writeIndex == m_writeBuffers.size())
+			return false;
+
+		m_writeBuffers[m_writeIndex].buf += bytes;
+		m_writeBuffers[m_writeIndex].len -= static_cast<ULONG>(bytes);
+		return true;
+	}
+
+	static TransportStatus TranslateError(DWORD errorCode)
+	{
+		switch (errorCode)
+		{
+		case ERROR_SUCCESS:
+			return TransportStatus::Success;
+
+		case WSAECONNRESET:
+		case WSAECONNABORTED:
+		case WSAEDISCON:
+		case WSAESHUTDOWN:
+			return TransportStatus::Closed;
+
+		case WSA_OPERATION_ABORTED:
+			return TransportStatus::Canceled;
+
+		default:
+			return TransportStatus::Failed;
+		}
+	}
+
+	SOCKET m_socket = INVALID_SOCKET;
+	uint32_t m_processId = 0;
+
+	WSAOVERLAPPED m_readOverlapped;
+	TransportCallback m_readCallback;
+
+	WSAOVERLAPPED m_writeOverlapped;
+	TransportCallback m_writeCallback;
+	std::vector<WSABUF> m_writeBuffers;
+	size_t m_writeIndex = 0;
+	size_t m_writeTotal = 0;
+};
+
+class UnixSocketListener : public PipeListener
+{
+public:
+	explicit UnixSocketListener(std::string endpointName)
+		: m_endpointName(std::move(endpointName))
+	{
+		m_acceptEvent.create(wil::EventOptions::ManualReset);
+	}
+
+	~UnixSocketListener() override
+	{
+		Close();
+	}
+
+	TransportWaitHandle GetAcceptHandle() const override { return m_acceptEvent.get(); }
+
+	void Listen() override
+	{
+		// a listening socket keeps accepting, so there's only something to do the first time.
+		if (m_socket != INVALID_SOCKET)
+			return;
+
+		if (!InitializeWinsock())
+			throw fmt::windows_error(::WSAGetLastError(), "Failed to initialize winsock");
+
+		sockaddr_un address;
+		if (!MakeUnixSocketAddress(m_endpointName, address))
+			throw fmt::windows_error(WSAEINVAL, "Invalid unix socket path {}", m_endpointName);
+
+		m_socket = CreateUnixSocket();
+		if (m_socket == INVALID_SOCKET)
+			throw fmt::windows_error(::WSAGetLastError(), "Failed to create unix socket on {}", m_endpointName);
+
+		// a socket file left behind by a previous run would make the bind fail
+		::DeleteFileA(address.sun_path);
+		m_path = address.sun_path;
+
+		if (::bind(m_socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == SOCKET_ERROR
+			|| ::listen(m_socket, SOMAXCONN) == SOCKET_ERROR
+			|| ::WSAEventSelect(m_socket, m_acceptEvent.get(), FD_ACCEPT) == SOCKET_ERROR)
+		{
+			int error = ::WSAGetLastError();
+			Close();
+
+			throw fmt::windows_error(error, "Failed to listen on unix socket {}", m_endpointName);
+		}
+	}
+
+	PipeTransportPtr Accept() override
+	{
+		if (m_socket == INVALID_SOCKET)
+			return nullptr;
+
+		// resets the event. Calling accept re-enables FD_ACCEPT, which signals it again if there
+		// are more connections waiting.
+		WSANETWORKEVENTS events;
+		::WSAEnumNetworkEvents(m_socket, m_acceptEvent.get(), &events);
+
+		SOCKET socket = ::accept(m_socket, nullptr, nullptr);
+		if (socket == INVALID_SOCKET)
+		{
+			int error = ::WSAGetLastError();
+			if (error == WSAEWOULDBLOCK)
+				return nullptr;
+
+			throw fmt::windows_error(error, "Failed to accept connection on unix socket");
+		}
+
+		// the accepted socket inherits the event selection (and non-blocking mode) of the listener
+		::WSAEventSelect(socket, nullptr, 0);
+		u_long nonBlocking = 0;
+		::ioctlsocket(socket, FIONBIO, &nonBlocking);
+
+		return std::make_unique<UnixSocketTransport>(socket);
+	}
+
+	void Close() override
+	{
+		if (m_socket == INVALID_SOCKET)
+			return;
+
+		::closesocket(m_socket);
+		m_socket = INVALID_SOCKET;
+
+		if (!m_path.empty())
+			::DeleteFileA(m_path.c_str());
+	}
+
+private:
+	std::string m_endpointName;
+	std::string m_path;
+	wil::unique_event m_acceptEvent;
+	SOCKET m_socket = INVALID_SOCKET;
+};
+
+static TransportConnectResult ConnectToUnixSocket(const std::string& endpointName, PipeTransportPtr& transport)
+{
+	if (!InitializeWinsock())
+		return TransportConnectResult::Failed;
+
+	sockaddr_un address;
+	if (!MakeUnixSocketAddress(endpointName, address))
+	{
+		::SetLastError(WSAEINVAL);
+		return TransportConnectResult::Failed;
+	}
+
+	SOCKET socket = CreateUnixSocket();
+	if (socket == INVALID_SOCKET)
+	{
+		::SetLastError(::WSAGetLastError());
+		return TransportConnectResult::Failed;
+	}
+
+	if (::connect(socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == SOCKET_ERROR)
+	{
+		int error = ::WSAGetLastError();
+		::closesocket(socket);
+
+		if (error == WSAECONNREFUSED)
+			return TransportConnectResult::NotFound;
+
+		::SetLastError(error);
+		return TransportConnectResult::Failed;
+	}
+
+	transport = std::make_unique<UnixSocketTransport>(socket);
+	return TransportConnectResult::Connected;
+}
+
+//============================================================================
+
+static bool IsUnixSocketEndpoint(std::string_view endpointName)
+{
+	return endpointName.substr(0, UNIX_SOCKET_PREFIX.length()) == UNIX_SOCKET_PREFIX;
+}
+
+PipeListenerPtr CreatePipeListener(const std::string& endpointName)
+{
+	if (IsUnixSocketEndpoint(endpointName))
+		return std::make_unique<UnixSocketListener>(endpointName);
+
+	return std::make_unique<NamedPipeListener>(endpointName);
+}
+
+TransportConnectResult ConnectPipeTransport(const std::string& endpointName, PipeTransportPtr& transport)
+{
+	if (IsUnixSocketEndpoint(endpointName))
+		return ConnectToUnixSocket(endpointName, transport);
+
+	return ConnectToNamedPipe(endpointName, transport);
+}
+
+uint32_t GetLastTransportError()
+{
+	return ::GetLastError();
+}
+
+//============================================================================
+
+TransportWaiter::TransportWaiter()
+	: m_interruptEvent(::CreateEventW(nullptr, FALSE, FALSE, nullptr))
+{
+}
+
+TransportWaiter::~TransportWaiter()
+{
+	if (m_interruptEvent != nullptr)
+		::CloseHandle(m_interruptEvent);
+}
+
+void TransportWaiter::Interrupt()
+{
+	::SetEvent(m_interruptEvent);
+}
+
+TransportWaiter::Result TransportWaiter::Wait(const PipeListener* listener, std::chrono::milliseconds timeout)
+{
+	HANDLE waitEvents[2];
+	DWORD count = 0;
+
+	if (listener != nullptr)
+		waitEvents[count++] = listener->GetAcceptHandle();
+
+	const DWORD interruptIndex = count;
+	waitEvents[count++] = m_interruptEvent;
+
+	// Waiting here will result in one of three things:
+	// 1. A connection event (a new incoming connection)
+	// 2. An interrupt (work was queued, or the endpoint is shutting down)
+	// 3. Completion routines being run while we wait.
+	DWORD dwWait = ::WaitForMultipleObjectsEx(count, waitEvents, FALSE,
+		timeout.count() < 0 ? INFINITE : static_cast<DWORD>(timeout.count()), TRUE);
+
+	if (dwWait == WAIT_IO_COMPLETION)
+		return Result::Completion;
+
+	if (dwWait == WAIT_TIMEOUT)
+		return Result::Timeout;
+
+	if (dwWait == WAIT_OBJECT_0 + interruptIndex)
+		return Result::Interrupt;
+
+	if (dwWait < WAIT_OBJECT_0 + interruptIndex)
+		return Result::Accept;
+
+	throw fmt::windows_error(::GetLastError(), "Failed in WaitForMultipleObjectsEx");
+}
+
+#else // !defined(_WIN32)
+
+//============================================================================
+// Unix domain sockets
+//============================================================================
+
+class UnixSocketTransport;
+
+// Operations on sockets don't complete by themselves like overlapped io does. Sockets with an
+// operation waiting are registered with the thread that started it, and that thread's
+// TransportWaiter polls them and completes the operations. Operations that are canceled are
+// completed at the next wait, the same as an aborted APC would be.
+struct SocketPollState
+{
+	std::mutex mutex;
+	std::vector<UnixSocketTransport*> sockets;
+	std::vector<std::function<void()>> completions;
+
+	void Register(UnixSocketTransport* socket)
+	{
+		std::scoped_lock lock(mutex);
+		if (std::find(sockets.begin(), sockets.end(), socket) == sockets.end())
+			sockets.push_back(socket);
+	}
+
+	void Unregister(UnixSocketTransport* socket)
+	{
+		std::scoped_lock lock(mutex);
+		sockets.erase(std::remove(sockets.begin(), sockets.end(), socket), sockets.end());
+	}
+
+	bool IsRegistered(UnixSocketTransport* socket)
+	{
+		std::scoped_lock lock(mutex);
+		return std::find(sockets.begin(), sockets.end(), socket) != sockets.end();
+	}
+
+	void QueueCompletion(std::function<void()>&& completion)
+	{
+		std::scoped_lock lock(mutex);
+		completions.push_back(std::move(completion));
+	}
+};
+
+static thread_local SocketPollState t_pollState;
+
+static bool MakeUnixSocketAddress(std::string_view endpointName, sockaddr_un& address)
+{
+	std::string_view path = endpointName.substr(UNIX_SOCKET_PREFIX.length());
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+
+	// sun_path needs to keep its null terminator
+	if (path.empty() || path.length() >= sizeof(address.sun_path))
+		return false;
+
+	memcpy(address.sun_path, path.data(), path.length());
+	return true;
+}
+
+static void SetNonBlocking(int fd)
+{
+	::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+	::fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+static TransportStatus TranslateSocketError(int error)
+{
+	switch (error)
+	{
+	case 0:
+		return TransportStatus::Success;
+
+	case ECONNRESET:
+	case ECONNABORTED:
+	case EPIPE:
+	case ESHUTDOWN:
+		return TransportStatus::Closed;
+
+	case ECANCELED:
+		return TransportStatus::Canceled;
+
+	default:
+		return TransportStatus::Failed;
+	}
+}
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+class UnixSocketTransport : public PipeTransport
+{
+public:
+	explicit UnixSocketTransport(int socket)
+		: m_socket(socket)
+	{
+		SetNonBlocking(m_socket);
+
+#if defined(SO_PEERCRED)
+		ucred credentials;
+		socklen_t length = sizeof(credentials);
+		if (::getsockopt(m_socket, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0)
+			m_processId = static_cast<uint32_t>(credentials.pid);
+#endif
+	}
+
+	~UnixSocketTransport() override
+	{
+		Close(false);
+	}
+
+	bool IsOpen() const override { return m_socket != -1; }
+	uint32_t GetPeerProcessId() const override { return m_processId; }
+	bool PreservesMessageBoundaries() const override { return false; }
+
+	bool BeginRead(uint8_t* buffer, size_t length, TransportCallback&& callback) override
+	{
+		if (m_socket == -1)
+		{
+			errno = EBADF;
+			return false;
+		}
+
+		m_readBuffer = buffer;
+		m_readLength = length;
+		m_readCallback = std::move(callback);
+		m_readPending = true;
+
+		Register();
+		return true;
+	}
+
+	bool BeginWrite(const TransportBuffer* buffers, size_t count, TransportCallback&& callback) override
+	{
+		if (m_socket == -1)
+		{
+			errno = EBADF;
+			return false;
+		}
+
+		m_writeBuffers.resize(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			m_writeBuffers[i].iov_base = const_cast<uint8_t*>(buffers[i].data);
+			m_writeBuffers[i].iov_len = buffers[i].length;
+		}
+
+		m_writeIndex = 0;
+		m_writeTotal = 0;
+		m_writeCallback = std::move(callback);
+		m_writePending = true;
+
+		Register();
+		return true;
+	}
+
+	void CancelRead() override
+	{
+		if (m_readPending)
+			CancelOperation(m_readPending, m_readCallback, 0);
+	}
+
+	void Close(bool) override
+	{
+		if (m_socket == -1)
+			return;
+
+		::close(m_socket);
+		m_socket = -1;
+
+		if (m_readPending)
+			CancelOperation(m_readPending, m_readCallback, 0);
+
+		if (m_writePending)
+			CancelOperation(m_writePending, m_writeCallback, m_writeTotal);
+
+		if (m_pollState != nullptr)
+		{
+			m_pollState->Unregister(this);
+			m_pollState = nullptr;
+		}
+	}
+
+	int GetSocket() const { return m_socket; }
+
+	short GetPollEvents() const
+	{
+		return (m_readPending ? POLLIN : 0) | (m_writePending ? POLLOUT : 0);
+	}
+
+	// Called by the waiter when poll reports the socket is ready. Returns true if an operation completed.
+	bool HandleReady(short events)
+	{
+		bool completed = false;
+
+		if (m_readPending && (events & (POLLIN | POLLHUP | POLLERR)) != 0)
+			completed |= ContinueRead();
+
+		// the read callback might have closed the socket
+		if (m_writePending && m_socket != -1 && (events & (POLLOUT | POLLHUP | POLLERR)) != 0)
+			completed |= ContinueWrite();
+
+		if (!m_readPending && !m_writePending && m_pollState != nullptr)
+		{
+			m_pollState->Unregister(this);
+			m_pollState = nullptr;
+		}
+
+		return completed;
+	}
+
+private:
+	void Register()
+	{
+		if (m_pollState == nullptr)
+		{
+			m_pollState = &t_pollState;
+			m_pollState->Register(this);
+		}
+	}
+
+	bool ContinueRead()
+	{
+		ssize_t bytes = ::recv(m_socket, m_readBuffer, m_readLength, 0);
+		if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+			return false;
+
+		int error = bytes < 0 ? errno : 0;
+
+		// a zero byte read is the other end closing the stream
+		TransportStatus status = bytes == 0 ? TransportStatus::Closed : TranslateSocketError(error);
+
+		m_readPending = false;
+		TransportCallback callback = std::move(m_readCallback);
+		callback(status, static_cast<uint32_t>(error), bytes > 0 ? static_cast<size_t>(bytes) : 0);
+		return true;
+	}
+
+	// A stream socket can accept only part of the data, so keep sending until all of it has
+	// been written before reporting the write as complete.
+	bool ContinueWrite()
+	{
+		msghdr message = {};
+		message.msg_iov = &m_writeBuffers[m_writeIndex];
+		message.msg_iovlen = std::min<size_t>(m_writeBuffers.size() - m_writeIndex, IOV_MAX);
+
+		ssize_t bytes = ::sendmsg(m_socket, &message, MSG_NOSIGNAL);
+		if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+			return false;
+
+		int error = bytes < 0 ? errno : 0;
+		if (bytes > 0)
+		{
+			m_writeTotal += bytes;
+			if (AdvanceWrite(bytes))
+				return false;
+		}
+
+		m_writePending = false;
+		TransportCallback callback = std::move(m_writeCallback);
+		callback(TranslateSocketError(error), static_cast<uint32_t>(error), m_writeTotal);
+		return true;
+	}
+
+	// Skips past the bytes that were sent. Returns true if there is still more to send.
+	bool AdvanceWrite(size_t bytes)
+	{
+		while (m_writeIndex < m_writeBuffers.size() && bytes >= m_writeBuffers[m_writeIndex].iov_len)
+		{
+			bytes -= m_writeBuffers[m_writeIndex].iov_len;
+			++m_writeIndex;
+		}
+
+		if (m_writeIndex == m_writeBuffers.size())
+			return false;
+
+		m_writeBuffers[m_writeIndex].iov_base = static_cast<uint8_t*>(m_writeBuffers[m_writeIndex].iov_base) + bytes;
+		m_writeBuffers[m_writeIndex].iov_len -= bytes;
+		return true;
+	}
+
+	void CancelOperation(bool& pending, TransportCallback& callback, size_t bytes)
+	{
+		pending = false;
+
+		SocketPollState* pollState = m_pollState != nullptr ? m_pollState : &t_pollState;
+		pollState->QueueCompletion([callback = std::move(callback), bytes]()
+			{
+				callback(TransportStatus::Canceled, ECANCELED, bytes);
+			});
+	}
+
+	int m_socket = -1;
+	uint32_t m_processId = 0;
+	SocketPollState* m_pollState = nullptr;
+
+	bool m_readPending = false;
+	uint8_t* m_readBuffer = nullptr;
+	size_t m_readLength = 0;
+	TransportCallback m_readCallback;
+
+	bool m_writePending = false;
+	std::vector<iovec> m_writeBuffers;
+	size_t m_writeIndex = 0;
+	size_t m_writeTotal = 0;
+	TransportCallback m_writeCallback;
+};
+
+class UnixSocketListener : public PipeListener
+{
+public:
+	explicit UnixSocketListener(std::string endpointName)
+		: m_endpointName(std::move(endpointName))
+	{
+	}
+
+	~UnixSocketListener() override
+	{
+		Close();
+	}
+
+	TransportWaitHandle GetAcceptHandle() const override { return m_socket; }
+
+	void Listen() override
+	{
+		// a listening socket keeps accepting, so there's only something to do the first time.
+		if (m_socket != -1)
+			return;
+
+		sockaddr_un address;
+		if (!MakeUnixSocketAddress(m_endpointName, address))
+			throw std::system_error(EINVAL, std::generic_category(), "Invalid unix socket path " + m_endpointName);
+
+		m_socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		if (m_socket == -1)
+			throw std::system_error(errno, std::generic_category(), "Failed to create unix socket on " + m_endpointName);
+
+		// a socket file left behind by a previous run would make the bind fail
+		::unlink(address.sun_path);
+		m_path = address.sun_path;
+
+		if (::bind(m_socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1
+			|| ::listen(m_socket, SOMAXCONN) == -1)
+		{
+			int error = errno;
+			Close();
+
+			throw std::system_error(error, std::generic_category(), "Failed to listen on unix socket " + m_endpointName);
+		}
+
+		SetNonBlocking(m_socket);
+	}
+
+	PipeTransportPtr Accept() override
+	{
+		if (m_socket == -1)
+			return nullptr;
+
+		int socket = ::accept(m_socket, nullptr, nullptr);
+		if (socket == -1)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ECONNABORTED)
+				return nullptr;
+
+			throw std::system_error(errno, std::generic_category(), "Failed to accept connection on unix socket");
+		}
+
+		return std::make_unique<UnixSocketTransport>(socket);
+	}
+
+	void Close() override
+	{
+		if (m_socket == -1)
+			return;
+
+		::close(m_socket);
+		m_socket = -1;
+
+		if (!m_path.empty())
+			::unlink(m_path.c_str());
+	}
+
+private:
+	std::string m_endpointName;
+	std::string m_path;
+	int m_socket = -1;
+};
+
+static TransportConnectResult ConnectToUnixSocket(const std::string& endpointName, PipeTransportPtr& transport)
+{
+	sockaddr_un address;
+	if (!MakeUnixSocketAddress(endpointName, address))
+	{
+		errno = EINVAL;
+		return TransportConnectResult::Failed;
+	}
+
+	int socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (socket == -1)
+		return TransportConnectResult::Failed;
+
+	if (::connect(socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1)
+	{
+		int error = errno;
+		::close(socket);
+
+		if (error == ECONNREFUSED || error == ENOENT)
+			return TransportConnectResult::NotFound;
+
+		errno = error;
+		return TransportConnectResult::Failed;
+	}
+
+	transport = std::make_unique<UnixSocketTransport>(socket);
+	return TransportConnectResult::Connected;
+}
+
+//============================================================================
+
+static bool IsUnixSocketEndpoint(std::string_view endpointName)
+{
+	return endpointName.substr(0, UNIX_SOCKET_PREFIX.length()) == UNIX_SOCKET_PREFIX;
+}
+
+PipeListenerPtr CreatePipeListener(const std::string& endpointName)
+{
+	if (!IsUnixSocketEndpoint(endpointName))
+		throw std::system_error(ENOTSUP, std::generic_category(), "Named pipes are only available on windows: " + endpointName);
+
+	return std::make_unique<UnixSocketListener>(endpointName);
+}
+
+TransportConnectResult ConnectPipeTransport(const std::string& endpointName, PipeTransportPtr& transport)
+{
+	if (!IsUnixSocketEndpoint(endpointName))
+	{
+		errno = ENOTSUP;
+		return TransportConnectResult::Failed;
+	}
+
+	return ConnectToUnixSocket(endpointName, transport);
+}
+
+uint32_t GetLastTransportError()
+{
+	return static_cast<uint32_t>(errno);
+}
+
+//============================================================================
+
+TransportWaiter::TransportWaiter()
+{
+	if (::pipe(m_interruptPipe) == 0)
+	{
+		SetNonBlocking(m_interruptPipe[0]);
+		SetNonBlocking(m_interruptPipe[1]);
+	}
+}
+
+TransportWaiter::~TransportWaiter()
+{
+	for (int fd : m_interruptPipe)
+	{
+		if (fd != -1)
+			::close(fd);
+	}
+}
+
+void TransportWaiter::Interrupt()
+{
+	// if the pipe is full, there is already an interrupt waiting
+	char signal = 1;
+	[[maybe_unused]] ssize_t written = ::write(m_interruptPipe[1], &signal, 1);
+}
+
+TransportWaiter::Result TransportWaiter::Wait(const PipeListener* listener, std::chrono::milliseconds timeout)
+{
+	SocketPollState& pollState = t_pollState;
+
+	// Canceled operations complete right away, without waiting.
+	std::vector<std::function<void()>> completions;
+	{
+		std::scoped_lock lock(pollState.mutex);
+		std::swap(completions, pollState.completions);
+	}
+
+	if (!completions.empty())
+	{
+		for (auto& completion : completions)
+			completion();
+
+		return Result::Completion;
+	}
+
+	std::vector<pollfd> fds;
+	std::vector<UnixSocketTransport*> sockets;
+
+	fds.push_back({ m_interruptPipe[0], POLLIN, 0 });
+
+	const int listenerFd = listener != nullptr ? listener->GetAcceptHandle() : -1;
+	if (listenerFd != -1)
+		fds.push_back({ listenerFd, POLLIN, 0 });
+
+	const size_t firstSocket = fds.size();
+	{
+		std::scoped_lock lock(pollState.mutex);
+		sockets = pollState.sockets;
+	}
+
+	for (UnixSocketTransport* socket : sockets)
+		fds.push_back({ socket->GetSocket(), socket->GetPollEvents(), 0 });
+
+	int result = ::poll(fds.data(), static_cast<nfds_t>(fds.size()), timeout.count() < 0 ? -1 : static_cast<int>(timeout.count()));
+	if (result < 0)
+	{
+		if (errno == EINTR)
+			return Result::Timeout;
+
+		throw std::system_error(errno, std::generic_category(), "Failed in poll");
+	}
+
+	bool completed = false;
+	for (size_t i = firstSocket; i < fds.size(); ++i)
+	{
+		// an earlier completion can close (and destroy) other connections
+		UnixSocketTransport* socket = sockets[i - firstSocket];
+		if (fds[i].revents != 0 && pollState.IsRegistered(socket))
+			completed |= socket->HandleReady(fds[i].revents);
+	}
+
+	if (fds[0].revents & POLLIN)
+	{
+		char buffer[64];
+		while (::read(m_interruptPipe[0], buffer, sizeof(buffer)) > 0) {}
+
+		return Result::Interrupt;
+	}
+
+	if (listenerFd != -1 && (fds[1].revents & POLLIN))
+		return Result::Accept;
+
+	return completed ? Result::Completion : Result::Timeout;
+}
+
+#endif // !defined(_WIN32)
+
+std::string DescribeTransportError(uint32_t errorCode)
+{
+	return std::system_category().message(static_cast<int>(errorCode));
+}
+
+} // namespace mq
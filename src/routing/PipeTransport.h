@@ -0,0 +1,183 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace mq {
+
+//============================================================================
+// Transports move bytes between two endpoints for a PipeConnection. They do not know
+// anything about messages: the connection frames messages with MQMessageHeader, so a
+// transport is free to be a message pipe or a plain byte stream.
+//
+// All operations are asynchronous and complete on the thread that started them, the next
+// time it waits in a TransportWaiter. On windows that is an alertable wait, so completions
+// run as APCs the same way the named pipe completion routines always have. Elsewhere the
+// waiter polls the thread's sockets and runs the completions itself. Only one read and one
+// write may be outstanding at a time.
+//
+// Named pipes are only available on windows. Unix domain sockets are available everywhere,
+// so the routing stack can also be run (and load tested) on other systems.
+
+// Prefix for endpoint names that use a unix domain socket instead of a named pipe,
+// for example "unix:C:\MacroQuest\mq.sock" or "unix:/tmp/mq.sock".
+constexpr std::string_view UNIX_SOCKET_PREFIX = "unix:";
+
+#if defined(_WIN32)
+// An event handle, signaled when it is ready
+using TransportWaitHandle = void*;
+#else
+// A file descriptor, ready when it is readable
+using TransportWaitHandle = int;
+#endif
+
+enum class TransportStatus
+{
+	Success,            // The operation completed. A zero byte read is reported as Closed.
+	Closed,             // The other end closed the connection.
+	Canceled,           // The operation was canceled because the transport is closing.
+	Failed,             // Any other error. The error code has the details.
+};
+
+using TransportCallback = std::function<void(TransportStatus status, uint32_t errorCode, size_t bytes)>;
+
+// One piece of a gathered write
+struct TransportBuffer
+{
+	const uint8_t* data;
+	size_t length;
+};
+
+class PipeTransport
+{
+public:
+	virtual ~PipeTransport() {}
+
+	virtual bool IsOpen() const = 0;
+
+	// Process id of the process on the other end of the transport, or 0 if it isn't known.
+	virtual uint32_t GetPeerProcessId() const = 0;
+
+	// Start reading up to length bytes into buffer. The buffer must remain valid until
+	// the callback is called. Returns false (GetLastTransportError has the reason) if the
+	// read could not be started.
+	virtual bool BeginRead(uint8_t* buffer, size_t length, TransportCallback&& callback) = 0;
+
+	// Start writing the buffers, in order, as a single write. The buffers must remain valid until
+	// the callback is called, which only happens once all of them have been written (or the write
+	// failed). Returns false (GetLastTransportError has the reason) if the write could not be started.
+	virtual bool BeginWrite(const TransportBuffer* buffers, size_t count, TransportCallback&& callback) = 0;
+
+	// True if every write arrives at the other end as a read of its own, like a message mode
+	// named pipe. Stream transports return false.
+	virtual bool PreservesMessageBoundaries() const = 0;
+
+	// Cancel an outstanding read. Its callback will be called with TransportStatus::Canceled.
+	virtual void CancelRead() = 0;
+
+	// Close the transport. If disconnect is true, the other end is explicitly told that
+	// the connection is going away (only meaningful for the server side of a named pipe).
+	virtual void Close(bool disconnect) = 0;
+};
+using PipeTransportPtr = std::unique_ptr<PipeTransport>;
+
+// Accepts incoming connections for a server.
+class PipeListener
+{
+public:
+	virtual ~PipeListener() {}
+
+	// Becomes ready when a connection is ready to be accepted.
+	virtual TransportWaitHandle GetAcceptHandle() const = 0;
+
+	// Begin listening for a connection. Throws if the endpoint can't be created.
+	virtual void Listen() = 0;
+
+	// Accept a ready connection after the accept handle is ready. Can return nullptr if there
+	// was nothing to accept. Throws if the connection could not be completed.
+	virtual PipeTransportPtr Accept() = 0;
+
+	// Stop listening and cancel any pending accept.
+	virtual void Close() = 0;
+};
+using PipeListenerPtr = std::unique_ptr<PipeListener>;
+
+enum class TransportConnectResult
+{
+	Connected,
+	NotFound,           // Nothing is listening on the endpoint yet.
+	Busy,               // The endpoint is busy. Already waited for it, so try again right away.
+	Failed,             // Any other error. GetLastTransportError() has the details.
+};
+
+// Creates a listener for the endpoint name. Names that start with UNIX_SOCKET_PREFIX
+// are unix domain sockets, anything else is a named pipe.
+PipeListenerPtr CreatePipeListener(const std::string& endpointName);
+
+// Connects to the endpoint name, storing the transport on success.
+TransportConnectResult ConnectPipeTransport(const std::string& endpointName, PipeTransportPtr& transport);
+
+// The error left by the last transport call on this thread that failed: GetLastError() on windows,
+// errno elsewhere.
+uint32_t GetLastTransportError();
+
+// Describes a transport error code, including the error codes passed to transport callbacks.
+std::string DescribeTransportError(uint32_t errorCode);
+
+//============================================================================
+
+// The wait an endpoint thread sits in between operations. Any transport completions for the
+// thread are run while it waits.
+class TransportWaiter
+{
+public:
+	enum class Result
+	{
+		Accept,             // The listener has a connection ready to accept.
+		Interrupt,          // Interrupt was called.
+		Completion,         // Transport completions were run.
+		Timeout,
+	};
+
+	TransportWaiter();
+	~TransportWaiter();
+
+	TransportWaiter(const TransportWaiter&) = delete;
+	TransportWaiter& operator=(const TransportWaiter&) = delete;
+
+	// Wakes up the waiting thread. Can be called from any thread. An interrupt that arrives while
+	// nothing is waiting is picked up by the next wait.
+	void Interrupt();
+
+	// Waits for the listener (if there is one) to have a connection ready, for an interrupt or for
+	// transport completions to run, up to the timeout. A negative timeout waits forever. Throws if
+	// the wait itself fails.
+	Result Wait(const PipeListener* listener, std::chrono::milliseconds timeout = std::chrono::milliseconds(-1));
+
+private:
+#if defined(_WIN32)
+	void* m_interruptEvent = nullptr;
+#else
+	int m_interruptPipe[2] = { -1, -1 };
+#endif
+};
+
+} // namespace mq
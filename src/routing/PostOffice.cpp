@@ -15,55 +15,389 @@
 #define MQLIB_OBJECT
 #include "PostOffice.h"
 
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+#include <lz4.h>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <vector>
+
+#ifdef _DEBUG
+#pragma comment(lib, "lz4d")
+#else
+#pragma comment(lib, "lz4")
+#endif
+
 namespace mq::postoffice {
 
-void Mailbox::Deliver(PipeMessagePtr&& message) const
+// LZ4 can't turn a byte of input into more than 255 bytes of output, so a payload that claims to
+// expand by more than that wasn't compressed by LZ4 and isn't worth allocating for.
+constexpr uint64_t LZ4_MAX_EXPANSION = 255;
+
+static bool IsValidUncompressedSize(uint32_t uncompressedSize, size_t compressedSize)
+{
+	return uncompressedSize <= ENVELOPE_MAX_UNCOMPRESSED_SIZE
+		&& uncompressedSize <= (static_cast<uint64_t>(compressedSize) + 1) * LZ4_MAX_EXPANSION;
+}
+
+EnvelopePayload::EnvelopePayload(const EnvelopeHeader& envelope)
+	: EnvelopePayload(envelope.GetPayload())
+{
+	m_compression = envelope.compression;
+	m_uncompressedSize = envelope.uncompressedSize;
+}
+
+bool EnvelopeHeader::Peek(const void* data, size_t length)
+{
+	using google::protobuf::internal::WireFormatLite;
+
+	*this = EnvelopeHeader();
+
+	google::protobuf::io::CodedInputStream input(static_cast<const uint8_t*>(data), static_cast<int>(length));
+	while (uint32_t tag = input.ReadTag())
+	{
+		const bool delimited = WireFormatLite::GetTagWireType(tag) == WireFormatLite::WIRETYPE_LENGTH_DELIMITED;
+
+		switch (WireFormatLite::GetTagFieldNumber(tag))
+		{
+		case proto::routing::Envelope::kAddressFieldNumber:
+			if (!delimited || !WireFormatLite::ReadMessage(&input, &address))
+				return false;
+			hasAddress = true;
+			break;
+
+		case proto::routing::Envelope::kReturnAddressFieldNumber:
+			if (!delimited || !WireFormatLite::ReadMessage(&input, &returnAddress))
+				return false;
+			hasReturnAddress = true;
+			break;
+
+		case proto::routing::Envelope::kCompressionFieldNumber:
+		{
+			uint32_t value = 0;
+			if (WireFormatLite::GetTagWireType(tag) != WireFormatLite::WIRETYPE_VARINT || !input.ReadVarint32(&value))
+				return false;
+			compression = static_cast<proto::routing::PayloadCompression>(value);
+			break;
+		}
+
+		case proto::routing::Envelope::kUncompressedSizeFieldNumber:
+			if (WireFormatLite::GetTagWireType(tag) != WireFormatLite::WIRETYPE_VARINT || !input.ReadVarint32(&uncompressedSize))
+				return false;
+			break;
+
+		case proto::routing::Envelope::kPayloadFieldNumber:
+		{
+			// only remember where the payload is, the last one on the wire wins just like a parse would
+			uint32_t size = 0;
+			if (!delimited || !input.ReadVarint32(&size))
+				return false;
+
+			const int offset = input.CurrentPosition();
+			if (!input.Skip(static_cast<int>(size)))
+				return false;
+
+			payload = static_cast<const uint8_t*>(data) + offset;
+			payloadLength = size;
+			hasPayload = true;
+			break;
+		}
+
+		default:
+			if (!WireFormatLite::SkipField(&input, tag))
+				return false;
+			break;
+		}
+	}
+
+	if (compression != proto::routing::PayloadUncompressed && !IsValidUncompressedSize(uncompressedSize, payloadLength))
+	{
+		// don't leave a size behind for a caller to allocate
+		payload = nullptr;
+		payloadLength = 0;
+		hasPayload = false;
+		uncompressedSize = 0;
+		return false;
+	}
+
+	return input.ConsumedEntireMessage();
+}
+
+bool EnvelopeHeader::ReadPayload(void* target) const
+{
+	switch (compression)
+	{
+	case proto::routing::PayloadUncompressed:
+		if (payloadLength > 0)
+			memcpy(target, payload, payloadLength);
+		return true;
+
+	case proto::routing::PayloadLZ4:
+		if (!IsValidUncompressedSize(uncompressedSize, payloadLength))
+			return false;
+
+		return LZ4_decompress_safe(reinterpret_cast<const char*>(payload), static_cast<char*>(target),
+			static_cast<int>(payloadLength), static_cast<int>(uncompressedSize)) == static_cast<int>(uncompressedSize);
+
+	default:
+		// a newer client is using something we don't know how to decompress
+		return false;
+	}
+}
+
+PipeMessagePtr StuffEnvelope(
+	const proto::routing::Address& address,
+	const proto::routing::Address& returnAddress,
+	const EnvelopePayload& payload,
+	bool allowCompression /* = true */)
+{
+	using google::protobuf::internal::WireFormatLite;
+	using google::protobuf::io::CodedOutputStream;
+
+	constexpr uint32_t addressTag = WireFormatLite::MakeTag(
+		proto::routing::Envelope::kAddressFieldNumber, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+	constexpr uint32_t returnAddressTag = WireFormatLite::MakeTag(
+		proto::routing::Envelope::kReturnAddressFieldNumber, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+	constexpr uint32_t compressionTag = WireFormatLite::MakeTag(
+		proto::routing::Envelope::kCompressionFieldNumber, WireFormatLite::WIRETYPE_VARINT);
+	constexpr uint32_t uncompressedSizeTag = WireFormatLite::MakeTag(
+		proto::routing::Envelope::kUncompressedSizeFieldNumber, WireFormatLite::WIRETYPE_VARINT);
+	constexpr uint32_t payloadTag = WireFormatLite::MakeTag(
+		proto::routing::Envelope::kPayloadFieldNumber, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+
+	// scratch space for compression, kept per thread so compressing doesn't allocate every message
+	thread_local std::vector<uint8_t> s_serialized;
+	thread_local std::vector<char> s_compressed;
+
+	proto::routing::PayloadCompression compression = payload.GetCompression();
+	uint32_t uncompressedSize = payload.GetUncompressedSize();
+	uint32_t payloadSize = static_cast<uint32_t>(payload.size());
+	const void* payloadData = nullptr; // when set, the payload is copied from here instead of written by the payload
+
+	if (allowCompression
+		&& compression == proto::routing::PayloadUncompressed
+		&& payload.size() >= ENVELOPE_COMPRESSION_THRESHOLD
+		&& payload.size() <= LZ4_MAX_INPUT_SIZE)
+	{
+		const uint8_t* source = payload.data();
+		if (source == nullptr)
+		{
+			s_serialized.resize(payload.size());
+			payload.Write(s_serialized.data());
+			source = s_serialized.data();
+			payloadData = source; // don't serialize it a second time if it doesn't compress
+		}
+
+		s_compressed.resize(LZ4_compressBound(static_cast<int>(payload.size())));
+		const int compressedSize = LZ4_compress_default(reinterpret_cast<const char*>(source), s_compressed.data(),
+			static_cast<int>(payload.size()), static_cast<int>(s_compressed.size()));
+
+		// the compression fields cost a few bytes, so make sure it's a real saving
+		if (compressedSize > 0 && static_cast<size_t>(compressedSize) + 16 < payload.size())
+		{
+			compression = proto::routing::PayloadLZ4;
+			uncompressedSize = payloadSize;
+			payloadSize = static_cast<uint32_t>(compressedSize);
+			payloadData = s_compressed.data();
+		}
+	}
+
+	// ByteSizeLong caches the sizes, which the serialization below relies on
+	const uint32_t addressSize = static_cast<uint32_t>(address.ByteSizeLong());
+	const uint32_t returnAddressSize = static_cast<uint32_t>(returnAddress.ByteSizeLong());
+
+	size_t size =
+		CodedOutputStream::VarintSize32(addressTag) + CodedOutputStream::VarintSize32(addressSize) + addressSize +
+		CodedOutputStream::VarintSize32(returnAddressTag) + CodedOutputStream::VarintSize32(returnAddressSize) + returnAddressSize +
+		CodedOutputStream::VarintSize32(payloadTag) + CodedOutputStream::VarintSize32(payloadSize) + payloadSize;
+
+	if (compression != proto::routing::PayloadUncompressed)
+	{
+		size += CodedOutputStream::VarintSize32(compressionTag) + CodedOutputStream::VarintSize32(compression) +
+			CodedOutputStream::VarintSize32(uncompressedSizeTag) + CodedOutputStream::VarintSize32(uncompressedSize);
+	}
+
+	auto message = std::make_unique<PipeMessage>(MQMessageId::MSG_ROUTE, nullptr, size);
+	uint8_t* target = message->get<uint8_t>();
+
+	// fields are written in field number order, just like the Envelope would serialize itself
+	target = CodedOutputStream::WriteTagToArray(addressTag, target);
+	target = CodedOutputStream::WriteVarint32ToArray(addressSize, target);
+	target = address.SerializeWithCachedSizesToArray(target);
+
+	target = CodedOutputStream::WriteTagToArray(returnAddressTag, target);
+	target = CodedOutputStream::WriteVarint32ToArray(returnAddressSize, target);
+	target = returnAddress.SerializeWithCachedSizesToArray(target);
+
+	if (compression != proto::routing::PayloadUncompressed)
+	{
+		target = CodedOutputStream::WriteTagToArray(compressionTag, target);
+		target = CodedOutputStream::WriteVarint32ToArray(compression, target);
+		target = CodedOutputStream::WriteTagToArray(uncompressedSizeTag, target);
+		target = CodedOutputStream::WriteVarint32ToArray(uncompressedSize, target);
+	}
+
+	target = CodedOutputStream::WriteTagToArray(payloadTag, target);
+	target = CodedOutputStream::WriteVarint32ToArray(payloadSize, target);
+	if (payloadData != nullptr)
+	{
+		memcpy(target, payloadData, payloadSize);
+		target += payloadSize;
+	}
+	else
+	{
+		target = payload.Write(target);
+	}
+
+	assert(target == message->get<uint8_t>() + size);
+	return message;
+}
+
+PipeMessagePtr DecompressEnvelope(PipeMessagePtr&& message)
+{
+	EnvelopeHeader envelope;
+	if (!envelope.Peek(message) || envelope.compression == proto::routing::PayloadUncompressed)
+		return std::move(message);
+
+	std::string payload(envelope.GetPayloadSize(), '\0');
+	if (!envelope.ReadPayload(payload.data()))
+		return nullptr;
+
+	auto stuffed = StuffEnvelope(envelope.address, envelope.returnAddress, EnvelopePayload(payload), false);
+
+	// keep the original header, so replies and sequence ids still line up
+	return std::make_unique<PipeMessage>(*message, stuffed->get(), stuffed->size());
+}
+
+// Answers a dropped RPC message so the sender isn't left waiting for a reply that will never come
+static void ReplyQueueFull(PipeMessage& message, const proto::routing::Address* returnAddress, const std::string& localAddress)
+{
+	if (message.GetRequestMode() != MQRequestMode::CallAndResponse)
+		return;
+
+	// this has the same shape as a routing failure: addressed back to the sender, with the
+	// address that couldn't take the message as the payload
+	proto::routing::Envelope outbound;
+	if (returnAddress != nullptr)
+		*outbound.mutable_address() = *returnAddress;
+
+	proto::routing::Address failed;
+	failed.set_pid(GetCurrentProcessId());
+	failed.set_mailbox(localAddress);
+	outbound.set_payload(failed.SerializeAsString());
+
+	std::string data = outbound.SerializeAsString();
+	message.SendReply(MQMessageId::MSG_ROUTE, &data[0], data.size(), static_cast<uint8_t>(MsgError_QueueFull));
+}
+
+bool Mailbox::Deliver(PipeMessagePtr&& message) const
 {
 	// Don't do anything if this isn't wrapped in an envelope
-	if (message->GetMessageId() == MQMessageId::MSG_ROUTE)
+	if (message->GetMessageId() != MQMessageId::MSG_ROUTE)
+		return true;
+
+	EnvelopeHeader envelope;
+	if (!envelope.Peek(message))
+		return true;
+
+	if (m_limits.maxQueueSize > 0 && m_receiveQueue.size() >= m_limits.maxQueueSize)
+	{
+		switch (m_limits.policy)
+		{
+		case MailboxOverflowPolicy::DropOldest:
+		{
+			auto& oldest = m_receiveQueue.front().message;
+			ReplyQueueFull(*oldest, oldest->GetSender() ? &*oldest->GetSender() : nullptr, m_localAddress);
+
+			m_receiveQueue.pop_front();
+			++m_stats.dropped;
+			break;
+		}
+
+		case MailboxOverflowPolicy::DropNewest:
+			ReplyQueueFull(*message, envelope.hasReturnAddress ? &envelope.returnAddress : nullptr, m_localAddress);
+			++m_stats.dropped;
+			return true;
+
+		case MailboxOverflowPolicy::Reject:
+			++m_stats.rejected;
+			return false;
+		}
+	}
+
+	if (auto unwrapped = Open(envelope, message))
 	{
-		m_receiveQueue.push(Open(ProtoMessage::Parse<proto::routing::Envelope>(message), message));
+		m_receiveQueue.push_back(QueuedMessage{ std::move(unwrapped), std::chrono::steady_clock::now() });
+
+		++m_stats.enqueued;
+		m_stats.queueDepth = m_receiveQueue.size();
+		m_stats.peakQueueDepth = std::max(m_stats.peakQueueDepth, m_stats.queueDepth);
 	}
+	else
+	{
+		SPDLOG_WARN("Mailbox::Deliver: Failed to decompress message for {}", m_localAddress);
+	}
+
+	return true;
 }
 
 void Mailbox::Process(size_t howMany) const
 {
 	if (howMany > 0 && !m_receiveQueue.empty())
 	{
-		m_receive(std::move(m_receiveQueue.front()));
-		m_receiveQueue.pop();
+		QueuedMessage queued = std::move(m_receiveQueue.front());
+		m_receiveQueue.pop_front();
+
+		auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now() - queued.received);
+
+		++m_stats.delivered;
+		m_stats.queueDepth = m_receiveQueue.size();
+		m_stats.lastLatency = latency;
+		m_stats.maxLatency = std::max(m_stats.maxLatency, latency);
+		m_stats.totalLatency += latency;
+
+		m_receive(std::move(queued.message));
 
 		Process(howMany - 1);
 	}
 }
 
-ProtoMessagePtr Mailbox::Open(proto::routing::Envelope&& envelope, const PipeMessagePtr& message)
+void Mailbox::ResetStats() const
+{
+	m_stats = MailboxStats();
+	m_stats.queueDepth = m_receiveQueue.size();
+}
+
+ProtoMessagePtr Mailbox::Open(const EnvelopeHeader& envelope, const PipeMessagePtr& message)
 {
 	ProtoMessagePtr unwrapped;
 
-	const void* data = nullptr;
-	size_t length = 0;
-	if (envelope.has_payload())
-	{
-		data = &envelope.payload()[0];
-		length = envelope.payload().size();
-	}
+	// the payload is copied (or decompressed) once, straight out of the routed message
+	const size_t length = envelope.GetPayloadSize();
+	if (length > ENVELOPE_MAX_UNCOMPRESSED_SIZE)
+		return nullptr;
 
 	if (message != nullptr) // this resets the m_replied member, but it couldn't have become true before this anyway
-		unwrapped = std::make_unique<ProtoMessage>(*message, data, length);
+		unwrapped = std::make_unique<ProtoMessage>(*message, nullptr, length);
 	else
-		unwrapped = std::make_unique<ProtoMessage>(MQMessageId::MSG_NULL, data, length);
+		unwrapped = std::make_unique<ProtoMessage>(MQMessageId::MSG_NULL, nullptr, length);
 
-	if (envelope.has_return_address())
-		unwrapped->SetSender(envelope.return_address());
+	if (!envelope.ReadPayload(unwrapped->get()))
+		return nullptr;
+
+	if (envelope.hasReturnAddress)
+		unwrapped->SetSender(envelope.returnAddress);
 
 	return unwrapped;
 }
 
-Dropbox::Dropbox(std::string localAddress, PostCallback&& post, DropboxDropper&& unregister)
+Dropbox::Dropbox(std::string localAddress, PostCallback&& post, DropboxDropper&& unregister, DropboxSubscriber&& subscribe)
 	: m_localAddress(localAddress)
 	, m_post(post)
 	, m_unregister(unregister)
+	, m_subscribe(subscribe)
 	, m_valid(true)
 {}
 
@@ -71,6 +405,7 @@ Dropbox::Dropbox(const Dropbox& other)
 	: m_localAddress(other.m_localAddress)
 	, m_post(other.m_post)
 	, m_unregister(other.m_unregister)
+	, m_subscribe(other.m_subscribe)
 	, m_valid(other.m_valid)
 {}
 
@@ -78,6 +413,7 @@ Dropbox::Dropbox(Dropbox&& other) noexcept
 	: m_localAddress(std::move(other.m_localAddress))
 	, m_post(std::move(other.m_post))
 	, m_unregister(std::move(other.m_unregister))
+	, m_subscribe(std::move(other.m_subscribe))
 	, m_valid(other.m_valid)
 {}
 
@@ -86,10 +422,23 @@ Dropbox& Dropbox::operator=(Dropbox other) noexcept
 	m_localAddress = std::move(other.m_localAddress);
 	m_post = std::move(other.m_post);
 	m_unregister = std::move(other.m_unregister);
+	m_subscribe = std::move(other.m_subscribe);
 	m_valid = other.m_valid;
 	return *this;
 }
 
+void Dropbox::Subscribe(const std::string& topic)
+{
+	if (m_valid && m_subscribe)
+		m_subscribe(m_localAddress, topic, true);
+}
+
+void Dropbox::Unsubscribe(const std::string& topic)
+{
+	if (m_valid && m_subscribe)
+		m_subscribe(m_localAddress, topic, false);
+}
+
 void Dropbox::Remove()
 {
 	if (m_valid)
@@ -108,15 +457,42 @@ void PostOffice::RouteMessage(const std::string& data, const PipeMessageResponse
 	RouteMessage(&data[0], data.size(), callback);
 }
 
+void PostOffice::PostEnvelope(
+	const proto::routing::Address& address,
+	const std::string* mailbox,
+	const EnvelopePayload& payload,
+	const PipeMessageResponseCb& callback)
+{
+	proto::routing::Address ret;
+	ret.set_pid(GetCurrentProcessId());
+
+	if (mailbox != nullptr)
+		ret.set_mailbox(*mailbox);
+
+	FillReturnAddress(ret);
+
+	RouteMessage(StuffEnvelope(address, ret, payload), callback);
+}
+
 Dropbox PostOffice::RegisterAddress(const std::string& localAddress, ReceiveCallback&& receive)
 {
-	auto [mailbox, added] = m_mailboxes.emplace(localAddress, std::make_unique<Mailbox>(localAddress, std::move(receive)));
+	auto [mailbox, added] = m_mailboxes.emplace(localAddress, std::make_unique<Mailbox>(localAddress, std::move(receive), m_defaultLimits));
 	if (added)
 	{
 		return Dropbox(
 			localAddress,
-			[this](const std::string& data, const PipeMessageResponseCb& callback) { RouteMessage(data, callback); },
-			[this](const std::string& localAddress) { RemoveMailbox(localAddress); });
+			[this, localAddress](const proto::routing::Address& address, const EnvelopePayload& payload, const PipeMessageResponseCb& callback)
+			{
+				PostEnvelope(address, &localAddress, payload, callback);
+			},
+			[this](const std::string& localAddress) { RemoveMailbox(localAddress); },
+			[this](const std::string& localAddress, const std::string& topic, bool subscribe)
+			{
+				if (subscribe)
+					Subscribe(localAddress, topic);
+				else
+					Unsubscribe(localAddress, topic);
+			});
 	}
 
 	return Dropbox();
@@ -124,7 +500,107 @@ Dropbox PostOffice::RegisterAddress(const std::string& localAddress, ReceiveCall
 
 bool PostOffice::RemoveMailbox(const std::string& localAddress)
 {
-	return m_mailboxes.erase(localAddress) == 1;
+	if (m_mailboxes.erase(localAddress) != 1)
+		return false;
+
+	for (auto topic_it = m_topics.begin(); topic_it != m_topics.end();)
+	{
+		auto& subscribers = topic_it->second;
+		subscribers.erase(std::remove(subscribers.begin(), subscribers.end(), localAddress), subscribers.end());
+
+		if (subscribers.empty())
+		{
+			std::string topic = topic_it->first;
+			topic_it = m_topics.erase(topic_it);
+			OnSubscriptionChanged(topic, false);
+		}
+		else
+		{
+			++topic_it;
+		}
+	}
+
+	return true;
+}
+
+bool PostOffice::SetMailboxLimits(const std::string& localAddress, const MailboxLimits& limits)
+{
+	auto mailbox_it = m_mailboxes.find(localAddress);
+	if (mailbox_it == m_mailboxes.end())
+		return false;
+
+	mailbox_it->second->SetLimits(limits);
+	return true;
+}
+
+void PostOffice::ForEachMailbox(const std::function<void(const Mailbox&)>& visit) const
+{
+	for (const auto& [_, mailbox] : m_mailboxes)
+		visit(*mailbox);
+}
+
+bool PostOffice::Subscribe(const std::string& localAddress, const std::string& topic)
+{
+	if (m_mailboxes.find(localAddress) == m_mailboxes.end())
+		return false;
+
+	auto [topic_it, added] = m_topics.try_emplace(topic);
+	auto& subscribers = topic_it->second;
+
+	if (std::find(subscribers.begin(), subscribers.end(), localAddress) != subscribers.end())
+		return false;
+
+	subscribers.push_back(localAddress);
+
+	if (added)
+		OnSubscriptionChanged(topic, true);
+
+	return true;
+}
+
+bool PostOffice::Unsubscribe(const std::string& localAddress, const std::string& topic)
+{
+	auto topic_it = m_topics.find(topic);
+	if (topic_it == m_topics.end())
+		return false;
+
+	auto& subscribers = topic_it->second;
+	auto subscriber_it = std::find(subscribers.begin(), subscribers.end(), localAddress);
+	if (subscriber_it == subscribers.end())
+		return false;
+
+	subscribers.erase(subscriber_it);
+
+	if (subscribers.empty())
+	{
+		m_topics.erase(topic_it);
+		OnSubscriptionChanged(topic, false);
+	}
+
+	return true;
+}
+
+size_t PostOffice::DeliverToTopic(const std::string& topic, PipeMessagePtr&& message, const std::function<void(int, PipeMessagePtr&&)>& failed)
+{
+	auto topic_it = m_topics.find(topic);
+	if (topic_it == m_topics.end())
+		return 0;
+
+	const auto& subscribers = topic_it->second;
+	if (subscribers.size() == 1)
+		return DeliverTo(subscribers.front(), std::move(message), failed) ? 1 : 0;
+
+	// every subscriber gets its own header, but they all share the one payload
+	std::shared_ptr<const PipeMessage> shared = std::move(message);
+
+	size_t delivered = 0;
+	for (const auto& localAddress : subscribers)
+	{
+		if (DeliverTo(localAddress, std::make_unique<PipeMessage>(*shared->GetHeader(), shared)))
+			++delivered;
+	}
+
+	return delivered;
 }
 
 bool PostOffice::DeliverTo(const std::string& localAddress, PipeMessagePtr&& message, const std::function<void(int, PipeMessagePtr&&)>& failed)
@@ -133,8 +609,11 @@ bool PostOffice::DeliverTo(const std::string& localAddress, PipeMessagePtr&& mes
 	if (mailbox_it != m_mailboxes.end())
 	{
 		OnDeliver(localAddress, message);
-		mailbox_it->second->Deliver(std::move(message));
-		return true;
+		if (mailbox_it->second->Deliver(std::move(message)))
+			return true;
+
+		failed(MsgError_QueueFull, std::move(message));
+		return false;
 	}
 
 	failed(MsgError_RoutingFailed, std::move(message));
@@ -16,23 +16,242 @@
 
 #include "Routing.h"
 
+#include <chrono>
+#include <cstring>
+#include <deque>
 #include <string>
+#include <string_view>
 #include <unordered_map>
-#include <queue>
+#include <vector>
 #include <memory>
 
 namespace mq::postoffice {
 
+// Payloads at least this large are compressed when they are put in an envelope, as long as
+// compressing actually makes them smaller. Anything smaller is sent exactly as before.
+constexpr size_t ENVELOPE_COMPRESSION_THRESHOLD = 4 * 1024;
+
+// Largest payload that will be decompressed, the same as the largest message a pipe will accept.
+// Envelopes that claim a larger uncompressed size are rejected before anything is allocated.
+constexpr uint32_t ENVELOPE_MAX_UNCOMPRESSED_SIZE = 64 * 1024 * 1024;
+
+// Mailboxes hold at most this many undelivered messages unless they are given other limits
+constexpr size_t DEFAULT_MAILBOX_QUEUE_SIZE = 4096;
+
+struct EnvelopeHeader;
+
+/**
+ * A payload to put in an envelope, without taking a copy of it
+ *
+ * This is either a proto, which will be serialized straight into the outgoing message, or
+ * already serialized bytes. It only refers to the payload, so it must not outlive it.
+ */
+class EnvelopePayload
+{
+public:
+	template <typename T>
+	explicit EnvelopePayload(const T& obj)
+		: m_size(obj.ByteSizeLong())
+		, m_object(&obj)
+		, m_write([](const void* obj, uint8_t* target)
+			{ return static_cast<const T*>(obj)->SerializeWithCachedSizesToArray(target); })
+	{}
+
+	explicit EnvelopePayload(std::string_view data)
+		: m_size(data.size())
+		, m_object(data.data())
+		, m_write(nullptr)
+	{}
+
+	explicit EnvelopePayload(const std::string& data)
+		: EnvelopePayload(std::string_view(data))
+	{}
+
+	// The payload of an envelope that was already received, exactly as it was on the wire.
+	// If it was compressed, it stays compressed.
+	explicit EnvelopePayload(const EnvelopeHeader& envelope);
+
+	size_t size() const { return m_size; }
+
+	// The serialized bytes, or nullptr if the payload is a proto that hasn't been serialized yet
+	const uint8_t* data() const { return m_write == nullptr ? static_cast<const uint8_t*>(m_object) : nullptr; }
+
+	proto::routing::PayloadCompression GetCompression() const { return m_compression; }
+	uint32_t GetUncompressedSize() const { return m_uncompressedSize; }
+
+	/**
+	 * Writes the payload to the target, which must have room for size() bytes
+	 *
+	 * @param target where to write the payload
+	 * @return the position after the payload
+	 */
+	uint8_t* Write(uint8_t* target) const
+	{
+		if (m_write != nullptr)
+			return m_write(m_object, target);
+
+		if (m_size > 0)
+			memcpy(target, m_object, m_size);
+
+		return target + m_size;
+	}
+
+private:
+	size_t m_size;
+	const void* m_object;
+	uint8_t* (*m_write)(const void*, uint8_t*);
+	proto::routing::PayloadCompression m_compression = proto::routing::PayloadUncompressed;
+	uint32_t m_uncompressedSize = 0;
+};
+
+/**
+ * Builds a routed message, writing the envelope and its payload directly into the message buffer
+ *
+ * This produces the same bytes as serializing an Envelope with the addresses and payload set, but
+ * the payload is only written once. Payloads of at least ENVELOPE_COMPRESSION_THRESHOLD bytes are
+ * compressed if that makes them smaller, and the envelope is flagged so the receiver can undo it.
+ *
+ * @param address the address to send the message to
+ * @param returnAddress the address of the sender
+ * @param payload the contents of the envelope
+ * @param allowCompression false to never compress the payload
+ * @return a MSG_ROUTE message holding the envelope
+ */
+PipeMessagePtr StuffEnvelope(
+	const proto::routing::Address& address,
+	const proto::routing::Address& returnAddress,
+	const EnvelopePayload& payload,
+	bool allowCompression = true);
+
+/**
+ * Rewrites a routed message with its payload decompressed, for a connection whose other end
+ * can't decompress payloads (see PipeCapability_CompressedPayloads)
+ *
+ * @param message a MSG_ROUTE message
+ * @return the message itself if its payload isn't compressed, a copy of it with the payload
+ *         decompressed if it is, or nullptr if the payload couldn't be decompressed
+ */
+PipeMessagePtr DecompressEnvelope(PipeMessagePtr&& message);
+
 using ReceiveCallback = std::function<void(ProtoMessagePtr&&)>;
-using PostCallback = std::function<void(const std::string&, const PipeMessageResponseCb&)>;
+using PostCallback = std::function<void(const proto::routing::Address&, const EnvelopePayload&, const PipeMessageResponseCb&)>;
 using DropboxDropper = std::function<void(const std::string&)>;
+using DropboxSubscriber = std::function<void(const std::string& localAddress, const std::string& topic, bool subscribe)>;
+
+/**
+ * The routing information of an Envelope, read straight off the wire
+ *
+ * Routers only need the addresses to make a decision, so this reads the address fields of a
+ * serialized Envelope and records where the payload lives instead of copying it. The message
+ * itself can then be forwarded as-is, with the payload treated as opaque bytes.
+ */
+struct EnvelopeHeader
+{
+	proto::routing::Address address;
+	proto::routing::Address returnAddress;
+	bool hasAddress = false;
+	bool hasReturnAddress = false;
+
+	const uint8_t* payload = nullptr;
+	size_t payloadLength = 0;
+	bool hasPayload = false;
+
+	// how the payload bytes are compressed, if at all
+	proto::routing::PayloadCompression compression = proto::routing::PayloadUncompressed;
+	uint32_t uncompressedSize = 0;
+
+	/**
+	 * Reads the addresses out of a serialized Envelope, skipping over the payload
+	 *
+	 * @param data the serialized envelope
+	 * @param length the length of the serialized envelope
+	 * @return true if the envelope was well formed. A compressed payload whose uncompressed size
+	 *         is out of bounds makes the envelope malformed, and leaves no payload behind.
+	 */
+	bool Peek(const void* data, size_t length);
+
+	/**
+	 * Reads the addresses out of a message that contains an Envelope
+	 *
+	 * @param message the message containing the serialized envelope
+	 * @return true if the envelope was well formed
+	 */
+	bool Peek(const PipeMessagePtr& message) { return Peek(message->get(), message->size()); }
+
+	/**
+	 * Gets a view of the payload in the buffer that was peeked, as it is on the wire, so it may
+	 * be compressed. Only valid as long as that buffer is.
+	 *
+	 * @return the payload bytes, or an empty view if there was no payload
+	 */
+	std::string_view GetPayload() const
+	{
+		return std::string_view(reinterpret_cast<const char*>(payload), payloadLength);
+	}
+
+	/**
+	 * Gets the size of the payload once it has been decompressed
+	 *
+	 * @return the number of bytes ReadPayload will write
+	 */
+	size_t GetPayloadSize() const
+	{
+		return compression == proto::routing::PayloadUncompressed ? payloadLength : uncompressedSize;
+	}
+
+	/**
+	 * Copies the payload out of the buffer that was peeked, decompressing it if needed
+	 *
+	 * @param target where to write the payload, which must have room for GetPayloadSize() bytes
+	 * @return false if the payload could not be decompressed, or its size is out of bounds
+	 */
+	bool ReadPayload(void* target) const;
+};
+
+/**
+ * What a mailbox does with a message that arrives while its queue is full. Whatever the policy,
+ * the sender of a dropped RPC message is answered with MsgError_QueueFull so it doesn't wait forever.
+ */
+enum class MailboxOverflowPolicy
+{
+	DropOldest,         // Make room by discarding the message that has waited the longest
+	DropNewest,         // Discard the message that just arrived
+	Reject,             // Refuse the message that just arrived, and report it as a delivery failure
+};
+
+struct MailboxLimits
+{
+	size_t maxQueueSize = DEFAULT_MAILBOX_QUEUE_SIZE;      // 0 means the queue is unbounded
+	MailboxOverflowPolicy policy = MailboxOverflowPolicy::DropOldest;
+};
+
+struct MailboxStats
+{
+	uint64_t enqueued = 0;
+	uint64_t delivered = 0;
+	uint64_t dropped = 0;                                   // dropped because of the overflow policy
+	uint64_t rejected = 0;                                  // refused with MailboxOverflowPolicy::Reject
+	size_t queueDepth = 0;
+	size_t peakQueueDepth = 0;
+
+	// time between a message arriving in the mailbox and it being handed to the receive callback
+	std::chrono::microseconds lastLatency{ 0 };
+	std::chrono::microseconds maxLatency{ 0 };
+	std::chrono::microseconds totalLatency{ 0 };
+
+	std::chrono::microseconds GetAverageLatency() const
+	{
+		return delivered > 0 ? totalLatency / static_cast<int64_t>(delivered) : std::chrono::microseconds{ 0 };
+	}
+};
 
 class Mailbox
 {
 public:
-	Mailbox(std::string localAddress, ReceiveCallback&& receive)
+	Mailbox(std::string localAddress, ReceiveCallback&& receive, const MailboxLimits& limits = {})
 		: m_localAddress(localAddress)
 		, m_receive(std::move(receive))
+		, m_limits(limits)
 	{}
 
 	~Mailbox() {}
@@ -48,8 +267,9 @@ public:
 	 * Delivers a message to this mailbox to be handled by the receive callback
 	 *
 	 * @param message the message to deliver
+	 * @return false if the queue is full and the policy is to reject, in which case the message is not consumed
 	 */
-	void Deliver(PipeMessagePtr&& message) const;
+	bool Deliver(PipeMessagePtr&& message) const;
 
 	/**
 	 * Process some messages that have been delivered
@@ -58,13 +278,34 @@ public:
 	 */
 	void Process(size_t howMany) const;
 
+	/**
+	 * Sets how many messages can wait in this mailbox and what happens when it is full. Lowering
+	 * the limit doesn't drop anything that is already queued.
+	 *
+	 * @param limits the new limits
+	 */
+	void SetLimits(const MailboxLimits& limits) const { m_limits = limits; }
+	const MailboxLimits& GetLimits() const { return m_limits; }
+
+	const MailboxStats& GetStats() const { return m_stats; }
+	void ResetStats() const;
+
 private:
-	static ProtoMessagePtr Open(proto::routing::Envelope&& envelope, const PipeMessagePtr& header);
+	struct QueuedMessage
+	{
+		ProtoMessagePtr message;
+		std::chrono::steady_clock::time_point received;
+	};
+
+	// returns nullptr if the payload could not be decompressed
+	static ProtoMessagePtr Open(const EnvelopeHeader& envelope, const PipeMessagePtr& header);
 
 	const std::string m_localAddress;
 	const ReceiveCallback m_receive;
 
-	mutable std::queue<ProtoMessagePtr> m_receiveQueue;
+	mutable MailboxLimits m_limits;
+	mutable MailboxStats m_stats;
+	mutable std::deque<QueuedMessage> m_receiveQueue;
 };
 
 class Dropbox
@@ -78,7 +319,7 @@ public:
 
 	~Dropbox() {}
 
-	Dropbox(std::string localAddress, PostCallback&& post, DropboxDropper&& unregister);
+	Dropbox(std::string localAddress, PostCallback&& post, DropboxDropper&& unregister, DropboxSubscriber&& subscribe = nullptr);
 	Dropbox(const Dropbox& other);
 	Dropbox(Dropbox&& other) noexcept;
 	//Dropbox& operator=(const Dropbox& other);
@@ -96,7 +337,7 @@ public:
 	template <typename T>
 	void Post(const proto::routing::Address& address, const T& obj, const PipeMessageResponseCb& callback = nullptr)
 	{
-		if (IsValid()) m_post(Stuff(address, obj), callback);
+		if (IsValid()) m_post(address, EnvelopePayload(obj), callback);
 	}
 
 	/**
@@ -107,7 +348,7 @@ public:
 	 */
 	void Post(const proto::routing::Address& address, const PipeMessageResponseCb& callback = nullptr)
 	{
-		if (IsValid()) m_post(Stuff(address, std::string()), callback);
+		if (IsValid()) m_post(address, EnvelopePayload(std::string_view()), callback);
 	}
 
 	/**
@@ -125,8 +366,7 @@ public:
 	{
 		if (IsValid())
 		{
-			std::string data(Data(obj));
-			message->SendReply(message->GetMessageId(), &data[0], data.size(), status);
+			message->SendReply(Data(message->GetMessageId(), obj), status);
 		}
 	}
 
@@ -145,17 +385,29 @@ public:
 		{
 			if (auto sender = message->GetSender())
 			{
-				std::string data(Stuff(*sender, obj));
-				message->SendReply(MQMessageId::MSG_ROUTE, &data[0], data.size(), status);
+				message->SendReply(Stuff(*sender, obj), status);
 			}
 			else
 			{
-				std::string data(Data(obj));
-				message->SendReply(message->GetMessageId(), &data[0], data.size(), status);
+				message->SendReply(Data(message->GetMessageId(), obj), status);
 			}
 		}
 	}
 
+	/**
+	 * Subscribes the mailbox to a topic, so that it receives every message sent to the topic
+	 *
+	 * @param topic the name of the topic
+	 */
+	void Subscribe(const std::string& topic);
+
+	/**
+	 * Unsubscribes the mailbox from a topic
+	 *
+	 * @param topic the name of the topic
+	 */
+	void Unsubscribe(const std::string& topic);
+
 	/**
 	 * Checks if the dropbox has a post callback and an address
 	 *
@@ -170,39 +422,29 @@ public:
 
 private:
 	template <typename T>
-	std::string Data(const T& obj)
+	PipeMessagePtr Data(MQMessageId messageId, const T& obj)
 	{
-		return obj.SerializeAsString();
-	}
+		EnvelopePayload payload(obj);
 
-	std::string Data(const std::string& obj)
-	{
-		return obj;
+		auto message = std::make_unique<PipeMessage>(messageId, nullptr, payload.size());
+		payload.Write(message->get<uint8_t>());
+		return message;
 	}
 
 	template <typename T>
-	std::string Stuff(const proto::routing::Address& address, const T& obj)
-	{
-		return Stuff(address, obj.SerializeAsString());
-	}
-
-	std::string Stuff(const proto::routing::Address& address, const std::string& data)
+	PipeMessagePtr Stuff(const proto::routing::Address& address, const T& obj)
 	{
-		proto::routing::Envelope envelope;
-		*envelope.mutable_address() = address;
-
-		proto::routing::Address& ret = *envelope.mutable_return_address();
+		proto::routing::Address ret;
 		ret.set_pid(GetCurrentProcessId());
 		ret.set_mailbox(m_localAddress);
 
-		envelope.set_payload(data);
-
-		return envelope.SerializeAsString();
+		return StuffEnvelope(address, ret, EnvelopePayload(obj));
 	}
 
 	std::string m_localAddress;
 	PostCallback m_post;
 	DropboxDropper m_unregister;
+	DropboxSubscriber m_subscribe;
 	bool m_valid;
 };
 
@@ -251,7 +493,7 @@ public:
 	template <typename T>
 	void RouteMessage(const proto::routing::Address& address, const T& obj, const PipeMessageResponseCb& callback)
 	{
-		RouteMessage(address, obj.SerializeAsString(), callback);
+		PostEnvelope(address, nullptr, EnvelopePayload(obj), callback);
 	}
 
 	/**
@@ -263,16 +505,30 @@ public:
 	 */
 	void RouteMessage(const proto::routing::Address& address, const std::string& data, const PipeMessageResponseCb& callback)
 	{
-		proto::routing::Envelope envelope;
-		*envelope.mutable_address() = address;
-
-		proto::routing::Address& ret = *envelope.mutable_return_address();
-		ret.set_pid(GetCurrentProcessId());
+		PostEnvelope(address, nullptr, EnvelopePayload(data), callback);
+	}
 
-		envelope.set_payload(data);
+	/**
+	 * Puts a payload in an envelope and routes it
+	 *
+	 * @param address the address to send the message to
+	 * @param mailbox the local mailbox sending the message, if any
+	 * @param payload the contents of the envelope
+	 * @param callback an optional callback for RPC responses
+	 */
+	void PostEnvelope(
+		const proto::routing::Address& address,
+		const std::string* mailbox,
+		const EnvelopePayload& payload,
+		const PipeMessageResponseCb& callback);
 
-		RouteMessage(envelope, callback);
-	}
+	/**
+	 * Callback for adding information about this post office to the return address of outgoing
+	 * messages, before they are put in their envelope
+	 *
+	 * @param returnAddress the return address, which already has the pid and mailbox
+	 */
+	virtual void FillReturnAddress(proto::routing::Address& returnAddress) {}
 
 	/**
 	 * A helper interface to route a message
@@ -304,13 +560,75 @@ public:
 	Dropbox RegisterAddress(const std::string& localAddress, ReceiveCallback&& receive);
 
 	/**
-	 * Removes a mailbox from the post office
+	 * Sets the queue limits that new mailboxes are created with
+	 *
+	 * @param limits the limits for mailboxes registered after this call
+	 */
+	void SetDefaultMailboxLimits(const MailboxLimits& limits) { m_defaultLimits = limits; }
+	const MailboxLimits& GetDefaultMailboxLimits() const { return m_defaultLimits; }
+
+	/**
+	 * Changes the queue limits of a registered mailbox
+	 *
+	 * @param localAddress the mailbox to change
+	 * @param limits the new limits
+	 * @return true if the mailbox exists
+	 */
+	bool SetMailboxLimits(const std::string& localAddress, const MailboxLimits& limits);
+
+	/**
+	 * Visits every registered mailbox, for instance to report on their queues
+	 *
+	 * @param visit called with each mailbox
+	 */
+	void ForEachMailbox(const std::function<void(const Mailbox&)>& visit) const;
+
+	/**
+	 * Removes a mailbox from the post office, along with its topic subscriptions
 	 *
 	 * @param localAddress the string address that identifies the mailbox to be removed
 	 * @return true if the mailbox was removed
 	 */
 	bool RemoveMailbox(const std::string& localAddress);
 
+	/**
+	 * Subscribes a local mailbox to a topic
+	 *
+	 * @param localAddress the mailbox to subscribe
+	 * @param topic the topic to subscribe to
+	 * @return true if the mailbox wasn't already subscribed
+	 */
+	bool Subscribe(const std::string& localAddress, const std::string& topic);
+
+	/**
+	 * Unsubscribes a local mailbox from a topic
+	 *
+	 * @param localAddress the mailbox to unsubscribe
+	 * @param topic the topic to unsubscribe from
+	 * @return true if the mailbox was subscribed
+	 */
+	bool Unsubscribe(const std::string& localAddress, const std::string& topic);
+
+	/**
+	 * Callback for when the first local mailbox subscribes to a topic, or the last one unsubscribes. This
+	 * is where the post office tells the router which topics it wants.
+	 *
+	 * @param topic the topic that changed
+	 * @param subscribed true if this post office now has subscribers to the topic
+	 */
+	virtual void OnSubscriptionChanged(const std::string& topic, bool subscribed) {}
+
+	/**
+	 * Delivers a message to every local mailbox subscribed to a topic. Each mailbox gets its own header,
+	 * but the payload is shared between them rather than copied.
+	 *
+	 * @param topic the topic the message was sent to
+	 * @param message the message to deliver
+	 * @param failed a callback for failure when there is a single subscriber (since message is moved)
+	 * @return the number of mailboxes the message was delivered to
+	 */
+	size_t DeliverToTopic(const std::string& topic, PipeMessagePtr&& message, const std::function<void(int, PipeMessagePtr&&)>& failed = [](int, const auto&) {});
+
 	/**
 	 * Callback for when a message is delivered to a mailbox, called before the delivery happens
 	 *
@@ -346,6 +664,10 @@ public:
 
 protected:
 	std::unordered_map<std::string, std::unique_ptr<Mailbox>> m_mailboxes;
+	MailboxLimits m_defaultLimits;
+
+	// the local mailboxes subscribed to each topic
+	std::unordered_map<std::string, std::vector<std::string>> m_topics;
 };
 
 /**
@@ -65,6 +65,15 @@ private:
 };
 using ProtoMessagePtr = std::unique_ptr<ProtoMessage>;
 
+// Serializes a proto directly into a new message, without going through an intermediate string.
+template <typename T>
+PipeMessagePtr MakeProtoMessage(MQMessageId messageId, const T& obj)
+{
+	PipeMessagePtr message = std::make_unique<PipeMessage>(messageId, nullptr, obj.ByteSizeLong());
+	obj.SerializeWithCachedSizesToArray(message->get<uint8_t>());
+	return message;
+}
+
 class ProtoPipeServer : public NamedPipeServer
 {
 public:
@@ -73,15 +82,13 @@ public:
 	template <typename ID, typename T>
 	void SendProtoMessage(int connectionId, ID messageId, const T& obj)
 	{
-		std::string data = obj.SerializeAsString();
-		SendMessage(connectionId, static_cast<MQMessageId>(messageId), &data[0], data.size());
+		SendMessage(connectionId, MakeProtoMessage(static_cast<MQMessageId>(messageId), obj));
 	}
 
 	template <typename ID, typename T>
 	void BroadcastProtoMessage(ID messageId, const T& obj)
 	{
-		std::string data = obj.SerializeAsString();
-		BroadcastMessage(static_cast<MQMessageId>(messageId), &data[0], data.size());
+		BroadcastMessage(MakeProtoMessage(static_cast<MQMessageId>(messageId), obj));
 	}
 };
 
@@ -93,16 +100,14 @@ public:
 	template <typename ID, typename T>
 	void SendProtoMessage(ID messageId, const T& obj)
 	{
-		std::string data = obj.SerializeAsString();
-		SendMessage(static_cast<MQMessageId>(messageId), &data[0], data.size());
+		SendMessage(MakeProtoMessage(static_cast<MQMessageId>(messageId), obj));
 	}
 
 	template <typename ID, typename T>
 	void SendProtoMessageWithResponse(ID messageId, const T& obj,
 		const PipeMessageResponseCb& response)
 	{
-		std::string data = obj.SerializeAsString();
-		SendMessageWithResponse(static_cast<MQMessageId>(messageId), &data[0], data.size(), response);
+		SendMessageWithResponse(MakeProtoMessage(static_cast<MQMessageId>(messageId), obj), response);
 	}
 };
 
@@ -0,0 +1,237 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// Tests and an ingest benchmark for the queue that MQ2ChatWnd holds pending chat in
+// (plugins/chatwnd/ChatRingBuffer.h). The tests check wrapping, dropping the oldest lines when
+// full, bulk pops and the dropped count. The benchmark ingests chat into the ring and into the
+// list the window used before.
+// Only depends on fmt, so this also builds elsewhere, for example:
+//
+//   g++ -std=c++17 -O2 -I../.. App.cpp -lfmt -o ChatRingBufferTests
+//
+// Run with --help for the benchmark options.
+
+#include "plugins/chatwnd/ChatRingBuffer.h"
+#include "tests/TestHarness.h"
+
+#include <fmt/format.h>
+
+#include <list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace mq::test;
+
+static int s_lines = 1000000;
+static int s_capacity = 700;
+static int s_drain = 16;
+
+template <typename T>
+static std::vector<T> Contents(const ChatRingBuffer<T>& buffer)
+{
+	std::vector<T> items;
+	for (size_t i = 0; i < buffer.size(); ++i)
+		items.push_back(buffer[i]);
+	return items;
+}
+
+//============================================================================
+
+TEST_CASE(TestWrap)
+{
+	ChatRingBuffer<int> buffer(4);
+	CHECK(buffer.empty());
+	CHECK(buffer.capacity() == 4);
+
+	buffer.push_back(1);
+	buffer.push_back(2);
+	buffer.push_back(3);
+	buffer.pop_front(2);
+
+	// these wrap around the end of the storage
+	CHECK(!buffer.push_back(4));
+	CHECK(!buffer.push_back(5));
+	CHECK(!buffer.push_back(6));
+
+	CHECK(buffer.full());
+	CHECK((Contents(buffer) == std::vector<int>{ 3, 4, 5, 6 }));
+	CHECK(buffer.front() == 3);
+	CHECK(buffer.back() == 6);
+	CHECK(buffer.dropped() == 0);
+
+	buffer[1] = 40;
+	CHECK(buffer[1] == 40);
+
+	// A zero capacity still holds one line
+	ChatRingBuffer<int> tiny(0);
+	CHECK(tiny.capacity() == 1);
+	CHECK(!tiny.push_back(1));
+	CHECK(tiny.push_back(2));
+	CHECK((Contents(tiny) == std::vector<int>{ 2 }));
+}
+
+TEST_CASE(TestOverwrite)
+{
+	ChatRingBuffer<std::string> buffer(3);
+
+	for (int i = 0; i < 3; ++i)
+		CHECK(!buffer.push_back(std::to_string(i)));
+
+	// the oldest lines make room for the new ones
+	CHECK(buffer.push_back("3"));
+	CHECK(buffer.push_back("4"));
+
+	CHECK(buffer.size() == 3);
+	CHECK((Contents(buffer) == std::vector<std::string>{ "2", "3", "4" }));
+	CHECK(buffer.dropped() == 2);
+
+	// wrap all the way around more than once
+	for (int i = 5; i < 12; ++i)
+		CHECK(buffer.push_back(std::to_string(i)));
+
+	CHECK((Contents(buffer) == std::vector<std::string>{ "9", "10", "11" }));
+	CHECK(buffer.dropped() == 9);
+}
+
+TEST_CASE(TestBulkPop)
+{
+	ChatRingBuffer<std::shared_ptr<int>> buffer(8);
+	auto line = std::make_shared<int>(0);
+
+	for (int i = 0; i < 6; ++i)
+		buffer.push_back(line);
+	CHECK(line.use_count() == 7);
+
+	// popped lines are released right away, not when their slot is reused
+	buffer.pop_front(4);
+	CHECK(buffer.size() == 2);
+	CHECK(line.use_count() == 3);
+
+	// popping more than there is empties the buffer
+	buffer.pop_front(100);
+	CHECK(buffer.empty());
+	CHECK(line.use_count() == 1);
+
+	ChatRingBuffer<int> numbers(5);
+	for (int i = 0; i < 8; ++i)
+		numbers.push_back(i);
+
+	numbers.pop_front(3);
+	CHECK((Contents(numbers) == std::vector<int>{ 6, 7 }));
+
+	numbers.pop_front(0);
+	CHECK(numbers.size() == 2);
+
+	numbers.pop_front();
+	CHECK((Contents(numbers) == std::vector<int>{ 7 }));
+}
+
+TEST_CASE(TestDropped)
+{
+	ChatRingBuffer<int> buffer(2);
+	for (int i = 0; i < 5; ++i)
+		buffer.push_back(i);
+	CHECK(buffer.dropped() == 3);
+
+	// popping and clearing aren't drops
+	buffer.pop_front();
+	buffer.clear();
+	CHECK(buffer.empty());
+	CHECK(buffer.dropped() == 3);
+
+	buffer.reset_dropped();
+	CHECK(buffer.dropped() == 0);
+
+	buffer.push_back(10);
+	buffer.push_back(11);
+	CHECK(buffer.dropped() == 0);
+	CHECK(buffer.push_back(12));
+	CHECK(buffer.dropped() == 1);
+	CHECK((Contents(buffer) == std::vector<int>{ 11, 12 }));
+}
+
+//============================================================================
+
+// Ingests every line, taking drain lines off the front after each batch, the way the window takes
+// a few lines at a time each frame. Returns the time in milliseconds.
+template <typename Push, typename Drain>
+static double TimeIngest(const std::vector<std::string>& lines, int drain, Push&& push, Drain&& drainLines)
+{
+	constexpr size_t linesPerFrame = 64;
+
+	const auto start = bench_clock::now();
+	for (size_t i = 0; i < lines.size(); ++i)
+	{
+		push(std::string(lines[i]));
+
+		if (drain > 0 && (i + 1) % linesPerFrame == 0)
+			drainLines(drain);
+	}
+
+	return ElapsedMs(start);
+}
+
+static void RunBenchmark()
+{
+	std::vector<std::string> lines;
+	lines.reserve(s_lines);
+	for (int i = 0; i < s_lines; ++i)
+		lines.push_back(fmt::format("\\ayA goblin\\ax hits YOU for \\ar{}\\ax points of damage. (line {})", i % 500, i));
+
+	fmt::print("{} lines, capacity {}, draining {} lines every 64\n\n", s_lines, s_capacity, s_drain);
+
+	// What MQ2ChatWnd used before: a list that grows without limit
+	std::list<std::string> list;
+	const double listMs = TimeIngest(lines, s_drain,
+		[&](std::string&& line) { list.push_back(std::move(line)); },
+		[&](int count) { for (int i = 0; i < count && !list.empty(); ++i) list.pop_front(); });
+
+	// The same list, trimmed to the capacity as it goes
+	std::list<std::string> trimmed;
+	const double trimmedMs = TimeIngest(lines, s_drain,
+		[&](std::string&& line)
+		{
+			trimmed.push_back(std::move(line));
+			if (trimmed.size() > static_cast<size_t>(s_capacity))
+				trimmed.pop_front();
+		},
+		[&](int count) { for (int i = 0; i < count && !trimmed.empty(); ++i) trimmed.pop_front(); });
+
+	ChatRingBuffer<std::string> ring(s_capacity);
+	const double ringMs = TimeIngest(lines, s_drain,
+		[&](std::string&& line) { ring.push_back(std::move(line)); },
+		[&](int count) { ring.pop_front(count); });
+
+	auto report = [&](std::string_view name, double ms, size_t kept)
+	{
+		fmt::print("{:<14} {:>10.2f} ms {:>12.0f} lines/s {:>10} kept\n", name, ms, s_lines / (ms / 1000.0), kept);
+	};
+
+	report("list", listMs, list.size());
+	report("trimmed list", trimmedMs, trimmed.size());
+	report("ring", ringMs, ring.size());
+	fmt::print("\nring dropped {} lines\n", ring.dropped());
+}
+
+int main(int argc, char* argv[])
+{
+	CommandLine commandLine("ChatRingBufferTests");
+	commandLine.Add("--lines", s_lines, 1, "chat lines to ingest");
+	commandLine.Add("--capacity", s_capacity, 1, "lines the queue holds, like MAX_LINES_OUTBOX");
+	commandLine.Add("--drain", s_drain, 0, "lines taken off after each frame's worth of chat, 0 never drains");
+
+	return Main(commandLine, argc, argv, RunBenchmark);
+}
@@ -0,0 +1,308 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// Tests and a benchmark for the console's persistent command history writer
+// (main/ConsoleHistoryWriter.h). The tests use an in memory database, the benchmark a file in the
+// temp directory. Neither depends on Windows, so this also builds elsewhere, for example:
+//
+//   g++ -std=c++17 -O2 -I../.. App.cpp ../../main/ConsoleHistoryWriter.cpp -lsqlite3 -lfmt -pthread -o ConsoleHistoryWriterTests
+//
+// Run with --help for the benchmark options.
+
+#include "main/ConsoleHistoryWriter.h"
+#include "tests/TestHarness.h"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "sqlite3.h"
+
+using namespace mq;
+using namespace mq::test;
+
+static int s_entries = 20000;
+
+static const char* s_schema = "CREATE TABLE entries (entry_timestamp TEXT, pid INTEGER, command TEXT);";
+
+static sqlite3* OpenDatabase(const std::string& path, const char* schema)
+{
+	sqlite3* db = nullptr;
+	sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr);
+	if (schema != nullptr)
+		sqlite3_exec(db, schema, nullptr, nullptr, nullptr);
+	return db;
+}
+
+static void InsertRows(sqlite3* db, int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		const std::string query = fmt::format("INSERT INTO entries VALUES ('old', 1, 'old{}');", i);
+		sqlite3_exec(db, query.c_str(), nullptr, nullptr, nullptr);
+	}
+}
+
+struct Row
+{
+	std::string timestamp;
+	int pid;
+	std::string command;
+};
+
+static std::vector<Row> ReadRows(sqlite3* db)
+{
+	std::vector<Row> rows;
+
+	sqlite3_stmt* stmt = nullptr;
+	sqlite3_prepare_v2(db, "SELECT entry_timestamp, pid, command FROM entries ORDER BY rowid", -1, &stmt, nullptr);
+	while (sqlite3_step(stmt) == SQLITE_ROW)
+	{
+		rows.push_back({
+			reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)),
+			sqlite3_column_int(stmt, 1),
+			reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2))
+		});
+	}
+	sqlite3_finalize(stmt);
+
+	return rows;
+}
+
+// A timestamp source that counts the entries it has stamped, and an error sink that keeps what it
+// was told. Errors are reported from the writer thread, so only look at them after the writer is gone.
+struct TestWriter
+{
+	int stamped = 0;
+	std::vector<std::string> errors;
+	std::unique_ptr<ConsoleHistoryWriter> writer;
+
+	TestWriter(sqlite3* db, int process_id, int max_entries)
+	{
+		writer = std::make_unique<ConsoleHistoryWriter>(db, process_id, max_entries,
+			[this] { return fmt::format("t{}", ++stamped); },
+			[this](std::string_view message) { errors.emplace_back(message); });
+	}
+
+	// Writes everything still queued and stops the writer thread.
+	void Finish() { writer.reset(); }
+};
+
+//============================================================================
+
+TEST_CASE(TestWritesEntries)
+{
+	sqlite3* db = OpenDatabase(":memory:", s_schema);
+
+	TestWriter test(db, 42, 100);
+	test.writer->AddEntry("/echo one");
+	test.writer->AddEntry("/echo two");
+	test.writer->AddEntry("/echo three");
+	test.Finish();
+
+	// entries keep the timestamp they were given when they were added, in order
+	const std::vector<Row> rows = ReadRows(db);
+	CHECK(rows.size() == 3);
+	if (rows.size() == 3)
+	{
+		CHECK(rows[0].timestamp == "t1" && rows[0].command == "/echo one");
+		CHECK(rows[1].timestamp == "t2" && rows[1].command == "/echo two");
+		CHECK(rows[2].timestamp == "t3" && rows[2].command == "/echo three");
+		CHECK(rows[0].pid == 42 && rows[2].pid == 42);
+	}
+
+	CHECK(test.stamped == 3);
+	CHECK(test.errors.empty());
+
+	sqlite3_close(db);
+}
+
+TEST_CASE(TestWritesFullBatches)
+{
+	sqlite3* db = OpenDatabase(":memory:", s_schema);
+
+	const int count = static_cast<int>(ConsoleHistoryWriter::BatchSize) * 3 + 1;
+
+	TestWriter test(db, 1, 0);
+	for (int i = 0; i < count; ++i)
+		test.writer->AddEntry(fmt::format("/echo {}", i));
+
+	const ConsoleHistoryWriter* writer = test.writer.get();
+	CHECK(writer->GetDroppedCount() == 0);
+	test.Finish();
+
+	const std::vector<Row> rows = ReadRows(db);
+	CHECK(rows.size() == static_cast<size_t>(count));
+	CHECK(!rows.empty() && rows.back().command == fmt::format("/echo {}", count - 1));
+
+	sqlite3_close(db);
+}
+
+TEST_CASE(TestTrimsOnStart)
+{
+	sqlite3* db = OpenDatabase(":memory:", s_schema);
+	InsertRows(db, 10);
+
+	TestWriter test(db, 1, 4);
+	test.Finish();
+
+	// the newest rows from the previous session are kept
+	const std::vector<Row> rows = ReadRows(db);
+	CHECK(rows.size() == 4);
+	CHECK(!rows.empty() && rows.front().command == "old6" && rows.back().command == "old9");
+
+	sqlite3_close(db);
+}
+
+TEST_CASE(TestZeroKeepsEverything)
+{
+	sqlite3* db = OpenDatabase(":memory:", s_schema);
+	InsertRows(db, 10);
+
+	TestWriter test(db, 1, 0);
+	test.writer->AddEntry("/echo new");
+	test.Finish();
+
+	CHECK(ReadRows(db).size() == 11);
+
+	sqlite3_close(db);
+}
+
+TEST_CASE(TestTrimsWhileWriting)
+{
+	sqlite3* db = OpenDatabase(":memory:", s_schema);
+
+	// how the entries are batched depends on the writer thread, but after TrimInterval of them the
+	// table is trimmed back down, so never holds all of them
+	const int count = ConsoleHistoryWriter::TrimInterval + 5;
+
+	TestWriter test(db, 1, 10);
+	for (int i = 0; i < count; ++i)
+		test.writer->AddEntry(fmt::format("/echo {}", i));
+	test.Finish();
+
+	const std::vector<Row> rows = ReadRows(db);
+	CHECK(rows.size() >= 10);
+	CHECK(rows.size() < static_cast<size_t>(count));
+	CHECK(!rows.empty() && rows.back().command == fmt::format("/echo {}", count - 1));
+
+	sqlite3_close(db);
+}
+
+TEST_CASE(TestDropsWhenFull)
+{
+	// without the table, the insert can't be prepared: that is reported and nothing is written,
+	// so the queue fills up and further entries are dropped
+	sqlite3* db = OpenDatabase(":memory:", nullptr);
+
+	TestWriter test(db, 1, 0);
+	CHECK(test.errors.size() == 1);
+	CHECK(!test.errors.empty() && test.errors[0].find("preparing query for console buffer insertion") != std::string::npos);
+
+	const int extra = 10;
+	for (size_t i = 0; i < ConsoleHistoryWriter::MaxQueueSize + extra; ++i)
+		test.writer->AddEntry("/echo");
+
+	CHECK(test.writer->GetDroppedCount() == extra);
+	CHECK(test.writer->GetWrittenCount() == 0);
+	test.Finish();
+
+	sqlite3_close(db);
+}
+
+TEST_CASE(TestReportsInsertErrors)
+{
+	sqlite3* db = OpenDatabase(":memory:", s_schema);
+	sqlite3_exec(db, R"(
+		CREATE TRIGGER reject BEFORE INSERT ON entries WHEN NEW.command = 'bad'
+		BEGIN SELECT RAISE(ABORT, 'rejected'); END;
+		)", nullptr, nullptr, nullptr);
+
+	TestWriter test(db, 1, 0);
+	test.writer->AddEntry("good");
+	test.writer->AddEntry("bad");
+	test.writer->AddEntry("also good");
+	test.Finish();
+
+	// the failed insert is reported and doesn't take the rest of the batch with it
+	CHECK(test.errors.size() == 1);
+	CHECK(!test.errors.empty() && test.errors[0].find("inserting into console buffer: rejected") != std::string::npos);
+
+	const std::vector<Row> rows = ReadRows(db);
+	CHECK(rows.size() == 2);
+	CHECK(rows.size() == 2 && rows[1].command == "also good");
+
+	sqlite3_close(db);
+}
+
+//============================================================================
+
+static void RunBenchmark()
+{
+	const std::filesystem::path path = std::filesystem::temp_directory_path() / "ConsoleHistoryWriterTests.db";
+	auto removeDatabase = [&path]
+	{
+		std::error_code ec;
+		for (const char* suffix : { "", "-wal", "-shm" })
+			std::filesystem::remove(path.string() + suffix, ec);
+	};
+
+	removeDatabase();
+
+	sqlite3* db = OpenDatabase(path.string(), s_schema);
+	sqlite3_exec(db, "PRAGMA journal_mode=WAL;", nullptr, nullptr, nullptr);
+
+	fmt::print("Command history: {} entries added as fast as possible\n\n", s_entries);
+
+	uint64_t written = 0;
+	uint64_t dropped = 0;
+	double addNs = 0;
+
+	auto start = bench_clock::now();
+	{
+		TestWriter test(db, 1, 10000);
+		addNs = TimePerCallNs(s_entries, [&](int i) { test.writer->AddEntry(fmt::format("/echo command {}", i)); });
+
+		const ConsoleHistoryWriter* writer = test.writer.get();
+		dropped = writer->GetDroppedCount();
+		test.Finish();
+
+		CHECK(test.errors.empty());
+	}
+	const double totalMs = ElapsedMs(start);
+
+	written = ReadRows(db).size();
+	sqlite3_close(db);
+	removeDatabase();
+
+	CHECK(written + dropped >= static_cast<uint64_t>(std::min(s_entries, 10000)));
+
+	fmt::print("  {:<28} {:>10.1f} ns per entry\n", "AddEntry on the caller", addNs);
+	fmt::print("  {:<28} {:>10.1f} ms\n", "until written and stopped", totalMs);
+	fmt::print("  {:<28} {:>10}\n", "rows kept", written);
+	fmt::print("  {:<28} {:>10}\n", "dropped (queue full)", dropped);
+}
+
+int main(int argc, char* argv[])
+{
+	CommandLine commandLine("ConsoleHistoryWriterTests");
+	commandLine.Add("--entries", s_entries, 1, "entries added by the benchmark");
+
+	return Main(commandLine, argc, argv, RunBenchmark);
+}
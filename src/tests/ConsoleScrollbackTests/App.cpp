@@ -0,0 +1,221 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// Tests and a benchmark for the console's scrollback (main/ConsoleScrollback.h), without the
+// game or the editor. This is the headless version of /mqconsole benchmark. The tests check
+// appending, trimming a segment at a time, and searching in the background while lines are
+// added. The benchmark appends past the limit, reads windows of lines and runs a search.
+// Only depends on fmt, so this also builds elsewhere, for example:
+//
+//   g++ -std=c++17 -O2 -I../.. App.cpp ../../main/ConsoleScrollback.cpp -lfmt -pthread -o ConsoleScrollbackTests
+//
+// Run with --help for the benchmark options.
+
+#include "main/ConsoleScrollback.h"
+#include "tests/TestHarness.h"
+
+#include <fmt/format.h>
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+
+using namespace mq;
+using namespace mq::test;
+
+static int s_lines = 100000;
+static int s_windows = 1000;
+
+// Stands in for the console's color parsing: the whole line in a single color.
+static ConsoleLine MakeLine(std::string text)
+{
+	ConsoleLine line;
+	line.spans.push_back({ 0, static_cast<uint32_t>(text.length()), 0xFFFFFFFF });
+	line.text = std::move(text);
+	line.newline = true;
+	return line;
+}
+
+static ConsoleSearchResults WaitForSearch(ConsoleScrollback& scrollback)
+{
+	std::optional<ConsoleSearchResults> results;
+	while (!(results = scrollback.TakeSearchResults()))
+		std::this_thread::yield();
+
+	return std::move(*results);
+}
+
+//============================================================================
+
+TEST_CASE(TestAppend)
+{
+	ConsoleScrollback scrollback(10);
+	CHECK(scrollback.GetLineCount() == 0);
+	CHECK(scrollback.GetFirstLineNumber() == 0);
+
+	for (int i = 0; i < 5; ++i)
+		scrollback.Append(MakeLine(fmt::format("line {}", i)));
+
+	CHECK(scrollback.GetLineCount() == 5);
+	CHECK(scrollback.GetLine(0).text == "line 0");
+	CHECK(scrollback.GetLine(4).text == "line 4");
+	CHECK(scrollback.GetLine(4).spans.size() == 1);
+
+	scrollback.Clear();
+	CHECK(scrollback.GetLineCount() == 0);
+
+	// line numbers keep counting across a clear
+	CHECK(scrollback.GetFirstLineNumber() == 5);
+
+	// zero lines still keeps one
+	ConsoleScrollback tiny(0);
+	CHECK(tiny.GetMaxLines() == 1);
+}
+
+TEST_CASE(TestTrim)
+{
+	constexpr size_t segment = ConsoleScrollback::SegmentSize;
+
+	ConsoleScrollback scrollback(segment + 10);
+
+	// Lines are only trimmed a whole segment at a time, once what is left is still enough
+	for (size_t i = 0; i < segment * 2; ++i)
+		scrollback.Append(MakeLine(std::to_string(i)));
+	CHECK(scrollback.GetLineCount() == segment * 2);
+	CHECK(scrollback.GetFirstLineNumber() == 0);
+
+	for (size_t i = segment * 2; i < segment * 2 + 11; ++i)
+		scrollback.Append(MakeLine(std::to_string(i)));
+
+	CHECK(scrollback.GetLineCount() == segment + 11);
+	CHECK(scrollback.GetFirstLineNumber() == segment);
+	CHECK(scrollback.GetLine(0).text == std::to_string(segment));
+	CHECK(scrollback.GetLine(scrollback.GetLineCount() - 1).text == std::to_string(segment * 2 + 10));
+
+	// never keeps fewer than the maximum
+	CHECK(scrollback.GetLineCount() >= scrollback.GetMaxLines());
+
+	// lowering the maximum trims right away
+	scrollback.SetMaxLines(5);
+	CHECK(scrollback.GetLineCount() == 11);
+	CHECK(scrollback.GetFirstLineNumber() == segment * 2);
+	CHECK(scrollback.GetLine(0).text == std::to_string(segment * 2));
+}
+
+TEST_CASE(TestSearch)
+{
+	constexpr size_t segment = ConsoleScrollback::SegmentSize;
+
+	ConsoleScrollback scrollback(segment * 4);
+	for (size_t i = 0; i < segment * 3 + 100; ++i)
+		scrollback.Append(MakeLine(fmt::format("{} {}", i % 100 == 0 ? "Needle" : "hay", i)));
+
+	scrollback.StartSearch("NEEDLE", 5);
+
+	// lines appended while the search runs aren't part of it, even in the segment it copied
+	for (int i = 0; i < 50; ++i)
+		scrollback.Append(MakeLine("needle added later"));
+
+	ConsoleSearchResults results = WaitForSearch(scrollback);
+	CHECK(results.needle == "NEEDLE");
+	CHECK(results.linesSearched == segment * 3 + 100);
+	CHECK(results.totalMatches == (segment * 3 + 100 + 99) / 100);
+
+	// only the newest matches are kept, oldest first
+	CHECK(results.matches.size() == 5);
+	CHECK(results.matches.back().lineNumber == (segment * 3 + 99) / 100 * 100);
+	CHECK(results.matches.back().text == fmt::format("Needle {}", results.matches.back().lineNumber));
+	CHECK(results.matches.front().lineNumber == results.matches.back().lineNumber - 400);
+
+	// results are only handed out once
+	CHECK(!scrollback.TakeSearchResults());
+
+	// a new search replaces the one that is running
+	scrollback.StartSearch("hay", 1);
+	scrollback.StartSearch("added later", 100);
+	results = WaitForSearch(scrollback);
+	CHECK(results.needle == "added later");
+	CHECK(results.totalMatches == 50);
+
+	// Line numbers stay the same after trimming
+	ConsoleScrollback trimmed(segment);
+	for (size_t i = 0; i < segment * 3; ++i)
+		trimmed.Append(MakeLine(i == segment * 2 + 7 ? "marker" : "filler"));
+
+	trimmed.StartSearch("marker", 10);
+	results = WaitForSearch(trimmed);
+	CHECK(results.totalMatches == 1);
+	CHECK(results.totalMatches == 1 && results.matches[0].lineNumber == segment * 2 + 7);
+	CHECK(results.totalMatches == 1
+		&& trimmed.GetLine(static_cast<size_t>(results.matches[0].lineNumber - trimmed.GetFirstLineNumber())).text == "marker");
+}
+
+TEST_CASE(TestSearchWhileDestroyed)
+{
+	// A running search is abandoned, and waited for, when the scrollback goes away
+	auto scrollback = std::make_unique<ConsoleScrollback>(100000);
+	for (int i = 0; i < 100000; ++i)
+		scrollback->Append(MakeLine("some text that won't match"));
+
+	scrollback->StartSearch("nothing", 10);
+	scrollback.reset();
+}
+
+//============================================================================
+
+static void RunBenchmark()
+{
+	ConsoleScrollback scrollback(s_lines);
+
+	// Half again as many lines as are kept, so that the last third of them are trimming.
+	const int appendCount = s_lines + s_lines / 2;
+
+	auto start = bench_clock::now();
+	for (int i = 0; i < appendCount; ++i)
+		scrollback.Append(MakeLine(fmt::format("A goblin hits YOU for {} points of damage. ({})", i % 500, i)));
+	const double appendMs = ElapsedMs(start);
+
+	// A window's worth of lines from all over the scrollback
+	constexpr size_t visibleLines = 60;
+	const size_t lineCount = scrollback.GetLineCount();
+	const size_t firstLines = lineCount - std::min(visibleLines, lineCount) + 1;
+	size_t visibleBytes = 0;
+
+	start = bench_clock::now();
+	for (int window = 0; window < s_windows; ++window)
+	{
+		size_t first = (static_cast<size_t>(window) * 7919) % firstLines;
+		for (size_t index = first; index < first + visibleLines && index < lineCount; ++index)
+			visibleBytes += scrollback.GetLine(index).text.length();
+	}
+	const double visibleMs = ElapsedMs(start);
+
+	scrollback.StartSearch("points of damage. (7", 100);
+	ConsoleSearchResults results = WaitForSearch(scrollback);
+
+	fmt::print("{} lines kept, {} appended\n\n", s_lines, appendCount);
+	fmt::print("{:<10} {:>10.2f} ms {:>10.3f} us/line\n", "append", appendMs, appendMs * 1000.0 / appendCount);
+	fmt::print("{:<10} {:>10.3f} ms {:>10} windows ({} bytes)\n", "windows", visibleMs, s_windows, visibleBytes);
+	fmt::print("{:<10} {:>10.2f} ms {:>10} lines ({} matches)\n", "search", results.elapsedMs, results.linesSearched, results.totalMatches);
+}
+
+int main(int argc, char* argv[])
+{
+	CommandLine commandLine("ConsoleScrollbackTests");
+	commandLine.Add("--lines", s_lines, 100, "lines kept in the scrollback, half again as many are appended");
+	commandLine.Add("--windows", s_windows, 1, "window's worth of lines to read from all over the scrollback");
+
+	return Main(commandLine, argc, argv, RunBenchmark);
+}
@@ -0,0 +1,272 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// Tests and a benchmark for compressed envelope payloads (routing/PostOffice.h): the round trip
+// through StuffEnvelope and EnvelopeHeader, the bounds on the uncompressed size, and rewriting
+// messages for peers that can't decompress. Only depends on the routing library, protobuf and
+// lz4, so this also builds elsewhere, for example:
+//
+//   protoc --cpp_out=../../routing -I../../routing ../../routing/Routing.proto
+//   g++ -std=c++17 -O2 -I../.. -I../../routing App.cpp ../../routing/PostOffice.cpp ../../routing/NamedPipes.cpp
+//       ../../routing/PipeTransport.cpp ../../routing/Routing.pb.cc -lprotobuf -llz4 -lspdlog -lfmt -pthread
+//       -o EnvelopeCompressionTests
+//
+// Run with --help for the benchmark options.
+
+#include "routing/PostOffice.h"
+#include "routing/Routing.h"
+#include "tests/TestHarness.h"
+
+#include <fmt/format.h>
+
+#include <cstring>
+#include <random>
+#include <string>
+
+using namespace mq;
+using namespace mq::postoffice;
+using namespace mq::test;
+
+static int s_size = 64 * 1024;
+static int s_iterations = 2000;
+
+static std::string MakeTextPayload(size_t size)
+{
+	std::string payload;
+	payload.reserve(size);
+
+	for (int i = 0; payload.size() < size; ++i)
+		payload += fmt::format("[{}] You say, 'Hail, a guard of the town'\n", i % 100);
+
+	payload.resize(size);
+	return payload;
+}
+
+static std::string MakeRandomPayload(size_t size)
+{
+	std::mt19937 random(1234);
+	std::string payload(size, '\0');
+	for (char& c : payload)
+		c = static_cast<char>(random());
+
+	return payload;
+}
+
+static proto::routing::Address MakeAddress(uint32_t pid, const char* mailbox)
+{
+	proto::routing::Address address;
+	address.set_pid(pid);
+	address.set_mailbox(mailbox);
+	return address;
+}
+
+static PipeMessagePtr Stuff(const std::string& payload, bool allowCompression = true)
+{
+	return StuffEnvelope(MakeAddress(1, "to"), MakeAddress(2, "from"), EnvelopePayload(payload), allowCompression);
+}
+
+// Reads the payload back out of a routed message the way a mailbox does
+static bool ReadBack(const PipeMessagePtr& message, std::string& payload)
+{
+	EnvelopeHeader envelope;
+	if (!envelope.Peek(message))
+		return false;
+
+	payload.assign(envelope.GetPayloadSize(), '\0');
+	return envelope.ReadPayload(payload.data());
+}
+
+// A serialized envelope that claims a compressed payload of the given sizes
+static std::string MakeCompressedEnvelope(size_t compressedSize, uint32_t uncompressedSize)
+{
+	proto::routing::Envelope envelope;
+	*envelope.mutable_address() = MakeAddress(1, "to");
+	envelope.set_compression(proto::routing::PayloadLZ4);
+	envelope.set_uncompressed_size(uncompressedSize);
+	envelope.set_payload(std::string(compressedSize, 'x'));
+
+	return envelope.SerializeAsString();
+}
+
+//============================================================================
+
+TEST_CASE(TestRoundTrip)
+{
+	const std::string payload = MakeTextPayload(64 * 1024);
+	PipeMessagePtr message = Stuff(payload);
+
+	EnvelopeHeader envelope;
+	CHECK(envelope.Peek(message));
+	CHECK(envelope.compression == proto::routing::PayloadLZ4);
+	CHECK(envelope.uncompressedSize == payload.size());
+	CHECK(envelope.payloadLength < payload.size());
+	CHECK(envelope.GetPayloadSize() == payload.size());
+	CHECK(envelope.address.mailbox() == "to" && envelope.returnAddress.mailbox() == "from");
+
+	std::string read;
+	CHECK(ReadBack(message, read));
+	CHECK(read == payload);
+}
+
+TEST_CASE(TestSmallPayloadsAreNotCompressed)
+{
+	const std::string payload = MakeTextPayload(ENVELOPE_COMPRESSION_THRESHOLD - 1);
+	PipeMessagePtr message = Stuff(payload);
+
+	EnvelopeHeader envelope;
+	CHECK(envelope.Peek(message));
+	CHECK(envelope.compression == proto::routing::PayloadUncompressed);
+	CHECK(envelope.GetPayload() == payload);
+}
+
+TEST_CASE(TestIncompressiblePayloadsAreNotCompressed)
+{
+	const std::string payload = MakeRandomPayload(64 * 1024);
+	PipeMessagePtr message = Stuff(payload);
+
+	EnvelopeHeader envelope;
+	CHECK(envelope.Peek(message));
+	CHECK(envelope.compression == proto::routing::PayloadUncompressed);
+	CHECK(envelope.GetPayload() == payload);
+}
+
+TEST_CASE(TestCompressionCanBeTurnedOff)
+{
+	const std::string payload = MakeTextPayload(64 * 1024);
+	PipeMessagePtr message = Stuff(payload, false);
+
+	EnvelopeHeader envelope;
+	CHECK(envelope.Peek(message));
+	CHECK(envelope.compression == proto::routing::PayloadUncompressed);
+	CHECK(envelope.GetPayload() == payload);
+}
+
+TEST_CASE(TestRejectsOversizedPayloads)
+{
+	// even with enough compressed bytes to make the ratio plausible, nothing over the cap is accepted
+	const std::string data = MakeCompressedEnvelope(ENVELOPE_MAX_UNCOMPRESSED_SIZE / 200, ENVELOPE_MAX_UNCOMPRESSED_SIZE + 1);
+
+	EnvelopeHeader envelope;
+	CHECK(!envelope.Peek(data.data(), data.size()));
+	CHECK(!envelope.hasPayload);
+	CHECK(envelope.payload == nullptr);
+	CHECK(envelope.GetPayloadSize() == 0);
+
+	// and if the fields are set by hand, ReadPayload still refuses
+	envelope.payload = reinterpret_cast<const uint8_t*>(data.data());
+	envelope.payloadLength = 16;
+	envelope.compression = proto::routing::PayloadLZ4;
+	envelope.uncompressedSize = ENVELOPE_MAX_UNCOMPRESSED_SIZE + 1;
+
+	char target[16];
+	CHECK(!envelope.ReadPayload(target));
+}
+
+TEST_CASE(TestRejectsImpossibleRatios)
+{
+	// LZ4 can't expand 10 bytes into a megabyte
+	const std::string data = MakeCompressedEnvelope(10, 1024 * 1024);
+
+	EnvelopeHeader envelope;
+	CHECK(!envelope.Peek(data.data(), data.size()));
+	CHECK(envelope.GetPayloadSize() == 0);
+
+	// right at the bound is allowed through to the decompressor, which then finds it isn't LZ4
+	const std::string atBound = MakeCompressedEnvelope(9, 10 * 255);
+	CHECK(envelope.Peek(atBound.data(), atBound.size()));
+	CHECK(envelope.GetPayloadSize() == 10 * 255);
+
+	std::string target(envelope.GetPayloadSize(), '\0');
+	CHECK(!envelope.ReadPayload(target.data()));
+}
+
+TEST_CASE(TestDecompressEnvelope)
+{
+	const std::string payload = MakeTextPayload(64 * 1024);
+	PipeMessagePtr message = Stuff(payload);
+	message->SetSequenceId(77);
+
+	PipeMessagePtr decompressed = DecompressEnvelope(std::move(message));
+	CHECK(decompressed != nullptr);
+	if (decompressed == nullptr)
+		return;
+
+	// the header is kept, only the envelope is rewritten
+	CHECK(decompressed->GetMessageId() == MQMessageId::MSG_ROUTE);
+	CHECK(decompressed->GetSequenceId() == 77);
+
+	EnvelopeHeader envelope;
+	CHECK(envelope.Peek(decompressed));
+	CHECK(envelope.compression == proto::routing::PayloadUncompressed);
+	CHECK(envelope.address.pid() == 1 && envelope.address.mailbox() == "to");
+	CHECK(envelope.returnAddress.pid() == 2 && envelope.returnAddress.mailbox() == "from");
+	CHECK(envelope.GetPayload() == payload);
+}
+
+TEST_CASE(TestDecompressEnvelopeKeepsUncompressedMessages)
+{
+	const std::string payload = MakeTextPayload(100);
+	PipeMessagePtr message = Stuff(payload);
+	const PipeMessage* original = message.get();
+
+	PipeMessagePtr result = DecompressEnvelope(std::move(message));
+	CHECK(result.get() == original);
+}
+
+TEST_CASE(TestDecompressEnvelopeRejectsCorruptPayloads)
+{
+	const std::string data = MakeCompressedEnvelope(100, 1000);
+	PipeMessagePtr message = std::make_unique<PipeMessage>(MQMessageId::MSG_ROUTE, data.data(), data.size());
+
+	CHECK(DecompressEnvelope(std::move(message)) == nullptr);
+}
+
+//============================================================================
+
+static void RunBenchmark()
+{
+	const std::string payload = MakeTextPayload(s_size);
+	std::string read;
+
+	fmt::print("Envelope payloads: {} bytes of text, {} iterations\n\n", s_size, s_iterations);
+
+	const double plainNs = TimePerCallNs(s_iterations, [&](int) { Stuff(payload, false); });
+	const double compressNs = TimePerCallNs(s_iterations, [&](int) { Stuff(payload); });
+
+	PipeMessagePtr plain = Stuff(payload, false);
+	PipeMessagePtr compressed = Stuff(payload);
+
+	const double readPlainNs = TimePerCallNs(s_iterations, [&](int) { ReadBack(plain, read); });
+	const double readCompressedNs = TimePerCallNs(s_iterations, [&](int) { ReadBack(compressed, read); });
+	CHECK(read == payload);
+
+	const double rewriteNs = TimePerCallNs(s_iterations, [&](int) { DecompressEnvelope(Stuff(payload)); });
+
+	fmt::print("  {:<32} {:>10} bytes\n", "uncompressed message", plain->size());
+	fmt::print("  {:<32} {:>10} bytes\n", "compressed message", compressed->size());
+	fmt::print("  {:<32} {:>10.1f} ns\n", "stuff uncompressed", plainNs);
+	fmt::print("  {:<32} {:>10.1f} ns\n", "stuff compressed", compressNs);
+	fmt::print("  {:<32} {:>10.1f} ns\n", "read uncompressed", readPlainNs);
+	fmt::print("  {:<32} {:>10.1f} ns\n", "read compressed", readCompressedNs);
+	fmt::print("  {:<32} {:>10.1f} ns\n", "stuff and rewrite for old peer", rewriteNs);
+}
+
+int main(int argc, char* argv[])
+{
+	CommandLine commandLine("EnvelopeCompressionTests");
+	commandLine.Add("--size", s_size, 1, "payload size in bytes for the benchmark");
+	commandLine.Add("--iterations", s_iterations, 1, "times each operation is timed");
+
+	return Main(commandLine, argc, argv, RunBenchmark);
+}
@@ -0,0 +1,383 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// Tests and a read benchmark for the ini parser and cache behind Config.h (mq/base/IniFile.h).
+// Neither depends on Windows, so this also builds elsewhere, for example:
+//
+//   g++ -std=c++17 -O2 -I../../../include -I../.. App.cpp -lfmt -o IniFileTests
+//
+// Run with --help for the benchmark options.
+
+#include "mq/base/IniFile.h"
+#include "tests/TestHarness.h"
+
+#include <fmt/format.h>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace mq;
+using namespace mq::test;
+
+static std::string ValueOf(const IniDocument& doc, std::string_view section, std::string_view key)
+{
+	auto value = doc.GetValue(section, key);
+	return value ? std::string(*value) : "<missing>";
+}
+
+static std::string ReadFile(const std::filesystem::path& path)
+{
+	std::ifstream file(path, std::ios::in | std::ios::binary);
+	return { std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+}
+
+static void WriteFile(const std::filesystem::path& path, std::string_view contents)
+{
+	std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+	file.write(contents.data(), contents.size());
+}
+
+//============================================================================
+
+TEST_CASE(TestLookup)
+{
+	IniDocument doc(
+		"; leading comment\r\n"
+		"[General]\r\n"
+		"  Name = Value with spaces  \r\n"
+		"Quoted=\"  padded  \"\r\n"
+		"Single='x'\r\n"
+		"Mismatched=\"x'\r\n"
+		"NoEquals\r\n"
+		"Dup=first\r\n"
+		"dup=second\r\n"
+		"\r\n"
+		"[general]\r\n"
+		"Name=from the second section\r\n"
+		"[ Other ]\r\n"
+		"Empty=\r\n");
+
+	CHECK(doc.HasSection("GENERAL"));
+	CHECK(doc.HasSection("other"));
+	CHECK(!doc.HasSection("Missing"));
+
+	CHECK(ValueOf(doc, "general", "NAME") == "Value with spaces");
+	CHECK(ValueOf(doc, "General", "Quoted") == "  padded  ");
+	CHECK(ValueOf(doc, "General", "Single") == "x");
+	CHECK(ValueOf(doc, "General", "Mismatched") == "\"x'");
+	CHECK(ValueOf(doc, "General", "NoEquals") == "");
+	CHECK(ValueOf(doc, "General", "Dup") == "first");
+	CHECK(ValueOf(doc, "Other", "Empty") == "");
+	CHECK(!doc.GetValue("Other", "Missing"));
+	CHECK(!doc.GetValue("Missing", "Name"));
+
+	auto sections = doc.GetSectionNames();
+	CHECK(sections.size() == 3);
+	CHECK(sections.size() == 3 && sections[0] == "General" && sections[1] == "general" && sections[2] == "Other");
+
+	auto keys = doc.GetKeys("General");
+	CHECK(keys.size() == 7);
+	CHECK(keys.size() == 7 && keys[0] == "Name" && keys[6] == "dup");
+
+	auto keyValues = doc.GetKeyValues("General");
+	CHECK(keyValues.size() == 7 && keyValues[1].second == "\"  padded  \"");
+}
+
+TEST_CASE(TestRoundTrip)
+{
+	const std::string_view files[] = {
+		"[A]\r\nx=1\r\n; comment\r\n\r\n[B]\r\ny = 2\r\n",
+		"[A]\nx=1\n\n[B]\ny=2",
+		"\xEF\xBB\xBF[A]\r\nx=1\r\n",
+		"preamble\r\n[A]\r\n",
+		"",
+	};
+
+	for (std::string_view contents : files)
+	{
+		IniDocument doc(contents);
+		CHECK(doc.Serialize() == contents);
+	}
+}
+
+TEST_CASE(TestEdits)
+{
+	IniDocument doc(
+		"[A]\r\n"
+		"x = 1\r\n"
+		"; trailing comment\r\n"
+		"\r\n"
+		"[B]\r\n"
+		"y=2\r\n");
+
+	// Unchanged values don't modify the document
+	CHECK(!doc.SetValue("a", "X", "1"));
+
+	CHECK(doc.SetValue("A", "x", "10"));
+	CHECK(doc.SetValue("A", "z", "3"));
+	CHECK(doc.SetValue("C", "w", "4"));
+	CHECK(doc.Serialize() ==
+		"[A]\r\n"
+		"x=10\r\n"
+		"z=3\r\n"
+		"; trailing comment\r\n"
+		"\r\n"
+		"[B]\r\n"
+		"y=2\r\n"
+		"[C]\r\n"
+		"w=4\r\n");
+
+	CHECK(doc.DeleteKey("a", "X"));
+	CHECK(!doc.DeleteKey("A", "x"));
+	CHECK(ValueOf(doc, "A", "z") == "3");
+
+	CHECK(doc.DeleteSection("b"));
+	CHECK(!doc.HasSection("B"));
+	CHECK(ValueOf(doc, "C", "w") == "4");
+
+	doc.SetSection("A", { "p=1", "q=2" });
+	CHECK(doc.Serialize() ==
+		"[A]\r\n"
+		"p=1\r\n"
+		"q=2\r\n"
+		"\r\n"
+		"[C]\r\n"
+		"w=4\r\n");
+}
+
+TEST_CASE(TestCache)
+{
+	const std::filesystem::path path = std::filesystem::temp_directory_path() / "IniFileTests.ini";
+	const std::string fileName = path.string();
+
+	std::error_code ec;
+	std::filesystem::remove(path, ec);
+
+	auto setValue = [](std::string section, std::string key, std::string value)
+	{
+		return [=](IniDocument& doc) { return doc.SetValue(section, key, value); };
+	};
+
+	// Write-through: a change made by someone else right after we read the file must survive our write,
+	// even though it falls inside the validation interval.
+	{
+		IniCache cache;
+		cache.SetValidateInterval(std::chrono::hours(1));
+
+		CHECK(!cache.Exists(fileName));
+
+		WriteFile(path, "[A]\r\nx=1\r\n");
+		cache.Invalidate(fileName);
+		CHECK(cache.Read(fileName, [](const IniDocument& doc) { return ValueOf(doc, "A", "x"); }) == "1");
+
+		WriteFile(path, "[A]\r\nx=1\r\nexternal=yes\r\n");
+		CHECK(cache.Write(fileName, setValue("A", "ours", "1")));
+
+		IniDocument onDisk(ReadFile(path));
+		CHECK(ValueOf(onDisk, "A", "external") == "yes");
+		CHECK(ValueOf(onDisk, "A", "ours") == "1");
+	}
+
+	// Write-behind: pending edits are replayed on top of changes made before the flush
+	{
+		WriteFile(path, "[A]\r\nx=1\r\n");
+
+		IniCache cache;
+		cache.SetWriteBehindDelay(std::chrono::hours(1));
+
+		CHECK(cache.Write(fileName, setValue("A", "ours", "1")));
+		CHECK(cache.Write(fileName, setValue("A", "x", "2")));
+		CHECK(ValueOf(IniDocument(ReadFile(path)), "A", "ours") == "<missing>");
+
+		WriteFile(path, "[A]\r\nx=1\r\nexternal=yes\r\n");
+		cache.Flush(true);
+
+		IniDocument onDisk(ReadFile(path));
+		CHECK(ValueOf(onDisk, "A", "external") == "yes");
+		CHECK(ValueOf(onDisk, "A", "ours") == "1");
+		CHECK(ValueOf(onDisk, "A", "x") == "2");
+	}
+
+	// A file that only has pending changes already exists as far as readers are concerned
+	{
+		std::filesystem::remove(path, ec);
+
+		IniCache cache;
+		cache.SetWriteBehindDelay(std::chrono::hours(1));
+
+		CHECK(!cache.Exists(fileName));
+		cache.Write(fileName, setValue("A", "x", "1"));
+		CHECK(cache.Exists(fileName));
+		CHECK(!std::filesystem::exists(path, ec));
+
+		cache.Flush(true);
+		CHECK(std::filesystem::exists(path, ec));
+	}
+
+	std::filesystem::remove(path, ec);
+}
+
+TEST_CASE(TestEviction)
+{
+	const std::filesystem::path dir = std::filesystem::temp_directory_path();
+	auto fileName = [&](int i) { return (dir / fmt::format("IniFileTests{}.ini", i)).string(); };
+
+	for (int i = 0; i < 4; ++i)
+		WriteFile(fileName(i), fmt::format("[A]\r\nx={}\r\n", i));
+
+	IniCache cache;
+	cache.SetMaxFiles(2);
+	cache.SetWriteBehindDelay(std::chrono::hours(1));
+
+	auto readX = [&](int i) { return cache.Read(fileName(i), [](const IniDocument& doc) { return ValueOf(doc, "A", "x"); }); };
+
+	// A dirty file that falls out of the cache is written out first
+	CHECK(cache.Write(fileName(0), [](IniDocument& doc) { return doc.SetValue("A", "x", "dirty"); }));
+	CHECK(readX(1) == "1");
+	CHECK(cache.GetFileCount() == 2);
+	CHECK(ValueOf(IniDocument(ReadFile(fileName(0))), "A", "x") == "0");
+
+	CHECK(readX(2) == "2");
+	CHECK(cache.GetFileCount() == 2);
+	CHECK(ValueOf(IniDocument(ReadFile(fileName(0))), "A", "x") == "dirty");
+
+	// The least recently used file goes, not the oldest one loaded
+	CHECK(readX(1) == "1");
+	CHECK(readX(3) == "3");
+	WriteFile(fileName(1), "[A]\r\nx=changed\r\n");
+	cache.SetValidateInterval(std::chrono::hours(1));
+	CHECK(readX(1) == "1");
+	CHECK(readX(0) == "dirty");
+	CHECK(cache.GetFileCount() == 2);
+
+	cache.SetMaxFiles(1);
+	CHECK(cache.GetFileCount() == 1);
+
+	std::error_code ec;
+	for (int i = 0; i < 4; ++i)
+		std::filesystem::remove(fileName(i), ec);
+}
+
+TEST_CASE(TestSharedCache)
+{
+	const std::filesystem::path path = std::filesystem::temp_directory_path() / "IniFileTests.ini";
+	const std::string fileName = path.string();
+	WriteFile(path, "[A]\r\nx=1\r\n");
+
+	// Another module's cache, with a pending write-behind edit
+	IniCache shared;
+	shared.SetValidateInterval(std::chrono::hours(1));
+	shared.SetWriteBehindDelay(std::chrono::hours(1));
+	CHECK(shared.Write(fileName, [](IniDocument& doc) { return doc.SetValue("A", "x", "2"); }));
+
+	auto readX = [&]() { return GetIniCache().Read(fileName, [](const IniDocument& doc) { return ValueOf(doc, "A", "x"); }); };
+
+	CHECK(readX() == "1");
+
+	SetIniCache(&shared);
+	CHECK(&GetIniCache() == &shared);
+	CHECK(readX() == "2");
+
+	SetIniCache(nullptr);
+	CHECK(&GetIniCache() != &shared);
+
+	shared.Flush(true);
+
+	std::error_code ec;
+	std::filesystem::remove(path, ec);
+}
+
+//============================================================================
+
+struct Options
+{
+	int sections = 100;
+	int keys = 50;
+	int reads = 1000000;
+};
+
+static Options s_options;
+
+static void RunBenchmark()
+{
+	const Options& options = s_options;
+
+	const std::filesystem::path path = std::filesystem::temp_directory_path() / "IniFileBenchmark.ini";
+	const std::string fileName = path.string();
+
+	std::string contents;
+	for (int section = 0; section < options.sections; ++section)
+	{
+		contents += fmt::format("[Section{}]\r\n", section);
+		for (int key = 0; key < options.keys; ++key)
+			contents += fmt::format("Key{}=Value {} of section {}\r\n", key, key, section);
+		contents += "\r\n";
+	}
+
+	WriteFile(path, contents);
+
+	fmt::print("{} sections of {} keys, {} bytes\n\n", options.sections, options.keys, contents.size());
+
+	constexpr int parses = 20;
+	auto start = bench_clock::now();
+	for (int i = 0; i < parses; ++i)
+	{
+		IniDocument doc(contents);
+		if (!doc.HasSection("Section0"))
+			fmt::print("parse failed\n");
+	}
+	const double parseMs = ElapsedMs(start) / parses;
+
+	// Build the names up front so that only the lookups are timed
+	std::vector<std::pair<std::string, std::string>> names;
+	names.reserve(1024);
+	for (int i = 0; i < 1024; ++i)
+		names.emplace_back(fmt::format("section{}", (i * 7) % options.sections), fmt::format("KEY{}", (i * 13) % options.keys));
+
+	IniCache cache;
+	size_t totalLength = 0;
+
+	start = bench_clock::now();
+	for (int i = 0; i < options.reads; ++i)
+	{
+		const auto& [section, key] = names[i % names.size()];
+		totalLength += cache.Read(fileName, [&](const IniDocument& doc)
+			{
+				auto value = doc.GetValue(section, key);
+				return value ? value->length() : 0;
+			});
+	}
+	const double readSeconds = ElapsedSeconds(start);
+
+	fmt::print("{:<14} {:>12.3f} ms\n", "parse", parseMs);
+	fmt::print("{:<14} {:>12.0f} reads/s {:>9.1f} ns/read ({} bytes read)\n", "cached read",
+		options.reads / readSeconds, readSeconds * 1e9 / options.reads, totalLength);
+
+	std::error_code ec;
+	std::filesystem::remove(path, ec);
+}
+
+int main(int argc, char* argv[])
+{
+	CommandLine commandLine("IniFileTests");
+	commandLine.Add("--sections", s_options.sections, 1, "sections in the benchmark file");
+	commandLine.Add("--keys", s_options.keys, 1, "keys in each section");
+	commandLine.Add("--reads", s_options.reads, 1, "cached reads to time");
+
+	return Main(commandLine, argc, argv, RunBenchmark);
+}
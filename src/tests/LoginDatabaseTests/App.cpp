@@ -0,0 +1,488 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// Tests and a profile list benchmark for the login database connection layer (login/LoginDatabase.h),
+// run against a database in the temp directory.
+//
+// The profile list queries in Login.cpp can't be built here, since the rest of Login.cpp needs
+// DPAPI, the registry and argon2. The benchmark instead runs the same query shape as
+// GetProfileGroups over a copy of the tables it reads: once preparing every statement for each
+// query, as the login database did before statements were cached, and once through WithDb inside
+// a single read transaction, as it does now.
+//
+// Only depends on sqlite, spdlog and fmt, so this also builds elsewhere, for example:
+//
+//   g++ -std=c++17 -O2 -I../.. App.cpp ../../login/LoginDatabase.cpp -lsqlite3 -lspdlog -lfmt -pthread -o LoginDatabaseTests
+//
+// Run with --help for the benchmark options.
+
+#include "login/LoginDatabase.h"
+#include "tests/TestHarness.h"
+
+#include <fmt/format.h>
+
+#include <filesystem>
+#include <map>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "sqlite3.h"
+
+using namespace login::db;
+using namespace mq::test;
+
+static int s_accounts = 80;
+static int s_groups = 8;
+static int s_iterations = 200;
+
+static std::filesystem::path GetDatabasePath()
+{
+	return std::filesystem::temp_directory_path() / "LoginDatabaseTests.db";
+}
+
+static void RemoveDatabase()
+{
+	const std::filesystem::path path = GetDatabasePath();
+
+	std::error_code ec;
+	for (const char* suffix : { "", "-wal", "-shm" })
+		std::filesystem::remove(path.string() + suffix, ec);
+}
+
+// Closes every connection (including the worker's), then recreates the database with the given schema.
+static void ResetDatabase(const char* schema)
+{
+	ShutdownDatabase();
+	RemoveDatabase();
+
+	const std::string path = GetDatabasePath().string();
+	SetDatabasePath(path);
+
+	sqlite3* db = nullptr;
+	if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr) == SQLITE_OK)
+		sqlite3_exec(db, schema, nullptr, nullptr, nullptr);
+	sqlite3_close(db);
+}
+
+static const char* s_valuesSchema = "CREATE TABLE vals (value INTEGER NOT NULL);";
+
+static void InsertValue(int value)
+{
+	WithDb::Query<void>(SQLITE_OPEN_READWRITE, "INSERT INTO vals (value) VALUES (?)",
+		[value](sqlite3_stmt* stmt, sqlite3*)
+		{
+			sqlite3_bind_int(stmt, 1, value);
+			sqlite3_step(stmt);
+		});
+}
+
+static int CountValues(int flags = SQLITE_OPEN_READONLY)
+{
+	return WithDb::Query<int>(flags, "SELECT COUNT(*) FROM vals",
+		[](sqlite3_stmt* stmt, sqlite3*)
+		{
+			return sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int(stmt, 0) : -1;
+		});
+}
+
+//============================================================================
+
+TEST_CASE(TestStatementReuse)
+{
+	ResetDatabase(s_valuesSchema);
+
+	const std::shared_ptr<WithDb>& connection = WithDb::Get(SQLITE_OPEN_READONLY);
+	const std::string query = "SELECT value FROM vals";
+
+	// the statement is prepared once and handed out again after it is released
+	sqlite3_stmt* first = connection->AcquireStatement(query);
+	CHECK(first != nullptr);
+	connection->ReleaseStatement(query, first);
+
+	sqlite3_stmt* second = connection->AcquireStatement(query);
+	CHECK(second == first);
+
+	// while it is in use, a nested use gets a statement of its own
+	sqlite3_stmt* nested = connection->AcquireStatement(query);
+	CHECK(nested != nullptr);
+	CHECK(nested != second);
+
+	connection->ReleaseStatement(query, nested);
+	connection->ReleaseStatement(query, second);
+
+	CHECK(connection->AcquireStatement(query) == first);
+	connection->ReleaseStatement(query, first);
+
+	// nested Results over the same query each get a working statement
+	InsertValue(1);
+	InsertValue(2);
+
+	int pairs = 0;
+	Results<int> outer(WithDb::Get(SQLITE_OPEN_READONLY), query,
+		[](sqlite3_stmt*, sqlite3*) {}, [](sqlite3_stmt* stmt, sqlite3*) { return sqlite3_column_int(stmt, 0); });
+	for (int a : outer)
+	{
+		Results<int> inner(WithDb::Get(SQLITE_OPEN_READONLY), query,
+			[](sqlite3_stmt*, sqlite3*) {}, [](sqlite3_stmt* stmt, sqlite3*) { return sqlite3_column_int(stmt, 0); });
+		for (int b : inner)
+			pairs += a * b;
+	}
+
+	CHECK(pairs == (1 + 2) * (1 + 2));
+}
+
+TEST_CASE(TestNestedCommit)
+{
+	ResetDatabase(s_valuesSchema);
+
+	{
+		Transaction outer;
+		InsertValue(1);
+
+		{
+			Transaction inner;
+			InsertValue(2);
+			inner.Commit();
+
+			// leaving the inner transaction doesn't commit anything
+			CHECK(WithDb::GetOwn(SQLITE_OPEN_READONLY) != WithDb::Get(SQLITE_OPEN_READWRITE));
+			CHECK(CountValues() == 2);
+			CHECK(WithDb::Query<int>(WithDb::GetOwn(SQLITE_OPEN_READONLY), "SELECT COUNT(*) FROM vals",
+				[](sqlite3_stmt* stmt, sqlite3*) { return sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int(stmt, 0) : -1; }) == 0);
+		}
+
+		CHECK(WithDb::Get(SQLITE_OPEN_READWRITE)->InTransaction());
+	}
+
+	CHECK(!WithDb::Get(SQLITE_OPEN_READWRITE)->InTransaction());
+	CHECK(CountValues() == 2);
+}
+
+TEST_CASE(TestNestedRollback)
+{
+	ResetDatabase(s_valuesSchema);
+
+	{
+		Transaction outer;
+		InsertValue(1);
+
+		{
+			Transaction inner;
+			InsertValue(2);
+			inner.Rollback();
+
+			// ending twice only leaves the transaction once
+			inner.Commit();
+		}
+
+		CHECK(WithDb::Get(SQLITE_OPEN_READWRITE)->InTransaction());
+		outer.Commit();
+	}
+
+	// the nested rollback rolled back the outer transaction as well
+	CHECK(CountValues() == 0);
+
+	// and doesn't carry over into the next transaction
+	{
+		Transaction transaction;
+		InsertValue(3);
+	}
+
+	CHECK(CountValues() == 1);
+}
+
+TEST_CASE(TestReadsInsideTransaction)
+{
+	ResetDatabase(s_valuesSchema);
+
+	const WithDb* reader = WithDb::Get(SQLITE_OPEN_READONLY).get();
+	const WithDb* writer = WithDb::Get(SQLITE_OPEN_READWRITE).get();
+	CHECK(reader != writer);
+
+	{
+		Transaction transaction;
+		InsertValue(7);
+
+		// reads go through the connection that owns the open transaction and see its rows
+		CHECK(WithDb::Get(SQLITE_OPEN_READONLY).get() == writer);
+		CHECK(CountValues() == 1);
+
+		// other threads have their own connections and don't
+		std::thread other([] { CHECK(CountValues() == 0); });
+		other.join();
+
+		transaction.Rollback();
+	}
+
+	CHECK(WithDb::Get(SQLITE_OPEN_READONLY).get() == reader);
+	CHECK(CountValues() == 0);
+
+	// a read transaction doesn't redirect anything
+	{
+		Transaction transaction(true);
+		CHECK(WithDb::Get(SQLITE_OPEN_READONLY).get() == reader);
+		CHECK(WithDb::Get(SQLITE_OPEN_READONLY)->InTransaction());
+		CHECK(!WithDb::Get(SQLITE_OPEN_READWRITE)->InTransaction());
+	}
+}
+
+TEST_CASE(TestRunAsync)
+{
+	ResetDatabase(s_valuesSchema);
+
+	InsertValue(1);
+
+	const std::thread::id caller = std::this_thread::get_id();
+	auto result = RunAsync([caller]
+		{
+			// the worker has its own connections
+			CHECK(std::this_thread::get_id() != caller);
+
+			Transaction transaction;
+			InsertValue(2);
+			return CountValues();
+		});
+
+	CHECK(result.get() == 2);
+	CHECK(CountValues() == 2);
+
+	// the worker is restarted after a shutdown
+	ShutdownDatabase();
+	CHECK(RunAsync([] { return CountValues(); }).get() == 2);
+
+	ShutdownDatabase();
+	RemoveDatabase();
+}
+
+//============================================================================
+
+static const char* s_profileSchema = R"(
+	CREATE TABLE accounts (
+		id INTEGER PRIMARY KEY, account TEXT NOT NULL, password BLOB NOT NULL, server_type TEXT NOT NULL
+	);
+	CREATE TABLE characters (
+		id INTEGER PRIMARY KEY, character TEXT NOT NULL, server TEXT NOT NULL,
+		account_id INTEGER NOT NULL REFERENCES accounts(id)
+	);
+	CREATE TABLE personas (
+		character_id INTEGER NOT NULL REFERENCES characters(id), class TEXT NOT NULL, level INTEGER,
+		last_seen INTEGER NOT NULL
+	);
+	CREATE TABLE profile_groups (
+		id INTEGER PRIMARY KEY, name TEXT NOT NULL, eq_path TEXT, sort_order INTEGER
+	);
+	CREATE TABLE profiles (
+		id INTEGER PRIMARY KEY, character_id INTEGER NOT NULL REFERENCES characters(id),
+		group_id INTEGER NOT NULL REFERENCES profile_groups(id), eq_path TEXT, hotkey TEXT NOT NULL DEFAULT '',
+		sort_order INTEGER, end_after_select INTEGER, char_select_delay INTEGER, custom_client_ini TEXT,
+		will_load INTEGER NOT NULL DEFAULT 1
+	);
+)";
+
+static const char* s_groupsQuery = "SELECT id, name, eq_path FROM profile_groups ORDER BY sort_order ASC";
+
+static const char* s_profilesQuery = R"(
+	SELECT DISTINCT a.account, a.password, c.server, c.character, p.hotkey, p.sort_order, p.eq_path,
+	    FIRST_VALUE(l.class) OVER (PARTITION BY c.id ORDER BY l.last_seen DESC) AS class,
+	    FIRST_VALUE(l.level) OVER (PARTITION BY c.id ORDER BY l.last_seen DESC) AS level,
+	    a.server_type, p.end_after_select, p.char_select_delay, p.custom_client_ini, p.will_load
+	FROM profiles p
+	JOIN characters c ON p.character_id = c.id
+	JOIN accounts a ON c.account_id = a.id
+	LEFT JOIN personas l ON l.character_id = c.id
+	WHERE p.group_id = ?
+	ORDER BY p.sort_order ASC)";
+
+struct BenchmarkProfile
+{
+	std::string account;
+	std::string server;
+	std::string character;
+	std::string characterClass;
+	int level = 0;
+};
+
+using BenchmarkGroups = std::map<int, std::vector<BenchmarkProfile>>;
+
+static void PopulateProfiles()
+{
+	ResetDatabase(s_profileSchema);
+
+	Transaction transaction;
+	for (int group = 1; group <= s_groups; ++group)
+	{
+		WithDb::Query<void>(SQLITE_OPEN_READWRITE, "INSERT INTO profile_groups (id, name, sort_order) VALUES (?, ?, ?)",
+			[group](sqlite3_stmt* stmt, sqlite3*)
+			{
+				const std::string name = fmt::format("group{}", group);
+				sqlite3_bind_int(stmt, 1, group);
+				sqlite3_bind_text(stmt, 2, name.c_str(), -1, SQLITE_TRANSIENT);
+				sqlite3_bind_int(stmt, 3, group);
+				sqlite3_step(stmt);
+			});
+	}
+
+	for (int account = 1; account <= s_accounts; ++account)
+	{
+		WithDb::Query<void>(SQLITE_OPEN_READWRITE, R"(
+			INSERT INTO accounts (id, account, password, server_type) VALUES (?1, 'account' || ?1, 'password', 'live');
+			)",
+			[account](sqlite3_stmt* stmt, sqlite3*)
+			{
+				sqlite3_bind_int(stmt, 1, account);
+				sqlite3_step(stmt);
+			});
+
+		WithDb::Query<void>(SQLITE_OPEN_READWRITE, R"(
+			INSERT INTO characters (id, character, server, account_id) VALUES (?1, 'character' || ?1, 'server', ?1);
+			)",
+			[account](sqlite3_stmt* stmt, sqlite3*)
+			{
+				sqlite3_bind_int(stmt, 1, account);
+				sqlite3_step(stmt);
+			});
+
+		// two personas, so that the window functions have something to pick from
+		for (int persona = 0; persona < 2; ++persona)
+		{
+			WithDb::Query<void>(SQLITE_OPEN_READWRITE,
+				"INSERT INTO personas (character_id, class, level, last_seen) VALUES (?, ?, ?, ?)",
+				[account, persona](sqlite3_stmt* stmt, sqlite3*)
+				{
+					sqlite3_bind_int(stmt, 1, account);
+					sqlite3_bind_text(stmt, 2, persona == 0 ? "WAR" : "CLR", -1, SQLITE_STATIC);
+					sqlite3_bind_int(stmt, 3, 50 + persona);
+					sqlite3_bind_int(stmt, 4, persona);
+					sqlite3_step(stmt);
+				});
+		}
+
+		WithDb::Query<void>(SQLITE_OPEN_READWRITE,
+			"INSERT INTO profiles (character_id, group_id, sort_order) VALUES (?1, ?2, ?1)",
+			[account](sqlite3_stmt* stmt, sqlite3*)
+			{
+				sqlite3_bind_int(stmt, 1, account);
+				sqlite3_bind_int(stmt, 2, (account - 1) % s_groups + 1);
+				sqlite3_step(stmt);
+			});
+	}
+}
+
+static void ReadProfileRows(sqlite3_stmt* stmt, std::vector<BenchmarkProfile>& profiles)
+{
+	while (sqlite3_step(stmt) == SQLITE_ROW)
+	{
+		BenchmarkProfile& profile = profiles.emplace_back();
+		profile.account = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+		profile.server = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+		profile.character = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
+		profile.characterClass = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 7));
+		profile.level = sqlite3_column_int(stmt, 8);
+	}
+}
+
+// Prepares and finalizes every statement, with each query in its own implicit transaction.
+static BenchmarkGroups ReadProfilesPrepared()
+{
+	sqlite3* db = WithDb::Get(SQLITE_OPEN_READONLY)->GetDB();
+	BenchmarkGroups groups;
+
+	sqlite3_stmt* stmt = nullptr;
+	sqlite3_prepare_v2(db, s_groupsQuery, -1, &stmt, nullptr);
+	while (sqlite3_step(stmt) == SQLITE_ROW)
+		groups[sqlite3_column_int(stmt, 0)];
+	sqlite3_finalize(stmt);
+
+	for (auto& [id, profiles] : groups)
+	{
+		sqlite3_prepare_v2(db, s_profilesQuery, -1, &stmt, nullptr);
+		sqlite3_bind_int(stmt, 1, id);
+		ReadProfileRows(stmt, profiles);
+		sqlite3_finalize(stmt);
+	}
+
+	return groups;
+}
+
+// Reuses this thread's cached statements, with every query in one read transaction.
+static BenchmarkGroups ReadProfilesCached()
+{
+	Transaction transaction(true);
+
+	BenchmarkGroups groups = WithDb::Query<BenchmarkGroups>(SQLITE_OPEN_READONLY, s_groupsQuery,
+		[](sqlite3_stmt* stmt, sqlite3*)
+		{
+			BenchmarkGroups groups;
+			while (sqlite3_step(stmt) == SQLITE_ROW)
+				groups[sqlite3_column_int(stmt, 0)];
+			return groups;
+		});
+
+	for (auto& [id, profiles] : groups)
+	{
+		WithDb::Query<void>(SQLITE_OPEN_READONLY, s_profilesQuery,
+			[id = id, &profiles = profiles](sqlite3_stmt* stmt, sqlite3*)
+			{
+				sqlite3_bind_int(stmt, 1, id);
+				ReadProfileRows(stmt, profiles);
+			});
+	}
+
+	return groups;
+}
+
+static size_t CountProfiles(const BenchmarkGroups& groups)
+{
+	size_t count = 0;
+	for (const auto& [_, profiles] : groups)
+		count += profiles.size();
+	return count;
+}
+
+static void RunBenchmark()
+{
+	PopulateProfiles();
+
+	fmt::print("Profile list: {} accounts in {} groups, {} reads\n\n", s_accounts, s_groups, s_iterations);
+
+	// both read the same rows
+	const BenchmarkGroups prepared = ReadProfilesPrepared();
+	const BenchmarkGroups cached = ReadProfilesCached();
+	CHECK(CountProfiles(prepared) == static_cast<size_t>(s_accounts));
+	CHECK(CountProfiles(cached) == CountProfiles(prepared));
+	CHECK(cached.begin()->second.empty() || cached.begin()->second.front().characterClass == "CLR");
+
+	size_t rows = 0;
+	const double preparedNs = TimePerCallNs(s_iterations, [&](int) { rows += CountProfiles(ReadProfilesPrepared()); });
+	const double cachedNs = TimePerCallNs(s_iterations, [&](int) { rows += CountProfiles(ReadProfilesCached()); });
+	CHECK(rows == static_cast<size_t>(s_accounts) * s_iterations * 2);
+
+	fmt::print("  {:<36} {:>10.1f} us per list\n", "prepared per query", preparedNs / 1000.0);
+	fmt::print("  {:<36} {:>10.1f} us per list\n", "cached, one read transaction", cachedNs / 1000.0);
+
+	ShutdownDatabase();
+	RemoveDatabase();
+}
+
+int main(int argc, char* argv[])
+{
+	CommandLine commandLine("LoginDatabaseTests");
+	commandLine.Add("--accounts", s_accounts, 1, "accounts (one character and profile each)");
+	commandLine.Add("--groups", s_groups, 1, "profile groups the profiles are spread across");
+	commandLine.Add("--iterations", s_iterations, 1, "times the profile list is read");
+
+	return Main(commandLine, argc, argv, RunBenchmark);
+}
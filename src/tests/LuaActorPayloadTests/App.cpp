@@ -0,0 +1,548 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// Tests and a benchmark for Lua actor payloads (plugins/lua/LuaActorPayload.h), which are written
+// straight between the lua stack and the wire. The tests round trip nested, mixed and cyclic
+// tables and check that the bytes are the same Variant that protobuf reads and writes. The
+// benchmark compares against the old path, which built a Variant message and serialized that.
+// Only depends on LuaJIT and protobuf, so this also builds elsewhere, for example:
+//
+//   protoc --cpp_out=. -I../../plugins/lua ../../plugins/lua/Actor.proto
+//   g++ -std=c++17 -O2 -I../.. -I../../plugins/lua -I. -I/usr/include/luajit-2.1 App.cpp
+//       ../../plugins/lua/LuaActorPayload.cpp Actor.pb.cc -lluajit-5.1 -lprotobuf -lfmt -o LuaActorPayloadTests
+//
+// Run with --help for the benchmark options.
+
+#include "plugins/lua/LuaActorPayload.h"
+#include "tests/TestHarness.h"
+
+#include "Actor.pb.h"
+
+#include <google/protobuf/util/message_differencer.h>
+#include <lua.hpp>
+#include <fmt/format.h>
+
+#include <cmath>
+#include <string>
+
+#ifdef _DEBUG
+#pragma comment(lib, "libprotobufd")
+#else
+#pragma comment(lib, "libprotobuf")
+#endif
+
+using namespace mq::lua;
+using namespace mq::test;
+
+namespace messaging = mq::proto::lua::actor;
+
+static int s_members = 6;
+static int s_iterations = 20000;
+
+// Vectors are plain userdata here, told apart by their metatable
+static const char* VEC2_META = "test.vec2";
+static const char* VEC4_META = "test.vec4";
+
+static bool GetVector(lua_State* L, int index, const char* meta, int count, float* components)
+{
+	const float* data = static_cast<const float*>(luaL_testudata(L, index, meta));
+	if (data == nullptr)
+		return false;
+
+	std::copy(data, data + count, components);
+	return true;
+}
+
+static void PushVector(lua_State* L, const char* meta, int count, const float* components)
+{
+	float* data = static_cast<float*>(lua_newuserdata(L, count * sizeof(float)));
+	std::copy(components, components + count, data);
+	luaL_setmetatable(L, meta);
+}
+
+static const LuaPayloadVectors s_vectors = {
+	[](lua_State* L, int index, float* components) { return GetVector(L, index, VEC2_META, 2, components); },
+	[](lua_State* L, int index, float* components) { return GetVector(L, index, VEC4_META, 4, components); },
+	[](lua_State* L, const float* components) { PushVector(L, VEC2_META, 2, components); },
+	[](lua_State* L, const float* components) { PushVector(L, VEC4_META, 4, components); },
+};
+
+static int NewVec2(lua_State* L)
+{
+	const float components[2] = { static_cast<float>(lua_tonumber(L, 1)), static_cast<float>(lua_tonumber(L, 2)) };
+	PushVector(L, VEC2_META, 2, components);
+	return 1;
+}
+
+static int NewVec4(lua_State* L)
+{
+	float components[4];
+	for (int i = 0; i < 4; ++i)
+		components[i] = static_cast<float>(lua_tonumber(L, i + 1));
+
+	PushVector(L, VEC4_META, 4, components);
+	return 1;
+}
+
+static int UnpackVec(lua_State* L)
+{
+	float components[4];
+	const int count = GetVector(L, 1, VEC2_META, 2, components) ? 2 : GetVector(L, 1, VEC4_META, 4, components) ? 4 : 0;
+	for (int i = 0; i < count; ++i)
+		lua_pushnumber(L, components[i]);
+
+	return count;
+}
+
+// A lua state with vec2(x, y), vec4(x, y, z, w), unpack_vec(v) and deep_equal(a, b)
+class LuaTestState
+{
+public:
+	LuaTestState()
+		: L(luaL_newstate())
+	{
+		luaL_openlibs(L);
+
+		luaL_newmetatable(L, VEC2_META);
+		luaL_newmetatable(L, VEC4_META);
+		lua_pop(L, 2);
+
+		lua_register(L, "vec2", NewVec2);
+		lua_register(L, "vec4", NewVec4);
+		lua_register(L, "unpack_vec", UnpackVec);
+
+		Run(R"(
+			function deep_equal(a, b)
+				if type(a) ~= type(b) then return false end
+				if type(a) == 'userdata' then
+					local a1, a2, a3, a4 = unpack_vec(a)
+					local b1, b2, b3, b4 = unpack_vec(b)
+					return a1 == b1 and a2 == b2 and a3 == b3 and a4 == b4
+				end
+				if type(a) ~= 'table' then return a == b end
+				for k, v in pairs(a) do
+					if not deep_equal(v, b[k]) then return false end
+				end
+				for k in pairs(b) do
+					if a[k] == nil then return false end
+				end
+				return true
+			end
+		)");
+		lua_pop(L, 1);
+	}
+
+	~LuaTestState() { lua_close(L); }
+
+	// runs a chunk, leaving the value it returns on the stack
+	void Run(const char* code)
+	{
+		if (luaL_loadstring(L, code) != 0 || lua_pcall(L, 0, 1, 0) != 0)
+		{
+			fmt::print("lua error: {}\n", lua_tostring(L, -1));
+			CHECK(false);
+		}
+	}
+
+	// compares the values at the two indices with deep_equal
+	bool Equal(int a, int b)
+	{
+		if (a < 0)
+			a = lua_gettop(L) + a + 1;
+		if (b < 0)
+			b = lua_gettop(L) + b + 1;
+
+		lua_getglobal(L, "deep_equal");
+		lua_pushvalue(L, a);
+		lua_pushvalue(L, b);
+		lua_call(L, 2, 1);
+
+		const bool equal = lua_toboolean(L, -1) != 0;
+		lua_pop(L, 1);
+		return equal;
+	}
+
+	lua_State* L;
+};
+
+//============================================================================
+// The old path: build a Variant message from the lua value, serialize it, and parse it back into
+// lua values. Used to check the bytes and as the baseline for the benchmark. Like the old code, it
+// doesn't guard against cycles.
+
+static messaging::Variant VariantFromLua(lua_State* L, int index)
+{
+	messaging::Variant variant;
+	float components[4];
+
+	if (index < 0)
+		index = lua_gettop(L) + index + 1;
+
+	switch (lua_type(L, index))
+	{
+	case LUA_TSTRING:
+	{
+		size_t length = 0;
+		const char* str = lua_tolstring(L, index, &length);
+		variant.set_str(std::string(str, length));
+		break;
+	}
+	case LUA_TNUMBER:
+		variant.set_number(lua_tonumber(L, index));
+		break;
+	case LUA_TBOOLEAN:
+		variant.set_boolean(lua_toboolean(L, index) != 0);
+		break;
+	case LUA_TTABLE:
+	{
+		messaging::Table table;
+		lua_pushnil(L);
+		while (lua_next(L, index) != 0)
+		{
+			const int value = lua_gettop(L);
+			if (lua_type(L, -2) == LUA_TSTRING)
+			{
+				size_t length = 0;
+				const char* key = lua_tolstring(L, -2, &length);
+				(*table.mutable_entries())[std::string(key, length)] = VariantFromLua(L, value);
+			}
+			else if (lua_type(L, -2) == LUA_TNUMBER)
+			{
+				const lua_Number key = lua_tonumber(L, -2);
+				if (key >= 0 && key <= static_cast<lua_Number>(UINT32_MAX) && key == std::floor(key))
+					(*table.mutable_arr())[static_cast<uint32_t>(key)] = VariantFromLua(L, value);
+			}
+			lua_pop(L, 1);
+		}
+
+		if (table.entries_size() > 0 || table.arr_size() > 0)
+			*variant.mutable_table() = std::move(table);
+		break;
+	}
+	case LUA_TUSERDATA:
+		if (GetVector(L, index, VEC2_META, 2, components))
+		{
+			variant.mutable_imvec2()->set_x(components[0]);
+			variant.mutable_imvec2()->set_y(components[1]);
+		}
+		else if (GetVector(L, index, VEC4_META, 4, components))
+		{
+			variant.mutable_imvec4()->set_x(components[0]);
+			variant.mutable_imvec4()->set_y(components[1]);
+			variant.mutable_imvec4()->set_z(components[2]);
+			variant.mutable_imvec4()->set_w(components[3]);
+		}
+		break;
+	default:
+		break;
+	}
+
+	return variant;
+}
+
+static void PushVariant(lua_State* L, const messaging::Variant& variant)
+{
+	switch (variant.value_case())
+	{
+	case messaging::Variant::kNumber:
+		lua_pushnumber(L, variant.number());
+		break;
+	case messaging::Variant::kBoolean:
+		lua_pushboolean(L, variant.boolean());
+		break;
+	case messaging::Variant::kStr:
+		lua_pushlstring(L, variant.str().data(), variant.str().size());
+		break;
+	case messaging::Variant::kTable:
+		lua_createtable(L, 0, static_cast<int>(variant.table().entries_size() + variant.table().arr_size()));
+		for (const auto& [key, value] : variant.table().entries())
+		{
+			lua_pushlstring(L, key.data(), key.size());
+			PushVariant(L, value);
+			lua_rawset(L, -3);
+		}
+		for (const auto& [key, value] : variant.table().arr())
+		{
+			lua_pushnumber(L, key);
+			PushVariant(L, value);
+			lua_rawset(L, -3);
+		}
+		break;
+	case messaging::Variant::kImvec2:
+	{
+		const float components[2] = { variant.imvec2().x(), variant.imvec2().y() };
+		PushVector(L, VEC2_META, 2, components);
+		break;
+	}
+	case messaging::Variant::kImvec4:
+	{
+		const float components[4] = { variant.imvec4().x(), variant.imvec4().y(), variant.imvec4().z(), variant.imvec4().w() };
+		PushVector(L, VEC4_META, 4, components);
+		break;
+	}
+	default:
+		lua_pushnil(L);
+		break;
+	}
+}
+
+static std::string WriteOld(lua_State* L, int index)
+{
+	return VariantFromLua(L, index).SerializeAsString();
+}
+
+static void ReadOld(lua_State* L, const std::string& data)
+{
+	messaging::Variant variant;
+	variant.ParseFromString(data);
+	PushVariant(L, variant);
+}
+
+static bool SameVariant(const std::string& a, const std::string& b)
+{
+	messaging::Variant first, second;
+	return first.ParseFromString(a) && second.ParseFromString(b)
+		&& google::protobuf::util::MessageDifferencer::Equals(first, second);
+}
+
+// writes the value on top of the stack, reads it back and checks it arrived as expected
+static void CheckRoundTrip(LuaTestState& state, const char* code, const char* expected = nullptr)
+{
+	lua_State* L = state.L;
+	const int top = lua_gettop(L);
+
+	state.Run(code);
+	const std::string data = WriteLuaPayload(L, -1, s_vectors);
+	CHECK(lua_gettop(L) == top + 1);
+
+	CHECK(ReadLuaPayload(L, data, s_vectors));
+	CHECK(lua_gettop(L) == top + 2);
+
+	if (expected != nullptr)
+		state.Run(expected);
+	else
+		lua_pushvalue(L, -2);
+
+	if (!state.Equal(-1, -2))
+		fmt::print("round trip differs: {}\n", code);
+	CHECK(state.Equal(-1, -2));
+
+	lua_settop(L, top);
+}
+
+//============================================================================
+
+TEST_CASE(TestScalars)
+{
+	LuaTestState state;
+	CheckRoundTrip(state, "return 42.5");
+	CheckRoundTrip(state, "return -1e300");
+	CheckRoundTrip(state, "return true");
+	CheckRoundTrip(state, "return false");
+	CheckRoundTrip(state, "return 'hello'");
+	CheckRoundTrip(state, "return ''");
+	CheckRoundTrip(state, "return 'embedded\\0zero'");
+	CheckRoundTrip(state, "return nil");
+}
+
+TEST_CASE(TestNestedAndMixedTables)
+{
+	LuaTestState state;
+	CheckRoundTrip(state, "return { 1, 2, 3, 'four', true }");
+	CheckRoundTrip(state, "return { name = 'Fippy', level = 12, [0] = 'zero', [7] = 'seven', [4294967295] = 'max' }");
+	CheckRoundTrip(state, R"(
+		return {
+			group = { { name = 'a', hp = 100 }, { name = 'b', hp = 55.5, buffs = { 'haste', 'clarity' } } },
+			position = { x = 1.5, y = -2, z = 3 },
+			flags = { afk = false, lfg = true },
+		})");
+}
+
+TEST_CASE(TestSkippedValues)
+{
+	LuaTestState state;
+
+	// functions, fractional, negative, out of range and boolean keys, and empty tables don't make it
+	CheckRoundTrip(state,
+		"return { keep = 1, fn = print, [1.5] = 'x', [-1] = 'x', [4294967296] = 'x', [true] = 'x', empty = {}, nested = { {} } }",
+		"return { keep = 1 }");
+
+	// and a table that ends up with nothing in it is nil
+	CheckRoundTrip(state, "return {}", "return nil");
+	CheckRoundTrip(state, "return { fn = print }", "return nil");
+}
+
+TEST_CASE(TestCycles)
+{
+	LuaTestState state;
+
+	// anything leading back to a table we're already inside of is dropped, the rest arrives
+	CheckRoundTrip(state,
+		"local t = { a = 1 }; t.self = t; t.child = { parent = t, b = 2 }; return t",
+		"return { a = 1, child = { b = 2 } }");
+
+	// the same table in two places isn't a cycle, so it is sent twice
+	CheckRoundTrip(state,
+		"local shared = { v = 1 }; return { first = shared, second = shared }",
+		"return { first = { v = 1 }, second = { v = 1 } }");
+}
+
+TEST_CASE(TestDepthLimit)
+{
+	LuaTestState state;
+	lua_State* L = state.L;
+
+	// tables past the limit are dropped when writing, everything above them arrives
+	state.Run(fmt::format("local t = {{ v = 1 }}; for i = 1, {} do t = {{ t = t, v = 1 }} end; return t", MAX_VARIANT_DEPTH + 5).c_str());
+	CHECK(ReadLuaPayload(L, WriteLuaPayload(L, -1, s_vectors), s_vectors));
+
+	state.Run("return function(t) local depth = 0; while t do depth = depth + 1; t = t.t end; return depth end");
+	lua_pushvalue(L, -2);
+	lua_call(L, 1, 1);
+	CHECK(lua_tointeger(L, -1) == MAX_VARIANT_DEPTH);
+	lua_settop(L, 0);
+
+	// and data nested deeper than that is rejected when reading
+	messaging::Variant variant;
+	variant.set_number(1);
+	for (int i = 0; i < MAX_VARIANT_DEPTH + 1; ++i)
+	{
+		messaging::Variant outer;
+		(*outer.mutable_table()->mutable_entries())["t"] = std::move(variant);
+		variant = std::move(outer);
+	}
+
+	CHECK(!ReadLuaPayload(L, variant.SerializeAsString(), s_vectors));
+	CHECK(lua_gettop(L) == 1 && lua_isnil(L, -1));
+}
+
+TEST_CASE(TestVectors)
+{
+	LuaTestState state;
+	CheckRoundTrip(state, "return { size = vec2(10, 20.5), color = vec4(1, 0.5, 0.25, 1) }");
+
+	// without a way to read them, vectors are skipped, and without a way to make them they are nil
+	lua_State* L = state.L;
+	state.Run("return { size = vec2(10, 20), n = 1 }");
+	state.Run("return { n = 1 }");
+
+	CHECK(ReadLuaPayload(L, WriteLuaPayload(L, 1), s_vectors));
+	CHECK(state.Equal(-1, 2));
+	lua_pop(L, 1);
+
+	CHECK(ReadLuaPayload(L, WriteLuaPayload(L, 1, s_vectors)));
+	CHECK(state.Equal(-1, 2));
+	lua_settop(L, 0);
+}
+
+TEST_CASE(TestSameBytesAsProtobuf)
+{
+	LuaTestState state;
+	lua_State* L = state.L;
+
+	const char* values[] = {
+		"return 3.25",
+		"return 'text'",
+		"return { 1, 'two', { three = 3 }, size = vec2(1, 2), color = vec4(1, 2, 3, 4), yes = true, no = false }",
+		"return { players = { { name = 'a', hp = 1 }, { name = 'b', hp = 2 } }, [10] = 10 }",
+	};
+
+	for (const char* value : values)
+	{
+		state.Run(value);
+
+		// the direct writer's bytes parse as the same Variant protobuf builds, and each side reads
+		// what the other wrote
+		const std::string direct = WriteLuaPayload(L, -1, s_vectors);
+		const std::string old = WriteOld(L, -1);
+		CHECK(SameVariant(direct, old));
+
+		ReadOld(L, direct);
+		CHECK(state.Equal(-1, -2));
+		lua_pop(L, 1);
+
+		CHECK(ReadLuaPayload(L, old, s_vectors));
+		CHECK(state.Equal(-1, -2));
+		lua_settop(L, 0);
+	}
+}
+
+TEST_CASE(TestMalformedData)
+{
+	LuaTestState state;
+	lua_State* L = state.L;
+
+	state.Run("return { a = { b = 'c' } }");
+	std::string data = WriteLuaPayload(L, -1, s_vectors);
+	lua_settop(L, 0);
+
+	// truncated anywhere, the read fails cleanly with a single nil
+	for (size_t length = 1; length < data.size(); ++length)
+	{
+		CHECK(!ReadLuaPayload(L, std::string_view(data.data(), length), s_vectors));
+		CHECK(lua_gettop(L) == 1 && lua_isnil(L, -1));
+		lua_settop(L, 0);
+	}
+
+	CHECK(!ReadLuaPayload(L, "\xff\xff\xff\xff\xff\xff", s_vectors));
+	CHECK(lua_gettop(L) == 1 && lua_isnil(L, -1));
+}
+
+//============================================================================
+
+static void RunBenchmark()
+{
+	LuaTestState state;
+	lua_State* L = state.L;
+
+	// the kind of state scripts sync between boxes every second
+	state.Run(fmt::format(R"(
+		local members = {{}}
+		for i = 1, {} do
+			local buffs = {{}}
+			for b = 1, 20 do buffs[b] = {{ id = 1000 + b, name = 'Buff ' .. b, duration = b * 6 }} end
+			members[i] = {{
+				name = 'Member' .. i, class = 'CLR', level = 60 + i, hp = 98.5, mana = 75,
+				position = {{ x = i * 10.5, y = -i * 3.25, z = 12 }},
+				buffs = buffs, casting = false, target = 'a decaying skeleton',
+			}}
+		end
+		return {{ zone = 'guildlobby', members = members, color = vec4(1, 1, 1, 1) }}
+	)", s_members).c_str());
+
+	const std::string direct = WriteLuaPayload(L, -1, s_vectors);
+	CHECK(SameVariant(direct, WriteOld(L, -1)));
+
+	fmt::print("Lua actor payload: {} group members, {} bytes, {} iterations\n\n", s_members, direct.size(), s_iterations);
+
+	const double writeOldNs = TimePerCallNs(s_iterations, [&](int) { WriteOld(L, -1); });
+	const double writeNs = TimePerCallNs(s_iterations, [&](int) { WriteLuaPayload(L, -1, s_vectors); });
+
+	const double readOldNs = TimePerCallNs(s_iterations, [&](int) { ReadOld(L, direct); lua_pop(L, 1); });
+	const double readNs = TimePerCallNs(s_iterations, [&](int) { ReadLuaPayload(L, direct, s_vectors); lua_pop(L, 1); });
+
+	fmt::print("  {:<28} {:>10.1f} ns\n", "write through Variant", writeOldNs);
+	fmt::print("  {:<28} {:>10.1f} ns\n", "write direct", writeNs);
+	fmt::print("  {:<28} {:>10.1f} ns\n", "read through Variant", readOldNs);
+	fmt::print("  {:<28} {:>10.1f} ns\n", "read direct", readNs);
+}
+
+int main(int argc, char* argv[])
+{
+	CommandLine commandLine("LuaActorPayloadTests");
+	commandLine.Add("--members", s_members, 1, "group members in the benchmark payload");
+	commandLine.Add("--iterations", s_iterations, 1, "times each payload is written and read");
+
+	return Main(commandLine, argc, argv, RunBenchmark);
+}
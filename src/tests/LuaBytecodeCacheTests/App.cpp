@@ -0,0 +1,367 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// Tests and a benchmark for the shared lua bytecode cache (plugins/lua/LuaBytecodeCache.h). The
+// tests cover a hit, a touched file whose contents didn't change, an edit that throws the
+// bytecode out, and persisted bytecode that LuaJIT refuses to load. The benchmark compares
+// compiling a large library against loading it from memory and from the persisted cache.
+// Only depends on LuaJIT and fmt, so this also builds elsewhere, for example:
+//
+//   g++ -std=c++17 -O2 -I../.. -I../../../include -I/usr/include/luajit-2.1 App.cpp
+//       ../../plugins/lua/LuaBytecodeCache.cpp -lluajit-5.1 -lfmt -o LuaBytecodeCacheTests
+//
+// Run with --help for the benchmark options.
+
+#include "plugins/lua/LuaBytecodeCache.h"
+#include "tests/TestHarness.h"
+
+#include <fmt/format.h>
+#include <lua.hpp>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+using namespace mq::lua;
+using namespace mq::test;
+
+namespace fs = std::filesystem;
+
+static int s_functions = 2000;
+static int s_iterations = 200;
+
+// A scratch directory for the files a test loads, removed again when the test is done
+class ScratchDirectory
+{
+public:
+	ScratchDirectory()
+	{
+		static int s_count = 0;
+		m_path = fs::temp_directory_path() / fmt::format("LuaBytecodeCacheTests-{}-{}",
+			std::chrono::steady_clock::now().time_since_epoch().count(), ++s_count);
+		fs::create_directories(m_path);
+	}
+
+	~ScratchDirectory()
+	{
+		std::error_code ec;
+		fs::remove_all(m_path, ec);
+	}
+
+	const fs::path& GetPath() const { return m_path; }
+
+	// writes a file, giving it a write time of its own so that the cache can't mistake it for
+	// an earlier version written within the same timestamp tick
+	std::string Write(const std::string& name, const std::string& contents)
+	{
+		const fs::path path = m_path / name;
+		{
+			std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+			file << contents;
+		}
+
+		fs::last_write_time(path, fs::file_time_type::clock::now() + std::chrono::seconds(++m_writes));
+		return path.string();
+	}
+
+	// moves a file's write time forward without changing its contents
+	void Touch(const std::string& path)
+	{
+		fs::last_write_time(path, fs::last_write_time(path) + std::chrono::seconds(100));
+	}
+
+private:
+	fs::path m_path;
+	int m_writes = 0;
+};
+
+class LuaState
+{
+public:
+	LuaState()
+		: L(luaL_newstate())
+	{
+		luaL_openlibs(L);
+	}
+
+	~LuaState() { lua_close(L); }
+
+	// loads a file through the cache and runs it, returning the number it returns, or -1 if it failed
+	int Run(LuaBytecodeCache& cache, const std::string& path)
+	{
+		const int top = lua_gettop(L);
+		int result = -1;
+
+		if (cache.LoadFile(L, path) == 0 && lua_pcall(L, 0, 1, 0) == 0 && lua_isnumber(L, -1))
+			result = static_cast<int>(lua_tointeger(L, -1));
+
+		lua_settop(L, top);
+		return result;
+	}
+
+	lua_State* L;
+};
+
+static bool operator==(const LuaBytecodeCache::Stats& a, const LuaBytecodeCache::Stats& b)
+{
+	return a.hits == b.hits && a.diskHits == b.diskHits && a.compiles == b.compiles && a.invalidations == b.invalidations;
+}
+
+static LuaBytecodeCache::Stats MakeStats(uint32_t hits, uint32_t diskHits, uint32_t compiles, uint32_t invalidations)
+{
+	LuaBytecodeCache::Stats stats;
+	stats.hits = hits;
+	stats.diskHits = diskHits;
+	stats.compiles = compiles;
+	stats.invalidations = invalidations;
+	return stats;
+}
+
+//============================================================================
+
+TEST_CASE(TestSecondLoadIsAHit)
+{
+	ScratchDirectory directory;
+	LuaState state;
+	LuaBytecodeCache cache;
+
+	const std::string path = directory.Write("lib.lua", "return 1 + 2");
+
+	CHECK(state.Run(cache, path) == 3);
+	CHECK(cache.GetStats() == MakeStats(0, 0, 1, 0));
+
+	CHECK(state.Run(cache, path) == 3);
+	CHECK(cache.GetStats() == MakeStats(1, 0, 1, 0));
+	CHECK(cache.GetEntryCount() == 1);
+}
+
+TEST_CASE(TestSameFileSpelledDifferentlyIsAHit)
+{
+	ScratchDirectory directory;
+	LuaState state;
+	LuaBytecodeCache cache;
+
+	const std::string path = directory.Write("lib.lua", "return 4");
+	fs::create_directories(directory.GetPath() / "sub");
+
+	CHECK(state.Run(cache, path) == 4);
+	CHECK(state.Run(cache, (directory.GetPath() / "sub" / ".." / "lib.lua").string()) == 4);
+	CHECK(cache.GetStats() == MakeStats(1, 0, 1, 0));
+}
+
+TEST_CASE(TestTouchWithSameContentsKeepsBytecode)
+{
+	ScratchDirectory directory;
+	LuaState state;
+	LuaBytecodeCache cache;
+
+	const std::string path = directory.Write("lib.lua", "return 5");
+	CHECK(state.Run(cache, path) == 5);
+
+	// the write time changed, so the source is read and hashed again, but not compiled
+	directory.Touch(path);
+	CHECK(state.Run(cache, path) == 5);
+	CHECK(cache.GetStats() == MakeStats(1, 0, 1, 0));
+
+	// and the entry now has the new write time, so the next load doesn't read the source
+	CHECK(state.Run(cache, path) == 5);
+	CHECK(cache.GetStats() == MakeStats(2, 0, 1, 0));
+}
+
+TEST_CASE(TestEditInvalidates)
+{
+	ScratchDirectory directory;
+	LuaState state;
+	LuaBytecodeCache cache;
+
+	std::string path = directory.Write("lib.lua", "return 6");
+	CHECK(state.Run(cache, path) == 6);
+
+	// same size, different contents
+	path = directory.Write("lib.lua", "return 7");
+	CHECK(state.Run(cache, path) == 7);
+	CHECK(cache.GetStats() == MakeStats(0, 0, 2, 1));
+	CHECK(cache.GetEntryCount() == 1);
+
+	CHECK(state.Run(cache, path) == 7);
+	CHECK(cache.GetStats() == MakeStats(1, 0, 2, 1));
+}
+
+TEST_CASE(TestCompileErrorIsNotCached)
+{
+	ScratchDirectory directory;
+	LuaState state;
+	LuaBytecodeCache cache;
+
+	const std::string path = directory.Write("broken.lua", "return = 1");
+
+	CHECK(cache.LoadFile(state.L, path) == LUA_ERRSYNTAX);
+	CHECK(lua_isstring(state.L, -1));
+	lua_pop(state.L, 1);
+
+	CHECK(cache.GetEntryCount() == 0);
+	CHECK(cache.GetStats() == MakeStats(0, 0, 0, 0));
+
+	// a missing file is reported by lua the same way as without the cache
+	CHECK(cache.LoadFile(state.L, (directory.GetPath() / "missing.lua").string()) == LUA_ERRFILE);
+	lua_pop(state.L, 1);
+}
+
+TEST_CASE(TestPersistedBytecodeIsLoaded)
+{
+	ScratchDirectory directory;
+	LuaState state;
+
+	const std::string path = directory.Write("lib.lua", "return 8");
+	const std::string persist = (directory.GetPath() / "cache").string();
+
+	LuaBytecodeCache first;
+	first.SetPersistDirectory(persist);
+	CHECK(state.Run(first, path) == 8);
+	CHECK(first.GetStats() == MakeStats(0, 0, 1, 0));
+
+	// as if after a restart
+	LuaBytecodeCache second;
+	second.SetPersistDirectory(persist);
+	CHECK(state.Run(second, path) == 8);
+	CHECK(second.GetStats() == MakeStats(0, 1, 0, 0));
+}
+
+TEST_CASE(TestRejectedPersistedBytecodeIsRecompiled)
+{
+	ScratchDirectory directory;
+	LuaState state;
+
+	const std::string path = directory.Write("lib.lua", "return 9");
+	const fs::path persist = directory.GetPath() / "cache";
+
+	{
+		LuaBytecodeCache cache;
+		cache.SetPersistDirectory(persist.string());
+		CHECK(state.Run(cache, path) == 9);
+	}
+
+	// replace what was persisted with bytecode from a LuaJIT version that doesn't exist
+	int blobs = 0;
+	for (const auto& file : fs::directory_iterator(persist))
+	{
+		std::ofstream out(file.path(), std::ios::out | std::ios::binary | std::ios::trunc);
+		out << "\x1bLJ\x7f" << std::string(32, '\0');
+		++blobs;
+	}
+	CHECK(blobs == 1);
+
+	LuaBytecodeCache rejected;
+	rejected.SetPersistDirectory(persist.string());
+	CHECK(state.Run(rejected, path) == 9);
+	CHECK(rejected.GetStats() == MakeStats(0, 0, 1, 0));
+	CHECK(lua_gettop(state.L) == 0);
+
+	// the recompiled bytecode replaced the blob
+	LuaBytecodeCache restarted;
+	restarted.SetPersistDirectory(persist.string());
+	CHECK(state.Run(restarted, path) == 9);
+	CHECK(restarted.GetStats() == MakeStats(0, 1, 0, 0));
+}
+
+TEST_CASE(TestEditRemovesPersistedBytecode)
+{
+	ScratchDirectory directory;
+	LuaState state;
+
+	const fs::path persist = directory.GetPath() / "cache";
+	LuaBytecodeCache cache;
+	cache.SetPersistDirectory(persist.string());
+
+	std::string path = directory.Write("lib.lua", "return 10");
+	CHECK(state.Run(cache, path) == 10);
+
+	path = directory.Write("lib.lua", "return 11");
+	CHECK(state.Run(cache, path) == 11);
+
+	const auto count = std::distance(fs::directory_iterator(persist), fs::directory_iterator());
+	CHECK(count == 1);
+
+	cache.Clear();
+	CHECK(fs::is_empty(persist));
+	CHECK(cache.GetEntryCount() == 0);
+}
+
+//============================================================================
+
+static void RunBenchmark()
+{
+	ScratchDirectory directory;
+	LuaState state;
+	lua_State* L = state.L;
+
+	// a library about the size of the larger ones scripts share
+	std::string source = "local M = {}\n";
+	for (int i = 0; i < s_functions; ++i)
+	{
+		source += fmt::format(
+			"function M.f{0}(a, b)\n"
+			"  local t = {{ name = 'f{0}', value = a * {0} + b }}\n"
+			"  for i = 1, #t.name do t.value = t.value + i end\n"
+			"  return t\n"
+			"end\n", i);
+	}
+	source += "return M\n";
+
+	const std::string path = directory.Write("library.lua", source);
+	const std::string persist = (directory.GetPath() / "cache").string();
+
+	fmt::print("Lua bytecode cache: {} functions, {} bytes of source, {} iterations\n\n", s_functions, source.size(), s_iterations);
+
+	auto load = [&](auto&& loader)
+	{
+		CHECK(loader() == 0);
+		lua_pop(L, 1);
+	};
+
+	const double compileNs = TimePerCallNs(s_iterations, [&](int) { load([&] { return luaL_loadfile(L, path.c_str()); }); });
+
+	LuaBytecodeCache memory;
+	load([&] { return memory.LoadFile(L, path); });
+	const double memoryNs = TimePerCallNs(s_iterations, [&](int) { load([&] { return memory.LoadFile(L, path); }); });
+
+	LuaBytecodeCache writer;
+	writer.SetPersistDirectory(persist);
+	load([&] { return writer.LoadFile(L, path); });
+
+	// a fresh cache each time, like the first require after a restart
+	const double diskNs = TimePerCallNs(s_iterations,
+		[&](int)
+		{
+			LuaBytecodeCache restarted;
+			restarted.SetPersistDirectory(persist);
+			load([&] { return restarted.LoadFile(L, path); });
+		});
+
+	CHECK(memory.GetStats().hits == static_cast<uint32_t>(s_iterations));
+
+	fmt::print("  {:<24} {:>12.1f} us\n", "compile from source", compileNs / 1000.0);
+	fmt::print("  {:<24} {:>12.1f} us\n", "cached in memory", memoryNs / 1000.0);
+	fmt::print("  {:<24} {:>12.1f} us\n", "persisted to disk", diskNs / 1000.0);
+}
+
+int main(int argc, char* argv[])
+{
+	CommandLine commandLine("LuaBytecodeCacheTests");
+	commandLine.Add("--functions", s_functions, 1, "functions in the benchmark library");
+	commandLine.Add("--iterations", s_iterations, 1, "times the library is loaded each way");
+
+	return Main(commandLine, argc, argv, RunBenchmark);
+}
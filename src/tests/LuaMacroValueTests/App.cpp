@@ -0,0 +1,261 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// Tests and a benchmark for how actualized macro values are pushed onto the lua stack
+// (plugins/lua/LuaMacroValue.h). The tests check that each kind of value arrives in lua as the
+// same type and value it did when it went through a sol::object, and that strings pointing into a
+// scratch buffer like DataTypeTemp are copied by lua before the next evaluation writes over
+// them. The benchmark compares pushing a value directly with holding it in a registry reference
+// on the way, which is what a sol::object costs.
+// Only depends on LuaJIT and fmt, so this also builds elsewhere, for example:
+//
+//   g++ -std=c++17 -O2 -I../.. -I/usr/include/luajit-2.1 App.cpp ../../plugins/lua/LuaMacroValue.cpp
+//       -lluajit-5.1 -lfmt -o LuaMacroValueTests
+//
+// Run with --help for the benchmark options.
+
+#include "plugins/lua/LuaMacroValue.h"
+#include "tests/TestHarness.h"
+
+#include <fmt/format.h>
+#include <lua.hpp>
+
+#include <cstring>
+#include <string>
+
+using namespace mq::lua;
+using namespace mq::test;
+
+static int s_calls = 1'000'000;
+
+template <typename T>
+static LuaMacroScalar MakeScalar(T value)
+{
+	return LuaMacroScalar{ LuaMacroScalar::Value(std::in_place_type<T>, value) };
+}
+
+class LuaState
+{
+public:
+	LuaState()
+		: L(luaL_newstate())
+	{
+		luaL_openlibs(L);
+	}
+
+	~LuaState() { lua_close(L); }
+
+	// pushes the value into a global, the way a TLO member call hands it back to a script
+	void SetGlobal(const char* name, const LuaMacroScalar& scalar)
+	{
+		const int top = lua_gettop(L);
+		CHECK(PushLuaMacroScalar(L, scalar) == 1);
+		CHECK(lua_gettop(L) == top + 1);
+
+		lua_setglobal(L, name);
+	}
+
+	std::string Eval(const char* code)
+	{
+		if (luaL_dostring(L, fmt::format("return tostring({})", code).c_str()) != 0)
+		{
+			fmt::print("lua error: {}\n", lua_tostring(L, -1));
+			lua_pop(L, 1);
+			CHECK(false);
+			return {};
+		}
+
+		std::string result = lua_tostring(L, -1);
+		lua_pop(L, 1);
+		return result;
+	}
+
+	lua_State* L;
+};
+
+// Stands in for DataTypeTemp: every evaluation writes its string result into the same buffer
+static char s_scratch[64];
+
+static LuaMacroScalar EvaluateName(const char* name)
+{
+	strcpy(s_scratch, name);
+	return MakeScalar<const char*>(s_scratch);
+}
+
+static int PushEvaluatedName(lua_State* L)
+{
+	return PushLuaMacroScalar(L, EvaluateName(lua_tostring(L, 1)));
+}
+
+//============================================================================
+
+TEST_CASE(TestNil)
+{
+	LuaState state;
+	state.SetGlobal("value", LuaMacroScalar{});
+	CHECK(state.Eval("type(value)") == "nil");
+
+	// a string type with no string is nil, the same as sol pushes a null const char*
+	state.SetGlobal("value", MakeScalar<const char*>(nullptr));
+	CHECK(state.Eval("type(value)") == "nil");
+}
+
+TEST_CASE(TestBool)
+{
+	LuaState state;
+	state.SetGlobal("yes", MakeScalar<bool>(true));
+	state.SetGlobal("no", MakeScalar<bool>(false));
+	CHECK(state.Eval("type(yes)") == "boolean");
+	CHECK(state.Eval("yes == true and no == false") == "true");
+
+	// false is not nil, so `if value ~= nil` still works on a FALSE macro value
+	CHECK(state.Eval("no ~= nil") == "true");
+}
+
+TEST_CASE(TestIntegers)
+{
+	LuaState state;
+	state.SetGlobal("int", MakeScalar<int>(-2147483647 - 1));
+	state.SetGlobal("int64", MakeScalar<int64_t>(int64_t{ 1 } << 53));
+	state.SetGlobal("timestamp", MakeScalar<int64_t>(1'700'000'000'000));
+
+	CHECK(state.Eval("type(int)") == "number");
+	CHECK(state.Eval("int == -2147483648") == "true");
+	CHECK(state.Eval("type(int64)") == "number");
+	CHECK(state.Eval("int64 == 2^53") == "true");
+	CHECK(state.Eval("timestamp == 1700000000000") == "true");
+}
+
+TEST_CASE(TestByteIsANumber)
+{
+	// uint8_t is unsigned char, but sol pushes it as a number and so does this
+	LuaState state;
+	state.SetGlobal("byte", MakeScalar<uint8_t>(255));
+	state.SetGlobal("zero", MakeScalar<uint8_t>(0));
+
+	CHECK(state.Eval("type(byte)") == "number");
+	CHECK(state.Eval("byte == 255") == "true");
+	CHECK(state.Eval("zero == 0") == "true");
+}
+
+TEST_CASE(TestFloatsWidenToDouble)
+{
+	LuaState state;
+	state.SetGlobal("float", MakeScalar<float>(0.1f));
+	state.SetGlobal("double", MakeScalar<double>(0.1));
+
+	CHECK(state.Eval("type(float)") == "number");
+	CHECK(state.Eval("string.format('%.17g', float)") == "0.10000000149011612");
+	CHECK(state.Eval("string.format('%.17g', double)") == "0.10000000000000001");
+	CHECK(state.Eval("float ~= double") == "true");
+}
+
+TEST_CASE(TestStrings)
+{
+	LuaState state;
+	state.SetGlobal("empty", MakeScalar<const char*>(""));
+	state.SetGlobal("name", MakeScalar<const char*>("Soandso"));
+
+	CHECK(state.Eval("type(empty)") == "string");
+	CHECK(state.Eval("#empty") == "0");
+	CHECK(state.Eval("name") == "Soandso");
+
+	// a number that is a string stays a string
+	state.SetGlobal("digits", MakeScalar<const char*>("42"));
+	CHECK(state.Eval("type(digits)") == "string");
+}
+
+TEST_CASE(TestStringsAreCopiedBeforeTheScratchBufferIsReused)
+{
+	LuaState state;
+
+	const LuaMacroScalar first = EvaluateName("first");
+	state.SetGlobal("first", first);
+	state.SetGlobal("second", EvaluateName("second"));
+
+	CHECK(state.Eval("first") == "first");
+	CHECK(state.Eval("second") == "second");
+
+	// this is why a value must never be kept: it now reads whatever was evaluated last
+	CHECK(strcmp(std::get<const char*>(first.value), "second") == 0);
+}
+
+TEST_CASE(TestStringsEvaluatedInOneExpression)
+{
+	// each call pushes its result before lua evaluates the next one
+	LuaState state;
+	lua_register(state.L, "evaluate", PushEvaluatedName);
+
+	CHECK(state.Eval("evaluate('a') .. evaluate('b') .. evaluate('c')") == "abc");
+	CHECK(state.Eval("select('#', evaluate('a'), evaluate('b'))") == "2");
+	CHECK(state.Eval("(function(a, b) return a ~= b end)(evaluate('a'), evaluate('b'))") == "true");
+}
+
+//============================================================================
+
+// Pushes the value the way it went through a sol::object: into the registry, back onto the stack
+// to be returned, and the reference released when the object is destroyed
+static void PushThroughRegistry(lua_State* L, const LuaMacroScalar& scalar)
+{
+	PushLuaMacroScalar(L, scalar);
+	const int ref = luaL_ref(L, LUA_REGISTRYINDEX);
+	lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+	luaL_unref(L, LUA_REGISTRYINDEX, ref);
+}
+
+static void RunBenchmark()
+{
+	LuaState state;
+	lua_State* L = state.L;
+
+	fmt::print("Pushing actualized macro values: {} calls\n\n", s_calls);
+	fmt::print("  {:<10} {:>12} {:>16}\n", "value", "direct", "registry ref");
+
+	const std::pair<const char*, LuaMacroScalar> values[] = {
+		{ "nil", LuaMacroScalar{} },
+		{ "bool", MakeScalar<bool>(true) },
+		{ "int", MakeScalar<int>(12345) },
+		{ "float", MakeScalar<float>(0.5f) },
+		{ "string", EvaluateName("An NPC named Soandso") },
+	};
+
+	for (const auto& [name, scalar] : values)
+	{
+		const double directNs = TimePerCallNs(s_calls,
+			[&](int)
+			{
+				PushLuaMacroScalar(L, scalar);
+				lua_pop(L, 1);
+			});
+
+		const double registryNs = TimePerCallNs(s_calls,
+			[&](int)
+			{
+				PushThroughRegistry(L, scalar);
+				lua_pop(L, 1);
+			});
+
+		fmt::print("  {:<10} {:>9.1f} ns {:>13.1f} ns\n", name, directNs, registryNs);
+	}
+
+	CHECK(lua_gettop(L) == 0);
+}
+
+int main(int argc, char* argv[])
+{
+	CommandLine commandLine("LuaMacroValueTests");
+	commandLine.Add("--calls", s_calls, 1, "values pushed for each measurement");
+
+	return Main(commandLine, argc, argv, RunBenchmark);
+}
@@ -0,0 +1,625 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// Tests and a benchmark for how scripts waiting on mq.delay are scheduled
+// (plugins/lua/LuaScheduler.h). The tests check the order parked scripts are woken in, that stale
+// timer entries are dropped, when a delay runs out or has its condition checked, and that the
+// conditions run on one reused lua thread that is only replaced after an error. A simulated
+// pulse loop runs scripts with real lua conditions against a made up clock, the same way
+// OnPulse does. The benchmark compares parking sleeping scripts with looking at every one of
+// them each frame, and a reused condition thread with a new thread per check.
+// Only depends on LuaJIT and fmt, so this also builds elsewhere, for example:
+//
+//   g++ -std=c++17 -O2 -I../.. -I/usr/include/luajit-2.1 App.cpp ../../plugins/lua/LuaScheduler.cpp
+//       -lluajit-5.1 -lfmt -o LuaSchedulerTests
+//
+// Run with --help for the benchmark options.
+
+#include "plugins/lua/LuaScheduler.h"
+#include "tests/TestHarness.h"
+
+#include <fmt/format.h>
+#include <lua.hpp>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace mq::lua;
+using namespace mq::test;
+
+static int s_scripts = 200;
+static int s_seconds = 60;
+static int s_checks = 200000;
+
+// Frames are about 60 per second
+static constexpr uint64_t FRAME_TIME = 16;
+
+class LuaState
+{
+public:
+	LuaState()
+		: L(luaL_newstate())
+	{
+		luaL_openlibs(L);
+	}
+
+	~LuaState() { lua_close(L); }
+
+	void Run(const char* code)
+	{
+		if (luaL_dostring(L, code) != 0)
+		{
+			fmt::print("lua error: {}\n", lua_tostring(L, -1));
+			lua_pop(L, 1);
+			CHECK(false);
+		}
+	}
+
+	int GetInt(const char* code)
+	{
+		Run(code);
+		const int value = static_cast<int>(lua_tointeger(L, -1));
+		lua_pop(L, 1);
+		return value;
+	}
+
+	// calls a global function on the condition thread
+	bool Check(LuaConditionThread& condition, const char* function, std::string& error)
+	{
+		lua_getglobal(L, function);
+		return condition.Check(L, error);
+	}
+
+	lua_State* L;
+};
+
+// A script parked on the timer queue, which logs when it's woken
+struct FakeThread
+{
+	int id = 0;
+	std::vector<int>* log = nullptr;
+	uint64_t parkedUntil = 0;
+	int wakes = 0;
+
+	uint64_t GetParkedUntil() const { return parkedUntil; }
+	void Park(uint64_t wakeTime) { parkedUntil = wakeTime; }
+	void Wake() { parkedUntil = 0; ++wakes; if (log) log->push_back(id); }
+};
+
+static std::shared_ptr<FakeThread> MakeThread(int id, std::vector<int>& log)
+{
+	auto thread = std::make_shared<FakeThread>();
+	thread->id = id;
+	thread->log = &log;
+	return thread;
+}
+
+//============================================================================
+// Timer queue
+
+TEST_CASE(TestWakeOrder)
+{
+	std::vector<int> log;
+	LuaTimerQueue<FakeThread> timers;
+
+	auto a = MakeThread(1, log), b = MakeThread(2, log), c = MakeThread(3, log);
+	timers.Park(a, 300);
+	timers.Park(b, 100);
+	timers.Park(c, 200);
+	CHECK(a->GetParkedUntil() == 300);
+
+	CHECK(timers.WakeDue(99) == 0);
+	CHECK(timers.WakeDue(200) == 2);
+	CHECK((log == std::vector<int>{ 2, 3 }));
+	CHECK(a->GetParkedUntil() == 300);
+	CHECK(b->GetParkedUntil() == 0);
+
+	CHECK(timers.WakeDue(1000) == 1);
+	CHECK((log == std::vector<int>{ 2, 3, 1 }));
+	CHECK(timers.IsEmpty());
+}
+
+TEST_CASE(TestWokenEarlyIsDropped)
+{
+	std::vector<int> log;
+	LuaTimerQueue<FakeThread> timers;
+
+	// a bind came in, or the script was told to exit
+	auto thread = MakeThread(1, log);
+	timers.Park(thread, 100);
+	thread->Wake();
+
+	CHECK(timers.WakeDue(100) == 0);
+	CHECK(thread->wakes == 1);
+	CHECK(timers.IsEmpty());
+}
+
+TEST_CASE(TestParkedAgainIsWokenOnce)
+{
+	std::vector<int> log;
+	LuaTimerQueue<FakeThread> timers;
+
+	// woken early, ran, and went back to sleep for longer
+	auto thread = MakeThread(1, log);
+	timers.Park(thread, 100);
+	thread->Wake();
+	timers.Park(thread, 500);
+	CHECK(timers.GetSize() == 2);
+
+	CHECK(timers.WakeDue(100) == 0);
+	CHECK(thread->GetParkedUntil() == 500);
+	CHECK(timers.WakeDue(500) == 1);
+	CHECK(thread->wakes == 2);
+}
+
+TEST_CASE(TestEndedThreadIsDropped)
+{
+	std::vector<int> log;
+	LuaTimerQueue<FakeThread> timers;
+
+	auto thread = MakeThread(1, log);
+	timers.Park(thread, 100);
+	thread.reset();
+
+	CHECK(timers.WakeDue(100) == 0);
+	CHECK(log.empty());
+	CHECK(timers.IsEmpty());
+}
+
+//============================================================================
+// Delay timing
+
+TEST_CASE(TestDelayRunsOut)
+{
+	LuaDelayTimer delay;
+	CHECK(!delay.IsActive());
+
+	delay.Start(1100, false, 1000, 50);
+	CHECK(delay.IsActive());
+	CHECK(delay.GetWakeTime() == 1100);
+
+	// without a condition the interval doesn't matter
+	CHECK(delay.Update(1099, 50) == LuaDelayTimer::Status::Waiting);
+	CHECK(delay.Update(1100, 50) == LuaDelayTimer::Status::Expired);
+
+	delay.Clear();
+	CHECK(!delay.IsActive());
+}
+
+TEST_CASE(TestConditionIsCheckedAtInterval)
+{
+	LuaDelayTimer delay;
+	delay.Start(2000, true, 1000, 100);
+	CHECK(delay.GetWakeTime() == 1100);
+
+	CHECK(delay.Update(1050, 100) == LuaDelayTimer::Status::Waiting);
+	CHECK(delay.Update(1116, 100) == LuaDelayTimer::Status::CheckCondition);
+
+	// the next check is an interval after this one, not after when it was due
+	CHECK(delay.GetWakeTime() == 1216);
+	CHECK(delay.Update(1200, 100) == LuaDelayTimer::Status::Waiting);
+	CHECK(delay.Update(1216, 100) == LuaDelayTimer::Status::CheckCondition);
+}
+
+TEST_CASE(TestConditionEveryFrame)
+{
+	// an interval of zero is due every time it's looked at, so it's never parked
+	LuaDelayTimer delay;
+	delay.Start(2000, true, 1000, 0);
+	CHECK(delay.GetWakeTime() == 1000);
+
+	CHECK(delay.Update(1000, 0) == LuaDelayTimer::Status::CheckCondition);
+	CHECK(delay.GetWakeTime() == 1000);
+	CHECK(delay.Update(1016, 0) == LuaDelayTimer::Status::CheckCondition);
+	CHECK(delay.GetWakeTime() == 1016);
+}
+
+TEST_CASE(TestTimeoutBeforeNextCheck)
+{
+	LuaDelayTimer delay;
+	delay.Start(1150, true, 1000, 100);
+
+	CHECK(delay.Update(1100, 100) == LuaDelayTimer::Status::CheckCondition);
+
+	// the delay runs out before the condition is due again
+	CHECK(delay.GetWakeTime() == 1150);
+	CHECK(delay.Update(1150, 100) == LuaDelayTimer::Status::Expired);
+}
+
+TEST_CASE(TestDroppedConditionOnlyWaitsForTimeout)
+{
+	LuaDelayTimer delay;
+	delay.Start(1500, true, 1000, 100);
+
+	// what ShouldRun does when the condition failed with an error
+	delay.hasCondition = false;
+	CHECK(delay.GetWakeTime() == 1500);
+	CHECK(delay.Update(1200, 100) == LuaDelayTimer::Status::Waiting);
+}
+
+//============================================================================
+// Condition thread
+
+TEST_CASE(TestConditionThreadIsReused)
+{
+	LuaState state;
+	state.Run(R"(
+		threads = setmetatable({}, { __mode = 'k' })
+		calls = 0
+		function cond()
+			threads[coroutine.running()] = true
+			calls = calls + 1
+			return calls >= 3
+		end
+		function count_threads()
+			local n = 0
+			for _ in pairs(threads) do n = n + 1 end
+			return n
+		end
+	)");
+
+	LuaConditionThread condition;
+	std::string error;
+
+	CHECK(!state.Check(condition, "cond", error));
+	lua_State* thread = condition.GetThread();
+	CHECK(thread != nullptr);
+	CHECK(thread != state.L);
+
+	CHECK(!state.Check(condition, "cond", error));
+	CHECK(state.Check(condition, "cond", error));
+	CHECK(error.empty());
+
+	CHECK(condition.GetThread() == thread);
+	CHECK(state.GetInt("return count_threads()") == 1);
+	CHECK(lua_gettop(state.L) == 0);
+
+	// the thread is kept alive while it's in use, and can be collected once it's released
+	lua_gc(state.L, LUA_GCCOLLECT, 0);
+	CHECK(state.GetInt("return count_threads()") == 1);
+
+	condition.Reset();
+	CHECK(condition.GetThread() == nullptr);
+	lua_gc(state.L, LUA_GCCOLLECT, 0);
+	CHECK(state.GetInt("return count_threads()") == 0);
+}
+
+TEST_CASE(TestFailedCheckReplacesThread)
+{
+	LuaState state;
+	state.Run(R"(
+		threads = {}
+		function cond()
+			threads[#threads + 1] = coroutine.running()
+			return false
+		end
+		function broken()
+			threads[#threads + 1] = coroutine.running()
+			error('boom')
+		end
+	)");
+
+	LuaConditionThread condition;
+	std::string error;
+
+	CHECK(!state.Check(condition, "cond", error));
+	CHECK(!state.Check(condition, "broken", error));
+	CHECK(error.find("boom") != std::string::npos);
+	CHECK(condition.GetThread() == nullptr);
+
+	error.clear();
+	CHECK(!state.Check(condition, "cond", error));
+	CHECK(error.empty());
+
+	CHECK(state.GetInt("return #threads") == 3);
+	CHECK(state.GetInt("return threads[1] == threads[2] and 1 or 0") == 1);
+	CHECK(state.GetInt("return threads[2] ~= threads[3] and 1 or 0") == 1);
+	CHECK(lua_gettop(state.L) == 0);
+}
+
+TEST_CASE(TestConditionResultIsTruthiness)
+{
+	LuaState state;
+	state.Run(R"(
+		function returns_nil() return nil end
+		function returns_nothing() end
+		function returns_zero() return 0 end
+		function returns_string() return 'yes' end
+		function returns_two() return false, true end
+	)");
+
+	LuaConditionThread condition;
+	std::string error;
+
+	CHECK(!state.Check(condition, "returns_nil", error));
+	CHECK(!state.Check(condition, "returns_nothing", error));
+	CHECK(state.Check(condition, "returns_zero", error));
+	CHECK(state.Check(condition, "returns_string", error));
+	CHECK(!state.Check(condition, "returns_two", error));
+	CHECK(error.empty());
+	CHECK(lua_gettop(condition.GetThread()) == 0);
+}
+
+//============================================================================
+// Simulated pulse loop
+
+// A script sleeping in mq.delay, with an optional condition that is a global lua function
+struct SimulatedScript
+{
+	int id = 0;
+	const char* condition = nullptr;
+
+	LuaDelayTimer delay;
+	LuaConditionThread conditionThread;
+
+	uint64_t parkedUntil = 0;
+	uint64_t resumedAt = 0;
+	int looks = 0;
+	int conditionChecks = 0;
+
+	uint64_t GetParkedUntil() const { return parkedUntil; }
+	void Park(uint64_t wakeTime) { parkedUntil = wakeTime; }
+	void Wake() { parkedUntil = 0; }
+};
+
+using ScriptPtr = std::shared_ptr<SimulatedScript>;
+
+class SimulatedPulse
+{
+public:
+	SimulatedPulse(LuaState& state, uint32_t conditionInterval, bool park = true)
+		: m_state(state)
+		, m_conditionInterval(conditionInterval)
+		, m_park(park)
+	{
+	}
+
+	ScriptPtr Delay(int id, uint64_t delay, const char* condition = nullptr)
+	{
+		auto script = std::make_shared<SimulatedScript>();
+		script->id = id;
+		script->condition = condition;
+		script->delay.Start(m_now + delay, condition != nullptr, m_now, m_conditionInterval);
+
+		m_scripts.push_back(script);
+		return script;
+	}
+
+	// one OnPulse: wake what's due, then look at every script that isn't parked
+	void Frame()
+	{
+		m_now += FRAME_TIME;
+		m_timers.WakeDue(m_now);
+
+		for (const ScriptPtr& script : m_scripts)
+		{
+			if (script->resumedAt != 0 || script->GetParkedUntil() != 0)
+				continue;
+
+			++script->looks;
+			if (ShouldRun(*script))
+			{
+				script->resumedAt = m_now;
+				m_resumeOrder.push_back(script->id);
+				continue;
+			}
+
+			const uint64_t wakeTime = script->delay.GetWakeTime();
+			if (m_park && wakeTime > m_now)
+				m_timers.Park(script, wakeTime);
+		}
+	}
+
+	void RunUntil(uint64_t time)
+	{
+		while (m_now < time)
+			Frame();
+	}
+
+	uint64_t GetNow() const { return m_now; }
+	const std::vector<int>& GetResumeOrder() const { return m_resumeOrder; }
+
+private:
+	// what LuaCoroutine::ShouldRun does
+	bool ShouldRun(SimulatedScript& script)
+	{
+		switch (script.delay.Update(m_now, m_conditionInterval))
+		{
+		case LuaDelayTimer::Status::Expired:
+			script.delay.Clear();
+			return true;
+
+		case LuaDelayTimer::Status::CheckCondition:
+		{
+			++script.conditionChecks;
+
+			std::string error;
+			if (m_state.Check(script.conditionThread, script.condition, error))
+			{
+				script.delay.Clear();
+				return true;
+			}
+
+			if (!error.empty())
+				script.delay.hasCondition = false;
+			break;
+		}
+
+		case LuaDelayTimer::Status::Waiting:
+			break;
+		}
+
+		return false;
+	}
+
+	LuaState& m_state;
+	uint32_t m_conditionInterval;
+	bool m_park;
+	uint64_t m_now = 1000;
+
+	std::vector<ScriptPtr> m_scripts;
+	LuaTimerQueue<SimulatedScript> m_timers;
+	std::vector<int> m_resumeOrder;
+};
+
+TEST_CASE(TestScriptsResumeInWakeOrder)
+{
+	LuaState state;
+	SimulatedPulse pulse(state, 0);
+
+	auto slow = pulse.Delay(1, 1000);
+	auto fast = pulse.Delay(2, 100);
+	auto medium = pulse.Delay(3, 500);
+
+	pulse.RunUntil(3000);
+	CHECK((pulse.GetResumeOrder() == std::vector<int>{ 2, 3, 1 }));
+
+	// resumed on the first frame at or after the delay ran out
+	CHECK(fast->resumedAt >= 1100 && fast->resumedAt < 1100 + FRAME_TIME);
+	CHECK(medium->resumedAt >= 1500 && medium->resumedAt < 1500 + FRAME_TIME);
+	CHECK(slow->resumedAt >= 2000 && slow->resumedAt < 2000 + FRAME_TIME);
+
+	// looked at once to be parked and once when woken, not every frame
+	CHECK(slow->looks == 2);
+	CHECK(fast->looks == 2);
+}
+
+TEST_CASE(TestConditionTimesOut)
+{
+	LuaState state;
+	state.Run("function never() return false end");
+
+	SimulatedPulse pulse(state, 100);
+	auto script = pulse.Delay(1, 450, "never");
+
+	pulse.RunUntil(2000);
+
+	// checked about every 100ms until the delay ran out
+	CHECK(script->resumedAt >= 1450 && script->resumedAt < 1450 + FRAME_TIME);
+	CHECK(script->conditionChecks == 4);
+	CHECK(script->looks == script->conditionChecks + 2);
+}
+
+TEST_CASE(TestConditionEndsDelayEarly)
+{
+	LuaState state;
+	state.Run(R"(
+		ready = false
+		threads = {}
+		function is_ready()
+			threads[coroutine.running()] = true
+			return ready
+		end
+	)");
+
+	SimulatedPulse pulse(state, 100);
+	auto script = pulse.Delay(1, 10000, "is_ready");
+
+	pulse.RunUntil(1300);
+	CHECK(script->resumedAt == 0);
+
+	state.Run("ready = true");
+	pulse.RunUntil(2000);
+
+	// resumed at the first check after the condition came true
+	CHECK(script->resumedAt > 1300 && script->resumedAt <= 1300 + 100 + FRAME_TIME);
+	CHECK(script->conditionChecks >= 3);
+
+	// every check ran on the same thread
+	CHECK(state.GetInt("local n = 0 for _ in pairs(threads) do n = n + 1 end return n") == 1);
+}
+
+TEST_CASE(TestFailingConditionFallsBackToTimeout)
+{
+	LuaState state;
+	state.Run("function broken() error('nope') end");
+
+	SimulatedPulse pulse(state, 50);
+	auto script = pulse.Delay(1, 300, "broken");
+
+	pulse.RunUntil(2000);
+	CHECK(script->conditionChecks == 1);
+	CHECK(script->resumedAt >= 1300 && script->resumedAt < 1300 + FRAME_TIME);
+	CHECK(script->conditionThread.GetThread() == nullptr);
+}
+
+//============================================================================
+
+static void RunBenchmark()
+{
+	LuaState state;
+	state.Run("function never() return false end");
+
+	fmt::print("Lua scheduling: {} scripts sleeping for up to {} seconds\n\n", s_scripts, s_seconds);
+	fmt::print("  {:<30} {:>12} {:>12}\n", "", "looks", "ns/frame");
+
+	for (const bool park : { false, true })
+	{
+		SimulatedPulse pulse(state, 250, park);
+
+		std::vector<ScriptPtr> scripts;
+		for (int i = 0; i < s_scripts; ++i)
+		{
+			// every fourth script waits on a condition that is checked every 250ms
+			const uint64_t delay = 1 + (i * 7919ULL) % 10000;
+			scripts.push_back(pulse.Delay(i, delay * s_seconds / 10, i % 4 == 0 ? "never" : nullptr));
+		}
+
+		const int frames = static_cast<int>(s_seconds * 1000 / FRAME_TIME) + 1;
+		const double frameNs = TimePerCallNs(frames, [&](int) { pulse.Frame(); });
+
+		uint64_t looks = 0;
+		for (const ScriptPtr& script : scripts)
+		{
+			CHECK(script->resumedAt != 0);
+			looks += script->looks;
+		}
+
+		fmt::print("  {:<30} {:>12} {:>12.1f}\n", park ? "parked on timers" : "looked at every frame", looks, frameNs);
+	}
+
+	fmt::print("\n");
+
+	// what mq.delay conditions cost before the thread was reused
+	const double newThreadNs = TimePerCallNs(s_checks,
+		[&](int)
+		{
+			LuaConditionThread condition;
+			std::string error;
+			state.Check(condition, "never", error);
+		});
+
+	LuaConditionThread reused;
+	const double reusedNs = TimePerCallNs(s_checks,
+		[&](int)
+		{
+			std::string error;
+			state.Check(reused, "never", error);
+		});
+
+	fmt::print("  {:<30} {:>12.1f} ns\n", "condition on a new thread", newThreadNs);
+	fmt::print("  {:<30} {:>12.1f} ns\n", "condition on a reused thread", reusedNs);
+}
+
+int main(int argc, char* argv[])
+{
+	CommandLine commandLine("LuaSchedulerTests");
+	commandLine.Add("--scripts", s_scripts, 1, "sleeping scripts in the benchmark");
+	commandLine.Add("--seconds", s_seconds, 1, "simulated seconds the scripts sleep for at most");
+	commandLine.Add("--checks", s_checks, 1, "delay conditions checked each way");
+
+	return Main(commandLine, argc, argv, RunBenchmark);
+}
@@ -0,0 +1,317 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// Tests and a benchmark for how lua scripts share each frame's time budget
+// (plugins/lua/LuaTimeSlice.h). Frames are simulated on a made up clock, with heavy scripts that
+// use all of their slice and light scripts that are done early. The tests check how the budget is
+// split, the minimum slice, that rotating the order puts every script in every place, and how
+// the count hook's interval follows the cost of a script's instructions. The benchmark prints
+// how a mix of scripts shares the budget and what a clock check in the hook costs.
+// Only depends on fmt, so this also builds elsewhere, for example:
+//
+//   g++ -std=c++17 -O2 -I../.. App.cpp ../../plugins/lua/LuaTimeSlice.cpp -lfmt -o LuaTimeSliceTests
+//
+// Run with --help for the benchmark options.
+
+#include "plugins/lua/LuaTimeSlice.h"
+#include "tests/TestHarness.h"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace mq::lua;
+using namespace mq::test;
+
+using std::chrono::microseconds;
+using std::chrono::nanoseconds;
+
+static int s_budget = 2000;
+static int s_heavy = 2;
+static int s_light = 6;
+static int s_frames = 1000;
+
+// A script that wants to run for a while each frame, and runs until it is done or its slice is up
+struct SimulatedScript
+{
+	int id = 0;
+	microseconds wants{ 0 };
+
+	microseconds total{ 0 };
+	microseconds lastSlice{ 0 };
+	int frames = 0;
+};
+
+using Scripts = std::vector<SimulatedScript>;
+
+static Scripts MakeScripts(int heavy, int light, microseconds lightWants = microseconds{ 10 })
+{
+	Scripts scripts;
+	for (int i = 0; i < heavy; ++i)
+		scripts.push_back({ static_cast<int>(scripts.size()), microseconds{ 1'000'000 } });
+	for (int i = 0; i < light; ++i)
+		scripts.push_back({ static_cast<int>(scripts.size()), lightWants });
+
+	return scripts;
+}
+
+// Runs one frame the way OnPulse does, returning the time all of the scripts ran for
+static microseconds RunFrame(Scripts& scripts, microseconds budget)
+{
+	RotateRunOrder(scripts);
+
+	microseconds used{ 0 };
+	size_t scriptsLeft = scripts.size();
+
+	for (SimulatedScript& script : scripts)
+	{
+		script.lastSlice = GetTimeSlice(budget, used, scriptsLeft);
+		--scriptsLeft;
+
+		const microseconds ran = budget.count() > 0 ? std::min(script.wants, script.lastSlice) : script.wants;
+		script.total += ran;
+		++script.frames;
+		used += ran;
+	}
+
+	return used;
+}
+
+static const SimulatedScript& FindScript(const Scripts& scripts, int id)
+{
+	return *std::find_if(scripts.begin(), scripts.end(), [id](const SimulatedScript& script) { return script.id == id; });
+}
+
+//============================================================================
+
+TEST_CASE(TestHeavyScriptsSplitTheBudgetEvenly)
+{
+	Scripts scripts = MakeScripts(4, 0);
+
+	CHECK(RunFrame(scripts, microseconds{ 2000 }) == microseconds{ 2000 });
+	for (const SimulatedScript& script : scripts)
+		CHECK(script.lastSlice == microseconds{ 500 });
+}
+
+TEST_CASE(TestLightScriptsLeaveTheirShareToHeavyOnes)
+{
+	Scripts scripts = MakeScripts(1, 3);
+	const microseconds budget{ 2000 };
+
+	// one frame with the heavy script in each position
+	for (int frame = 0; frame < 4; ++frame)
+	{
+		CHECK(RunFrame(scripts, budget) <= budget);
+
+		for (const SimulatedScript& script : scripts)
+		{
+			if (script.id != 0)
+				CHECK(script.lastSlice >= microseconds{ 500 });
+		}
+	}
+
+	// first it gets a quarter, second a third of what's left, then half, then everything that's left
+	const SimulatedScript& heavy = FindScript(scripts, 0);
+	CHECK(heavy.total == microseconds{ 500 + 663 + 990 + 1970 });
+	CHECK(heavy.frames == 4);
+
+	for (int id = 1; id < 4; ++id)
+		CHECK(FindScript(scripts, id).total == microseconds{ 40 });
+}
+
+TEST_CASE(TestMinimumSlice)
+{
+	// more scripts than the budget can give the minimum to
+	Scripts scripts = MakeScripts(10, 0);
+	CHECK(RunFrame(scripts, microseconds{ 100 }) == MIN_TIME_SLICE * 10);
+	for (const SimulatedScript& script : scripts)
+		CHECK(script.lastSlice == MIN_TIME_SLICE);
+
+	// a budget that is already spent, or overspent by a script that ran long
+	CHECK(GetTimeSlice(microseconds{ 2000 }, microseconds{ 2000 }, 3) == MIN_TIME_SLICE);
+	CHECK(GetTimeSlice(microseconds{ 2000 }, microseconds{ 5000 }, 1) == MIN_TIME_SLICE);
+
+	// a share that would be just under the minimum
+	CHECK(GetTimeSlice(microseconds{ 2000 }, microseconds{ 1900 }, 2) == MIN_TIME_SLICE);
+	CHECK(GetTimeSlice(microseconds{ 2000 }, microseconds{ 1800 }, 2) == microseconds{ 100 });
+
+	// the last script gets everything that is left
+	CHECK(GetTimeSlice(microseconds{ 2000 }, microseconds{ 700 }, 1) == microseconds{ 1300 });
+}
+
+TEST_CASE(TestNoBudgetUsesInstructionCount)
+{
+	CHECK(GetTimeSlice(microseconds{ 0 }, microseconds{ 0 }, 1) == microseconds{ 0 });
+	CHECK(GetTimeSlice(microseconds{ 0 }, microseconds{ 5000 }, 4) == microseconds{ 0 });
+
+	Scripts scripts = MakeScripts(2, 1);
+	RunFrame(scripts, microseconds{ 0 });
+	for (const SimulatedScript& script : scripts)
+		CHECK(script.lastSlice == microseconds{ 0 });
+}
+
+TEST_CASE(TestUsedTimeIsPartMicroseconds)
+{
+	// part of a microsecond used doesn't take a microsecond from the budget
+	CHECK(GetTimeSlice(microseconds{ 2000 }, nanoseconds{ 999 }, 1) == microseconds{ 2000 });
+	CHECK(GetTimeSlice(microseconds{ 2000 }, nanoseconds{ 1001 }, 1) == microseconds{ 1999 });
+}
+
+TEST_CASE(TestRotation)
+{
+	std::vector<int> order = { 1, 2, 3, 4 };
+	RotateRunOrder(order);
+	CHECK((order == std::vector<int>{ 2, 3, 4, 1 }));
+
+	// back where it started after one frame per script
+	for (int i = 0; i < 3; ++i)
+		RotateRunOrder(order);
+	CHECK((order == std::vector<int>{ 1, 2, 3, 4 }));
+
+	std::vector<int> single = { 1 };
+	RotateRunOrder(single);
+	CHECK((single == std::vector<int>{ 1 }));
+
+	std::vector<int> empty;
+	RotateRunOrder(empty);
+	CHECK(empty.empty());
+}
+
+TEST_CASE(TestRotationGivesEveryScriptEveryPlace)
+{
+	// without rotating, the script that runs first would always be held to an even share
+	Scripts scripts = MakeScripts(2, 2);
+	const int cycles = 25;
+	const int frames = static_cast<int>(scripts.size()) * cycles;
+
+	int places[4][4] = {};
+	for (int frame = 0; frame < frames; ++frame)
+	{
+		RunFrame(scripts, microseconds{ 2000 });
+
+		for (size_t place = 0; place < scripts.size(); ++place)
+			++places[scripts[place].id][place];
+	}
+
+	for (const auto& script : places)
+	{
+		for (int count : script)
+			CHECK(count == cycles);
+	}
+
+	// so both heavy scripts get some of what the light ones leave
+	for (int id = 0; id < 2; ++id)
+	{
+		CHECK(FindScript(scripts, id).total > microseconds{ 500 } * frames);
+		CHECK(FindScript(scripts, id).frames == frames);
+	}
+}
+
+TEST_CASE(TestHookIntervalFollowsInstructionCost)
+{
+	// already checking every period
+	CHECK(GetHookInterval(1000, HOOK_CHECK_PERIOD) == 1000);
+
+	// twice as slow as wanted aims for half, and moves halfway there
+	CHECK(GetHookInterval(1000, HOOK_CHECK_PERIOD * 2) == 750);
+
+	// twice as fast aims for double
+	CHECK(GetHookInterval(1000, nanoseconds{ HOOK_CHECK_PERIOD } / 2) == 1500);
+
+	// no time measured leaves it alone
+	CHECK(GetHookInterval(1000, nanoseconds{ 0 }) == 1000);
+
+	// a very slow call can't stop the hook from firing, and a very fast loop doesn't go unchecked
+	CHECK(GetHookInterval(MIN_HOOK_INTERVAL, std::chrono::seconds{ 1 }) == MIN_HOOK_INTERVAL);
+	CHECK(GetHookInterval(MAX_HOOK_INTERVAL, nanoseconds{ 1 }) == MAX_HOOK_INTERVAL);
+}
+
+TEST_CASE(TestHookIntervalConverges)
+{
+	struct Case { nanoseconds perInstruction; int expected; };
+	const Case cases[] = {
+		{ nanoseconds{ 5 }, 5000 },     // pure lua
+		{ nanoseconds{ 100 }, 250 },    // calling into TLOs
+		{ nanoseconds{ 1000 }, MIN_HOOK_INTERVAL },
+	};
+
+	for (const Case& test : cases)
+	{
+		int interval = 500;
+		for (int i = 0; i < 100; ++i)
+			interval = GetHookInterval(interval, test.perInstruction * interval);
+
+		CHECK(std::abs(interval - test.expected) <= 1);
+	}
+}
+
+//============================================================================
+
+static void RunBenchmark()
+{
+	Scripts scripts = MakeScripts(s_heavy, s_light, microseconds{ 20 });
+	const microseconds budget{ s_budget };
+
+	microseconds longest{ 0 };
+	microseconds total{ 0 };
+	for (int frame = 0; frame < s_frames; ++frame)
+	{
+		const microseconds used = RunFrame(scripts, budget);
+		longest = std::max(longest, used);
+		total += used;
+	}
+
+	fmt::print("Lua time slices: {} us budget, {} heavy and {} light scripts, {} frames\n\n", s_budget, s_heavy, s_light, s_frames);
+	fmt::print("  {:<24} {:>10.1f} us\n", "average frame", static_cast<double>(total.count()) / s_frames);
+	fmt::print("  {:<24} {:>10} us\n", "longest frame", longest.count());
+
+	for (const SimulatedScript& script : scripts)
+	{
+		CHECK(script.frames == s_frames);
+		// the first of each kind
+		if ((script.id == 0 && s_heavy > 0) || script.id == s_heavy)
+		{
+			fmt::print("  {:<24} {:>10.1f} us\n", fmt::format("{} script per frame", script.id < s_heavy ? "heavy" : "light"),
+				static_cast<double>(script.total.count()) / s_frames);
+		}
+	}
+
+	// what the count hook does each time it fires inside a slice
+	int interval = 500;
+	auto last = std::chrono::steady_clock::now();
+	const double checkNs = TimePerCallNs(1'000'000,
+		[&](int)
+		{
+			const auto now = std::chrono::steady_clock::now();
+			interval = GetHookInterval(interval, now - last);
+			last = now;
+		});
+
+	fmt::print("  {:<24} {:>10.1f} ns\n", "hook clock check", checkNs);
+}
+
+int main(int argc, char* argv[])
+{
+	CommandLine commandLine("LuaTimeSliceTests");
+	commandLine.Add("--budget", s_budget, 0, "lua time per frame, in microseconds");
+	commandLine.Add("--heavy", s_heavy, 0, "scripts that would use all of the time they get");
+	commandLine.Add("--light", s_light, 0, "scripts that run for 20us each frame");
+	commandLine.Add("--frames", s_frames, 1, "frames to simulate");
+
+	return Main(commandLine, argc, argv, RunBenchmark);
+}
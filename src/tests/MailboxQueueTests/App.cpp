@@ -0,0 +1,427 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// Tests and a benchmark for bounded mailbox queues (routing/PostOffice.h): what each
+// MailboxOverflowPolicy does with a full queue, the MsgError_QueueFull reply that RPC senders get
+// when their message is dropped, and the limit on messages waiting for a pipe's main thread. The
+// RPC tests go over a real pipe, so only depends on the routing library, protobuf, lz4, spdlog and
+// fmt, and this also builds elsewhere (over a unix domain socket), for example:
+//
+//   protoc --cpp_out=../../routing -I../../routing ../../routing/Routing.proto
+//   g++ -std=c++17 -O2 -I../.. -I../../routing App.cpp ../../routing/PostOffice.cpp ../../routing/NamedPipes.cpp
+//       ../../routing/PipeTransport.cpp ../../routing/Routing.pb.cc -lprotobuf -llz4 -lspdlog -lfmt -pthread
+//       -o MailboxQueueTests
+//
+// Run with --help for the benchmark options.
+
+#include "routing/PostOffice.h"
+#include "routing/Routing.h"
+#include "tests/TestHarness.h"
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace mq;
+using namespace mq::postoffice;
+using namespace mq::test;
+using namespace std::chrono_literals;
+
+static int s_messages = 200000;
+static int s_queueSize = 1024;
+
+constexpr auto PIPE_TIMEOUT = std::chrono::seconds(10);
+
+static proto::routing::Address MakeAddress(uint32_t pid, const std::string& mailbox)
+{
+	proto::routing::Address address;
+	address.set_pid(pid);
+	address.set_mailbox(mailbox);
+	return address;
+}
+
+static PipeMessagePtr MakeMessage(const std::string& payload, bool rpc = false)
+{
+	PipeMessagePtr message = StuffEnvelope(MakeAddress(1, "box"), MakeAddress(2, "sender"), EnvelopePayload(payload));
+	if (rpc)
+		message->SetRequestMode(MQRequestMode::CallAndResponse);
+
+	return message;
+}
+
+// A post office with the one mailbox, "box", that keeps the payloads it receives. RPC messages
+// are answered with status 0 when they are received.
+class TestPostOffice : public PostOffice
+{
+public:
+	explicit TestPostOffice(const MailboxLimits& limits)
+	{
+		SetDefaultMailboxLimits(limits);
+
+		m_dropbox = RegisterAddress("box",
+			[this](ProtoMessagePtr&& message)
+			{
+				received.emplace_back(message->get<const char>(), message->size());
+				message->SendReply(static_cast<uint8_t>(0));
+			});
+	}
+
+	void RouteMessage(PipeMessagePtr&& message, const PipeMessageResponseCb& callback) override {}
+
+	// Delivers a message to the mailbox, keeping the status of a failed delivery
+	bool Deliver(PipeMessagePtr&& message)
+	{
+		return DeliverTo("box", std::move(message),
+			[this](int status, PipeMessagePtr&& message)
+			{
+				failedStatus = status;
+				failedMessage = std::move(message);
+			});
+	}
+
+	bool Deliver(const std::string& payload) { return Deliver(MakeMessage(payload)); }
+
+	const Mailbox& GetMailbox() const { return *m_mailboxes.at("box"); }
+
+	std::vector<std::string> received;
+	int failedStatus = 0;
+	PipeMessagePtr failedMessage;
+
+private:
+	Dropbox m_dropbox;
+};
+
+// A pipe server that delivers every routed message to a post office's mailbox, and a client
+// connected to it that the tests send from
+class TestPipes
+{
+public:
+	explicit TestPipes(TestPostOffice& postOffice)
+		: m_endpoint(MakeEndpoint())
+		, m_server(m_endpoint.c_str())
+		, m_client(m_endpoint.c_str())
+	{
+		m_server.SetHandler(std::make_shared<ServerEvents>(postOffice));
+		m_server.Start();
+		m_client.Start();
+
+		m_connected = PumpUntil([this] { return m_client.IsConnected(); });
+	}
+
+	~TestPipes()
+	{
+		m_client.Stop();
+		m_server.Stop();
+	}
+
+	bool IsConnected() const { return m_connected; }
+	ProtoPipeServer& GetServer() { return m_server; }
+
+	// Sends an RPC message from the client, keeping the status of the reply in status
+	void Request(const std::string& payload, int& status, std::string* replyPayload = nullptr)
+	{
+		m_client.SendMessageWithResponse(MakeMessage(payload, true),
+			[&status, replyPayload](int replyStatus, PipeMessagePtr&& reply)
+			{
+				status = replyStatus;
+
+				EnvelopeHeader envelope;
+				if (replyPayload != nullptr && reply != nullptr && envelope.Peek(reply))
+					*replyPayload = envelope.GetPayload();
+			});
+	}
+
+	void Send(const std::string& payload) { m_client.SendMessage(MakeMessage(payload)); }
+
+	// Processes both ends until done returns true, the server end only if processServer is set
+	template <typename Func>
+	bool PumpUntil(Func&& done, bool processServer = true)
+	{
+		const auto start = bench_clock::now();
+		while (!done())
+		{
+			if (bench_clock::now() - start > PIPE_TIMEOUT)
+				return false;
+
+			if (processServer)
+				m_server.Process();
+			m_client.Process();
+
+			std::this_thread::sleep_for(1ms);
+		}
+
+		return true;
+	}
+
+private:
+	class ServerEvents : public NamedPipeEvents
+	{
+	public:
+		ServerEvents(TestPostOffice& postOffice) : m_postOffice(postOffice) {}
+
+		virtual void OnIncomingMessage(PipeMessagePtr&& message) override
+		{
+			if (message->GetMessageId() == MQMessageId::MSG_ROUTE)
+				m_postOffice.Deliver(std::move(message));
+		}
+
+	private:
+		TestPostOffice& m_postOffice;
+	};
+
+	static std::string MakeEndpoint()
+	{
+		static int s_endpoints = 0;
+		const std::string name = fmt::format("mqmailbox_{}_{}", GetCurrentProcessId(), ++s_endpoints);
+
+#if defined(_WIN32)
+		return fmt::format(R"(\\.\pipe\{})", name);
+#else
+		auto path = std::filesystem::temp_directory_path() / (name + ".sock");
+		return fmt::format("{}{}", UNIX_SOCKET_PREFIX, path.string());
+#endif
+	}
+
+	std::string m_endpoint;
+	ProtoPipeServer m_server;
+	ProtoPipeClient m_client;
+	bool m_connected = false;
+};
+
+//============================================================================
+
+TEST_CASE(TestDropOldest)
+{
+	TestPostOffice postOffice(MailboxLimits{ 2, MailboxOverflowPolicy::DropOldest });
+
+	CHECK(postOffice.Deliver("one"));
+	CHECK(postOffice.Deliver("two"));
+	CHECK(postOffice.Deliver("three"));
+
+	const MailboxStats& stats = postOffice.GetMailbox().GetStats();
+	CHECK(stats.enqueued == 3);
+	CHECK(stats.dropped == 1);
+	CHECK(stats.rejected == 0);
+	CHECK(stats.queueDepth == 2);
+	CHECK(stats.peakQueueDepth == 2);
+
+	postOffice.Process(10);
+	CHECK((postOffice.received == std::vector<std::string>{ "two", "three" }));
+	CHECK(stats.delivered == 2);
+	CHECK(stats.queueDepth == 0);
+}
+
+TEST_CASE(TestDropNewest)
+{
+	TestPostOffice postOffice(MailboxLimits{ 2, MailboxOverflowPolicy::DropNewest });
+
+	CHECK(postOffice.Deliver("one"));
+	CHECK(postOffice.Deliver("two"));
+
+	// the message is consumed, so it counts as delivered as far as the sender can tell
+	CHECK(postOffice.Deliver("three"));
+	CHECK(postOffice.failedStatus == 0);
+
+	const MailboxStats& stats = postOffice.GetMailbox().GetStats();
+	CHECK(stats.enqueued == 2);
+	CHECK(stats.dropped == 1);
+	CHECK(stats.rejected == 0);
+
+	postOffice.Process(10);
+	CHECK((postOffice.received == std::vector<std::string>{ "one", "two" }));
+}
+
+TEST_CASE(TestReject)
+{
+	TestPostOffice postOffice(MailboxLimits{ 2, MailboxOverflowPolicy::Reject });
+
+	CHECK(postOffice.Deliver("one"));
+	CHECK(postOffice.Deliver("two"));
+
+	// the message is handed back to the failure callback untouched
+	CHECK(!postOffice.Deliver("three"));
+	CHECK(postOffice.failedStatus == MsgError_QueueFull);
+	CHECK(postOffice.failedMessage != nullptr);
+
+	EnvelopeHeader envelope;
+	CHECK(postOffice.failedMessage != nullptr && envelope.Peek(postOffice.failedMessage));
+	CHECK(envelope.GetPayload() == "three");
+
+	const MailboxStats& stats = postOffice.GetMailbox().GetStats();
+	CHECK(stats.enqueued == 2);
+	CHECK(stats.dropped == 0);
+	CHECK(stats.rejected == 1);
+
+	// once there is room again, messages are accepted
+	postOffice.Process(1);
+	CHECK(postOffice.Deliver("four"));
+
+	postOffice.Process(10);
+	CHECK((postOffice.received == std::vector<std::string>{ "one", "two", "four" }));
+}
+
+TEST_CASE(TestUnbounded)
+{
+	TestPostOffice postOffice(MailboxLimits{ 0, MailboxOverflowPolicy::Reject });
+
+	for (int i = 0; i < 10000; ++i)
+		CHECK(postOffice.Deliver(fmt::format("{}", i)));
+
+	const MailboxStats& stats = postOffice.GetMailbox().GetStats();
+	CHECK(stats.enqueued == 10000);
+	CHECK(stats.dropped == 0 && stats.rejected == 0);
+	CHECK(stats.queueDepth == 10000);
+}
+
+TEST_CASE(TestDropNewestRepliesQueueFull)
+{
+	TestPostOffice postOffice(MailboxLimits{ 1, MailboxOverflowPolicy::DropNewest });
+	TestPipes pipes(postOffice);
+	CHECK(pipes.IsConnected());
+
+	pipes.Send("fills the queue");
+	CHECK(pipes.PumpUntil([&] { return postOffice.GetMailbox().GetStats().enqueued == 1; }));
+
+	int status = 1;
+	std::string reply;
+	pipes.Request("dropped", status, &reply);
+	CHECK(pipes.PumpUntil([&] { return status != 1; }));
+	CHECK(status == MsgError_QueueFull);
+
+	// like a routing failure, the reply carries the address that couldn't take the message
+	proto::routing::Address failed;
+	CHECK(failed.ParseFromString(reply));
+	CHECK(failed.mailbox() == "box");
+
+	postOffice.Process(10);
+	CHECK((postOffice.received == std::vector<std::string>{ "fills the queue" }));
+}
+
+TEST_CASE(TestDropOldestRepliesQueueFull)
+{
+	TestPostOffice postOffice(MailboxLimits{ 1, MailboxOverflowPolicy::DropOldest });
+	TestPipes pipes(postOffice);
+	CHECK(pipes.IsConnected());
+
+	int status = 1;
+	pipes.Request("dropped", status);
+	CHECK(pipes.PumpUntil([&] { return postOffice.GetMailbox().GetStats().enqueued == 1; }));
+
+	// the waiting request is pushed out by the next message, and its sender is told
+	pipes.Send("pushes it out");
+	CHECK(pipes.PumpUntil([&] { return status != 1; }));
+	CHECK(status == MsgError_QueueFull);
+
+	postOffice.Process(10);
+	CHECK((postOffice.received == std::vector<std::string>{ "pushes it out" }));
+}
+
+TEST_CASE(TestAcceptedRequestsAreAnswered)
+{
+	TestPostOffice postOffice(MailboxLimits{ 1, MailboxOverflowPolicy::DropNewest });
+	TestPipes pipes(postOffice);
+	CHECK(pipes.IsConnected());
+
+	int status = 1;
+	pipes.Request("accepted", status);
+	CHECK(pipes.PumpUntil([&] { postOffice.Process(1); return status != 1; }));
+	CHECK(status == 0);
+}
+
+TEST_CASE(TestPendingLimitRepliesQueueFull)
+{
+	TestPostOffice postOffice(MailboxLimits{ 0 });
+	TestPipes pipes(postOffice);
+	CHECK(pipes.IsConnected());
+
+	// while the server's main thread is busy, only one message can wait for it
+	pipes.GetServer().SetMaxPendingMessages(1);
+
+	int statuses[3] = { 1, 1, 1 };
+	for (int& status : statuses)
+		pipes.Request("waiting", status);
+
+	CHECK(pipes.PumpUntil([&] { return statuses[1] != 1 && statuses[2] != 1; }, false));
+	CHECK(statuses[0] == 1);
+	CHECK(statuses[1] == MsgError_QueueFull);
+	CHECK(statuses[2] == MsgError_QueueFull);
+	CHECK(pipes.GetServer().GetDroppedMessageCount() == 2);
+	CHECK(pipes.GetServer().GetPendingMessageCount() == 1);
+
+	// and the one that waited still gets through
+	CHECK(pipes.PumpUntil([&] { postOffice.Process(1); return statuses[0] != 1; }));
+	CHECK(statuses[0] == 0);
+}
+
+//============================================================================
+
+static void RunBenchmark()
+{
+	fmt::print("Mailbox queues: {} messages into a mailbox that holds {}, then processed\n\n", s_messages, s_queueSize);
+	fmt::print("  {:<12} {:>14} {:>12} {:>10} {:>10}\n", "policy", "deliver ns", "process ns", "dropped", "rejected");
+
+	std::vector<PipeMessagePtr> messages;
+	messages.reserve(s_messages);
+
+	const std::pair<MailboxOverflowPolicy, const char*> policies[] = {
+		{ MailboxOverflowPolicy::DropOldest, "DropOldest" },
+		{ MailboxOverflowPolicy::DropNewest, "DropNewest" },
+		{ MailboxOverflowPolicy::Reject, "Reject" },
+	};
+
+	for (const auto& [policy, name] : policies)
+	{
+		TestPostOffice postOffice(MailboxLimits{ static_cast<size_t>(s_queueSize), policy });
+
+		messages.clear();
+		for (int i = 0; i < s_messages; ++i)
+			messages.push_back(MakeMessage("a message that is about as long as a typical actor message"));
+
+		// a refused message is handed back to where it came from, so that no policy frees messages while
+		// being timed (freeing them one by one here skews the processing time that follows)
+		const double deliverNs = TimePerCallNs(s_messages,
+			[&](int i)
+			{
+				postOffice.DeliverTo("box", std::move(messages[i]),
+					[&message = messages[i]](int, PipeMessagePtr&& refused) { message = std::move(refused); });
+			});
+
+		const size_t queued = postOffice.GetMailbox().GetStats().queueDepth;
+		const double processNs = TimePerCallNs(1, [&](int) { postOffice.Process(queued); }) / std::max<size_t>(queued, 1);
+
+		const MailboxStats& stats = postOffice.GetMailbox().GetStats();
+		CHECK(stats.delivered == queued);
+		// every message is queued, dropped on arrival or refused, apart from those pushed out of the queue later
+		const uint64_t dropped = policy == MailboxOverflowPolicy::DropNewest ? stats.dropped : 0;
+		CHECK(stats.enqueued + dropped + stats.rejected == static_cast<uint64_t>(s_messages));
+
+		fmt::print("  {:<12} {:>14.1f} {:>12.1f} {:>10} {:>10}\n", name, deliverNs, processNs, stats.dropped, stats.rejected);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	spdlog::set_level(spdlog::level::err);
+
+	CommandLine commandLine("MailboxQueueTests");
+	commandLine.Add("--messages", s_messages, 1, "messages delivered for each policy");
+	commandLine.Add("--queue-size", s_queueSize, 1, "mailbox queue limit");
+
+	return Main(commandLine, argc, argv, RunBenchmark);
+}
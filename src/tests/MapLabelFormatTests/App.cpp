@@ -0,0 +1,327 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// Tests and a benchmark for compiled map label formats (plugins/map/MapLabelFormat.h). The
+// tests check how a format is split into literal text and specifiers, including %%, a trailing
+// % and specifiers the map doesn't know, when compiling gives a format a new id, and that the
+// hash a label is remembered by changes with the fields it shows and nothing else. Labels are
+// rendered from made up fields the same way MapObject renders them. The benchmark compares
+// rendering a label every frame with checking the hash and only rendering it when it changed.
+// Only depends on fmt, so this also builds elsewhere, for example:
+//
+//   g++ -std=c++17 -O2 -I../.. App.cpp ../../plugins/map/MapLabelFormat.cpp -lfmt -o MapLabelFormatTests
+//
+// Run with --help for the benchmark options.
+
+#include "plugins/map/MapLabelFormat.h"
+#include "tests/TestHarness.h"
+
+#include <fmt/format.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace mq::test;
+
+static int s_labels = 500;
+static int s_changing = 5;
+static int s_frames = 1000;
+
+// The fields of a made up spawn, by specifier
+using LabelFields = std::map<char, std::string>;
+
+// Renders a label the way MapObject::FormatString does, specifiers with no field pass through
+static std::string Render(const MapLabelFormat& format, const LabelFields& fields)
+{
+	std::string output;
+
+	for (const MapLabelFormat::Op& op : format.GetOps())
+	{
+		if (op.spec == 0)
+		{
+			output.append(op.text);
+			continue;
+		}
+
+		auto iter = fields.find(op.spec);
+		if (iter != fields.end())
+		{
+			output.append(iter->second);
+		}
+		else
+		{
+			output.append(1, '%');
+			output.append(1, op.spec);
+		}
+	}
+
+	return output;
+}
+
+static uint64_t Hash(const MapLabelFormat& format, const LabelFields& fields)
+{
+	return format.HashFields(
+		[&](char spec, uint64_t hash)
+		{
+			auto iter = fields.find(spec);
+			return iter != fields.end() ? HashLabelField(hash, iter->second) : hash;
+		});
+}
+
+// Remembers the label it last rendered the way MapObject::SetTextFromFormat does
+struct TestLabel
+{
+	bool Update(const MapLabelFormat& format, const LabelFields& fields)
+	{
+		const uint64_t hash = Hash(format, fields);
+		if (formatId == format.GetId() && textHash == hash)
+			return false;
+
+		text = Render(format, fields);
+		formatId = format.GetId();
+		textHash = hash;
+		return true;
+	}
+
+	std::string text;
+	uint32_t formatId = 0;
+	uint64_t textHash = 0;
+};
+
+static const LabelFields s_soandso = { { 'N', "Soandso" }, { 'l', "65" }, { 'C', "Warrior" }, { 'h', "100" } };
+
+// Lists the ops as text, literals quoted and specifiers as %x
+static std::string DescribeOps(const MapLabelFormat& format)
+{
+	std::string description;
+	for (const MapLabelFormat::Op& op : format.GetOps())
+	{
+		if (!description.empty())
+			description += ' ';
+
+		if (op.spec == 0)
+			description += fmt::format("'{}'", op.text);
+		else
+			description += fmt::format("%{}", op.spec);
+	}
+
+	return description;
+}
+
+//============================================================================
+
+TEST_CASE(TestLiteralsAndSpecifiers)
+{
+	MapLabelFormat format("%N (%l %C)");
+	CHECK(DescribeOps(format) == "%N ' (' %l ' ' %C ')'");
+	CHECK(Render(format, s_soandso) == "Soandso (65 Warrior)");
+
+	CHECK(DescribeOps(MapLabelFormat("just text")) == "'just text'");
+	CHECK(DescribeOps(MapLabelFormat("%N%l")) == "%N %l");
+}
+
+TEST_CASE(TestEmptyFormat)
+{
+	MapLabelFormat format("");
+	CHECK(format.GetOps().empty());
+	CHECK(format.GetId() != 0);
+	CHECK(Render(format, s_soandso).empty());
+}
+
+TEST_CASE(TestEscapedPercent)
+{
+	// %% is literal text, and joins the text around it
+	MapLabelFormat format("%h%% health");
+	CHECK(DescribeOps(format) == "%h '% health'");
+	CHECK(Render(format, s_soandso) == "100% health");
+
+	CHECK(DescribeOps(MapLabelFormat("%%")) == "'%'");
+	CHECK(DescribeOps(MapLabelFormat("a%%%%b")) == "'a%%b'");
+	CHECK(DescribeOps(MapLabelFormat("%%N")) == "'%N'");
+}
+
+TEST_CASE(TestTrailingPercent)
+{
+	CHECK(DescribeOps(MapLabelFormat("%")) == "'%'");
+	CHECK(DescribeOps(MapLabelFormat("100%")) == "'100%'");
+	CHECK(DescribeOps(MapLabelFormat("%N %")) == "%N ' %'");
+
+	// an escaped % followed by one with nothing after it
+	CHECK(DescribeOps(MapLabelFormat("%%%")) == "'%%'");
+	CHECK(Render(MapLabelFormat("%h%"), s_soandso) == "100%");
+}
+
+TEST_CASE(TestUnknownSpecifiers)
+{
+	// compiling doesn't know which specifiers exist, the object rendering the label does
+	MapLabelFormat format("%N %q %1");
+	CHECK(DescribeOps(format) == "%N ' ' %q ' ' %1");
+	CHECK(Render(format, s_soandso) == "Soandso %q %1");
+
+	// so a field the object doesn't have leaves the hash alone
+	CHECK(Hash(format, s_soandso) == Hash(format, LabelFields{ { 'N', "Soandso" } }));
+}
+
+TEST_CASE(TestRecompileGivesANewId)
+{
+	MapLabelFormat format;
+	CHECK(format.GetId() == 0);
+
+	CHECK(format.Compile("%N"));
+	const uint32_t first = format.GetId();
+	CHECK(first != 0);
+
+	// the same format again is left alone
+	CHECK(!format.Compile("%N"));
+	CHECK(format.GetId() == first);
+
+	CHECK(format.Compile("%N (%l)"));
+	const uint32_t second = format.GetId();
+	CHECK(second != first);
+	CHECK(format.GetSource() == "%N (%l)");
+
+	// going back to an earlier format is still a change
+	CHECK(format.Compile("%N"));
+	CHECK(format.GetId() != first);
+	CHECK(format.GetId() != second);
+
+	// every format has its own id, even when they are the same
+	CHECK(MapLabelFormat("%N").GetId() != MapLabelFormat("%N").GetId());
+
+	// an empty format is compiled the first time too
+	MapLabelFormat empty;
+	CHECK(empty.Compile(""));
+	CHECK(!empty.Compile(""));
+}
+
+TEST_CASE(TestHashFollowsShownFields)
+{
+	MapLabelFormat format("%N (%l)");
+	LabelFields fields = s_soandso;
+	const uint64_t hash = Hash(format, fields);
+
+	CHECK(Hash(format, fields) == hash);
+
+	// fields that aren't shown don't matter
+	fields['h'] = "50";
+	fields['C'] = "Cleric";
+	CHECK(Hash(format, fields) == hash);
+
+	fields['l'] = "66";
+	CHECK(Hash(format, fields) != hash);
+}
+
+TEST_CASE(TestHashKeepsFieldsApart)
+{
+	// the same text split differently between two fields
+	MapLabelFormat format("%N%l");
+	CHECK(Hash(format, { { 'N', "ab" }, { 'l', "c" } }) != Hash(format, { { 'N', "a" }, { 'l', "bc" } }));
+
+	// the same values under other specifiers
+	CHECK(Hash(MapLabelFormat("%N %l"), { { 'N', "x" }, { 'l', "y" } })
+		!= Hash(MapLabelFormat("%l %N"), { { 'N', "x" }, { 'l', "y" } }));
+
+	// no string and an empty string render the same, so they hash the same
+	CHECK(HashLabelField(LabelHashSeed, static_cast<const char*>(nullptr)) == HashLabelField(LabelHashSeed, ""));
+
+	CHECK(HashLabelField(LabelHashSeed, int64_t{ 1 }) != HashLabelField(LabelHashSeed, int64_t{ 2 }));
+	CHECK(HashLabelField(LabelHashSeed, 1.0f) != HashLabelField(LabelHashSeed, 1.5f));
+}
+
+TEST_CASE(TestLabelIsOnlyRenderedWhenSomethingChanged)
+{
+	MapLabelFormat format("%N (%l)");
+	LabelFields fields = s_soandso;
+	TestLabel label;
+
+	CHECK(label.Update(format, fields));
+	CHECK(label.text == "Soandso (65)");
+	CHECK(!label.Update(format, fields));
+
+	fields['l'] = "66";
+	CHECK(label.Update(format, fields));
+	CHECK(label.text == "Soandso (66)");
+
+	// literal text isn't in the hash, the new id is what renders it again
+	format.Compile("%N [%l]");
+	CHECK(label.Update(format, fields));
+	CHECK(label.text == "Soandso [66]");
+	CHECK(!label.Update(format, fields));
+}
+
+//============================================================================
+
+static void RunBenchmark()
+{
+	const MapLabelFormat format("%N (%l %C) %h%%");
+
+	std::vector<LabelFields> fields(s_labels, s_soandso);
+	std::vector<TestLabel> labels(s_labels);
+	std::vector<std::string> rendered(s_labels);
+
+	int frame = 0;
+	auto changeSome = [&]()
+	{
+		// some of the labels show something new each frame
+		for (int i = 0; i < s_labels; ++i)
+		{
+			if ((i + frame) % 100 < s_changing)
+				fields[i]['h'] = std::to_string((i + frame) % 100);
+		}
+
+		++frame;
+	};
+
+	const double renderNs = TimePerCallNs(s_frames,
+		[&](int)
+		{
+			changeSome();
+			for (int i = 0; i < s_labels; ++i)
+				rendered[i] = Render(format, fields[i]);
+		});
+
+	frame = 0;
+	uint64_t renders = 0;
+	const double memoNs = TimePerCallNs(s_frames,
+		[&](int)
+		{
+			changeSome();
+			for (int i = 0; i < s_labels; ++i)
+				renders += labels[i].Update(format, fields[i]);
+		});
+
+	MapLabelFormat compiled;
+	const char* formats[] = { "%N (%l %C)", "%N (%l %C) %h%%" };
+	const double compileNs = TimePerCallNs(100'000, [&](int i) { compiled.Compile(formats[i & 1]); });
+	const double sameNs = TimePerCallNs(100'000, [&](int) { compiled.Compile(formats[0]); });
+
+	fmt::print("Map labels: {} labels, {}% changing each frame, {} frames\n\n", s_labels, s_changing, s_frames);
+	fmt::print("  {:<30} {:>10.1f} us\n", "render every label", renderNs / 1000.0);
+	fmt::print("  {:<30} {:>10.1f} us\n", "render changed labels", memoNs / 1000.0);
+	fmt::print("  {:<30} {:>10.1f} of {}\n", "labels rendered per frame",
+		static_cast<double>(renders) / s_frames, s_labels);
+	fmt::print("  {:<30} {:>10.1f} ns\n", "compile a new format", compileNs);
+	fmt::print("  {:<30} {:>10.1f} ns\n", "compile the same format", sameNs);
+}
+
+int main(int argc, char* argv[])
+{
+	CommandLine commandLine("MapLabelFormatTests");
+	commandLine.Add("--labels", s_labels, 1, "labels on the map");
+	commandLine.Add("--changing", s_changing, 0, "percent of the labels that change each frame");
+	commandLine.Add("--frames", s_frames, 1, "frames to simulate");
+
+	return Main(commandLine, argc, argv, RunBenchmark);
+}
@@ -0,0 +1,320 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// Tests and a benchmark for how the map finds the objects that need updating each frame
+// (plugins/map/MapObjectStore.h). Made up spawns with the same fields the store reads stand in
+// for the game's. The tests check that removing an object moves the last one into its slot, and
+// which dirty flags moving, losing health, and each change to what kind of spawn it is set. The
+// benchmark moves some of the spawns every frame and prints what finding the changes costs and
+// how many objects are left to update.
+// Only depends on fmt, so this also builds elsewhere, for example:
+//
+//   g++ -std=c++17 -O2 -I../.. App.cpp -lfmt -o MapObjectStoreTests
+//
+// Run with --help for the benchmark options.
+
+#include "plugins/map/MapObjectStore.h"
+#include "tests/TestHarness.h"
+
+#include <fmt/format.h>
+
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+using namespace mq::test;
+
+static int s_spawns = 500;
+static int s_moving = 10;
+static int s_frames = 1000;
+
+struct TestPosition
+{
+	float X = 0.0f;
+	float Y = 0.0f;
+	float Z = 0.0f;
+};
+
+struct TestSpawn
+{
+	float X = 0.0f;
+	float Y = 0.0f;
+	float Z = 0.0f;
+	float Heading = 0.0f;
+	int64_t HPCurrent = 100;
+	uint8_t Level = 50;
+	uint8_t Type = 1;
+	uint8_t StandState = 100;
+	uint32_t MasterID = 0;
+	TestSpawn* Rider = nullptr;
+	bool Mercenary = false;
+	char DisplayedName[64] = "a_gnoll00";
+};
+
+struct TestObject
+{
+	uint32_t m_slot = 0;
+};
+
+using TestStore = BasicMapObjectStore<TestObject, TestSpawn, TestPosition, uint32_t>;
+
+// Objects for the spawns, added to a store the way MapObjectSpawn does
+class TestMap
+{
+public:
+	explicit TestMap(size_t count)
+		: spawns(count)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			spawns[i].X = static_cast<float>(i);
+			Add(&spawns[i]);
+		}
+	}
+
+	TestObject* Add(TestSpawn* pSpawn)
+	{
+		objects.push_back(std::make_unique<TestObject>());
+		TestObject* object = objects.back().get();
+
+		object->m_slot = store.Add(object);
+		if (pSpawn)
+			store.SetSpawn(object->m_slot, pSpawn);
+
+		return object;
+	}
+
+	void ClearDirty()
+	{
+		for (uint32_t slot = 0; slot < store.Size(); ++slot)
+			store.GetDirty(slot) = MapDirty_None;
+	}
+
+	uint8_t Sync(const TestObject* object)
+	{
+		ClearDirty();
+		store.SyncSpawns();
+		return store.GetDirty(object->m_slot);
+	}
+
+	std::vector<TestSpawn> spawns;
+	std::vector<std::unique_ptr<TestObject>> objects;
+	TestStore store;
+};
+
+//============================================================================
+
+TEST_CASE(TestNewObjectsAreDirty)
+{
+	TestMap map(0);
+	TestObject* marker = map.Add(nullptr);
+	CHECK(map.store.GetDirty(marker->m_slot) == MapDirty_All);
+
+	TestSpawn spawn;
+	spawn.X = 1.0f;
+	spawn.Y = 2.0f;
+	spawn.Z = 3.0f;
+	spawn.Heading = 90.0f;
+
+	TestObject* object = map.Add(&spawn);
+	CHECK(map.store.GetDirty(object->m_slot) == MapDirty_All);
+	CHECK(map.store.GetPosition(object->m_slot).Y == 2.0f);
+	CHECK(map.store.GetHeading(object->m_slot) == 90.0f);
+}
+
+TEST_CASE(TestRemoveMovesTheLastObjectIntoItsSlot)
+{
+	TestMap map(3);
+	TestObject* first = map.objects[0].get();
+	TestObject* last = map.objects[2].get();
+	map.store.GetColor(last->m_slot) = 0xff00ff00;
+
+	map.store.Remove(first->m_slot);
+
+	CHECK(map.store.Size() == 2);
+	CHECK(last->m_slot == 0);
+	CHECK(map.store.GetObject(0) == last);
+	CHECK(map.store.GetPosition(0).X == 2.0f);
+	CHECK(map.store.GetColor(0) == 0xff00ff00);
+
+	// the moved object is still compared against its own spawn
+	CHECK(map.Sync(last) == MapDirty_None);
+	map.spawns[2].X = 20.0f;
+	CHECK(map.Sync(last) == (MapDirty_Position | MapDirty_Geometry));
+	CHECK(map.store.GetPosition(0).X == 20.0f);
+
+	// removing the last object doesn't move anything
+	map.store.Remove(1);
+	CHECK(map.store.Size() == 1);
+	CHECK(last->m_slot == 0);
+}
+
+TEST_CASE(TestUnchangedSpawnsStayClean)
+{
+	TestMap map(10);
+	map.ClearDirty();
+
+	for (int frame = 0; frame < 3; ++frame)
+	{
+		map.store.SyncSpawns();
+		for (uint32_t slot = 0; slot < map.store.Size(); ++slot)
+			CHECK(map.store.GetDirty(slot) == MapDirty_None);
+	}
+}
+
+TEST_CASE(TestObjectsWithoutSpawnsAreSkipped)
+{
+	TestMap map(0);
+	TestObject* object = map.Add(nullptr);
+	CHECK(map.Sync(object) == MapDirty_None);
+}
+
+TEST_CASE(TestMovingAndTurning)
+{
+	TestMap map(1);
+	TestObject* object = map.objects[0].get();
+	TestSpawn& spawn = map.spawns[0];
+
+	spawn.Z = 5.0f;
+	CHECK(map.Sync(object) == (MapDirty_Position | MapDirty_Geometry));
+	CHECK(map.store.GetPosition(object->m_slot).Z == 5.0f);
+
+	spawn.Heading = 128.0f;
+	CHECK(map.Sync(object) == (MapDirty_Position | MapDirty_Geometry));
+	CHECK(map.store.GetHeading(object->m_slot) == 128.0f);
+
+	CHECK(map.Sync(object) == MapDirty_None);
+}
+
+TEST_CASE(TestHealthOnlyMarksHealth)
+{
+	TestMap map(1);
+	TestObject* object = map.objects[0].get();
+
+	map.spawns[0].HPCurrent = 40;
+	CHECK(map.Sync(object) == MapDirty_Health);
+	CHECK(map.Sync(object) == MapDirty_None);
+}
+
+TEST_CASE(TestSpawnKindChanges)
+{
+	TestSpawn owner;
+
+	// everything that can change the spawn type or con color of a spawn that is already up
+	const std::function<void(TestSpawn&)> changes[] = {
+		[](TestSpawn& spawn) { spawn.Level = 51; },
+		[](TestSpawn& spawn) { spawn.Type = 2; },             // died
+		[](TestSpawn& spawn) { spawn.StandState = 110; },
+		[](TestSpawn& spawn) { spawn.MasterID = 1234; },      // charmed
+		[&](TestSpawn& spawn) { spawn.Rider = &owner; },       // mounted
+		[](TestSpawn& spawn) { spawn.Mercenary = true; },
+		[](TestSpawn& spawn) { strcpy(spawn.DisplayedName, "Soandso`s Mount"); },
+	};
+
+	for (const auto& change : changes)
+	{
+		TestMap map(1);
+		TestObject* object = map.objects[0].get();
+
+		change(map.spawns[0]);
+		CHECK(map.Sync(object) == (MapDirty_Label | MapDirty_Color));
+		CHECK(map.Sync(object) == MapDirty_None);
+
+		// and back again
+		map.spawns[0] = TestSpawn{};
+		CHECK(map.Sync(object) == (MapDirty_Label | MapDirty_Color));
+	}
+}
+
+TEST_CASE(TestDirtyFlagsAccumulateUntilUpdated)
+{
+	TestMap map(1);
+	TestObject* object = map.objects[0].get();
+	map.ClearDirty();
+
+	map.spawns[0].X = 3.0f;
+	map.store.SyncSpawns();
+	map.spawns[0].HPCurrent = 1;
+	map.store.SyncSpawns();
+
+	CHECK(map.store.GetDirty(object->m_slot) == (MapDirty_Position | MapDirty_Geometry | MapDirty_Health));
+}
+
+TEST_CASE(TestMarkAllDirty)
+{
+	TestMap map(4);
+	map.ClearDirty();
+	map.store.GetDirty(1) = MapDirty_Health;
+
+	map.store.MarkAllDirty(MapDirty_Color);
+
+	CHECK(map.store.GetDirty(0) == MapDirty_Color);
+	CHECK(map.store.GetDirty(1) == (MapDirty_Color | MapDirty_Health));
+	CHECK(map.store.GetDirty(3) == MapDirty_Color);
+}
+
+//============================================================================
+
+static void RunBenchmark()
+{
+	TestMap map(s_spawns);
+	map.ClearDirty();
+
+	uint64_t updated = 0;
+	int frame = 0;
+
+	const double syncNs = TimePerCallNs(s_frames,
+		[&](int)
+		{
+			// some of the spawns move each frame, and now and then one takes damage
+			for (size_t i = 0; i < map.spawns.size(); ++i)
+			{
+				if ((i + frame) % 100 < static_cast<size_t>(s_moving))
+					map.spawns[i].X += 1.0f;
+				if ((i + frame) % 97 == 0)
+					--map.spawns[i].HPCurrent;
+			}
+
+			map.store.SyncSpawns();
+
+			// what MapUpdate would update, then clean
+			for (uint32_t slot = 0; slot < map.store.Size(); ++slot)
+			{
+				uint8_t& dirty = map.store.GetDirty(slot);
+				if (dirty != MapDirty_None)
+				{
+					++updated;
+					dirty = MapDirty_None;
+				}
+			}
+
+			++frame;
+		});
+
+	fmt::print("Map object updates: {} spawns, {}% moving each frame, {} frames\n\n", s_spawns, s_moving, s_frames);
+	fmt::print("  {:<28} {:>10.1f} us\n", "moving and syncing a frame", syncNs / 1000.0);
+	fmt::print("  {:<28} {:>10.1f} ns\n", "per spawn", syncNs / s_spawns);
+	fmt::print("  {:<28} {:>10.1f} of {}\n", "objects updated per frame", static_cast<double>(updated) / s_frames, s_spawns);
+}
+
+int main(int argc, char* argv[])
+{
+	CommandLine commandLine("MapObjectStoreTests");
+	commandLine.Add("--spawns", s_spawns, 1, "spawns on the map");
+	commandLine.Add("--moving", s_moving, 0, "percent of the spawns that move each frame");
+	commandLine.Add("--frames", s_frames, 1, "frames to simulate");
+
+	return Main(commandLine, argc, argv, RunBenchmark);
+}
@@ -0,0 +1,828 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// Tests and a benchmark for routing messages through the launcher (routing/LauncherRouter.h). This
+// stands up the launcher's router and a number of simulated clients in one process. They are
+// connected over the real pipe transport, and every client has its own post office and mailbox.
+// The tests check who gets what for each kind of address, and the benchmark measures how long it
+// takes routed messages to get from one client's dropbox into other clients' mailboxes, for
+// point to point, broadcast, topic and RPC traffic.
+//
+// Only depends on the routing library, protobuf, lz4, spdlog and fmt, so this also builds elsewhere
+// (over a unix domain socket), for example:
+//
+//   protoc --cpp_out=../../routing -I../../routing ../../routing/Routing.proto
+//   g++ -std=c++17 -O2 -I../.. -I../../../include -I../../routing App.cpp AllocationCounter.cpp
+//       ../../routing/LauncherRouter.cpp ../../routing/PostOffice.cpp ../../routing/NamedPipes.cpp
+//       ../../routing/PipeTransport.cpp ../../routing/Routing.pb.cc -lprotobuf -llz4 -lspdlog -lfmt
+//       -pthread -o RoutingBenchmark
+//
+// Run with --help for the benchmark options.
+
+#include "routing/LauncherRouter.h"
+#include "routing/NamedPipes.h"
+#include "routing/PostOffice.h"
+#include "routing/Routing.h"
+#include "tests/TestHarness.h"
+
+#include <spdlog/spdlog.h>
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace mq;
+using namespace mq::postoffice;
+using namespace mq::test;
+using namespace std::chrono_literals;
+
+// Defined in AllocationCounter.cpp, counts every allocation made through operator new
+uint64_t GetAllocationCount();
+
+static int s_clients = 4;
+static int s_messages = 10000;
+static int s_size = 64;
+static int s_window = 64;
+static bool s_random = false;
+static bool s_unixSocket = false;
+
+// If nothing is delivered for this long, a pattern gives up and reports what it has
+constexpr auto STALL_TIMEOUT = std::chrono::seconds(10);
+
+// Every client runs in this process, so they identify themselves with made up pids from here on
+constexpr uint32_t FIRST_CLIENT_PID = 0x40000000;
+
+constexpr const char* BENCH_MAILBOX = "bench";
+constexpr const char* BENCH_TOPIC = "bench_topic";
+
+enum class Pattern
+{
+	PointToPoint,       // each client sends to the next one, by character
+	Broadcast,          // each client sends to every client
+	Topic,              // each client sends to a topic that every client subscribes to
+	Request,            // each client sends RPC requests to the next one, which echoes them back
+};
+
+static const char* s_patternNames[] = { "p2p", "broadcast", "topic", "rpc" };
+
+// Written at the front of every payload
+struct PayloadHeader
+{
+	int64_t sent;       // bench_clock ticks
+	int32_t sender;     // index of the sending client
+};
+
+//============================================================================
+
+struct PatternRun
+{
+	Pattern pattern;
+	int recipients = 1;                 // deliveries each message makes
+	size_t expected = 0;                // deliveries (or replies) that should happen
+	size_t received = 0;
+	size_t failed = 0;
+	uint64_t payloadBytes = 0;          // payload bytes that arrived in mailboxes
+	uint64_t wireBytes = 0;             // routed message bytes that arrived at clients
+	std::vector<int64_t> latencies;     // nanoseconds
+	bench_clock::time_point lastProgress;
+
+	void Record(bench_clock::time_point sent)
+	{
+		latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - sent).count());
+		lastProgress = bench_clock::now();
+		++received;
+	}
+
+	void Fail()
+	{
+		lastProgress = bench_clock::now();
+		++failed;
+	}
+};
+
+//============================================================================
+// Stands in for the launcher: a pipe server whose routed messages all go through the launcher's
+// router. The launcher finds a client's connection from the process on the other end of the pipe,
+// but the simulated clients all share this process, so here it is found from the pid the client
+// identified itself with instead.
+
+class BenchmarkLauncher : public PostOffice
+{
+public:
+	explicit BenchmarkLauncher(const std::string& endpoint)
+		: m_router(*this, GetCurrentProcessId(),
+			[this](uint32_t pid) { return GetConnection(pid); },
+			[](PipeMessagePtr&&) {})
+		, m_server(endpoint.c_str())
+	{
+	}
+
+	void RouteMessage(PipeMessagePtr&& message, const PipeMessageResponseCb& callback) override
+	{
+		m_router.RouteMessage(std::move(message), callback);
+	}
+
+	void Start()
+	{
+		m_server.SetHandler(std::make_shared<LauncherEvents>(this));
+		m_server.Start();
+	}
+
+	void Stop() { m_server.Stop(); }
+	void Process() { m_server.Process(); }
+
+	size_t GetClientCount() const { return m_pids.size(); }
+	size_t GetSubscriptionCount() const { return m_subscriptionCount; }
+
+private:
+	class LauncherEvents : public NamedPipeEvents
+	{
+	public:
+		LauncherEvents(BenchmarkLauncher* launcher) : m_launcher(launcher) {}
+
+		virtual void OnIncomingMessage(PipeMessagePtr&& message) override
+		{
+			switch (message->GetMessageId())
+			{
+			case MQMessageId::MSG_IDENTIFICATION:
+			{
+				auto id = ProtoMessage::Parse<proto::routing::Identification>(message);
+				m_launcher->m_router.AddIdentity({ id.pid(), id.account(), id.server(), id.character() });
+				m_launcher->m_connections[id.pid()] = message->GetConnectionId();
+				m_launcher->m_pids[message->GetConnectionId()] = id.pid();
+				break;
+			}
+
+			case MQMessageId::MSG_SUBSCRIPTION:
+			{
+				auto pid_it = m_launcher->m_pids.find(message->GetConnectionId());
+				if (pid_it == m_launcher->m_pids.end())
+					break;
+
+				auto subscription = ProtoMessage::Parse<proto::routing::Subscription>(message);
+				if (subscription.subscribe())
+					m_launcher->m_router.AddSubscriber(subscription.topic(), pid_it->second);
+				else
+					m_launcher->m_router.RemoveSubscriber(subscription.topic(), pid_it->second);
+
+				++m_launcher->m_subscriptionCount;
+				break;
+			}
+
+			case MQMessageId::MSG_ROUTE:
+				m_launcher->m_router.RouteMessage(std::move(message));
+				break;
+
+			default: break;
+			}
+		}
+
+		virtual void OnConnectionClosed(int connectionId, int processId) override
+		{
+			auto pid_it = m_launcher->m_pids.find(connectionId);
+			if (pid_it == m_launcher->m_pids.end())
+				return;
+
+			m_launcher->m_router.RemoveIdentity(pid_it->second);
+			m_launcher->m_router.RemoveSubscriber(pid_it->second);
+			m_launcher->m_connections.erase(pid_it->second);
+			m_launcher->m_pids.erase(pid_it);
+		}
+
+	private:
+		BenchmarkLauncher* m_launcher;
+	};
+
+	PipeConnectionPtr GetConnection(uint32_t pid) const
+	{
+		auto connection_it = m_connections.find(pid);
+		return connection_it != m_connections.end() ? m_server.GetConnection(connection_it->second) : nullptr;
+	}
+
+	LauncherRouter m_router;
+	ProtoPipeServer m_server;
+	std::unordered_map<uint32_t, int> m_connections;    // client pid -> connection id
+	std::unordered_map<int, uint32_t> m_pids;           // connection id -> client pid
+	size_t m_subscriptionCount = 0;
+};
+
+//============================================================================
+// A simulated client, with a post office that routes everything through the launcher
+
+class SimulatedClient : public PostOffice
+{
+public:
+	SimulatedClient(int index, const std::string& endpoint, std::vector<std::unique_ptr<SimulatedClient>>& clients)
+		: m_index(index)
+		, m_pid(FIRST_CLIENT_PID + index)
+		, m_server(fmt::format("server{}", index % 2))
+		, m_character(fmt::format("Client{}", index))
+		, m_pipeClient(endpoint.c_str())
+		, m_clients(clients)
+	{
+		// the benchmark bounds traffic with its window, so mailboxes never need to drop anything
+		SetDefaultMailboxLimits(MailboxLimits{ 0 });
+
+		m_dropbox = RegisterAddress(BENCH_MAILBOX, [this](ProtoMessagePtr&& message) { Receive(std::move(message)); });
+	}
+
+	using PostOffice::RouteMessage;
+
+	void RouteMessage(PipeMessagePtr&& message, const PipeMessageResponseCb& callback) override
+	{
+		if (callback)
+			m_pipeClient.SendMessageWithResponse(std::move(message), callback);
+		else
+			m_pipeClient.SendMessage(std::move(message));
+	}
+
+	// The same return address a client fills in, but with this client's made up pid
+	void FillReturnAddress(proto::routing::Address& returnAddress) override
+	{
+		returnAddress.set_pid(m_pid);
+		returnAddress.set_server(m_server);
+		returnAddress.set_character(m_character);
+	}
+
+	void OnSubscriptionChanged(const std::string& topic, bool subscribed) override
+	{
+		proto::routing::Subscription subscription;
+		subscription.set_pid(m_pid);
+		subscription.set_topic(topic);
+		subscription.set_subscribe(subscribed);
+
+		m_pipeClient.SendProtoMessage(MQMessageId::MSG_SUBSCRIPTION, subscription);
+	}
+
+	void Start()
+	{
+		m_pipeClient.SetHandler(std::make_shared<ClientEvents>(this));
+		m_pipeClient.Start();
+	}
+
+	void Stop() { m_pipeClient.Stop(); }
+
+	void Process(size_t howMany)
+	{
+		m_pipeClient.Process();
+		PostOffice::Process(howMany);
+	}
+
+	uint32_t GetPid() const { return m_pid; }
+	const std::string& GetCharacter() const { return m_character; }
+	Dropbox& GetDropbox() { return m_dropbox; }
+
+	// Messages that arrived in the mailbox, and the payload of the last one
+	size_t GetReceivedCount() const { return m_received; }
+	const std::string& GetLastPayload() const { return m_lastPayload; }
+
+	void Begin(PatternRun* run)
+	{
+		m_run = run;
+		m_sent = 0;
+		m_inFlight = 0;
+	}
+
+	// Sends as many messages as the window allows
+	void Send(std::string& payload)
+	{
+		const int recipients = m_run->recipients;
+
+		while (m_sent < s_messages && m_inFlight + recipients <= s_window * recipients)
+		{
+			PayloadHeader header{ bench_clock::now().time_since_epoch().count(), m_index };
+			memcpy(payload.data(), &header, sizeof(header));
+
+			proto::routing::Address address;
+			address.set_mailbox(BENCH_MAILBOX);
+
+			if (m_run->pattern == Pattern::PointToPoint || m_run->pattern == Pattern::Request)
+				address.set_character(m_clients[(m_index + 1) % m_clients.size()]->GetCharacter());
+			else if (m_run->pattern == Pattern::Topic)
+				address.set_topic(BENCH_TOPIC);
+
+			if (m_run->pattern == Pattern::Request)
+			{
+				const auto sent = bench_clock::now();
+				m_dropbox.Post(address, std::string_view(payload),
+					[this, sent](int status, PipeMessagePtr&&)
+					{
+						// a reply that shows up after its pattern gave up doesn't count
+						if (m_run == nullptr)
+							return;
+
+						if (status < 0)
+							m_run->Fail();
+						else
+							m_run->Record(sent);
+
+						--m_inFlight;
+					});
+			}
+			else
+			{
+				m_dropbox.Post(address, std::string_view(payload));
+			}
+
+			++m_sent;
+			m_inFlight += recipients;
+		}
+	}
+
+private:
+	class ClientEvents : public NamedPipeEvents
+	{
+	public:
+		ClientEvents(SimulatedClient* client) : m_client(client) {}
+
+		virtual void OnIncomingMessage(PipeMessagePtr&& message) override
+		{
+			if (message->GetMessageId() != MQMessageId::MSG_ROUTE)
+				return;
+
+			if (m_client->m_run)
+				m_client->m_run->wireBytes += message->size();
+
+			// the launcher only sends a topic message to clients that subscribed to it
+			EnvelopeHeader envelope;
+			if (envelope.Peek(message) && envelope.address.has_topic())
+				m_client->DeliverToTopic(envelope.address.topic(), std::move(message));
+			else
+				m_client->DeliverTo(BENCH_MAILBOX, std::move(message));
+		}
+
+		virtual void OnClientConnected() override
+		{
+			proto::routing::Identification id;
+			id.set_pid(m_client->m_pid);
+			id.set_server(m_client->m_server);
+			id.set_character(m_client->m_character);
+
+			m_client->m_pipeClient.SendProtoMessage(MQMessageId::MSG_IDENTIFICATION, id);
+		}
+
+	private:
+		SimulatedClient* m_client;
+	};
+
+	void Receive(ProtoMessagePtr&& message)
+	{
+		++m_received;
+
+		if (m_run == nullptr)
+			m_lastPayload.assign(message->get<const char>(), message->size());
+		else
+			m_run->payloadBytes += message->size();
+
+		if (message->GetRequestMode() == MQRequestMode::CallAndResponse)
+		{
+			// echo the request back, the requester measures the round trip
+			m_dropbox.PostReply(std::move(message), std::string_view(message->get<const char>(), message->size()));
+			return;
+		}
+
+		if (m_run == nullptr || message->size() < sizeof(PayloadHeader))
+			return;
+
+		PayloadHeader header;
+		memcpy(&header, message->get(), sizeof(header));
+
+		m_run->Record(bench_clock::time_point(bench_clock::duration(header.sent)));
+
+		if (header.sender >= 0 && header.sender < static_cast<int>(m_clients.size()))
+			--m_clients[header.sender]->m_inFlight;
+	}
+
+	const int m_index;
+	const uint32_t m_pid;
+	const std::string m_server;
+	const std::string m_character;
+	ProtoPipeClient m_pipeClient;
+	Dropbox m_dropbox;
+	std::vector<std::unique_ptr<SimulatedClient>>& m_clients;
+
+	size_t m_received = 0;
+	std::string m_lastPayload;
+
+	PatternRun* m_run = nullptr;
+	int m_sent = 0;
+	int m_inFlight = 0;
+};
+
+//============================================================================
+// A launcher with connected clients. Client i is Client<i> on server<i % 2>.
+
+class TestNetwork
+{
+public:
+	explicit TestNetwork(int clientCount)
+		: m_endpoint(MakeEndpoint())
+		, m_launcher(m_endpoint)
+	{
+		m_launcher.Start();
+
+		for (int i = 0; i < clientCount; ++i)
+		{
+			m_clients.push_back(std::make_unique<SimulatedClient>(i, m_endpoint, m_clients));
+			m_clients.back()->Start();
+		}
+
+		// wait for every client to connect and identify itself
+		m_connected = PumpUntil([this] { return m_launcher.GetClientCount() == m_clients.size(); });
+		if (!m_connected)
+			SPDLOG_ERROR("Only {} of {} clients connected to {}", m_launcher.GetClientCount(), m_clients.size(), m_endpoint);
+	}
+
+	~TestNetwork()
+	{
+		for (auto& client : m_clients)
+			client->Stop();
+
+		m_launcher.Stop();
+	}
+
+	bool IsConnected() const { return m_connected; }
+	const std::string& GetEndpoint() const { return m_endpoint; }
+	std::vector<std::unique_ptr<SimulatedClient>>& GetClients() { return m_clients; }
+	SimulatedClient& operator[](size_t index) { return *m_clients[index]; }
+
+	void Pump(size_t howMany = 100)
+	{
+		m_launcher.Process();
+		for (auto& client : m_clients)
+			client->Process(howMany);
+	}
+
+	// Pumps messages until done returns true, returning false if it doesn't in time
+	template <typename Func>
+	bool PumpUntil(Func&& done, std::chrono::milliseconds timeout = STALL_TIMEOUT)
+	{
+		const auto start = bench_clock::now();
+		while (!done())
+		{
+			if (bench_clock::now() - start > timeout)
+				return false;
+
+			Pump();
+			std::this_thread::sleep_for(1ms);
+		}
+
+		return true;
+	}
+
+	// Pumps messages for a while, to give anything that shouldn't arrive a chance to
+	void Settle()
+	{
+		PumpUntil([] { return false; }, 50ms);
+	}
+
+	// Subscribes a client's mailbox to a topic and waits for the launcher to know about it
+	bool Subscribe(size_t index, const std::string& topic, bool subscribe = true)
+	{
+		const size_t before = m_launcher.GetSubscriptionCount();
+
+		if (subscribe)
+			m_clients[index]->GetDropbox().Subscribe(topic);
+		else
+			m_clients[index]->GetDropbox().Unsubscribe(topic);
+
+		return PumpUntil([&] { return m_launcher.GetSubscriptionCount() > before; });
+	}
+
+	std::vector<size_t> GetReceivedCounts() const
+	{
+		std::vector<size_t> counts;
+		for (const auto& client : m_clients)
+			counts.push_back(client->GetReceivedCount());
+
+		return counts;
+	}
+
+private:
+	static std::string MakeEndpoint()
+	{
+		static int s_endpoints = 0;
+		const std::string name = fmt::format("mqbench_{}_{}", GetCurrentProcessId(), ++s_endpoints);
+
+#if defined(_WIN32)
+		if (!s_unixSocket)
+			return fmt::format(R"(\\.\pipe\{})", name);
+#endif
+
+		auto path = std::filesystem::temp_directory_path() / (name + ".sock");
+		return fmt::format("{}{}", UNIX_SOCKET_PREFIX, path.string());
+	}
+
+	std::string m_endpoint;
+	BenchmarkLauncher m_launcher;
+	std::vector<std::unique_ptr<SimulatedClient>> m_clients;
+	bool m_connected = false;
+};
+
+static proto::routing::Address MakeAddress()
+{
+	proto::routing::Address address;
+	address.set_mailbox(BENCH_MAILBOX);
+	return address;
+}
+
+//============================================================================
+
+TEST_CASE(TestPointToPointByCharacter)
+{
+	TestNetwork network(4);
+	CHECK(network.IsConnected());
+
+	proto::routing::Address address = MakeAddress();
+	address.set_character("client2");
+	network[0].GetDropbox().Post(address, std::string_view("hello"));
+
+	CHECK(network.PumpUntil([&] { return network[2].GetReceivedCount() == 1; }));
+	network.Settle();
+
+	CHECK((network.GetReceivedCounts() == std::vector<size_t>{ 0, 0, 1, 0 }));
+	CHECK(network[2].GetLastPayload() == "hello");
+}
+
+TEST_CASE(TestPointToPointByPid)
+{
+	TestNetwork network(4);
+	CHECK(network.IsConnected());
+
+	proto::routing::Address address = MakeAddress();
+	address.set_pid(network[3].GetPid());
+	network[1].GetDropbox().Post(address, std::string_view("hello"));
+
+	CHECK(network.PumpUntil([&] { return network[3].GetReceivedCount() == 1; }));
+	network.Settle();
+
+	CHECK((network.GetReceivedCounts() == std::vector<size_t>{ 0, 0, 0, 1 }));
+}
+
+TEST_CASE(TestBroadcastMatchesAddress)
+{
+	TestNetwork network(4);
+	CHECK(network.IsConnected());
+
+	// with no character, every client on the server gets it, including the sender
+	proto::routing::Address address = MakeAddress();
+	address.set_server("SERVER1");
+	network[1].GetDropbox().Post(address, std::string_view("server"));
+
+	CHECK(network.PumpUntil([&] { return network[1].GetReceivedCount() == 1 && network[3].GetReceivedCount() == 1; }));
+	network.Settle();
+	CHECK((network.GetReceivedCounts() == std::vector<size_t>{ 0, 1, 0, 1 }));
+
+	// and with nothing but the mailbox, every client
+	network[0].GetDropbox().Post(MakeAddress(), std::string_view("everyone"));
+
+	CHECK(network.PumpUntil([&] { return network.GetReceivedCounts() == std::vector<size_t>{ 1, 2, 1, 2 }; }));
+}
+
+TEST_CASE(TestTopicOnlyReachesSubscribers)
+{
+	TestNetwork network(4);
+	CHECK(network.IsConnected());
+	CHECK(network.Subscribe(1, "news"));
+	CHECK(network.Subscribe(2, "news"));
+
+	proto::routing::Address address;
+	address.set_topic("news");
+	network[0].GetDropbox().Post(address, std::string_view("first"));
+
+	CHECK(network.PumpUntil([&] { return network[1].GetReceivedCount() == 1 && network[2].GetReceivedCount() == 1; }));
+	network.Settle();
+	CHECK((network.GetReceivedCounts() == std::vector<size_t>{ 0, 1, 1, 0 }));
+	CHECK(network[1].GetLastPayload() == "first" && network[2].GetLastPayload() == "first");
+
+	// the rest of the address still filters the subscribers
+	address.set_server("server0");
+	network[0].GetDropbox().Post(address, std::string_view("filtered"));
+
+	CHECK(network.PumpUntil([&] { return network[2].GetReceivedCount() == 2; }));
+	network.Settle();
+	CHECK((network.GetReceivedCounts() == std::vector<size_t>{ 0, 1, 2, 0 }));
+
+	// and unsubscribing stops them
+	CHECK(network.Subscribe(2, "news", false));
+	address.clear_server();
+	network[0].GetDropbox().Post(address, std::string_view("last"));
+
+	CHECK(network.PumpUntil([&] { return network[1].GetReceivedCount() == 2; }));
+	network.Settle();
+	CHECK((network.GetReceivedCounts() == std::vector<size_t>{ 0, 2, 2, 0 }));
+}
+
+TEST_CASE(TestRequestReply)
+{
+	TestNetwork network(3);
+	CHECK(network.IsConnected());
+
+	proto::routing::Address address = MakeAddress();
+	address.set_character("Client1");
+
+	int status = 1;
+	std::string reply;
+	network[0].GetDropbox().Post(address, std::string_view("ping"),
+		[&](int replyStatus, PipeMessagePtr&& message)
+		{
+			status = replyStatus;
+
+			EnvelopeHeader envelope;
+			if (message && envelope.Peek(message))
+				reply = envelope.GetPayload();
+		});
+
+	CHECK(network.PumpUntil([&] { return status != 1; }));
+	CHECK(status == 0);
+	CHECK(reply == "ping");
+	CHECK((network.GetReceivedCounts() == std::vector<size_t>{ 0, 1, 0 }));
+}
+
+TEST_CASE(TestRequestNeedsOneRecipient)
+{
+	TestNetwork network(4);
+	CHECK(network.IsConnected());
+
+	auto request = [&network](const proto::routing::Address& address)
+		{
+			int status = 1;
+			network[0].GetDropbox().Post(address, std::string_view("ping"),
+				[&status](int replyStatus, PipeMessagePtr&&) { status = replyStatus; });
+
+			network.PumpUntil([&status] { return status != 1; });
+			return status;
+		};
+
+	// two clients are on server1
+	proto::routing::Address address = MakeAddress();
+	address.set_server("server1");
+	CHECK(request(address) == MsgError_AmbiguousRecipient);
+
+	address.set_server("nowhere");
+	CHECK(request(address) == MsgError_RoutingFailed);
+
+	network.Settle();
+	CHECK((network.GetReceivedCounts() == std::vector<size_t>{ 0, 0, 0, 0 }));
+}
+
+TEST_CASE(TestDisconnectedClientsAreDropped)
+{
+	TestNetwork network(3);
+	CHECK(network.IsConnected());
+	CHECK(network.Subscribe(2, "news"));
+
+	network[2].Stop();
+
+	int status = 1;
+	proto::routing::Address address = MakeAddress();
+	address.set_character("Client2");
+
+	// wait for the launcher to notice, after which the character can't be found
+	CHECK(network.PumpUntil([&]
+		{
+			status = 1;
+			network[0].GetDropbox().Post(address, std::string_view("ping"),
+				[&status](int replyStatus, PipeMessagePtr&&) { status = replyStatus; });
+
+			network.PumpUntil([&status] { return status != 1; });
+			return status == MsgError_RoutingFailed;
+		}));
+}
+
+//============================================================================
+
+static int64_t Percentile(const std::vector<int64_t>& sorted, int percent)
+{
+	if (sorted.empty())
+		return 0;
+
+	return sorted[std::min(sorted.size() - 1, sorted.size() * percent / 100)];
+}
+
+static void RunPattern(Pattern pattern, TestNetwork& network, std::string& payload)
+{
+	auto& clients = network.GetClients();
+
+	PatternRun run;
+	run.pattern = pattern;
+	run.recipients = pattern == Pattern::Broadcast || pattern == Pattern::Topic ? s_clients : 1;
+	run.expected = static_cast<size_t>(s_clients) * s_messages * run.recipients;
+	run.latencies.reserve(run.expected);
+
+	for (auto& client : clients)
+		client->Begin(&run);
+
+	const uint64_t allocationsBefore = GetAllocationCount();
+	const auto start = bench_clock::now();
+	run.lastProgress = start;
+
+	while (run.received + run.failed < run.expected)
+	{
+		if (bench_clock::now() - run.lastProgress > STALL_TIMEOUT)
+		{
+			SPDLOG_ERROR("{}: nothing delivered for {} seconds, giving up", s_patternNames[static_cast<int>(pattern)],
+				std::chrono::duration_cast<std::chrono::seconds>(STALL_TIMEOUT).count());
+			break;
+		}
+
+		for (auto& client : clients)
+			client->Send(payload);
+
+		network.Pump(static_cast<size_t>(s_window) * s_clients * run.recipients);
+
+		std::this_thread::yield();
+	}
+
+	const double seconds = ElapsedSeconds(start);
+	const uint64_t allocations = GetAllocationCount() - allocationsBefore;
+
+	for (auto& client : clients)
+		client->Begin(nullptr);
+
+	CHECK(run.received == run.expected);
+
+	std::sort(run.latencies.begin(), run.latencies.end());
+
+	const size_t completed = std::max<size_t>(run.received, 1);
+	fmt::print("{:<10} {:>8} {:>12.0f} {:>9.1f} {:>9.1f} {:>9.1f} {:>9.1f} {:>9.2f} {:>9.1f} {:>7}\n",
+		s_patternNames[static_cast<int>(pattern)],
+		run.received,
+		run.received / seconds,
+		Percentile(run.latencies, 50) / 1000.0,
+		Percentile(run.latencies, 99) / 1000.0,
+		run.latencies.empty() ? 0.0 : run.latencies.back() / 1000.0,
+		run.payloadBytes / seconds / (1024 * 1024),
+		run.payloadBytes > 0 ? static_cast<double>(run.wireBytes) / run.payloadBytes : 0.0,
+		static_cast<double>(allocations) / completed,
+		run.failed + (run.expected - run.received - run.failed));
+}
+
+static void RunBenchmark()
+{
+	TestNetwork network(s_clients);
+	CHECK(network.IsConnected());
+	if (!network.IsConnected())
+		return;
+
+	for (int i = 0; i < s_clients; ++i)
+		CHECK(network.Subscribe(i, BENCH_TOPIC));
+
+	// the payload is rewritten in place for every message, only the header at the front changes
+	std::string payload(std::max<size_t>(s_size, sizeof(PayloadHeader)), '\0');
+	if (s_random)
+	{
+		std::mt19937 generator(0x4d51);
+		std::generate(payload.begin(), payload.end(), [&generator]() { return static_cast<char>(generator()); });
+	}
+	else
+	{
+		constexpr std::string_view filler = "MacroQuest routing benchmark payload. ";
+		for (size_t i = 0; i < payload.size(); ++i)
+			payload[i] = filler[i % filler.size()];
+	}
+
+	fmt::print("{} clients over {}, {} byte payloads ({}), window {}, {} messages per client\n\n",
+		s_clients, network.GetEndpoint().rfind(UNIX_SOCKET_PREFIX, 0) == 0 ? "a unix socket" : "a named pipe",
+		payload.size(), s_random ? "random" : "compressible", s_window, s_messages);
+	fmt::print("{:<10} {:>8} {:>12} {:>9} {:>9} {:>9} {:>9} {:>9} {:>9} {:>7}\n",
+		"pattern", "msgs", "msgs/s", "p50 us", "p99 us", "max us", "MB/s", "wire/pay", "allocs", "lost");
+
+	for (Pattern pattern : { Pattern::PointToPoint, Pattern::Broadcast, Pattern::Topic, Pattern::Request })
+		RunPattern(pattern, network, payload);
+}
+
+int main(int argc, char* argv[])
+{
+	spdlog::set_level(spdlog::level::err);
+
+	CommandLine commandLine("RoutingBenchmark");
+	commandLine.Add("--clients", s_clients, 2, "simulated clients");
+	commandLine.Add("--messages", s_messages, 1, "messages each client sends for each pattern");
+	commandLine.Add("--size", s_size, static_cast<int>(sizeof(PayloadHeader)), "payload size in bytes, at 4k and up payloads are compressed");
+	commandLine.Add("--window", s_window, 1, "messages each client can have in flight");
+	commandLine.Add("--random", s_random, "use incompressible payloads instead of repeated text");
+	commandLine.Add("--unix", s_unixSocket, "connect over a unix domain socket instead of a named pipe (always on elsewhere)");
+
+	return Main(commandLine, argc, argv, RunBenchmark);
+}
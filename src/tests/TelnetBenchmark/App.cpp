@@ -0,0 +1,316 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// Telnet broadcast benchmark. This runs the MQ2Telnet event loop on its own thread, the way
+// the plugin does, connects a number of local clients to it and measures how fast broadcast
+// lines reach all of them. Like the plugin, the loop only notices new broadcasts when its poll
+// wakes up, so the poll interval limits throughput. The benchmark fails if a reading client
+// didn't get every line. The tests check the bounded queue each client's output waits in.
+// The event loop doesn't depend on MacroQuest, so this also builds elsewhere, for example:
+//
+//   g++ -std=c++17 -O2 -I../.. -I../../../extras/plugins/MQ2Telnet App.cpp ../../../extras/plugins/MQ2Telnet/TelnetEventLoop.cpp
+//       -lfmt -pthread -o TelnetBenchmark
+//
+// Run with --help for the benchmark options.
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+
+#include <winsock2.h>
+#include <Ws2tcpip.h>
+
+#pragma comment(lib, "ws2_32")
+
+using socket_t = SOCKET;
+static constexpr socket_t BadSocket = INVALID_SOCKET;
+static void CloseSocket(socket_t s) { closesocket(s); }
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using socket_t = int;
+static constexpr socket_t BadSocket = -1;
+static void CloseSocket(socket_t s) { close(s); }
+#endif
+
+#include "TelnetEventLoop.h"
+#include "tests/TestHarness.h"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace mq::test;
+using namespace std::chrono_literals;
+
+// The plugin's thread waits this long for socket activity on each pass
+constexpr int POLL_TIMEOUT_MS = 10;
+
+// If clients stop receiving for this long, give up and report what arrived
+constexpr auto STALL_TIMEOUT = 10s;
+
+static int s_clients = 32;
+static int s_lines = 20000;
+static int s_size = 60;
+static int s_buffer = 64 * 1024;
+static int s_slow = 0;
+static int s_port = 42424;
+
+// What is queued in a ring buffer, oldest first
+static std::string Queued(const TelnetRingBuffer& buffer)
+{
+	const char* first;
+	const char* second;
+	size_t firstLength, secondLength;
+	buffer.Peek(first, firstLength, second, secondLength);
+
+	return std::string(first, firstLength) + std::string(second, secondLength);
+}
+
+//============================================================================
+
+TEST_CASE(TestRingBufferWritesAllOrNothing)
+{
+	TelnetRingBuffer buffer(8);
+	CHECK(buffer.Empty());
+	CHECK(buffer.Capacity() == 8);
+
+	CHECK(buffer.Write("hello", 5));
+	CHECK(buffer.Available() == 3);
+
+	// doesn't fit, so none of it is queued
+	CHECK(!buffer.Write("world", 5));
+	CHECK(buffer.Size() == 5);
+	CHECK(Queued(buffer) == "hello");
+
+	CHECK(buffer.Write("abc", 3));
+	CHECK(buffer.Available() == 0);
+	CHECK(Queued(buffer) == "helloabc");
+}
+
+TEST_CASE(TestRingBufferWraps)
+{
+	TelnetRingBuffer buffer(8);
+	buffer.Write("123456", 6);
+	buffer.Consume(4);
+
+	// this goes around the end of the storage, and comes back as two pieces
+	CHECK(buffer.Write("abcde", 5));
+
+	const char* first;
+	const char* second;
+	size_t firstLength, secondLength;
+	buffer.Peek(first, firstLength, second, secondLength);
+	CHECK(firstLength + secondLength == 7);
+	CHECK(secondLength > 0);
+	CHECK(Queued(buffer) == "56abcde");
+
+	// consuming across the end
+	buffer.Consume(4);
+	CHECK(Queued(buffer) == "cde");
+
+	buffer.Clear();
+	CHECK(buffer.Empty());
+	CHECK(buffer.Available() == 8);
+	CHECK(Queued(buffer).empty());
+}
+
+//============================================================================
+
+static socket_t ConnectClient(int port)
+{
+	socket_t s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (s == BadSocket)
+		return BadSocket;
+
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons(static_cast<uint16_t>(port));
+
+	if (connect(s, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+	{
+		CloseSocket(s);
+		return BadSocket;
+	}
+
+	return s;
+}
+
+// Reads until it has everything it expects, or the server closes the connection.
+static void ReadClient(socket_t s, uint64_t expected, std::atomic<uint64_t>& received)
+{
+	char buffer[16 * 1024];
+
+	while (received < expected)
+	{
+		int bytes = static_cast<int>(recv(s, buffer, sizeof(buffer), 0));
+		if (bytes <= 0)
+			break;
+
+		received += bytes;
+	}
+}
+
+static void RunBenchmark()
+{
+	TelnetEventLoop loop;
+	loop.SetSendBufferSize(s_buffer);
+
+	std::atomic<int> connected{ 0 };
+	loop.OnConnect = [&](uint32_t clientId)
+	{
+		loop.SetBroadcastEnabled(clientId, true);
+		++connected;
+	};
+
+	const int port = loop.Listen(s_port, true);
+	if (port == 0)
+	{
+		fmt::print("Unable to listen on port {}\n", s_port);
+		CHECK(port != 0);
+		return;
+	}
+
+	std::atomic<bool> running{ true };
+	std::thread loopThread([&]()
+		{
+			while (running)
+				loop.Poll(POLL_TIMEOUT_MS);
+		});
+
+	const int totalClients = s_clients + s_slow;
+	std::vector<socket_t> sockets;
+	for (int i = 0; i < totalClients; ++i)
+	{
+		socket_t s = ConnectClient(port);
+		if (s == BadSocket)
+		{
+			fmt::print("Client {} couldn't connect to port {}\n", i, port);
+			break;
+		}
+
+		sockets.push_back(s);
+	}
+
+	// wait for the loop to accept all of them and turn their broadcasts on
+	const auto connectStart = bench_clock::now();
+	while (connected < static_cast<int>(sockets.size()) && bench_clock::now() - connectStart < STALL_TIMEOUT)
+		std::this_thread::sleep_for(1ms);
+
+	const std::string line = [&]()
+	{
+		constexpr std::string_view filler = "[MQ2] A goblin hits YOU for 42 points of damage. ";
+		std::string text(s_size, ' ');
+		for (size_t i = 0; i < text.size(); ++i)
+			text[i] = filler[i % filler.size()];
+		return text;
+	}();
+
+	const uint64_t lineBytes = line.length() + 2;
+	const uint64_t expected = lineBytes * s_lines;
+
+	std::vector<std::atomic<uint64_t>> received(s_clients);
+	std::vector<std::thread> readers;
+	for (int i = 0; i < s_clients && i < static_cast<int>(sockets.size()); ++i)
+		readers.emplace_back(ReadClient, sockets[i], expected, std::ref(received[i]));
+
+	fmt::print("{} clients ({} not reading) on port {}, {} lines of {} bytes, {} byte send buffers\n\n",
+		sockets.size(), s_slow, port, s_lines, line.length(), s_buffer);
+
+	// Broadcast as fast as the loop keeps up. Only let half of a send buffer queue up for the
+	// readers, so that they aren't dropped for being slow when it's the broadcasting that is ahead.
+	const uint64_t maxQueued = static_cast<uint64_t>(s_buffer) / 2;
+	uint64_t slowestSent = 0;
+
+	auto start = bench_clock::now();
+	for (int i = 0; i < s_lines; ++i)
+	{
+		const uint64_t queued = lineBytes * i;
+		auto stallStart = bench_clock::now();
+
+		while (queued > slowestSent + maxQueued && bench_clock::now() - stallStart < STALL_TIMEOUT)
+		{
+			uint64_t slowest = expected;
+			for (auto& count : received)
+				slowest = std::min<uint64_t>(slowest, count);
+
+			slowestSent = slowest;
+			if (queued > slowestSent + maxQueued)
+				std::this_thread::yield();
+		}
+
+		loop.Broadcast(line);
+	}
+	const double broadcastSeconds = ElapsedSeconds(start);
+
+	for (std::thread& reader : readers)
+		reader.join();
+	const double seconds = ElapsedSeconds(start);
+
+	TelnetEventLoop::Stats stats = loop.GetStats();
+
+	running = false;
+	loopThread.join();
+
+	for (socket_t s : sockets)
+		CloseSocket(s);
+
+	int incomplete = 0;
+	uint64_t totalReceived = 0;
+	for (auto& count : received)
+	{
+		totalReceived += count;
+		if (count != expected)
+			++incomplete;
+	}
+
+	fmt::print("{:<12} {:>12.2f} ms\n", "broadcast", broadcastSeconds * 1000.0);
+	fmt::print("{:<12} {:>12.2f} ms\n", "delivered", seconds * 1000.0);
+	fmt::print("{:<12} {:>12.0f} lines/s\n", "throughput", s_lines / seconds);
+	fmt::print("{:<12} {:>12.1f} MB/s to all clients\n", "", totalReceived / seconds / (1024 * 1024));
+	fmt::print("{:<12} {:>12} (of {} broadcast)\n", "lines sent", stats.linesBroadcast, s_lines);
+	fmt::print("{:<12} {:>12}\n", "dropped", stats.slowDisconnects);
+
+	if (incomplete > 0)
+		fmt::print("\n{} reading clients didn't get every line\n", incomplete);
+	CHECK(incomplete == 0);
+
+	if (s_slow > 0 && static_cast<int>(stats.slowDisconnects) < s_slow)
+		fmt::print("\n{} of the clients that don't read were still connected at the end. Broadcast more lines to fill their buffers.\n",
+			s_slow - static_cast<int>(stats.slowDisconnects));
+}
+
+int main(int argc, char* argv[])
+{
+	CommandLine commandLine("TelnetBenchmark");
+	commandLine.Add("--clients", s_clients, 1, "clients that read everything they are sent");
+	commandLine.Add("--lines", s_lines, 1, "lines to broadcast");
+	commandLine.Add("--size", s_size, 1, "length of each line, not counting the line end");
+	commandLine.Add("--buffer", s_buffer, 1024, "send buffer size for each client, like the SendBufferSize setting");
+	commandLine.Add("--slow", s_slow, 0, "extra clients that never read, and should be dropped once they fall behind");
+	commandLine.Add("--port", s_port, 1, "first port to try listening on");
+
+	return Main(commandLine, argc, argv, RunBenchmark);
+}
@@ -0,0 +1,279 @@
+/*
+ * MacroQuest: The extension platform for EverQuest
+ * Copyright (C) 2002-present MacroQuest Authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// Shared helpers for the console test and benchmark tools in src/tests.
+//
+// A tool registers its tests with TEST_CASE, checks with CHECK, and hands its benchmark to
+// mq::test::Main, which parses the command line, runs the tests and then the benchmark:
+//
+//   TEST_CASE(TestSomething)
+//   {
+//       CHECK(1 + 1 == 2);
+//   }
+//
+//   int main(int argc, char* argv[])
+//   {
+//       mq::test::CommandLine commandLine("SomethingTests");
+//       commandLine.Add("--count", s_count, 1, "items to benchmark");
+//       return mq::test::Main(commandLine, argc, argv, RunBenchmark);
+//   }
+//
+// --tests runs only the tests and --benchmark runs only the benchmark. The process returns
+// non-zero if any check failed, including checks made by the benchmark.
+//
+// Only depends on fmt, so the tools can also be built with g++/clang on other systems.
+
+#pragma once
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mq::test {
+
+using bench_clock = std::chrono::steady_clock;
+
+inline double ElapsedMs(bench_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+}
+
+inline double ElapsedSeconds(bench_clock::time_point start)
+{
+	return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+// Runs func count times and returns the average time of one call in nanoseconds.
+template <typename Func>
+double TimePerCallNs(int count, Func&& func)
+{
+	auto start = bench_clock::now();
+	for (int i = 0; i < count; ++i)
+		func(i);
+
+	return ElapsedSeconds(start) * 1e9 / std::max(count, 1);
+}
+
+//============================================================================
+
+struct TestCase
+{
+	const char* name;
+	void (*func)();
+};
+
+struct TestState
+{
+	std::vector<TestCase> tests;
+	int failures = 0;
+};
+
+inline TestState& GetTestState()
+{
+	static TestState s_state;
+	return s_state;
+}
+
+struct TestRegistration
+{
+	TestRegistration(const char* name, void (*func)())
+	{
+		GetTestState().tests.push_back({ name, func });
+	}
+};
+
+inline void ReportFailure(const char* expr, const char* file, int line)
+{
+	fmt::print("FAILED: {} ({}:{})\n", expr, file, line);
+	++GetTestState().failures;
+}
+
+inline int GetFailureCount()
+{
+	return GetTestState().failures;
+}
+
+// Runs every registered test in registration order. Returns the number of failed checks.
+inline int RunTests()
+{
+	TestState& state = GetTestState();
+	for (const TestCase& test : state.tests)
+	{
+		const int before = state.failures;
+		test.func();
+
+		if (state.failures != before)
+			fmt::print("{}: {} checks failed\n", test.name, state.failures - before);
+	}
+
+	return state.failures;
+}
+
+//============================================================================
+
+// Integer and flag options for a tool's benchmark, plus --tests and --benchmark.
+class CommandLine
+{
+public:
+	explicit CommandLine(std::string_view program)
+		: m_program(program)
+	{
+	}
+
+	CommandLine& Add(std::string_view name, int& value, int minValue, std::string_view description)
+	{
+		m_options.push_back({ std::string(name), &value, nullptr, minValue, std::string(description) });
+		return *this;
+	}
+
+	// A flag takes no value, giving it turns it on.
+	CommandLine& Add(std::string_view name, bool& value, std::string_view description)
+	{
+		m_options.push_back({ std::string(name), nullptr, &value, 0, std::string(description) });
+		return *this;
+	}
+
+	bool Parse(int argc, char* argv[])
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			std::string_view arg = argv[i];
+
+			if (arg == "--tests")
+			{
+				m_runBenchmark = false;
+				continue;
+			}
+
+			if (arg == "--benchmark")
+			{
+				m_runTests = false;
+				continue;
+			}
+
+			auto iter = std::find_if(m_options.begin(), m_options.end(),
+				[&](const Option& option) { return option.name == arg; });
+			if (iter == m_options.end())
+				return false;
+
+			if (iter->flag != nullptr)
+			{
+				*iter->flag = true;
+				continue;
+			}
+
+			if (i + 1 >= argc)
+				return false;
+
+			*iter->value = std::max(iter->minValue, atoi(argv[++i]));
+		}
+
+		return m_runTests || m_runBenchmark;
+	}
+
+	void PrintUsage() const
+	{
+		fmt::print("Usage: {} [--tests | --benchmark]", m_program);
+		for (const Option& option : m_options)
+		{
+			if (option.flag != nullptr)
+				fmt::print(" [{}]", option.name);
+			else
+				fmt::print(" [{} N]", option.name);
+		}
+		fmt::print("\n\n");
+
+		fmt::print("  {:<14} run only the tests\n", "--tests");
+		fmt::print("  {:<14} run only the benchmark\n", "--benchmark");
+		for (const Option& option : m_options)
+		{
+			if (option.flag != nullptr)
+				fmt::print("  {:<14} {}\n", option.name, option.description);
+			else
+				fmt::print("  {:<14} {} (default {})\n", option.name, option.description, *option.value);
+		}
+	}
+
+	bool RunTests() const { return m_runTests; }
+	bool RunBenchmark() const { return m_runBenchmark; }
+
+private:
+	struct Option
+	{
+		std::string name;
+		int* value;
+		bool* flag;
+		int minValue;
+		std::string description;
+	};
+
+	std::string m_program;
+	std::vector<Option> m_options;
+	bool m_runTests = true;
+	bool m_runBenchmark = true;
+};
+
+// Parses the command line, runs the registered tests and then the benchmark. The benchmark
+// is skipped if a test failed. Returns the process exit code.
+inline int Main(CommandLine& commandLine, int argc, char* argv[], const std::function<void()>& benchmark)
+{
+	if (!commandLine.Parse(argc, argv))
+	{
+		commandLine.PrintUsage();
+		return 1;
+	}
+
+	if (commandLine.RunTests() && !GetTestState().tests.empty())
+	{
+		if (RunTests() != 0)
+		{
+			fmt::print("{} checks failed\n", GetFailureCount());
+			return 1;
+		}
+
+		fmt::print("All {} tests passed\n\n", GetTestState().tests.size());
+	}
+
+	if (commandLine.RunBenchmark() && benchmark)
+	{
+		benchmark();
+
+		if (GetFailureCount() != 0)
+		{
+			fmt::print("{} checks failed\n", GetFailureCount());
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+} // namespace mq::test
+
+#define TEST_CASE(name) \
+	static void name(); \
+	static const ::mq::test::TestRegistration name##Registration(#name, &name); \
+	static void name()
+
+#define CHECK(expr) \
+	do { \
+		if (!(expr)) \
+			::mq::test::ReportFailure(#expr, __FILE__, __LINE__); \
+	} while (0)